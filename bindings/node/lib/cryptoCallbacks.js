@@ -103,6 +103,41 @@ function signRsaSha256Hook(key, input, output) {
   return result.length;
 }
 
+// Matches `mongocrypt_crypto_op_type_t`.
+const CRYPTO_OP_HOOK_NAMES = {
+  1: 'aes256CbcEncryptHook',
+  2: 'aes256CbcDecryptHook',
+  3: 'hmacSha512Hook'
+};
+
+/**
+ * Runs every operation of one libmongocrypt step in a single call from the
+ * native binding. Each op is `{ type, key, iv, input, output }`, where `iv` is
+ * absent for HMAC. Returns the bytes written for each op, or the first error.
+ */
+function cryptoBatchHook(ops) {
+  const bytesWritten = [];
+  for (const op of ops) {
+    // look up the hook on the exports so stubbed hooks are honored
+    const hook = module.exports[CRYPTO_OP_HOOK_NAMES[op.type]];
+    if (typeof hook !== 'function') {
+      return new Error(`unsupported crypto operation type: ${op.type}`);
+    }
+
+    const result =
+      op.iv === undefined
+        ? hook(op.key, op.input, op.output)
+        : hook(op.key, op.iv, op.input, op.output);
+    if (result instanceof Error) {
+      return result;
+    }
+
+    bytesWritten.push(result);
+  }
+
+  return bytesWritten;
+}
+
 module.exports = {
   aes256CbcEncryptHook,
   aes256CbcDecryptHook,
@@ -110,5 +145,6 @@ module.exports = {
   hmacSha512Hook: makeHmacHook('sha512'),
   hmacSha256Hook: makeHmacHook('sha256'),
   sha256Hook,
-  signRsaSha256Hook
+  signRsaSha256Hook,
+  cryptoBatchHook
 };
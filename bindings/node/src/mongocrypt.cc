@@ -341,12 +341,63 @@ bool MongoCrypt::setupCryptoHooks(mongocrypt_t* mongoCrypt, CryptoHooks* cryptoH
             return true;
         };
 
+    auto crypto_batch =
+        [](void *ctx, mongocrypt_crypto_op_t **ops, uint32_t count, mongocrypt_status_t *status) -> bool {
+            Nan::HandleScope scope;
+            CryptoHooks* cryptoHooks = static_cast<CryptoHooks*>(ctx);
+            Nan::Callback* hook = cryptoHooks->cryptoBatchHook.get();
+
+            v8::Local<v8::String> TYPE_KEY = Nan::New("type").ToLocalChecked();
+            v8::Local<v8::String> KEY_KEY = Nan::New("key").ToLocalChecked();
+            v8::Local<v8::String> IV_KEY = Nan::New("iv").ToLocalChecked();
+            v8::Local<v8::String> INPUT_KEY = Nan::New("input").ToLocalChecked();
+            v8::Local<v8::String> OUTPUT_KEY = Nan::New("output").ToLocalChecked();
+
+            v8::Local<v8::Array> opArray = Nan::New<v8::Array>(count);
+            for (uint32_t i = 0; i < count; i++) {
+                v8::Local<v8::Object> op = Nan::New<v8::Object>();
+                mongocrypt_binary_t* iv = mongocrypt_crypto_op_iv(ops[i]);
+
+                Nan::Set(op, TYPE_KEY, Nan::New(static_cast<uint32_t>(mongocrypt_crypto_op_type(ops[i]))));
+                Nan::Set(op, KEY_KEY, BufferFromBinary(mongocrypt_crypto_op_key(ops[i])));
+                if (iv) {
+                    Nan::Set(op, IV_KEY, BufferFromBinary(iv));
+                }
+                Nan::Set(op, INPUT_KEY, BufferFromBinary(mongocrypt_crypto_op_in(ops[i])));
+                Nan::Set(op, OUTPUT_KEY, BufferWithLengthOf(mongocrypt_crypto_op_out(ops[i])));
+                Nan::Set(opArray, i, op);
+            }
+
+            v8::Local<v8::Value> argv[] = {opArray};
+            v8::Local<v8::Value> defaultValue = Nan::False();
+            v8::Local<v8::Value> result = Nan::Call(*hook, Nan::GetCurrentContext()->Global(), 1, argv).FromMaybe(defaultValue);
+            if (!result->IsArray() || v8::Local<v8::Array>::Cast(result)->Length() != count) {
+                MaybeSetCryptoHookErrorStatus(result, status);
+                return false;
+            }
+
+            v8::Local<v8::Array> bytesWrittenArray = v8::Local<v8::Array>::Cast(result);
+            for (uint32_t i = 0; i < count; i++) {
+                mongocrypt_binary_t* out = mongocrypt_crypto_op_out(ops[i]);
+                v8::Local<v8::Object> op = Nan::To<v8::Object>(Nan::Get(opArray, i).ToLocalChecked()).ToLocalChecked();
+                v8::Local<v8::Object> outBuffer = Nan::To<v8::Object>(Nan::Get(op, OUTPUT_KEY).ToLocalChecked()).ToLocalChecked();
+                uint32_t bytesWritten = Nan::To<uint32_t>(Nan::Get(bytesWrittenArray, i).ToLocalChecked()).FromMaybe(0);
+
+                if (bytesWritten > mongocrypt_binary_len(out)) {
+                    bytesWritten = mongocrypt_binary_len(out);
+                }
+                CopyBufferData(out, outBuffer, bytesWritten);
+                mongocrypt_crypto_op_set_bytes_written(ops[i], bytesWritten);
+            }
+            return true;
+        };
+
     // Added after `mongocrypt_setopt_crypto_hooks`, they should be treated as the same during configuration
     if (!mongocrypt_setopt_crypto_hook_sign_rsaes_pkcs1_v1_5(mongoCrypt, sign_rsa_sha256, cryptoHooks)) {
         Nan::ThrowError("unable to configure crypto hooks");
     }
 
-    return mongocrypt_setopt_crypto_hooks(mongoCrypt,
+    if (!mongocrypt_setopt_crypto_hooks(mongoCrypt,
         aes_256_cbc_encrypt,
         aes_256_cbc_decrypt,
         random,
@@ -354,7 +405,16 @@ bool MongoCrypt::setupCryptoHooks(mongocrypt_t* mongoCrypt, CryptoHooks* cryptoH
         hmac_sha_256,
         sha_256,
         cryptoHooks
-    );
+    )) {
+        return false;
+    }
+
+    // Optional, hands over every AES and HMAC operation of a step in one call
+    if (cryptoHooks->cryptoBatchHook) {
+        return mongocrypt_setopt_crypto_hook_batch(mongoCrypt, crypto_batch, cryptoHooks);
+    }
+
+    return true;
 }
 
 NAN_METHOD(MongoCrypt::New) {
@@ -384,6 +444,7 @@ NAN_METHOD(MongoCrypt::New) {
             v8::Local<v8::String> HMAC_SHA256_HOOK_KEY = Nan::New("hmacSha256Hook").ToLocalChecked();
             v8::Local<v8::String> SHA256_HOOK_KEY = Nan::New("sha256Hook").ToLocalChecked();
             v8::Local<v8::String> SIGN_RSASHA256_HOOK_KEY = Nan::New("signRsaSha256Hook").ToLocalChecked();
+            v8::Local<v8::String> CRYPTO_BATCH_HOOK_KEY = Nan::New("cryptoBatchHook").ToLocalChecked();
 
             if (Nan::Has(options, KMS_PROVIDERS_KEY).FromMaybe(false)) {
                 v8::Local<v8::Object> kmsProvidersOptions =
@@ -460,6 +521,12 @@ NAN_METHOD(MongoCrypt::New) {
                 cryptoHooks->signRsaSha256Hook.reset(new Nan::Callback(
                     Nan::To<v8::Function>(Nan::Get(cryptoCallbacks, SIGN_RSASHA256_HOOK_KEY).ToLocalChecked())
                         .ToLocalChecked()));
+
+                if (Nan::Has(cryptoCallbacks, CRYPTO_BATCH_HOOK_KEY).FromMaybe(false)) {
+                    cryptoHooks->cryptoBatchHook.reset(new Nan::Callback(
+                        Nan::To<v8::Function>(Nan::Get(cryptoCallbacks, CRYPTO_BATCH_HOOK_KEY).ToLocalChecked())
+                            .ToLocalChecked()));
+                }
             }
         }
 
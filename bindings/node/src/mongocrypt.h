@@ -54,6 +54,8 @@ class MongoCrypt : public Nan::ObjectWrap {
         std::unique_ptr<Nan::Callback> hmacSha256Hook;
         std::unique_ptr<Nan::Callback> sha256Hook;
         std::unique_ptr<Nan::Callback> signRsaSha256Hook;
+        // Optional, may be null.
+        std::unique_ptr<Nan::Callback> cryptoBatchHook;
     };
 
     friend class MongoCryptContext;
@@ -87,7 +87,8 @@ describe('cryptoCallbacks', function() {
     'randomHook',
     'hmacSha512Hook',
     'hmacSha256Hook',
-    'sha256Hook'
+    'sha256Hook',
+    'cryptoBatchHook'
   ]);
 
   it('should invoke crypto callbacks when doing encryption', function(done) {
@@ -137,7 +138,13 @@ describe('cryptoCallbacks', function() {
         try {
           expect(err).to.not.exist;
           assertCertainHooksCalled(
-            new Set(['aes256CbcEncryptHook', 'hmacSha512Hook', 'hmacSha256Hook', 'sha256Hook'])
+            new Set([
+              'cryptoBatchHook',
+              'aes256CbcEncryptHook',
+              'hmacSha512Hook',
+              'hmacSha256Hook',
+              'sha256Hook'
+            ])
           );
         } catch (e) {
           return done(e);
@@ -145,7 +152,9 @@ describe('cryptoCallbacks', function() {
         encryption.decrypt(encryptedValue, err => {
           try {
             expect(err).to.not.exist;
-            assertCertainHooksCalled(new Set(['aes256CbcDecryptHook', 'hmacSha512Hook']));
+            assertCertainHooksCalled(
+              new Set(['cryptoBatchHook', 'aes256CbcDecryptHook', 'hmacSha512Hook'])
+            );
           } catch (e) {
             return done(e);
           }
@@ -0,0 +1,656 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * AES-256 for the builtin crypto backend.
+ * Comments in this implementation refer to:
+ * [FIPS-197] https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.197.pdf
+ * [INTEL-AES] Intel Advanced Encryption Standard (AES) New Instructions Set
+ */
+
+#include "mongocrypt-config.h"
+
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+
+#include "builtin-private.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+   defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <wmmintrin.h>
+#define BUILTIN_HAVE_AESNI
+#define BUILTIN_TARGET_AESNI
+#elif defined(__clang__) || \
+   (defined(__GNUC__) &&     \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+/* Functions using AES-NI are compiled for it individually, so the rest of the
+ * library still runs on CPUs without it. */
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define BUILTIN_HAVE_AESNI
+#define BUILTIN_TARGET_AESNI __attribute__ ((target ("aes,sse2")))
+#endif
+#endif
+
+static bool _cpu_has_aesni = false;
+
+
+void
+_builtin_cpu_detect (void)
+{
+#ifdef BUILTIN_HAVE_AESNI
+#if defined(_MSC_VER)
+   int regs[4];
+
+   __cpuid (regs, 1);
+   /* CPUID.01H:ECX.AES[bit 25] */
+   _cpu_has_aesni = (regs[2] & (1 << 25)) != 0;
+#else
+   unsigned int eax, ebx, ecx, edx;
+
+   if (__get_cpuid (1, &eax, &ebx, &ecx, &edx)) {
+      /* CPUID.01H:ECX.AES[bit 25] */
+      _cpu_has_aesni = (ecx & bit_AES) != 0;
+   }
+#endif
+#endif /* BUILTIN_HAVE_AESNI */
+}
+
+
+bool
+_builtin_aes_impl_supported (_builtin_aes_impl_t impl)
+{
+   switch (impl) {
+   case BUILTIN_AES_IMPL_PORTABLE:
+      return true;
+   case BUILTIN_AES_IMPL_AESNI:
+      return _cpu_has_aesni;
+   default:
+      return false;
+   }
+}
+
+
+_builtin_aes_impl_t
+_builtin_aes_impl_default (void)
+{
+   return _cpu_has_aesni ? BUILTIN_AES_IMPL_AESNI : BUILTIN_AES_IMPL_PORTABLE;
+}
+
+
+/* The portable implementation works on bytes with the S-box tables below. It
+ * is not hardened against cache-timing attacks; AES-NI is used whenever the
+ * CPU has it. */
+static const uint8_t _aes_sbox[256] = {
+   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+   0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+   0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+   0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+   0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+   0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+   0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+   0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+   0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+   0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+   0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+   0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+   0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+   0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+   0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+   0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+   0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+   0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+   0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+   0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+   0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+   0xb0, 0x54, 0xbb, 0x16};
+
+
+static const uint8_t _aes_inv_sbox[256] = {
+   0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e,
+   0x81, 0xf3, 0xd7, 0xfb, 0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87,
+   0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb, 0x54, 0x7b, 0x94, 0x32,
+   0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+   0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49,
+   0x6d, 0x8b, 0xd1, 0x25, 0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16,
+   0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92, 0x6c, 0x70, 0x48, 0x50,
+   0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+   0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05,
+   0xb8, 0xb3, 0x45, 0x06, 0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02,
+   0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b, 0x3a, 0x91, 0x11, 0x41,
+   0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+   0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8,
+   0x1c, 0x75, 0xdf, 0x6e, 0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89,
+   0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b, 0xfc, 0x56, 0x3e, 0x4b,
+   0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+   0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59,
+   0x27, 0x80, 0xec, 0x5f, 0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d,
+   0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef, 0xa0, 0xe0, 0x3b, 0x4d,
+   0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+   0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63,
+   0x55, 0x21, 0x0c, 0x7d};
+
+
+/* Multiplication by x in GF(2^8) [FIPS-197 4.2.1]. */
+static uint8_t
+_xtime (uint8_t b)
+{
+   return (uint8_t) ((b << 1) ^ (0x1b & -(b >> 7)));
+}
+
+
+/* [FIPS-197 5.2] */
+static void
+_key_expansion (const uint8_t key[BUILTIN_AES_256_KEY_LEN], uint8_t *w)
+{
+   uint8_t rcon = 0x01;
+   uint8_t temp[4], t;
+   int i;
+
+   memcpy (w, key, BUILTIN_AES_256_KEY_LEN);
+   for (i = 8; i < 4 * (BUILTIN_AES_256_ROUNDS + 1); i++) {
+      memcpy (temp, w + 4 * (i - 1), 4);
+      if (i % 8 == 0) {
+         /* SubWord (RotWord (temp)) xor Rcon */
+         t = temp[0];
+         temp[0] = (uint8_t) (_aes_sbox[temp[1]] ^ rcon);
+         temp[1] = _aes_sbox[temp[2]];
+         temp[2] = _aes_sbox[temp[3]];
+         temp[3] = _aes_sbox[t];
+         rcon = _xtime (rcon);
+      } else if (i % 8 == 4) {
+         temp[0] = _aes_sbox[temp[0]];
+         temp[1] = _aes_sbox[temp[1]];
+         temp[2] = _aes_sbox[temp[2]];
+         temp[3] = _aes_sbox[temp[3]];
+      }
+      w[4 * i + 0] = w[4 * (i - 8) + 0] ^ temp[0];
+      w[4 * i + 1] = w[4 * (i - 8) + 1] ^ temp[1];
+      w[4 * i + 2] = w[4 * (i - 8) + 2] ^ temp[2];
+      w[4 * i + 3] = w[4 * (i - 8) + 3] ^ temp[3];
+   }
+}
+
+
+static void
+_add_round_key (uint8_t s[BUILTIN_AES_BLOCK_LEN], const uint8_t *rk)
+{
+   int i;
+
+   for (i = 0; i < BUILTIN_AES_BLOCK_LEN; i++) {
+      s[i] ^= rk[i];
+   }
+}
+
+
+/* SubBytes and ShiftRows [FIPS-197 5.1.1, 5.1.2]. The state is stored by
+ * column, so s[r + 4c] is row r of column c. */
+static void
+_sub_shift_rows (uint8_t s[BUILTIN_AES_BLOCK_LEN])
+{
+   uint8_t t;
+
+   s[0] = _aes_sbox[s[0]];
+   s[4] = _aes_sbox[s[4]];
+   s[8] = _aes_sbox[s[8]];
+   s[12] = _aes_sbox[s[12]];
+
+   t = s[1];
+   s[1] = _aes_sbox[s[5]];
+   s[5] = _aes_sbox[s[9]];
+   s[9] = _aes_sbox[s[13]];
+   s[13] = _aes_sbox[t];
+
+   t = s[2];
+   s[2] = _aes_sbox[s[10]];
+   s[10] = _aes_sbox[t];
+   t = s[6];
+   s[6] = _aes_sbox[s[14]];
+   s[14] = _aes_sbox[t];
+
+   t = s[15];
+   s[15] = _aes_sbox[s[11]];
+   s[11] = _aes_sbox[s[7]];
+   s[7] = _aes_sbox[s[3]];
+   s[3] = _aes_sbox[t];
+}
+
+
+/* InvShiftRows and InvSubBytes [FIPS-197 5.3.1, 5.3.2]. */
+static void
+_inv_sub_shift_rows (uint8_t s[BUILTIN_AES_BLOCK_LEN])
+{
+   uint8_t t;
+
+   s[0] = _aes_inv_sbox[s[0]];
+   s[4] = _aes_inv_sbox[s[4]];
+   s[8] = _aes_inv_sbox[s[8]];
+   s[12] = _aes_inv_sbox[s[12]];
+
+   t = s[13];
+   s[13] = _aes_inv_sbox[s[9]];
+   s[9] = _aes_inv_sbox[s[5]];
+   s[5] = _aes_inv_sbox[s[1]];
+   s[1] = _aes_inv_sbox[t];
+
+   t = s[2];
+   s[2] = _aes_inv_sbox[s[10]];
+   s[10] = _aes_inv_sbox[t];
+   t = s[6];
+   s[6] = _aes_inv_sbox[s[14]];
+   s[14] = _aes_inv_sbox[t];
+
+   t = s[3];
+   s[3] = _aes_inv_sbox[s[7]];
+   s[7] = _aes_inv_sbox[s[11]];
+   s[11] = _aes_inv_sbox[s[15]];
+   s[15] = _aes_inv_sbox[t];
+}
+
+
+/* [FIPS-197 5.1.3] */
+static void
+_mix_columns (uint8_t s[BUILTIN_AES_BLOCK_LEN])
+{
+   uint8_t *c;
+   uint8_t t, u;
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      c = s + 4 * i;
+      t = c[0] ^ c[1] ^ c[2] ^ c[3];
+      u = c[0];
+      c[0] ^= t ^ _xtime (c[0] ^ c[1]);
+      c[1] ^= t ^ _xtime (c[1] ^ c[2]);
+      c[2] ^= t ^ _xtime (c[2] ^ c[3]);
+      c[3] ^= t ^ _xtime (c[3] ^ u);
+   }
+}
+
+
+/* [FIPS-197 5.3.3], computed as a preprocessing step followed by
+ * MixColumns. */
+static void
+_inv_mix_columns (uint8_t s[BUILTIN_AES_BLOCK_LEN])
+{
+   uint8_t *c;
+   uint8_t u, v;
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      c = s + 4 * i;
+      u = _xtime (_xtime (c[0] ^ c[2]));
+      v = _xtime (_xtime (c[1] ^ c[3]));
+      c[0] ^= u;
+      c[1] ^= v;
+      c[2] ^= u;
+      c[3] ^= v;
+   }
+   _mix_columns (s);
+}
+
+
+/* [FIPS-197 5.1] */
+static void
+_portable_encrypt_block (const _builtin_aes_256_t *aes,
+                         const uint8_t in[BUILTIN_AES_BLOCK_LEN],
+                         uint8_t out[BUILTIN_AES_BLOCK_LEN])
+{
+   uint8_t s[BUILTIN_AES_BLOCK_LEN];
+   int round;
+
+   memcpy (s, in, BUILTIN_AES_BLOCK_LEN);
+   _add_round_key (s, aes->enc);
+   for (round = 1; round < BUILTIN_AES_256_ROUNDS; round++) {
+      _sub_shift_rows (s);
+      _mix_columns (s);
+      _add_round_key (s, aes->enc + round * BUILTIN_AES_BLOCK_LEN);
+   }
+   _sub_shift_rows (s);
+   _add_round_key (s, aes->enc + round * BUILTIN_AES_BLOCK_LEN);
+   memcpy (out, s, BUILTIN_AES_BLOCK_LEN);
+}
+
+
+/* [FIPS-197 5.3] */
+static void
+_portable_decrypt_block (const _builtin_aes_256_t *aes,
+                         const uint8_t in[BUILTIN_AES_BLOCK_LEN],
+                         uint8_t out[BUILTIN_AES_BLOCK_LEN])
+{
+   uint8_t s[BUILTIN_AES_BLOCK_LEN];
+   int round;
+
+   memcpy (s, in, BUILTIN_AES_BLOCK_LEN);
+   _add_round_key (s,
+                   aes->enc + BUILTIN_AES_256_ROUNDS * BUILTIN_AES_BLOCK_LEN);
+   for (round = BUILTIN_AES_256_ROUNDS - 1; round > 0; round--) {
+      _inv_sub_shift_rows (s);
+      _add_round_key (s, aes->enc + round * BUILTIN_AES_BLOCK_LEN);
+      _inv_mix_columns (s);
+   }
+   _inv_sub_shift_rows (s);
+   _add_round_key (s, aes->enc);
+   memcpy (out, s, BUILTIN_AES_BLOCK_LEN);
+}
+
+
+static void
+_portable_cbc_encrypt (const _builtin_aes_256_t *aes,
+                       uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                       const uint8_t *in,
+                       uint8_t *out,
+                       size_t len)
+{
+   uint8_t block[BUILTIN_AES_BLOCK_LEN];
+   size_t off;
+   int i;
+
+   for (off = 0; off < len; off += BUILTIN_AES_BLOCK_LEN) {
+      for (i = 0; i < BUILTIN_AES_BLOCK_LEN; i++) {
+         block[i] = in[off + i] ^ iv[i];
+      }
+      _portable_encrypt_block (aes, block, iv);
+      memcpy (out + off, iv, BUILTIN_AES_BLOCK_LEN);
+   }
+}
+
+
+static void
+_portable_cbc_decrypt (const _builtin_aes_256_t *aes,
+                       uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                       const uint8_t *in,
+                       uint8_t *out,
+                       size_t len)
+{
+   uint8_t block[BUILTIN_AES_BLOCK_LEN];
+   uint8_t next_iv[BUILTIN_AES_BLOCK_LEN];
+   size_t off;
+   int i;
+
+   for (off = 0; off < len; off += BUILTIN_AES_BLOCK_LEN) {
+      /* Save the ciphertext first, in case @out overwrites @in. */
+      memcpy (next_iv, in + off, BUILTIN_AES_BLOCK_LEN);
+      _portable_decrypt_block (aes, next_iv, block);
+      for (i = 0; i < BUILTIN_AES_BLOCK_LEN; i++) {
+         out[off + i] = block[i] ^ iv[i];
+      }
+      memcpy (iv, next_iv, BUILTIN_AES_BLOCK_LEN);
+   }
+}
+
+
+static void
+_portable_ecb_encrypt (const _builtin_aes_256_t *aes,
+                       const uint8_t *in,
+                       uint8_t *out,
+                       size_t len)
+{
+   size_t off;
+
+   for (off = 0; off < len; off += BUILTIN_AES_BLOCK_LEN) {
+      _portable_encrypt_block (aes, in + off, out + off);
+   }
+}
+
+
+#ifdef BUILTIN_HAVE_AESNI
+
+/* Number of independent blocks in flight when decrypting and encrypting in
+ * ECB mode. AESDEC has a latency of several cycles but a throughput of about
+ * one per cycle, so interleaving blocks keeps the unit busy. CBC encryption
+ * cannot be interleaved since each block depends on the previous one. */
+#define AESNI_LANES 4
+
+BUILTIN_TARGET_AESNI
+static void
+_aesni_load_keys (const uint8_t *rk, __m128i k[BUILTIN_AES_256_ROUNDS + 1])
+{
+   int i;
+
+   for (i = 0; i <= BUILTIN_AES_256_ROUNDS; i++) {
+      k[i] =
+         _mm_loadu_si128 ((const __m128i *) (rk + i * BUILTIN_AES_BLOCK_LEN));
+   }
+}
+
+
+/* Round keys for the equivalent inverse cipher [FIPS-197 5.3.5] are the
+ * encryption keys in reverse order with InvMixColumns applied to all but the
+ * first and last [INTEL-AES]. */
+BUILTIN_TARGET_AESNI
+static void
+_aesni_init_dec (_builtin_aes_256_t *aes)
+{
+   __m128i k[BUILTIN_AES_256_ROUNDS + 1];
+   __m128i dk;
+   int i;
+
+   _aesni_load_keys (aes->enc, k);
+   for (i = 0; i <= BUILTIN_AES_256_ROUNDS; i++) {
+      dk = k[BUILTIN_AES_256_ROUNDS - i];
+      if (i > 0 && i < BUILTIN_AES_256_ROUNDS) {
+         dk = _mm_aesimc_si128 (dk);
+      }
+      _mm_storeu_si128 ((__m128i *) (aes->dec + i * BUILTIN_AES_BLOCK_LEN), dk);
+   }
+}
+
+
+BUILTIN_TARGET_AESNI
+static void
+_aesni_cbc_encrypt (const _builtin_aes_256_t *aes,
+                    uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                    const uint8_t *in,
+                    uint8_t *out,
+                    size_t len)
+{
+   __m128i k[BUILTIN_AES_256_ROUNDS + 1];
+   __m128i b;
+   size_t off;
+   int r;
+
+   _aesni_load_keys (aes->enc, k);
+   b = _mm_loadu_si128 ((const __m128i *) iv);
+   for (off = 0; off < len; off += BUILTIN_AES_BLOCK_LEN) {
+      b = _mm_xor_si128 (b, _mm_loadu_si128 ((const __m128i *) (in + off)));
+      b = _mm_xor_si128 (b, k[0]);
+      for (r = 1; r < BUILTIN_AES_256_ROUNDS; r++) {
+         b = _mm_aesenc_si128 (b, k[r]);
+      }
+      b = _mm_aesenclast_si128 (b, k[BUILTIN_AES_256_ROUNDS]);
+      _mm_storeu_si128 ((__m128i *) (out + off), b);
+   }
+   _mm_storeu_si128 ((__m128i *) iv, b);
+}
+
+
+BUILTIN_TARGET_AESNI
+static void
+_aesni_cbc_decrypt (const _builtin_aes_256_t *aes,
+                    uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                    const uint8_t *in,
+                    uint8_t *out,
+                    size_t len)
+{
+   __m128i k[BUILTIN_AES_256_ROUNDS + 1];
+   __m128i prev, c[AESNI_LANES], b[AESNI_LANES];
+   size_t off = 0;
+   int r, j;
+
+   _aesni_load_keys (aes->dec, k);
+   prev = _mm_loadu_si128 ((const __m128i *) iv);
+
+   for (; off + AESNI_LANES * BUILTIN_AES_BLOCK_LEN <= len;
+        off += AESNI_LANES * BUILTIN_AES_BLOCK_LEN) {
+      for (j = 0; j < AESNI_LANES; j++) {
+         c[j] = _mm_loadu_si128 (
+            (const __m128i *) (in + off + j * BUILTIN_AES_BLOCK_LEN));
+         b[j] = _mm_xor_si128 (c[j], k[0]);
+      }
+      for (r = 1; r < BUILTIN_AES_256_ROUNDS; r++) {
+         for (j = 0; j < AESNI_LANES; j++) {
+            b[j] = _mm_aesdec_si128 (b[j], k[r]);
+         }
+      }
+      for (j = 0; j < AESNI_LANES; j++) {
+         b[j] = _mm_aesdeclast_si128 (b[j], k[BUILTIN_AES_256_ROUNDS]);
+         b[j] = _mm_xor_si128 (b[j], j == 0 ? prev : c[j - 1]);
+         _mm_storeu_si128 ((__m128i *) (out + off + j * BUILTIN_AES_BLOCK_LEN),
+                           b[j]);
+      }
+      prev = c[AESNI_LANES - 1];
+   }
+
+   for (; off < len; off += BUILTIN_AES_BLOCK_LEN) {
+      c[0] = _mm_loadu_si128 ((const __m128i *) (in + off));
+      b[0] = _mm_xor_si128 (c[0], k[0]);
+      for (r = 1; r < BUILTIN_AES_256_ROUNDS; r++) {
+         b[0] = _mm_aesdec_si128 (b[0], k[r]);
+      }
+      b[0] = _mm_aesdeclast_si128 (b[0], k[BUILTIN_AES_256_ROUNDS]);
+      _mm_storeu_si128 ((__m128i *) (out + off), _mm_xor_si128 (b[0], prev));
+      prev = c[0];
+   }
+   _mm_storeu_si128 ((__m128i *) iv, prev);
+}
+
+
+BUILTIN_TARGET_AESNI
+static void
+_aesni_ecb_encrypt (const _builtin_aes_256_t *aes,
+                    const uint8_t *in,
+                    uint8_t *out,
+                    size_t len)
+{
+   __m128i k[BUILTIN_AES_256_ROUNDS + 1];
+   __m128i b[AESNI_LANES];
+   size_t off = 0;
+   int r, j;
+
+   _aesni_load_keys (aes->enc, k);
+
+   for (; off + AESNI_LANES * BUILTIN_AES_BLOCK_LEN <= len;
+        off += AESNI_LANES * BUILTIN_AES_BLOCK_LEN) {
+      for (j = 0; j < AESNI_LANES; j++) {
+         b[j] = _mm_xor_si128 (
+            _mm_loadu_si128 (
+               (const __m128i *) (in + off + j * BUILTIN_AES_BLOCK_LEN)),
+            k[0]);
+      }
+      for (r = 1; r < BUILTIN_AES_256_ROUNDS; r++) {
+         for (j = 0; j < AESNI_LANES; j++) {
+            b[j] = _mm_aesenc_si128 (b[j], k[r]);
+         }
+      }
+      for (j = 0; j < AESNI_LANES; j++) {
+         b[j] = _mm_aesenclast_si128 (b[j], k[BUILTIN_AES_256_ROUNDS]);
+         _mm_storeu_si128 ((__m128i *) (out + off + j * BUILTIN_AES_BLOCK_LEN),
+                           b[j]);
+      }
+   }
+
+   for (; off < len; off += BUILTIN_AES_BLOCK_LEN) {
+      b[0] = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *) (in + off)),
+                            k[0]);
+      for (r = 1; r < BUILTIN_AES_256_ROUNDS; r++) {
+         b[0] = _mm_aesenc_si128 (b[0], k[r]);
+      }
+      b[0] = _mm_aesenclast_si128 (b[0], k[BUILTIN_AES_256_ROUNDS]);
+      _mm_storeu_si128 ((__m128i *) (out + off), b[0]);
+   }
+}
+
+#endif /* BUILTIN_HAVE_AESNI */
+
+
+void
+_builtin_aes_256_init (_builtin_aes_256_t *aes,
+                       const uint8_t key[BUILTIN_AES_256_KEY_LEN],
+                       _builtin_aes_impl_t impl)
+{
+   memset (aes, 0, sizeof (*aes));
+   aes->impl = _builtin_aes_impl_supported (impl) ? impl
+                                                   : BUILTIN_AES_IMPL_PORTABLE;
+   _key_expansion (key, aes->enc);
+#ifdef BUILTIN_HAVE_AESNI
+   if (aes->impl == BUILTIN_AES_IMPL_AESNI) {
+      _aesni_init_dec (aes);
+   }
+#endif
+}
+
+
+void
+_builtin_aes_256_cleanup (_builtin_aes_256_t *aes)
+{
+   _builtin_secure_zero (aes, sizeof (*aes));
+}
+
+
+void
+_builtin_aes_256_cbc_encrypt (const _builtin_aes_256_t *aes,
+                              uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                              const uint8_t *in,
+                              uint8_t *out,
+                              size_t len)
+{
+#ifdef BUILTIN_HAVE_AESNI
+   if (aes->impl == BUILTIN_AES_IMPL_AESNI) {
+      _aesni_cbc_encrypt (aes, iv, in, out, len);
+      return;
+   }
+#endif
+   _portable_cbc_encrypt (aes, iv, in, out, len);
+}
+
+
+void
+_builtin_aes_256_cbc_decrypt (const _builtin_aes_256_t *aes,
+                              uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                              const uint8_t *in,
+                              uint8_t *out,
+                              size_t len)
+{
+#ifdef BUILTIN_HAVE_AESNI
+   if (aes->impl == BUILTIN_AES_IMPL_AESNI) {
+      _aesni_cbc_decrypt (aes, iv, in, out, len);
+      return;
+   }
+#endif
+   _portable_cbc_decrypt (aes, iv, in, out, len);
+}
+
+
+void
+_builtin_aes_256_ecb_encrypt (const _builtin_aes_256_t *aes,
+                              const uint8_t *in,
+                              uint8_t *out,
+                              size_t len)
+{
+#ifdef BUILTIN_HAVE_AESNI
+   if (aes->impl == BUILTIN_AES_IMPL_AESNI) {
+      _aesni_ecb_encrypt (aes, in, out, len);
+      return;
+   }
+#endif
+   _portable_ecb_encrypt (aes, in, out, len);
+}
+
+#endif /* MONGOCRYPT_ENABLE_CRYPTO_BUILTIN */
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOCRYPT_CRYPTO_BUILTIN_PRIVATE_H
+#define MONGOCRYPT_CRYPTO_BUILTIN_PRIVATE_H
+
+/* Primitives for the builtin crypto backend (MONGOCRYPT_CRYPTO=builtin).
+ * These do not depend on any crypto library. AES uses AES-NI when the CPU
+ * supports it and falls back to portable C otherwise. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUILTIN_AES_BLOCK_LEN 16
+#define BUILTIN_AES_256_KEY_LEN 32
+#define BUILTIN_AES_256_ROUNDS 14
+#define BUILTIN_SHA256_LEN 32
+#define BUILTIN_SHA256_BLOCK_LEN 64
+#define BUILTIN_SHA512_LEN 64
+#define BUILTIN_SHA512_BLOCK_LEN 128
+
+
+typedef enum {
+   BUILTIN_AES_IMPL_PORTABLE,
+   BUILTIN_AES_IMPL_AESNI
+} _builtin_aes_impl_t;
+
+/* Detects CPU features. Called once from _native_crypto_init. */
+void
+_builtin_cpu_detect (void);
+
+/* Returns true if @impl can run on this CPU. */
+bool
+_builtin_aes_impl_supported (_builtin_aes_impl_t impl);
+
+/* Returns the fastest implementation supported by this CPU. */
+_builtin_aes_impl_t
+_builtin_aes_impl_default (void);
+
+
+typedef struct {
+   /* The expanded encryption key in FIPS-197 byte order. */
+   uint8_t enc[(BUILTIN_AES_256_ROUNDS + 1) * BUILTIN_AES_BLOCK_LEN];
+   /* Round keys for the AES-NI equivalent inverse cipher. Unused by the
+    * portable implementation, which runs the inverse cipher on @enc. */
+   uint8_t dec[(BUILTIN_AES_256_ROUNDS + 1) * BUILTIN_AES_BLOCK_LEN];
+   _builtin_aes_impl_t impl;
+} _builtin_aes_256_t;
+
+/* @impl must be supported. */
+void
+_builtin_aes_256_init (_builtin_aes_256_t *aes,
+                       const uint8_t key[BUILTIN_AES_256_KEY_LEN],
+                       _builtin_aes_impl_t impl);
+
+/* Zeroes the expanded key. */
+void
+_builtin_aes_256_cleanup (_builtin_aes_256_t *aes);
+
+/* @len must be a multiple of the block size. @in and @out may be the same.
+ * @iv is updated to chain into a following call. */
+void
+_builtin_aes_256_cbc_encrypt (const _builtin_aes_256_t *aes,
+                              uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                              const uint8_t *in,
+                              uint8_t *out,
+                              size_t len);
+
+void
+_builtin_aes_256_cbc_decrypt (const _builtin_aes_256_t *aes,
+                              uint8_t iv[BUILTIN_AES_BLOCK_LEN],
+                              const uint8_t *in,
+                              uint8_t *out,
+                              size_t len);
+
+/* Encrypts independent blocks. Used by the DRBG. */
+void
+_builtin_aes_256_ecb_encrypt (const _builtin_aes_256_t *aes,
+                              const uint8_t *in,
+                              uint8_t *out,
+                              size_t len);
+
+
+typedef struct {
+   uint32_t h[8];
+   uint64_t len;
+   uint8_t buf[BUILTIN_SHA256_BLOCK_LEN];
+   uint32_t buf_len;
+} _builtin_sha256_t;
+
+void
+_builtin_sha256_init (_builtin_sha256_t *sha);
+
+void
+_builtin_sha256_update (_builtin_sha256_t *sha,
+                        const uint8_t *data,
+                        size_t len);
+
+void
+_builtin_sha256_final (_builtin_sha256_t *sha,
+                       uint8_t out[BUILTIN_SHA256_LEN]);
+
+
+typedef struct {
+   uint64_t h[8];
+   uint64_t len;
+   uint8_t buf[BUILTIN_SHA512_BLOCK_LEN];
+   uint32_t buf_len;
+} _builtin_sha512_t;
+
+void
+_builtin_sha512_init (_builtin_sha512_t *sha);
+
+void
+_builtin_sha512_update (_builtin_sha512_t *sha,
+                        const uint8_t *data,
+                        size_t len);
+
+void
+_builtin_sha512_final (_builtin_sha512_t *sha,
+                       uint8_t out[BUILTIN_SHA512_LEN]);
+
+
+/* HMAC keeps the hash states after absorbing the inner and outer pads, so
+ * that _reset starts a new message without rehashing the key. */
+typedef struct {
+   _builtin_sha256_t ipad;
+   _builtin_sha256_t opad;
+   _builtin_sha256_t inner;
+} _builtin_hmac_sha256_t;
+
+void
+_builtin_hmac_sha256_init (_builtin_hmac_sha256_t *hmac,
+                           const uint8_t *key,
+                           size_t key_len);
+
+void
+_builtin_hmac_sha256_reset (_builtin_hmac_sha256_t *hmac);
+
+void
+_builtin_hmac_sha256_update (_builtin_hmac_sha256_t *hmac,
+                             const uint8_t *data,
+                             size_t len);
+
+void
+_builtin_hmac_sha256_final (_builtin_hmac_sha256_t *hmac,
+                            uint8_t out[BUILTIN_SHA256_LEN]);
+
+
+typedef struct {
+   _builtin_sha512_t ipad;
+   _builtin_sha512_t opad;
+   _builtin_sha512_t inner;
+} _builtin_hmac_sha512_t;
+
+void
+_builtin_hmac_sha512_init (_builtin_hmac_sha512_t *hmac,
+                           const uint8_t *key,
+                           size_t key_len);
+
+void
+_builtin_hmac_sha512_reset (_builtin_hmac_sha512_t *hmac);
+
+void
+_builtin_hmac_sha512_update (_builtin_hmac_sha512_t *hmac,
+                             const uint8_t *data,
+                             size_t len);
+
+void
+_builtin_hmac_sha512_final (_builtin_hmac_sha512_t *hmac,
+                            uint8_t out[BUILTIN_SHA512_LEN]);
+
+
+/* Zeroes memory in a way the compiler does not remove. */
+void
+_builtin_secure_zero (void *ptr, size_t len);
+
+#endif /* MONGOCRYPT_CRYPTO_BUILTIN_PRIVATE_H */
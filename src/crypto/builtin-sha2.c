@@ -0,0 +1,513 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SHA-256, SHA-512 and HMAC for the builtin crypto backend.
+ * Comments in this implementation refer to:
+ * [FIPS-180-4] https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.180-4.pdf
+ * [RFC2104] https://tools.ietf.org/html/rfc2104
+ */
+
+#include "mongocrypt-config.h"
+
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+
+#include "builtin-private.h"
+
+#include <string.h>
+
+/* [FIPS-180-4 4.2.2] */
+static const uint32_t _sha256_k[64] = {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+   0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+   0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+   0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+   0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+   0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+
+/* [FIPS-180-4 5.3.3] */
+static const uint32_t _sha256_h0[8] = {
+   0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+
+/* [FIPS-180-4 4.2.3] */
+static const uint64_t _sha512_k[80] = {
+   0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+   0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+   0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+   0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+   0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+   0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+   0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+   0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+   0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+   0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+   0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+   0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+   0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+   0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+   0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+   0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+   0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+   0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+   0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+   0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+   0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+   0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+   0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+   0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+   0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+   0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+   0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL};
+
+
+/* [FIPS-180-4 5.3.5] */
+static const uint64_t _sha512_h0[8] = {
+   0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+   0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+   0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+
+static uint32_t
+_load_be32 (const uint8_t *p)
+{
+   return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+          ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+static uint64_t
+_load_be64 (const uint8_t *p)
+{
+   return ((uint64_t) _load_be32 (p) << 32) | _load_be32 (p + 4);
+}
+
+
+static void
+_store_be32 (uint8_t *p, uint32_t v)
+{
+   p[0] = (uint8_t) (v >> 24);
+   p[1] = (uint8_t) (v >> 16);
+   p[2] = (uint8_t) (v >> 8);
+   p[3] = (uint8_t) v;
+}
+
+
+static void
+_store_be64 (uint8_t *p, uint64_t v)
+{
+   _store_be32 (p, (uint32_t) (v >> 32));
+   _store_be32 (p + 4, (uint32_t) v);
+}
+
+
+void
+_builtin_secure_zero (void *ptr, size_t len)
+{
+   /* Writing through a volatile pointer keeps the compiler from removing the
+    * stores as dead. */
+   volatile uint8_t *p = (volatile uint8_t *) ptr;
+
+   while (len--) {
+      *p++ = 0;
+   }
+}
+
+
+/* [FIPS-180-4 6.2.2] */
+static void
+_sha256_compress (uint32_t h[8], const uint8_t *block)
+{
+   uint32_t w[64];
+   uint32_t a, b, c, d, e, f, g, hh, t1, t2;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      w[i] = _load_be32 (block + 4 * i);
+   }
+   for (i = 16; i < 64; i++) {
+      t1 = ROTR32 (w[i - 2], 17) ^ ROTR32 (w[i - 2], 19) ^ (w[i - 2] >> 10);
+      t2 = ROTR32 (w[i - 15], 7) ^ ROTR32 (w[i - 15], 18) ^ (w[i - 15] >> 3);
+      w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+   }
+
+   a = h[0];
+   b = h[1];
+   c = h[2];
+   d = h[3];
+   e = h[4];
+   f = h[5];
+   g = h[6];
+   hh = h[7];
+   for (i = 0; i < 64; i++) {
+      t1 = hh + (ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25)) +
+           CH (e, f, g) + _sha256_k[i] + w[i];
+      t2 = (ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22)) + MAJ (a, b, c);
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+   }
+   h[0] += a;
+   h[1] += b;
+   h[2] += c;
+   h[3] += d;
+   h[4] += e;
+   h[5] += f;
+   h[6] += g;
+   h[7] += hh;
+}
+
+
+void
+_builtin_sha256_init (_builtin_sha256_t *sha)
+{
+   memcpy (sha->h, _sha256_h0, sizeof (sha->h));
+   sha->len = 0;
+   sha->buf_len = 0;
+}
+
+
+void
+_builtin_sha256_update (_builtin_sha256_t *sha,
+                        const uint8_t *data,
+                        size_t len)
+{
+   size_t n;
+
+   sha->len += len;
+   if (sha->buf_len > 0) {
+      n = BUILTIN_SHA256_BLOCK_LEN - sha->buf_len;
+      if (n > len) {
+         n = len;
+      }
+      memcpy (sha->buf + sha->buf_len, data, n);
+      sha->buf_len += (uint32_t) n;
+      data += n;
+      len -= n;
+      if (sha->buf_len < BUILTIN_SHA256_BLOCK_LEN) {
+         return;
+      }
+      _sha256_compress (sha->h, sha->buf);
+      sha->buf_len = 0;
+   }
+
+   /* Compress whole blocks straight from the input. */
+   while (len >= BUILTIN_SHA256_BLOCK_LEN) {
+      _sha256_compress (sha->h, data);
+      data += BUILTIN_SHA256_BLOCK_LEN;
+      len -= BUILTIN_SHA256_BLOCK_LEN;
+   }
+
+   memcpy (sha->buf, data, len);
+   sha->buf_len = (uint32_t) len;
+}
+
+
+/* [FIPS-180-4 5.1.1] */
+void
+_builtin_sha256_final (_builtin_sha256_t *sha, uint8_t out[BUILTIN_SHA256_LEN])
+{
+   uint64_t bit_len = sha->len * 8;
+   int i;
+
+   sha->buf[sha->buf_len++] = 0x80;
+   if (sha->buf_len > BUILTIN_SHA256_BLOCK_LEN - 8) {
+      memset (sha->buf + sha->buf_len,
+              0,
+              BUILTIN_SHA256_BLOCK_LEN - sha->buf_len);
+      _sha256_compress (sha->h, sha->buf);
+      sha->buf_len = 0;
+   }
+   memset (
+      sha->buf + sha->buf_len, 0, BUILTIN_SHA256_BLOCK_LEN - 8 - sha->buf_len);
+   _store_be64 (sha->buf + BUILTIN_SHA256_BLOCK_LEN - 8, bit_len);
+   _sha256_compress (sha->h, sha->buf);
+
+   for (i = 0; i < 8; i++) {
+      _store_be32 (out + 4 * i, sha->h[i]);
+   }
+   _builtin_secure_zero (sha, sizeof (*sha));
+}
+
+
+/* [FIPS-180-4 6.4.2] */
+static void
+_sha512_compress (uint64_t h[8], const uint8_t *block)
+{
+   uint64_t w[80];
+   uint64_t a, b, c, d, e, f, g, hh, t1, t2;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      w[i] = _load_be64 (block + 8 * i);
+   }
+   for (i = 16; i < 80; i++) {
+      t1 = ROTR64 (w[i - 2], 19) ^ ROTR64 (w[i - 2], 61) ^ (w[i - 2] >> 6);
+      t2 = ROTR64 (w[i - 15], 1) ^ ROTR64 (w[i - 15], 8) ^ (w[i - 15] >> 7);
+      w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+   }
+
+   a = h[0];
+   b = h[1];
+   c = h[2];
+   d = h[3];
+   e = h[4];
+   f = h[5];
+   g = h[6];
+   hh = h[7];
+   for (i = 0; i < 80; i++) {
+      t1 = hh + (ROTR64 (e, 14) ^ ROTR64 (e, 18) ^ ROTR64 (e, 41)) +
+           CH (e, f, g) + _sha512_k[i] + w[i];
+      t2 = (ROTR64 (a, 28) ^ ROTR64 (a, 34) ^ ROTR64 (a, 39)) + MAJ (a, b, c);
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+   }
+   h[0] += a;
+   h[1] += b;
+   h[2] += c;
+   h[3] += d;
+   h[4] += e;
+   h[5] += f;
+   h[6] += g;
+   h[7] += hh;
+}
+
+
+void
+_builtin_sha512_init (_builtin_sha512_t *sha)
+{
+   memcpy (sha->h, _sha512_h0, sizeof (sha->h));
+   sha->len = 0;
+   sha->buf_len = 0;
+}
+
+
+void
+_builtin_sha512_update (_builtin_sha512_t *sha,
+                        const uint8_t *data,
+                        size_t len)
+{
+   size_t n;
+
+   sha->len += len;
+   if (sha->buf_len > 0) {
+      n = BUILTIN_SHA512_BLOCK_LEN - sha->buf_len;
+      if (n > len) {
+         n = len;
+      }
+      memcpy (sha->buf + sha->buf_len, data, n);
+      sha->buf_len += (uint32_t) n;
+      data += n;
+      len -= n;
+      if (sha->buf_len < BUILTIN_SHA512_BLOCK_LEN) {
+         return;
+      }
+      _sha512_compress (sha->h, sha->buf);
+      sha->buf_len = 0;
+   }
+
+   /* Compress whole blocks straight from the input. */
+   while (len >= BUILTIN_SHA512_BLOCK_LEN) {
+      _sha512_compress (sha->h, data);
+      data += BUILTIN_SHA512_BLOCK_LEN;
+      len -= BUILTIN_SHA512_BLOCK_LEN;
+   }
+
+   memcpy (sha->buf, data, len);
+   sha->buf_len = (uint32_t) len;
+}
+
+
+/* [FIPS-180-4 5.1.2] The message length is stored in the low 64 bits of the
+ * 128 bit length field. */
+void
+_builtin_sha512_final (_builtin_sha512_t *sha, uint8_t out[BUILTIN_SHA512_LEN])
+{
+   uint64_t bit_len = sha->len * 8;
+   int i;
+
+   sha->buf[sha->buf_len++] = 0x80;
+   if (sha->buf_len > BUILTIN_SHA512_BLOCK_LEN - 16) {
+      memset (sha->buf + sha->buf_len,
+              0,
+              BUILTIN_SHA512_BLOCK_LEN - sha->buf_len);
+      _sha512_compress (sha->h, sha->buf);
+      sha->buf_len = 0;
+   }
+   memset (
+      sha->buf + sha->buf_len, 0, BUILTIN_SHA512_BLOCK_LEN - 8 - sha->buf_len);
+   _store_be64 (sha->buf + BUILTIN_SHA512_BLOCK_LEN - 8, bit_len);
+   _sha512_compress (sha->h, sha->buf);
+
+   for (i = 0; i < 8; i++) {
+      _store_be64 (out + 8 * i, sha->h[i]);
+   }
+   _builtin_secure_zero (sha, sizeof (*sha));
+}
+
+
+/* [RFC2104] Keys longer than the block size are hashed first. The pads are
+ * absorbed once here and copied on every reset. */
+void
+_builtin_hmac_sha256_init (_builtin_hmac_sha256_t *hmac,
+                           const uint8_t *key,
+                           size_t key_len)
+{
+   uint8_t pad[BUILTIN_SHA256_BLOCK_LEN];
+   size_t i;
+
+   memset (pad, 0, sizeof (pad));
+   if (key_len > BUILTIN_SHA256_BLOCK_LEN) {
+      _builtin_sha256_init (&hmac->inner);
+      _builtin_sha256_update (&hmac->inner, key, key_len);
+      _builtin_sha256_final (&hmac->inner, pad);
+   } else {
+      memcpy (pad, key, key_len);
+   }
+
+   for (i = 0; i < sizeof (pad); i++) {
+      pad[i] ^= 0x36;
+   }
+   _builtin_sha256_init (&hmac->ipad);
+   _builtin_sha256_update (&hmac->ipad, pad, sizeof (pad));
+
+   for (i = 0; i < sizeof (pad); i++) {
+      pad[i] ^= 0x36 ^ 0x5c;
+   }
+   _builtin_sha256_init (&hmac->opad);
+   _builtin_sha256_update (&hmac->opad, pad, sizeof (pad));
+
+   _builtin_secure_zero (pad, sizeof (pad));
+   _builtin_hmac_sha256_reset (hmac);
+}
+
+
+void
+_builtin_hmac_sha256_reset (_builtin_hmac_sha256_t *hmac)
+{
+   hmac->inner = hmac->ipad;
+}
+
+
+void
+_builtin_hmac_sha256_update (_builtin_hmac_sha256_t *hmac,
+                             const uint8_t *data,
+                             size_t len)
+{
+   _builtin_sha256_update (&hmac->inner, data, len);
+}
+
+
+void
+_builtin_hmac_sha256_final (_builtin_hmac_sha256_t *hmac,
+                            uint8_t out[BUILTIN_SHA256_LEN])
+{
+   _builtin_sha256_t outer;
+
+   _builtin_sha256_final (&hmac->inner, out);
+   outer = hmac->opad;
+   _builtin_sha256_update (&outer, out, BUILTIN_SHA256_LEN);
+   _builtin_sha256_final (&outer, out);
+}
+
+
+void
+_builtin_hmac_sha512_init (_builtin_hmac_sha512_t *hmac,
+                           const uint8_t *key,
+                           size_t key_len)
+{
+   uint8_t pad[BUILTIN_SHA512_BLOCK_LEN];
+   size_t i;
+
+   memset (pad, 0, sizeof (pad));
+   if (key_len > BUILTIN_SHA512_BLOCK_LEN) {
+      _builtin_sha512_init (&hmac->inner);
+      _builtin_sha512_update (&hmac->inner, key, key_len);
+      _builtin_sha512_final (&hmac->inner, pad);
+   } else {
+      memcpy (pad, key, key_len);
+   }
+
+   for (i = 0; i < sizeof (pad); i++) {
+      pad[i] ^= 0x36;
+   }
+   _builtin_sha512_init (&hmac->ipad);
+   _builtin_sha512_update (&hmac->ipad, pad, sizeof (pad));
+
+   for (i = 0; i < sizeof (pad); i++) {
+      pad[i] ^= 0x36 ^ 0x5c;
+   }
+   _builtin_sha512_init (&hmac->opad);
+   _builtin_sha512_update (&hmac->opad, pad, sizeof (pad));
+
+   _builtin_secure_zero (pad, sizeof (pad));
+   _builtin_hmac_sha512_reset (hmac);
+}
+
+
+void
+_builtin_hmac_sha512_reset (_builtin_hmac_sha512_t *hmac)
+{
+   hmac->inner = hmac->ipad;
+}
+
+
+void
+_builtin_hmac_sha512_update (_builtin_hmac_sha512_t *hmac,
+                             const uint8_t *data,
+                             size_t len)
+{
+   _builtin_sha512_update (&hmac->inner, data, len);
+}
+
+
+void
+_builtin_hmac_sha512_final (_builtin_hmac_sha512_t *hmac,
+                            uint8_t out[BUILTIN_SHA512_LEN])
+{
+   _builtin_sha512_t outer;
+
+   _builtin_sha512_final (&hmac->inner, out);
+   outer = hmac->opad;
+   _builtin_sha512_update (&outer, out, BUILTIN_SHA512_LEN);
+   _builtin_sha512_final (&outer, out);
+}
+
+#endif /* MONGOCRYPT_ENABLE_CRYPTO_BUILTIN */
@@ -0,0 +1,560 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A self-contained crypto backend that does not depend on a crypto library.
+ * Comments in this implementation refer to:
+ * [SP800-90A] https://doi.org/10.6028/NIST.SP.800-90Ar1
+ */
+
+#include "../mongocrypt-crypto-private.h"
+#include "../mongocrypt-private.h"
+
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+
+#include "builtin-private.h"
+
+#include <bson/bson.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <bcrypt.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* CTR_DRBG with AES-256 and no derivation function [SP800-90A 10.2.1]. */
+#define DRBG_SEED_LEN 48
+/* Reseed far more often than the 2^48 requests [SP800-90A] allows. */
+#define DRBG_RESEED_INTERVAL (1 << 16)
+/* Maximum bytes per request is 2^19 bits [SP800-90A Table 3]. */
+#define DRBG_MAX_REQUEST_LEN (1 << 16)
+/* Counter blocks encrypted per call into the block cipher. */
+#define DRBG_BATCH_BLOCKS 16
+
+typedef struct {
+   _builtin_aes_256_t key;
+   uint8_t v[BUILTIN_AES_BLOCK_LEN];
+   uint32_t reseed_counter;
+   bool seeded;
+#ifndef _WIN32
+   /* A forked child starts with the parent's state. It is reseeded when the
+    * process ID changes so that the two never produce the same output. */
+   pid_t pid;
+#endif
+} _ctr_drbg_t;
+
+static _ctr_drbg_t _drbg;
+static mongocrypt_mutex_t _drbg_mutex;
+
+bool _native_crypto_initialized = false;
+
+void
+_native_crypto_init ()
+{
+   _builtin_cpu_detect ();
+   _mongocrypt_mutex_init (&_drbg_mutex);
+   _native_crypto_initialized = true;
+}
+
+
+static bool
+_os_entropy (uint8_t *out, size_t len, mongocrypt_status_t *status)
+{
+#ifdef _WIN32
+   NTSTATUS nt_status;
+
+   nt_status = BCryptGenRandom (
+      NULL, out, (ULONG) len, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+   if (!BCRYPT_SUCCESS (nt_status)) {
+      CLIENT_ERR ("failed to read system entropy: 0x%x", (int) nt_status);
+      return false;
+   }
+   return true;
+#else
+   ssize_t n;
+   int fd;
+
+   fd = open ("/dev/urandom", O_RDONLY);
+   if (fd < 0) {
+      CLIENT_ERR ("failed to open /dev/urandom: errno %d", errno);
+      return false;
+   }
+
+   while (len > 0) {
+      n = read (fd, out, len);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         CLIENT_ERR ("failed to read /dev/urandom: errno %d", errno);
+         close (fd);
+         return false;
+      }
+      out += n;
+      len -= (size_t) n;
+   }
+
+   close (fd);
+   return true;
+#endif
+}
+
+
+static void
+_drbg_increment_v (uint8_t v[BUILTIN_AES_BLOCK_LEN])
+{
+   int i;
+
+   for (i = BUILTIN_AES_BLOCK_LEN - 1; i >= 0; i--) {
+      if (++v[i] != 0) {
+         break;
+      }
+   }
+}
+
+
+/* CTR_DRBG_Update [SP800-90A 10.2.1.2]. @provided_data may be NULL for all
+ * zeros. */
+static void
+_drbg_update (const uint8_t *provided_data)
+{
+   uint8_t counters[DRBG_SEED_LEN];
+   uint8_t temp[DRBG_SEED_LEN];
+   int i;
+
+   for (i = 0; i < DRBG_SEED_LEN; i += BUILTIN_AES_BLOCK_LEN) {
+      _drbg_increment_v (_drbg.v);
+      memcpy (counters + i, _drbg.v, BUILTIN_AES_BLOCK_LEN);
+   }
+   _builtin_aes_256_ecb_encrypt (&_drbg.key, counters, temp, DRBG_SEED_LEN);
+
+   if (provided_data) {
+      for (i = 0; i < DRBG_SEED_LEN; i++) {
+         temp[i] ^= provided_data[i];
+      }
+   }
+
+   _builtin_aes_256_init (&_drbg.key, temp, _builtin_aes_impl_default ());
+   memcpy (_drbg.v, temp + BUILTIN_AES_256_KEY_LEN, BUILTIN_AES_BLOCK_LEN);
+   _builtin_secure_zero (temp, sizeof (temp));
+}
+
+
+/* Instantiate or reseed with fresh entropy [SP800-90A 10.2.1.3.1, 10.2.1.4.1].
+ * Must be called with _drbg_mutex held. */
+static bool
+_drbg_seed (mongocrypt_status_t *status)
+{
+   uint8_t entropy[DRBG_SEED_LEN];
+   uint8_t zero_key[BUILTIN_AES_256_KEY_LEN] = {0};
+
+   if (!_os_entropy (entropy, sizeof (entropy), status)) {
+      return false;
+   }
+
+   if (!_drbg.seeded) {
+      _builtin_aes_256_init (
+         &_drbg.key, zero_key, _builtin_aes_impl_default ());
+      memset (_drbg.v, 0, sizeof (_drbg.v));
+   }
+
+   _drbg_update (entropy);
+   _builtin_secure_zero (entropy, sizeof (entropy));
+   _drbg.reseed_counter = 1;
+   _drbg.seeded = true;
+#ifndef _WIN32
+   _drbg.pid = getpid ();
+#endif
+   return true;
+}
+
+
+/* CTR_DRBG_Generate [SP800-90A 10.2.1.5.1] for one request. Must be called
+ * with _drbg_mutex held. */
+static bool
+_drbg_generate (uint8_t *out, size_t len, mongocrypt_status_t *status)
+{
+   uint8_t counters[DRBG_BATCH_BLOCKS * BUILTIN_AES_BLOCK_LEN];
+   uint8_t blocks[DRBG_BATCH_BLOCKS * BUILTIN_AES_BLOCK_LEN];
+   size_t nblocks, n, i;
+
+   BSON_ASSERT (len <= DRBG_MAX_REQUEST_LEN);
+
+   if (!_drbg.seeded || _drbg.reseed_counter > DRBG_RESEED_INTERVAL
+#ifndef _WIN32
+       || _drbg.pid != getpid ()
+#endif
+   ) {
+      if (!_drbg_seed (status)) {
+         return false;
+      }
+   }
+
+   while (len > 0) {
+      nblocks = (len + BUILTIN_AES_BLOCK_LEN - 1) / BUILTIN_AES_BLOCK_LEN;
+      if (nblocks > DRBG_BATCH_BLOCKS) {
+         nblocks = DRBG_BATCH_BLOCKS;
+      }
+      for (i = 0; i < nblocks; i++) {
+         _drbg_increment_v (_drbg.v);
+         memcpy (counters + i * BUILTIN_AES_BLOCK_LEN,
+                 _drbg.v,
+                 BUILTIN_AES_BLOCK_LEN);
+      }
+      _builtin_aes_256_ecb_encrypt (
+         &_drbg.key, counters, blocks, nblocks * BUILTIN_AES_BLOCK_LEN);
+
+      n = nblocks * BUILTIN_AES_BLOCK_LEN;
+      if (n > len) {
+         n = len;
+      }
+      memcpy (out, blocks, n);
+      out += n;
+      len -= n;
+   }
+
+   /* Backtracking resistance: the state used for this output is gone. */
+   _drbg_update (NULL);
+   _drbg.reseed_counter++;
+   _builtin_secure_zero (blocks, sizeof (blocks));
+   return true;
+}
+
+
+bool
+_native_crypto_random (_mongocrypt_buffer_t *out,
+                       uint32_t count,
+                       mongocrypt_status_t *status)
+{
+   uint8_t *data = out->data;
+   size_t n;
+   bool ret = true;
+
+   _mongocrypt_mutex_lock (&_drbg_mutex);
+   while (count > 0) {
+      n = count < DRBG_MAX_REQUEST_LEN ? count : DRBG_MAX_REQUEST_LEN;
+      if (!_drbg_generate (data, n, status)) {
+         ret = false;
+         break;
+      }
+      data += n;
+      count -= (uint32_t) n;
+   }
+   _mongocrypt_mutex_unlock (&_drbg_mutex);
+   return ret;
+}
+
+
+static bool
+_aes_256_cbc (const _builtin_aes_256_t *aes,
+              const _mongocrypt_buffer_t *iv,
+              const _mongocrypt_buffer_t *in,
+              _mongocrypt_buffer_t *out,
+              uint32_t *bytes_written,
+              bool encrypt,
+              mongocrypt_status_t *status)
+{
+   uint8_t chain[BUILTIN_AES_BLOCK_LEN];
+
+   *bytes_written = 0;
+
+   if (iv->len != BUILTIN_AES_BLOCK_LEN) {
+      CLIENT_ERR ("IV must be length %d, but is length %" PRIu32,
+                  BUILTIN_AES_BLOCK_LEN,
+                  iv->len);
+      return false;
+   }
+
+   /* Padding is applied by the caller. */
+   if (in->len % BUILTIN_AES_BLOCK_LEN != 0) {
+      CLIENT_ERR ("%s input length %" PRIu32
+                  " is not a multiple of the block size",
+                  encrypt ? "encryption" : "decryption",
+                  in->len);
+      return false;
+   }
+
+   if (out->len < in->len) {
+      CLIENT_ERR ("output buffer too small");
+      return false;
+   }
+
+   memcpy (chain, iv->data, BUILTIN_AES_BLOCK_LEN);
+   if (encrypt) {
+      _builtin_aes_256_cbc_encrypt (aes, chain, in->data, out->data, in->len);
+   } else {
+      _builtin_aes_256_cbc_decrypt (aes, chain, in->data, out->data, in->len);
+   }
+   *bytes_written = in->len;
+   return true;
+}
+
+
+static bool
+_check_aes_key (const _mongocrypt_buffer_t *key, mongocrypt_status_t *status)
+{
+   if (key->len != BUILTIN_AES_256_KEY_LEN) {
+      CLIENT_ERR ("AES key must be length %d, but is length %" PRIu32,
+                  BUILTIN_AES_256_KEY_LEN,
+                  key->len);
+      return false;
+   }
+   return true;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_encrypt (const _mongocrypt_buffer_t *key,
+                                    const _mongocrypt_buffer_t *iv,
+                                    const _mongocrypt_buffer_t *in,
+                                    _mongocrypt_buffer_t *out,
+                                    uint32_t *bytes_written,
+                                    mongocrypt_status_t *status)
+{
+   _builtin_aes_256_t aes;
+   bool ret;
+
+   if (!_check_aes_key (key, status)) {
+      return false;
+   }
+
+   _builtin_aes_256_init (&aes, key->data, _builtin_aes_impl_default ());
+   ret = _aes_256_cbc (&aes, iv, in, out, bytes_written, true, status);
+   _builtin_aes_256_cleanup (&aes);
+   return ret;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_decrypt (const _mongocrypt_buffer_t *key,
+                                    const _mongocrypt_buffer_t *iv,
+                                    const _mongocrypt_buffer_t *in,
+                                    _mongocrypt_buffer_t *out,
+                                    uint32_t *bytes_written,
+                                    mongocrypt_status_t *status)
+{
+   _builtin_aes_256_t aes;
+   bool ret;
+
+   if (!_check_aes_key (key, status)) {
+      return false;
+   }
+
+   _builtin_aes_256_init (&aes, key->data, _builtin_aes_impl_default ());
+   ret = _aes_256_cbc (&aes, iv, in, out, bytes_written, false, status);
+   _builtin_aes_256_cleanup (&aes);
+   return ret;
+}
+
+
+bool
+_native_crypto_hmac_sha_512 (const _mongocrypt_buffer_t *key,
+                             const _mongocrypt_buffer_t *in,
+                             _mongocrypt_buffer_t *out,
+                             mongocrypt_status_t *status)
+{
+   _builtin_hmac_sha512_t hmac;
+
+   if (out->len != MONGOCRYPT_HMAC_SHA512_LEN) {
+      CLIENT_ERR ("out does not contain %d bytes", MONGOCRYPT_HMAC_SHA512_LEN);
+      return false;
+   }
+
+   _builtin_hmac_sha512_init (&hmac, key->data, key->len);
+   _builtin_hmac_sha512_update (&hmac, in->data, in->len);
+   _builtin_hmac_sha512_final (&hmac, out->data);
+   _builtin_secure_zero (&hmac, sizeof (hmac));
+   return true;
+}
+
+
+bool
+_native_crypto_hmac_sha_256 (const _mongocrypt_buffer_t *key,
+                             const _mongocrypt_buffer_t *in,
+                             _mongocrypt_buffer_t *out,
+                             mongocrypt_status_t *status)
+{
+   _builtin_hmac_sha256_t hmac;
+
+   if (out->len != BUILTIN_SHA256_LEN) {
+      CLIENT_ERR ("out does not contain %d bytes", BUILTIN_SHA256_LEN);
+      return false;
+   }
+
+   _builtin_hmac_sha256_init (&hmac, key->data, key->len);
+   _builtin_hmac_sha256_update (&hmac, in->data, in->len);
+   _builtin_hmac_sha256_final (&hmac, out->data);
+   _builtin_secure_zero (&hmac, sizeof (hmac));
+   return true;
+}
+
+
+bool
+_native_crypto_sha_256 (const _mongocrypt_buffer_t *in,
+                        _mongocrypt_buffer_t *out,
+                        mongocrypt_status_t *status)
+{
+   _builtin_sha256_t sha;
+
+   if (out->len != BUILTIN_SHA256_LEN) {
+      CLIENT_ERR ("out does not contain %d bytes", BUILTIN_SHA256_LEN);
+      return false;
+   }
+
+   _builtin_sha256_init (&sha);
+   _builtin_sha256_update (&sha, in->data, in->len);
+   _builtin_sha256_final (&sha, out->data);
+   return true;
+}
+
+
+struct __native_crypto_aes_256_cbc_ctx_t {
+   _builtin_aes_256_t aes;
+};
+
+
+_native_crypto_aes_256_cbc_ctx_t *
+_native_crypto_aes_256_cbc_ctx_new (const _mongocrypt_buffer_t *key,
+                                    mongocrypt_status_t *status)
+{
+   _native_crypto_aes_256_cbc_ctx_t *ctx;
+
+   if (!_check_aes_key (key, status)) {
+      return NULL;
+   }
+
+   ctx = bson_malloc0 (sizeof (*ctx));
+   BSON_ASSERT (ctx);
+
+   /* Expand the key schedule once. */
+   _builtin_aes_256_init (&ctx->aes, key->data, _builtin_aes_impl_default ());
+   return ctx;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_ctx_encrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+   return _aes_256_cbc (&ctx->aes, iv, in, out, bytes_written, true, status);
+}
+
+
+bool
+_native_crypto_aes_256_cbc_ctx_decrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+   return _aes_256_cbc (&ctx->aes, iv, in, out, bytes_written, false, status);
+}
+
+
+void
+_native_crypto_aes_256_cbc_ctx_destroy (_native_crypto_aes_256_cbc_ctx_t *ctx)
+{
+   if (!ctx) {
+      return;
+   }
+
+   _builtin_aes_256_cleanup (&ctx->aes);
+   bson_free (ctx);
+}
+
+
+struct __native_crypto_hmac_sha_512_ctx_t {
+   _builtin_hmac_sha512_t hmac;
+};
+
+
+_native_crypto_hmac_sha_512_ctx_t *
+_native_crypto_hmac_sha_512_ctx_new (const _mongocrypt_buffer_t *key,
+                                     mongocrypt_status_t *status)
+{
+   _native_crypto_hmac_sha_512_ctx_t *ctx;
+
+   ctx = bson_malloc0 (sizeof (*ctx));
+   BSON_ASSERT (ctx);
+
+   /* Absorb the inner and outer pads once. */
+   _builtin_hmac_sha512_init (&ctx->hmac, key->data, key->len);
+   return ctx;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_init (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                      mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+
+   _builtin_hmac_sha512_reset (&ctx->hmac);
+   return true;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_update (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *in,
+                                        mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+
+   _builtin_hmac_sha512_update (&ctx->hmac, in->data, in->len);
+   return true;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_final (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                       _mongocrypt_buffer_t *out,
+                                       mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+
+   if (out->len != MONGOCRYPT_HMAC_SHA512_LEN) {
+      CLIENT_ERR ("out does not contain %d bytes", MONGOCRYPT_HMAC_SHA512_LEN);
+      return false;
+   }
+
+   _builtin_hmac_sha512_final (&ctx->hmac, out->data);
+   return true;
+}
+
+
+void
+_native_crypto_hmac_sha_512_ctx_destroy (_native_crypto_hmac_sha_512_ctx_t *ctx)
+{
+   if (!ctx) {
+      return;
+   }
+
+   _builtin_secure_zero (&ctx->hmac, sizeof (ctx->hmac));
+   bson_free (ctx);
+}
+
+#endif /* MONGOCRYPT_ENABLE_CRYPTO_BUILTIN */
@@ -181,4 +181,91 @@ _native_crypto_random (_mongocrypt_buffer_t *out,
    return true;
 }
 
+
+/* Precomputed per-key contexts are not supported. Callers fall back to the
+ * functions taking a raw key. */
+_native_crypto_aes_256_cbc_ctx_t *
+_native_crypto_aes_256_cbc_ctx_new (const _mongocrypt_buffer_t *key,
+                                    mongocrypt_status_t *status)
+{
+   return NULL;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_ctx_encrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+{
+   CLIENT_ERR ("precomputed AES contexts are not supported");
+   return false;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_ctx_decrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+{
+   CLIENT_ERR ("precomputed AES contexts are not supported");
+   return false;
+}
+
+
+void
+_native_crypto_aes_256_cbc_ctx_destroy (_native_crypto_aes_256_cbc_ctx_t *ctx)
+{
+   BSON_ASSERT (!ctx);
+}
+
+
+_native_crypto_hmac_sha_512_ctx_t *
+_native_crypto_hmac_sha_512_ctx_new (const _mongocrypt_buffer_t *key,
+                                     mongocrypt_status_t *status)
+{
+   return NULL;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_init (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                      mongocrypt_status_t *status)
+{
+   CLIENT_ERR ("precomputed HMAC contexts are not supported");
+   return false;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_update (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *in,
+                                        mongocrypt_status_t *status)
+{
+   CLIENT_ERR ("precomputed HMAC contexts are not supported");
+   return false;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_final (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                       _mongocrypt_buffer_t *out,
+                                       mongocrypt_status_t *status)
+{
+   CLIENT_ERR ("precomputed HMAC contexts are not supported");
+   return false;
+}
+
+
+void
+_native_crypto_hmac_sha_512_ctx_destroy (_native_crypto_hmac_sha_512_ctx_t *ctx)
+{
+   BSON_ASSERT (!ctx);
+}
+
 #endif /* MONGOCRYPT_ENABLE_CRYPTO_COMMON_CRYPTO */
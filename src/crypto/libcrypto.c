@@ -228,6 +228,253 @@ done:
 }
 
 
+struct __native_crypto_aes_256_cbc_ctx_t {
+   EVP_CIPHER_CTX *enc;
+   EVP_CIPHER_CTX *dec;
+};
+
+
+_native_crypto_aes_256_cbc_ctx_t *
+_native_crypto_aes_256_cbc_ctx_new (const _mongocrypt_buffer_t *key,
+                                    mongocrypt_status_t *status)
+{
+   const EVP_CIPHER *cipher;
+   _native_crypto_aes_256_cbc_ctx_t *ctx;
+
+   cipher = EVP_aes_256_cbc ();
+   BSON_ASSERT (EVP_CIPHER_key_length (cipher) == key->len);
+
+   ctx = bson_malloc0 (sizeof (*ctx));
+   ctx->enc = EVP_CIPHER_CTX_new ();
+   ctx->dec = EVP_CIPHER_CTX_new ();
+   BSON_ASSERT (ctx->enc);
+   BSON_ASSERT (ctx->dec);
+
+   /* Expand the key schedule once. The IV is set on every use. */
+   if (!EVP_EncryptInit_ex (
+          ctx->enc, cipher, NULL /* engine */, key->data, NULL /* iv */)) {
+      CLIENT_ERR ("error initializing cipher: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      goto fail;
+   }
+
+   if (!EVP_DecryptInit_ex (
+          ctx->dec, cipher, NULL /* engine */, key->data, NULL /* iv */)) {
+      CLIENT_ERR ("error initializing cipher: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      goto fail;
+   }
+
+   return ctx;
+
+fail:
+   _native_crypto_aes_256_cbc_ctx_destroy (ctx);
+   return NULL;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_ctx_encrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+{
+   int intermediate_bytes_written;
+
+   BSON_ASSERT (ctx);
+   BSON_ASSERT (EVP_CIPHER_CTX_iv_length (ctx->enc) == iv->len);
+
+   /* Passing a NULL cipher and key keeps the expanded key schedule. */
+   if (!EVP_EncryptInit_ex (ctx->enc, NULL, NULL, NULL, iv->data)) {
+      CLIENT_ERR ("error initializing cipher: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+
+   /* Disable the default OpenSSL padding. */
+   EVP_CIPHER_CTX_set_padding (ctx->enc, 0);
+
+   *bytes_written = 0;
+   if (!EVP_EncryptUpdate (ctx->enc,
+                           out->data,
+                           &intermediate_bytes_written,
+                           in->data,
+                           in->len)) {
+      CLIENT_ERR ("error encrypting: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+
+   *bytes_written = (uint32_t) intermediate_bytes_written;
+
+   if (!EVP_EncryptFinal_ex (
+          ctx->enc, out->data, &intermediate_bytes_written)) {
+      CLIENT_ERR ("error finalizing: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+
+   *bytes_written += (uint32_t) intermediate_bytes_written;
+   return true;
+}
+
+
+bool
+_native_crypto_aes_256_cbc_ctx_decrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+{
+   int intermediate_bytes_written;
+
+   BSON_ASSERT (ctx);
+   BSON_ASSERT (EVP_CIPHER_CTX_iv_length (ctx->dec) == iv->len);
+
+   /* Passing a NULL cipher and key keeps the expanded key schedule. */
+   if (!EVP_DecryptInit_ex (ctx->dec, NULL, NULL, NULL, iv->data)) {
+      CLIENT_ERR ("error initializing cipher: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+
+   /* Disable padding. */
+   EVP_CIPHER_CTX_set_padding (ctx->dec, 0);
+
+   *bytes_written = 0;
+   if (!EVP_DecryptUpdate (ctx->dec,
+                           out->data,
+                           &intermediate_bytes_written,
+                           in->data,
+                           in->len)) {
+      CLIENT_ERR ("error decrypting: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+
+   *bytes_written = (uint32_t) intermediate_bytes_written;
+
+   if (!EVP_DecryptFinal_ex (
+          ctx->dec, out->data, &intermediate_bytes_written)) {
+      CLIENT_ERR ("error decrypting: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+
+   *bytes_written += (uint32_t) intermediate_bytes_written;
+   return true;
+}
+
+
+void
+_native_crypto_aes_256_cbc_ctx_destroy (_native_crypto_aes_256_cbc_ctx_t *ctx)
+{
+   if (!ctx) {
+      return;
+   }
+
+   EVP_CIPHER_CTX_free (ctx->enc);
+   EVP_CIPHER_CTX_free (ctx->dec);
+   bson_free (ctx);
+}
+
+
+struct __native_crypto_hmac_sha_512_ctx_t {
+   HMAC_CTX *hmac;
+};
+
+
+_native_crypto_hmac_sha_512_ctx_t *
+_native_crypto_hmac_sha_512_ctx_new (const _mongocrypt_buffer_t *key,
+                                     mongocrypt_status_t *status)
+{
+   _native_crypto_hmac_sha_512_ctx_t *ctx;
+
+   ctx = bson_malloc0 (sizeof (*ctx));
+   ctx->hmac = HMAC_CTX_new ();
+   BSON_ASSERT (ctx->hmac);
+
+   /* Key the inner and outer pads once. */
+   if (!HMAC_Init_ex (
+          ctx->hmac, key->data, key->len, EVP_sha512 (), NULL /* engine */)) {
+      CLIENT_ERR ("error initializing HMAC: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      _native_crypto_hmac_sha_512_ctx_destroy (ctx);
+      return NULL;
+   }
+
+   return ctx;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_init (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                      mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+
+   /* Passing a NULL key and digest reuses the keyed pads. */
+   if (!HMAC_Init_ex (ctx->hmac, NULL, 0, NULL, NULL /* engine */)) {
+      CLIENT_ERR ("error initializing HMAC: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+   return true;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_update (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *in,
+                                        mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+
+   if (!HMAC_Update (ctx->hmac, in->data, in->len)) {
+      CLIENT_ERR ("error updating HMAC: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+   return true;
+}
+
+
+bool
+_native_crypto_hmac_sha_512_ctx_final (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                       _mongocrypt_buffer_t *out,
+                                       mongocrypt_status_t *status)
+{
+   BSON_ASSERT (ctx);
+
+   if (out->len != MONGOCRYPT_HMAC_SHA512_LEN) {
+      CLIENT_ERR ("out does not contain %d bytes", MONGOCRYPT_HMAC_SHA512_LEN);
+      return false;
+   }
+
+   if (!HMAC_Final (ctx->hmac, out->data, NULL /* unused out len */)) {
+      CLIENT_ERR ("error finalizing: %s",
+                  ERR_error_string (ERR_get_error (), NULL));
+      return false;
+   }
+   return true;
+}
+
+
+void
+_native_crypto_hmac_sha_512_ctx_destroy (_native_crypto_hmac_sha_512_ctx_t *ctx)
+{
+   if (!ctx) {
+      return;
+   }
+
+   HMAC_CTX_free (ctx->hmac);
+   bson_free (ctx);
+}
+
+
 bool
 _native_crypto_random (_mongocrypt_buffer_t *out,
                        uint32_t count,
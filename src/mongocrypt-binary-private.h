@@ -26,6 +26,11 @@ struct _mongocrypt_binary_t {
    uint32_t len;
 };
 
+/* Copies @data into the allocation of a new binary. mongocrypt_binary_destroy
+ * frees both, even if the binary was written to since. */
+mongocrypt_binary_t *
+_mongocrypt_binary_new_copy (const uint8_t *data, uint32_t len);
+
 bool
 _mongocrypt_binary_to_bson (mongocrypt_binary_t *binary,
                             bson_t *out) MONGOCRYPT_WARN_UNUSED_RESULT;
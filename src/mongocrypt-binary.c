@@ -44,6 +44,23 @@ mongocrypt_binary_new_from_data (uint8_t *data, uint32_t len)
 }
 
 
+mongocrypt_binary_t *
+_mongocrypt_binary_new_copy (const uint8_t *data, uint32_t len)
+{
+   mongocrypt_binary_t *binary;
+
+   binary = (mongocrypt_binary_t *) bson_malloc0 (sizeof *binary + len);
+   BSON_ASSERT (binary);
+   binary->data = (uint8_t *) (binary + 1);
+   binary->len = len;
+   if (len) {
+      memcpy (binary->data, data, len);
+   }
+
+   return binary;
+}
+
+
 bool
 _mongocrypt_binary_to_bson (mongocrypt_binary_t *binary, bson_t *out)
 {
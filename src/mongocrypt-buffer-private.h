@@ -43,6 +43,11 @@ _mongocrypt_buffer_init (_mongocrypt_buffer_t *buf);
 void
 _mongocrypt_buffer_resize (_mongocrypt_buffer_t *buf, uint32_t len);
 
+/* Grows @buf by @len bytes, keeping its contents, and returns a pointer to the
+ * new bytes. */
+uint8_t *
+_mongocrypt_buffer_append_space (_mongocrypt_buffer_t *buf, uint32_t len);
+
 
 void
 _mongocrypt_buffer_steal (_mongocrypt_buffer_t *buf, _mongocrypt_buffer_t *src);
@@ -119,6 +124,12 @@ _mongocrypt_buffer_cmp (const _mongocrypt_buffer_t *a,
                         const _mongocrypt_buffer_t *b);
 
 
+/* Compares the contents in constant time, for key ids and tags. */
+bool
+_mongocrypt_buffer_equal (const _mongocrypt_buffer_t *a,
+                          const _mongocrypt_buffer_t *b);
+
+
 void
 _mongocrypt_buffer_cleanup (_mongocrypt_buffer_t *buf);
 
@@ -16,6 +16,7 @@
 
 #include <bson/bson.h>
 #include "mongocrypt-buffer-private.h"
+#include "mongocrypt-crypto-private.h"
 
 #define INT32_LEN 4
 #define TYPE_LEN 1
@@ -72,6 +73,38 @@ _mongocrypt_buffer_resize (_mongocrypt_buffer_t *buf, uint32_t len)
 }
 
 
+uint8_t *
+_mongocrypt_buffer_append_space (_mongocrypt_buffer_t *buf, uint32_t len)
+{
+   uint32_t offset;
+
+   BSON_ASSERT (buf);
+   BSON_ASSERT (len <= UINT32_MAX - buf->len);
+
+   offset = buf->len;
+   if (len == 0) {
+      return buf->data ? buf->data + offset : NULL;
+   }
+
+   if (!buf->owned) {
+      uint8_t *data = buf->data;
+
+      buf->data = bson_malloc (offset + len);
+      BSON_ASSERT (buf->data);
+      if (offset > 0) {
+         memcpy (buf->data, data, offset);
+      }
+      buf->owned = true;
+   } else {
+      buf->data = bson_realloc (buf->data, offset + len);
+      BSON_ASSERT (buf->data);
+   }
+
+   buf->len = offset + len;
+   return buf->data + offset;
+}
+
+
 void
 _mongocrypt_buffer_steal (_mongocrypt_buffer_t *buf, _mongocrypt_buffer_t *src)
 {
@@ -268,6 +301,17 @@ _mongocrypt_buffer_cmp (const _mongocrypt_buffer_t *a,
 }
 
 
+bool
+_mongocrypt_buffer_equal (const _mongocrypt_buffer_t *a,
+                          const _mongocrypt_buffer_t *b)
+{
+   if (a->len != b->len) {
+      return false;
+   }
+   return 0 == _mongocrypt_memequal (a->data, b->data, a->len);
+}
+
+
 void
 _mongocrypt_buffer_cleanup (_mongocrypt_buffer_t *buf)
 {
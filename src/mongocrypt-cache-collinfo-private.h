@@ -16,9 +16,46 @@
 #ifndef MONGOCRYPT_CACHE_COLLINFO_PRIVATE_H
 #define MONGOCRYPT_CACHE_COLLINFO_PRIVATE_H
 
+#include "mongocrypt-buffer-private.h"
 #include "mongocrypt-cache-private.h"
 
+/* A listCollections result, parsed once when it is fed so contexts that hit
+ * the cache need neither walk the validator nor copy the schema. Immutable
+ * once created, and shared by reference count like key cache values. */
+typedef struct {
+   /* The $jsonSchema of the validator. Empty if there is none. */
+   _mongocrypt_buffer_t schema;
+   /* True if the validator has fields besides $jsonSchema. */
+   bool has_siblings;
+   bool is_view;
+   /* False once mongocryptd reported that the schema requires no encryption.
+    */
+   bool requires_encryption;
+   volatile int32_t refcount;
+} _mongocrypt_cache_collinfo_value_t;
+
 void
 _mongocrypt_cache_collinfo_init (_mongocrypt_cache_t *cache);
 
+/* Parses a listCollections result. A NULL @collinfo is a collection that does
+ * not exist. Returns NULL and sets @status on error. */
+_mongocrypt_cache_collinfo_value_t *
+_mongocrypt_cache_collinfo_value_new (const bson_t *collinfo,
+                                      mongocrypt_status_t *status);
+
+/* Returns a new value with the schema of @collinfo, which may be NULL, marked
+ * as not requiring encryption. */
+_mongocrypt_cache_collinfo_value_t *
+_mongocrypt_cache_collinfo_value_no_encryption (
+   const _mongocrypt_cache_collinfo_value_t *collinfo);
+
+/* Returns @value with another reference. */
+_mongocrypt_cache_collinfo_value_t *
+_mongocrypt_cache_collinfo_value_incref (
+   _mongocrypt_cache_collinfo_value_t *value);
+
+/* Releases a reference. */
+void
+_mongocrypt_cache_collinfo_value_destroy (void *value);
+
 #endif /* MONGOCRYPT_CACHE_COLLINFO_PRIVATE_H */
\ No newline at end of file
@@ -14,11 +14,13 @@
  * limitations under the License.
  */
 
-#include "mongocrypt-cache-private.h"
+#include "mongocrypt-cache-collinfo-private.h"
+#include "mongocrypt-private.h"
 /* The collinfo cache.
  *
  * Attribute is a null terminated namespace.
- * Value is a collection info doc (response to listCollections).
+ * Value is the collection info (response to listCollections), preprocessed
+ * into a _mongocrypt_cache_collinfo_value_t.
  */
 
 
@@ -30,6 +32,16 @@ _cmp_attr (void *a, void *b, int *out)
 }
 
 
+static uint32_t
+_hash_attr (void *ns, uint32_t *hashes, uint32_t max_hashes)
+{
+   if (max_hashes > 0) {
+      hashes[0] = _mongocrypt_cache_hash (ns, strlen ((char *) ns), 0);
+   }
+   return 1;
+}
+
+
 static void *
 _copy_attr (void *ns)
 {
@@ -45,28 +57,151 @@ _destroy_attr (void *ns)
 
 
 static void *
-_copy_value (void *bson)
+_copy_value (void *value)
 {
-   return bson_copy (bson);
+   return _mongocrypt_cache_collinfo_value_incref (
+      (_mongocrypt_cache_collinfo_value_t *) value);
 }
 
 
-static void
-_destroy_value (void *bson)
+static size_t
+_size_attr (void *ns)
+{
+   return strlen ((char *) ns) + 1;
+}
+
+
+static size_t
+_size_value (void *value)
+{
+   _mongocrypt_cache_collinfo_value_t *collinfo;
+
+   collinfo = (_mongocrypt_cache_collinfo_value_t *) value;
+   return sizeof (*collinfo) + collinfo->schema.len;
+}
+
+
+_mongocrypt_cache_collinfo_value_t *
+_mongocrypt_cache_collinfo_value_new (const bson_t *collinfo,
+                                      mongocrypt_status_t *status)
 {
-   bson_destroy (bson);
+   _mongocrypt_cache_collinfo_value_t *value;
+   bson_iter_t iter;
+   bool found_jsonschema = false;
+
+   value = bson_malloc0 (sizeof (*value));
+   BSON_ASSERT (value);
+   value->requires_encryption = true;
+   value->refcount = 1;
+
+   if (!collinfo) {
+      return value;
+   }
+
+   if (bson_iter_init_find (&iter, collinfo, "type") &&
+       BSON_ITER_HOLDS_UTF8 (&iter) && bson_iter_utf8 (&iter, NULL) &&
+       0 == strcmp ("view", bson_iter_utf8 (&iter, NULL))) {
+      value->is_view = true;
+      return value;
+   }
+
+   if (!bson_iter_init (&iter, collinfo)) {
+      CLIENT_ERR ("BSON malformed");
+      goto fail;
+   }
+
+   if (bson_iter_find_descendant (&iter, "options.validator", &iter) &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      if (!bson_iter_recurse (&iter, &iter)) {
+         CLIENT_ERR ("BSON malformed");
+         goto fail;
+      }
+      while (bson_iter_next (&iter)) {
+         const char *key;
+
+         key = bson_iter_key (&iter);
+         BSON_ASSERT (key);
+         if (0 == strcmp ("$jsonSchema", key)) {
+            if (found_jsonschema) {
+               CLIENT_ERR ("duplicate $jsonSchema fields found");
+               goto fail;
+            }
+            if (!_mongocrypt_buffer_copy_from_document_iter (&value->schema,
+                                                             &iter)) {
+               CLIENT_ERR ("malformed $jsonSchema");
+               goto fail;
+            }
+            found_jsonschema = true;
+         } else {
+            value->has_siblings = true;
+         }
+      }
+   }
+
+   return value;
+
+fail:
+   _mongocrypt_cache_collinfo_value_destroy (value);
+   return NULL;
+}
+
+
+_mongocrypt_cache_collinfo_value_t *
+_mongocrypt_cache_collinfo_value_no_encryption (
+   const _mongocrypt_cache_collinfo_value_t *collinfo)
+{
+   _mongocrypt_cache_collinfo_value_t *value;
+
+   value = _mongocrypt_cache_collinfo_value_new (NULL, NULL);
+   if (collinfo) {
+      _mongocrypt_buffer_copy_to (&collinfo->schema, &value->schema);
+      value->has_siblings = collinfo->has_siblings;
+      value->is_view = collinfo->is_view;
+   }
+   value->requires_encryption = false;
+   return value;
+}
+
+
+_mongocrypt_cache_collinfo_value_t *
+_mongocrypt_cache_collinfo_value_incref (
+   _mongocrypt_cache_collinfo_value_t *value)
+{
+   BSON_ASSERT (value);
+
+   _mongocrypt_atomic_int32_add (&value->refcount, 1);
+   return value;
+}
+
+
+void
+_mongocrypt_cache_collinfo_value_destroy (void *value)
+{
+   _mongocrypt_cache_collinfo_value_t *collinfo;
+
+   if (!value) {
+      return;
+   }
+
+   collinfo = (_mongocrypt_cache_collinfo_value_t *) value;
+   if (_mongocrypt_atomic_int32_add (&collinfo->refcount, -1) > 0) {
+      return;
+   }
+   _mongocrypt_buffer_cleanup (&collinfo->schema);
+   bson_free (collinfo);
 }
 
 
 void
 _mongocrypt_cache_collinfo_init (_mongocrypt_cache_t *cache)
 {
+   _mongocrypt_cache_init (cache);
    cache->cmp_attr = _cmp_attr;
+   cache->hash_attr = _hash_attr;
    cache->copy_attr = _copy_attr;
    cache->destroy_attr = _destroy_attr;
    cache->copy_value = _copy_value;
-   cache->destroy_value = _destroy_value;
-   _mongocrypt_mutex_init (&cache->mutex);
-   cache->pair = NULL;
-   cache->expiration = CACHE_EXPIRATION_MS;
+   cache->destroy_value = _mongocrypt_cache_collinfo_value_destroy;
+   cache->size_attr = _size_attr;
+   cache->size_value = _size_value;
 }
\ No newline at end of file
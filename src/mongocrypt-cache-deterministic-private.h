@@ -0,0 +1,103 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOCRYPT_CACHE_DETERMINISTIC_PRIVATE_H
+#define MONGOCRYPT_CACHE_DETERMINISTIC_PRIVATE_H
+
+#include "mongocrypt-buffer-private.h"
+#include "mongocrypt-cache-private.h"
+#include "mongocrypt-mutex-private.h"
+
+/* Number of bytes of the plaintext digest kept in each entry. The digest is
+ * the HMAC-SHA-512 computed for the deterministic IV, which is keyed with the
+ * IV key of the data key, so the cache never holds the plaintext. */
+#define MONGOCRYPT_DETERMINISTIC_DIGEST_LEN 32
+
+/* Initial size of the bucket table. It doubles whenever the entries outnumber
+ * the buckets, until it covers the maximum number of entries. */
+#define MONGOCRYPT_DETERMINISTIC_MIN_BUCKETS 16
+
+/* A bounded LRU cache of deterministic ciphertexts, keyed by the key id and
+ * a digest of the associated data and plaintext. A hit skips the AES and the
+ * tag HMAC. Disabled unless a maximum number of entries is set. */
+typedef struct __mongocrypt_cache_deterministic_entry_t {
+   _mongocrypt_buffer_t key_id;
+   uint8_t digest[MONGOCRYPT_DETERMINISTIC_DIGEST_LEN];
+   /* The ciphertext data: IV, encrypted plaintext, and tag. */
+   _mongocrypt_buffer_t ciphertext;
+   /* Next entry in the same bucket. */
+   struct __mongocrypt_cache_deterministic_entry_t *next;
+   /* Neighbors in recency order. */
+   struct __mongocrypt_cache_deterministic_entry_t *newer;
+   struct __mongocrypt_cache_deterministic_entry_t *older;
+} _mongocrypt_cache_deterministic_entry_t;
+
+typedef struct {
+   mongocrypt_mutex_t mutex;
+   uint32_t max_entries;
+   uint32_t num_entries;
+   /* Power of two. Grows with num_entries, up to max_entries rounded up. */
+   uint32_t num_buckets;
+   _mongocrypt_cache_deterministic_entry_t **buckets;
+   _mongocrypt_cache_deterministic_entry_t *newest;
+   _mongocrypt_cache_deterministic_entry_t *oldest;
+   uint64_t num_bytes;
+   uint64_t hits;
+   uint64_t misses;
+   uint64_t evictions;
+} _mongocrypt_cache_deterministic_t;
+
+
+void
+_mongocrypt_cache_deterministic_init (_mongocrypt_cache_deterministic_t *cache);
+
+/* Drops all entries, and resizes the cache to hold at most @max_entries.
+ * Zero disables the cache. */
+void
+_mongocrypt_cache_deterministic_set_max_entries (
+   _mongocrypt_cache_deterministic_t *cache, uint32_t max_entries);
+
+/* Copies the cached ciphertext data into @ciphertext and returns true on a hit.
+ * @digest has MONGOCRYPT_DETERMINISTIC_DIGEST_LEN bytes. */
+bool
+_mongocrypt_cache_deterministic_get (_mongocrypt_cache_deterministic_t *cache,
+                                     const _mongocrypt_buffer_t *key_id,
+                                     const uint8_t *digest,
+                                     _mongocrypt_buffer_t *ciphertext);
+
+/* Adds a copy of @ciphertext, evicting the least recently used entry if the
+ * cache is full. */
+void
+_mongocrypt_cache_deterministic_add (_mongocrypt_cache_deterministic_t *cache,
+                                     const _mongocrypt_buffer_t *key_id,
+                                     const uint8_t *digest,
+                                     const _mongocrypt_buffer_t *ciphertext);
+
+uint32_t
+_mongocrypt_cache_deterministic_num_entries (
+   _mongocrypt_cache_deterministic_t *cache);
+
+/* Entries never expire, so stats->expirations is always zero. */
+void
+_mongocrypt_cache_deterministic_stats (
+   _mongocrypt_cache_deterministic_t *cache, _mongocrypt_cache_stats_t *stats);
+
+/* Securely zeroes and frees all entries. */
+void
+_mongocrypt_cache_deterministic_cleanup (
+   _mongocrypt_cache_deterministic_t *cache);
+
+#endif /* MONGOCRYPT_CACHE_DETERMINISTIC_PRIVATE_H */
@@ -0,0 +1,326 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mongocrypt-cache-deterministic-private.h"
+
+#include "mongocrypt-crypto-private.h"
+#include "mongocrypt-private.h"
+
+
+void
+_mongocrypt_cache_deterministic_init (_mongocrypt_cache_deterministic_t *cache)
+{
+   BSON_ASSERT (cache);
+
+   memset (cache, 0, sizeof (*cache));
+   _mongocrypt_mutex_init (&cache->mutex);
+}
+
+
+static uint64_t
+_entry_size (_mongocrypt_cache_deterministic_entry_t *entry)
+{
+   return sizeof (*entry) + entry->key_id.len + entry->ciphertext.len;
+}
+
+
+static void
+_entry_destroy (_mongocrypt_cache_deterministic_entry_t *entry)
+{
+   _mongocrypt_buffer_cleanup (&entry->key_id);
+   if (entry->ciphertext.owned) {
+      bson_zero_free (entry->ciphertext.data, entry->ciphertext.len);
+   }
+   bson_zero_free (entry, sizeof (*entry));
+}
+
+
+/* The digest is an HMAC, so any four bytes of it are uniformly distributed. */
+static uint32_t
+_bucket (_mongocrypt_cache_deterministic_t *cache, const uint8_t *digest)
+{
+   uint32_t hash;
+
+   memcpy (&hash, digest, sizeof (hash));
+   return hash & (cache->num_buckets - 1);
+}
+
+
+/* Caller must hold lock. Allocates @num_buckets buckets and relinks every
+ * entry. The recency list holds every entry, so it doubles as the source for
+ * the rehash. */
+static void
+_rehash (_mongocrypt_cache_deterministic_t *cache, uint32_t num_buckets)
+{
+   _mongocrypt_cache_deterministic_entry_t *entry;
+   uint32_t bucket;
+
+   bson_free (cache->buckets);
+   cache->num_buckets = num_buckets;
+   cache->buckets = bson_malloc0 (num_buckets * sizeof (*cache->buckets));
+   BSON_ASSERT (cache->buckets);
+   for (entry = cache->oldest; entry; entry = entry->newer) {
+      bucket = _bucket (cache, entry->digest);
+      entry->next = cache->buckets[bucket];
+      cache->buckets[bucket] = entry;
+   }
+}
+
+
+/* Caller must hold lock. */
+static _mongocrypt_cache_deterministic_entry_t **
+_find (_mongocrypt_cache_deterministic_t *cache,
+       const _mongocrypt_buffer_t *key_id,
+       const uint8_t *digest)
+{
+   _mongocrypt_cache_deterministic_entry_t **link;
+
+   link = &cache->buckets[_bucket (cache, digest)];
+   while (*link) {
+      if (0 == _mongocrypt_memequal ((*link)->digest,
+                                     digest,
+                                     MONGOCRYPT_DETERMINISTIC_DIGEST_LEN) &&
+          _mongocrypt_buffer_equal (&(*link)->key_id, key_id)) {
+         return link;
+      }
+      link = &(*link)->next;
+   }
+   return link;
+}
+
+
+/* Caller must hold lock. */
+static void
+_lru_unlink (_mongocrypt_cache_deterministic_t *cache,
+             _mongocrypt_cache_deterministic_entry_t *entry)
+{
+   if (entry->newer) {
+      entry->newer->older = entry->older;
+   } else {
+      cache->newest = entry->older;
+   }
+   if (entry->older) {
+      entry->older->newer = entry->newer;
+   } else {
+      cache->oldest = entry->newer;
+   }
+   entry->newer = NULL;
+   entry->older = NULL;
+}
+
+
+/* Caller must hold lock. */
+static void
+_lru_push_newest (_mongocrypt_cache_deterministic_t *cache,
+                  _mongocrypt_cache_deterministic_entry_t *entry)
+{
+   entry->newer = NULL;
+   entry->older = cache->newest;
+   if (cache->newest) {
+      cache->newest->newer = entry;
+   } else {
+      cache->oldest = entry;
+   }
+   cache->newest = entry;
+}
+
+
+/* Caller must hold lock. */
+static void
+_clear (_mongocrypt_cache_deterministic_t *cache)
+{
+   _mongocrypt_cache_deterministic_entry_t *entry;
+   _mongocrypt_cache_deterministic_entry_t *tmp;
+
+   entry = cache->newest;
+   while (entry) {
+      tmp = entry->older;
+      _entry_destroy (entry);
+      entry = tmp;
+   }
+   bson_free (cache->buckets);
+   cache->buckets = NULL;
+   cache->num_buckets = 0;
+   cache->num_entries = 0;
+   cache->num_bytes = 0;
+   cache->newest = NULL;
+   cache->oldest = NULL;
+}
+
+
+void
+_mongocrypt_cache_deterministic_set_max_entries (
+   _mongocrypt_cache_deterministic_t *cache, uint32_t max_entries)
+{
+   BSON_ASSERT (cache);
+   BSON_ASSERT (max_entries <= (UINT32_MAX >> 1) + 1);
+
+   _mongocrypt_mutex_lock (&cache->mutex);
+   _clear (cache);
+   cache->max_entries = max_entries;
+   if (max_entries > 0) {
+      /* The table starts small and doubles as entries are added, so a large
+       * maximum costs nothing until the cache actually fills. */
+      _rehash (cache, MONGOCRYPT_DETERMINISTIC_MIN_BUCKETS);
+   }
+   _mongocrypt_mutex_unlock (&cache->mutex);
+}
+
+
+bool
+_mongocrypt_cache_deterministic_get (_mongocrypt_cache_deterministic_t *cache,
+                                     const _mongocrypt_buffer_t *key_id,
+                                     const uint8_t *digest,
+                                     _mongocrypt_buffer_t *ciphertext)
+{
+   _mongocrypt_cache_deterministic_entry_t *entry;
+   bool ret = false;
+
+   BSON_ASSERT (cache);
+   BSON_ASSERT (key_id);
+   BSON_ASSERT (digest);
+   BSON_ASSERT (ciphertext);
+
+   _mongocrypt_mutex_lock (&cache->mutex);
+   if (cache->max_entries == 0) {
+      goto done;
+   }
+
+   entry = *_find (cache, key_id, digest);
+   if (!entry) {
+      cache->misses++;
+      goto done;
+   }
+
+   cache->hits++;
+   _lru_unlink (cache, entry);
+   _lru_push_newest (cache, entry);
+   _mongocrypt_buffer_copy_to (&entry->ciphertext, ciphertext);
+   ret = true;
+
+done:
+   _mongocrypt_mutex_unlock (&cache->mutex);
+   return ret;
+}
+
+
+void
+_mongocrypt_cache_deterministic_add (_mongocrypt_cache_deterministic_t *cache,
+                                     const _mongocrypt_buffer_t *key_id,
+                                     const uint8_t *digest,
+                                     const _mongocrypt_buffer_t *ciphertext)
+{
+   _mongocrypt_cache_deterministic_entry_t **link;
+   _mongocrypt_cache_deterministic_entry_t *entry;
+
+   BSON_ASSERT (cache);
+   BSON_ASSERT (key_id);
+   BSON_ASSERT (digest);
+   BSON_ASSERT (ciphertext);
+
+   _mongocrypt_mutex_lock (&cache->mutex);
+   if (cache->max_entries == 0) {
+      goto done;
+   }
+
+   link = _find (cache, key_id, digest);
+   if (*link) {
+      /* Another context added the same value. Deterministic ciphertexts are
+       * identical, so only the recency changes. */
+      _lru_unlink (cache, *link);
+      _lru_push_newest (cache, *link);
+      goto done;
+   }
+
+   if (cache->num_entries == cache->max_entries) {
+      _mongocrypt_cache_deterministic_entry_t **evict;
+
+      entry = cache->oldest;
+      evict = _find (cache, &entry->key_id, entry->digest);
+      BSON_ASSERT (*evict == entry);
+      *evict = entry->next;
+      _lru_unlink (cache, entry);
+      cache->num_bytes -= _entry_size (entry);
+      _entry_destroy (entry);
+      cache->num_entries--;
+      cache->evictions++;
+      /* Unlinking from the bucket may have moved the end of the chain. */
+      link = _find (cache, key_id, digest);
+   }
+
+   entry = bson_malloc0 (sizeof (*entry));
+   BSON_ASSERT (entry);
+   _mongocrypt_buffer_copy_to (key_id, &entry->key_id);
+   memcpy (entry->digest, digest, MONGOCRYPT_DETERMINISTIC_DIGEST_LEN);
+   _mongocrypt_buffer_copy_to (ciphertext, &entry->ciphertext);
+   *link = entry;
+   _lru_push_newest (cache, entry);
+   cache->num_entries++;
+   cache->num_bytes += _entry_size (entry);
+   if (cache->num_entries > cache->num_buckets &&
+       cache->num_buckets < cache->max_entries) {
+      _rehash (cache, cache->num_buckets << 1);
+   }
+
+done:
+   _mongocrypt_mutex_unlock (&cache->mutex);
+}
+
+
+uint32_t
+_mongocrypt_cache_deterministic_num_entries (
+   _mongocrypt_cache_deterministic_t *cache)
+{
+   uint32_t ret;
+
+   BSON_ASSERT (cache);
+
+   _mongocrypt_mutex_lock (&cache->mutex);
+   ret = cache->num_entries;
+   _mongocrypt_mutex_unlock (&cache->mutex);
+   return ret;
+}
+
+
+void
+_mongocrypt_cache_deterministic_stats (
+   _mongocrypt_cache_deterministic_t *cache, _mongocrypt_cache_stats_t *stats)
+{
+   BSON_ASSERT (cache);
+   BSON_ASSERT (stats);
+
+   memset (stats, 0, sizeof (*stats));
+   _mongocrypt_mutex_lock (&cache->mutex);
+   stats->hits = cache->hits;
+   stats->misses = cache->misses;
+   stats->evictions = cache->evictions;
+   stats->entries = cache->num_entries;
+   stats->bytes = cache->num_bytes;
+   _mongocrypt_mutex_unlock (&cache->mutex);
+}
+
+
+void
+_mongocrypt_cache_deterministic_cleanup (
+   _mongocrypt_cache_deterministic_t *cache)
+{
+   if (!cache) {
+      return;
+   }
+
+   _clear (cache);
+   _mongocrypt_mutex_cleanup (&cache->mutex);
+}
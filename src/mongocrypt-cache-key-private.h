@@ -19,14 +19,19 @@
 
 #include "mongocrypt-buffer-private.h"
 #include "mongocrypt-cache-private.h"
+#include "mongocrypt-crypto-private.h"
 #include "mongocrypt-key-private.h"
 #include "mongocrypt-mutex-private.h"
 #include "mongocrypt-opts-private.h"
 #include "mongocrypt-status-private.h"
 
+/* Immutable once created, and shared by reference count: the cache and every
+ * key broker holding it from a cache hit each own a reference. The key material
+ * is zeroed when the last reference is released. */
 typedef struct {
    _mongocrypt_key_doc_t *key_doc;
    _mongocrypt_buffer_t decrypted_key_material;
+   volatile int32_t refcount;
 } _mongocrypt_cache_key_value_t;
 
 typedef struct {
@@ -45,11 +50,104 @@ _mongocrypt_cache_key_value_t *
 _mongocrypt_cache_key_value_new (_mongocrypt_key_doc_t *key_doc,
                                  _mongocrypt_buffer_t *decrypted_key_material);
 
+/* Returns @value with another reference. */
+_mongocrypt_cache_key_value_t *
+_mongocrypt_cache_key_value_incref (_mongocrypt_cache_key_value_t *value);
+
+/* Releases a reference. */
 void
 _mongocrypt_cache_key_value_destroy (void *value);
 
 void
 _mongocrypt_cache_key_attr_destroy (_mongocrypt_cache_key_attr_t *attr);
 
+/* Serializes the unexpired keys and their remaining TTLs, encrypted with @kek
+ * like key material under the local KMS provider. @out holds the ciphertext
+ * and must be cleaned up by the caller. */
+bool
+_mongocrypt_cache_key_export (_mongocrypt_cache_t *cache,
+                              _mongocrypt_crypto_t *crypto,
+                              const _mongocrypt_buffer_t *kek,
+                              _mongocrypt_buffer_t *out,
+                              mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Decrypts the output of _mongocrypt_cache_key_export and adds the keys that
+ * have not expired since. A key expires when it would have in the exporting
+ * cache, or after the TTL of @cache, whichever is sooner. */
+bool
+_mongocrypt_cache_key_import (_mongocrypt_cache_t *cache,
+                              _mongocrypt_crypto_t *crypto,
+                              const _mongocrypt_buffer_t *kek,
+                              const _mongocrypt_buffer_t *in,
+                              mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* A key being fetched from the key vault and KMS by one key broker. */
+typedef struct __mongocrypt_key_fetch_t {
+   _mongocrypt_cache_key_attr_t *attr;
+   const void *owner;
+   struct __mongocrypt_key_fetch_t *next;
+} _mongocrypt_key_fetch_t;
+
+/* The keys in flight across all contexts of one mongocrypt_t, so concurrent
+ * cache misses on the same key make one round trip instead of one each. Keys
+ * match like in the key cache: by id, or by any common keyAltName. */
+typedef struct {
+   mongocrypt_mutex_t mutex;
+   _mongocrypt_key_fetch_t *head;
+   /* Requests waiting to be fetched together, if key fetches are batched.
+    * Owners are unset. */
+   _mongocrypt_key_fetch_t *batch;
+   uint32_t batch_len;
+   int64_t batch_opened_ms;
+   /* Incremented each time a batch is taken. */
+   uint32_t batch_generation;
+} _mongocrypt_key_fetches_t;
+
+void
+_mongocrypt_key_fetches_init (_mongocrypt_key_fetches_t *fetches);
+
+/* Records that @owner is fetching the key matching @attr. Returns false,
+ * without recording anything, if a different owner is already fetching it. */
+bool
+_mongocrypt_key_fetches_claim (_mongocrypt_key_fetches_t *fetches,
+                               _mongocrypt_cache_key_attr_t *attr,
+                               const void *owner);
+
+/* Drops every claim of @owner. */
+void
+_mongocrypt_key_fetches_release (_mongocrypt_key_fetches_t *fetches,
+                                 const void *owner);
+
+/* Adds @attr to the open batch, unless it is already in it. Returns the
+ * generation of the batch. */
+uint32_t
+_mongocrypt_key_fetches_batch_add (_mongocrypt_key_fetches_t *fetches,
+                                   _mongocrypt_cache_key_attr_t *attr);
+
+/* Returns true if the batch of @generation is still open. Sets @due if it was
+ * opened at least @window_ms ago or holds at least @max_keys requests. */
+bool
+_mongocrypt_key_fetches_batch_open (_mongocrypt_key_fetches_t *fetches,
+                                    uint32_t generation,
+                                    uint64_t window_ms,
+                                    uint32_t max_keys,
+                                    bool *due);
+
+/* Closes the batch of @generation and sets @out to its requests. Returns
+ * false if that batch was already taken. Free @out with
+ * _mongocrypt_key_fetches_batch_destroy. */
+bool
+_mongocrypt_key_fetches_batch_take (_mongocrypt_key_fetches_t *fetches,
+                                    uint32_t generation,
+                                    _mongocrypt_key_fetch_t **out);
+
+void
+_mongocrypt_key_fetches_batch_destroy (_mongocrypt_key_fetch_t *batch);
+
+void
+_mongocrypt_key_fetches_cleanup (_mongocrypt_key_fetches_t *fetches);
+
 
 #endif /* MONGOCRYPT_CACHE_KEY_PRIVATE_H */
@@ -15,6 +15,7 @@
  */
 
 #include "mongocrypt-cache-key-private.h"
+#include "mongocrypt-private.h"
 /* The key cache.
  *
  * Attribute is a UUID in the form of a _mongocrypt_buffer_t.
@@ -34,7 +35,7 @@ _cmp_attr (void *a, void *b, int *out)
 
    if (!_mongocrypt_buffer_empty (&attr_a->id) &&
        !_mongocrypt_buffer_empty (&attr_b->id)) {
-      if (0 == _mongocrypt_buffer_cmp (&attr_a->id, &attr_b->id)) {
+      if (_mongocrypt_buffer_equal (&attr_a->id, &attr_b->id)) {
          *out = 0;
       }
    }
@@ -49,6 +50,34 @@ _cmp_attr (void *a, void *b, int *out)
 }
 
 
+/* Keys are found by id or by any key alt name. */
+static uint32_t
+_hash_attr (void *attr_in, uint32_t *hashes, uint32_t max_hashes)
+{
+   _mongocrypt_cache_key_attr_t *attr;
+   _mongocrypt_key_alt_name_t *altname;
+   const char *str;
+   uint32_t n = 0;
+
+   attr = (_mongocrypt_cache_key_attr_t *) attr_in;
+   if (!_mongocrypt_buffer_empty (&attr->id)) {
+      if (n < max_hashes) {
+         hashes[n] =
+            _mongocrypt_cache_hash (attr->id.data, attr->id.len, 'i');
+      }
+      n++;
+   }
+   for (altname = attr->alt_names; NULL != altname; altname = altname->next) {
+      if (n < max_hashes) {
+         str = _mongocrypt_key_alt_name_get_string (altname);
+         hashes[n] = _mongocrypt_cache_hash (str, strlen (str), 'n');
+      }
+      n++;
+   }
+   return n;
+}
+
+
 static void *
 _copy_attr (void *attr)
 {
@@ -67,16 +96,53 @@ _destroy_attr (void *attr)
 }
 
 
-static void *
-_copy_contents (void *value)
+static size_t
+_size_alt_names (_mongocrypt_key_alt_name_t *alt_names)
+{
+   _mongocrypt_key_alt_name_t *altname;
+   size_t size = 0;
+
+   for (altname = alt_names; NULL != altname; altname = altname->next) {
+      size += sizeof (*altname) +
+              strlen (_mongocrypt_key_alt_name_get_string (altname)) + 1;
+   }
+   return size;
+}
+
+
+static size_t
+_size_attr (void *attr_in)
+{
+   _mongocrypt_cache_key_attr_t *attr;
+
+   attr = (_mongocrypt_cache_key_attr_t *) attr_in;
+   return sizeof (*attr) + attr->id.len + _size_alt_names (attr->alt_names);
+}
+
+
+/* Counts the whole entry, though key brokers may share it. */
+static size_t
+_size_value (void *value)
 {
    _mongocrypt_cache_key_value_t *key_value;
+   _mongocrypt_key_doc_t *key_doc;
 
    key_value = (_mongocrypt_cache_key_value_t *) value;
-   return _mongocrypt_cache_key_value_new (key_value->key_doc,
-                                           &key_value->decrypted_key_material);
+   key_doc = key_value->key_doc;
+   return sizeof (*key_value) + key_value->decrypted_key_material.len +
+          sizeof (*key_doc) + key_doc->bson.len + key_doc->id.len +
+          key_doc->key_material.len + _size_alt_names (key_doc->key_alt_names);
+}
+
+
+/* A hit shares the entry instead of copying it. */
+static void *
+_copy_contents (void *value)
+{
+   return _mongocrypt_cache_key_value_incref (value);
 }
 
+
 static void
 _dump_attr (void *attr_in)
 {
@@ -111,11 +177,22 @@ _mongocrypt_cache_key_value_new (_mongocrypt_key_doc_t *key_doc,
 
    key_value->key_doc = _mongocrypt_key_new ();
    _mongocrypt_key_doc_copy_to (key_doc, key_value->key_doc);
+   key_value->refcount = 1;
 
    return key_value;
 }
 
 
+_mongocrypt_cache_key_value_t *
+_mongocrypt_cache_key_value_incref (_mongocrypt_cache_key_value_t *value)
+{
+   BSON_ASSERT (value);
+
+   _mongocrypt_atomic_int32_add (&value->refcount, 1);
+   return value;
+}
+
+
 void
 _mongocrypt_cache_key_value_destroy (void *value)
 {
@@ -125,23 +202,30 @@ _mongocrypt_cache_key_value_destroy (void *value)
       return;
    }
    key_value = (_mongocrypt_cache_key_value_t *) value;
+   if (_mongocrypt_atomic_int32_add (&key_value->refcount, -1) > 0) {
+      return;
+   }
    _mongocrypt_key_destroy (key_value->key_doc);
-   _mongocrypt_buffer_cleanup (&key_value->decrypted_key_material);
+   if (key_value->decrypted_key_material.owned) {
+      bson_zero_free (key_value->decrypted_key_material.data,
+                      key_value->decrypted_key_material.len);
+   }
    bson_free (key_value);
 }
 
 void
 _mongocrypt_cache_key_init (_mongocrypt_cache_t *cache)
 {
+   _mongocrypt_cache_init (cache);
    cache->cmp_attr = _cmp_attr;
+   cache->hash_attr = _hash_attr;
    cache->copy_attr = _copy_attr;
    cache->destroy_attr = _destroy_attr;
    cache->copy_value = _copy_contents;
    cache->destroy_value = _mongocrypt_cache_key_value_destroy;
+   cache->size_attr = _size_attr;
+   cache->size_value = _size_value;
    cache->dump_attr = _dump_attr;
-   _mongocrypt_mutex_init (&cache->mutex);
-   cache->pair = NULL;
-   cache->expiration = CACHE_EXPIRATION_MS;
 }
 
 /* Since key cache may be looked up by either _id or keyAltName,
@@ -176,3 +260,504 @@ _mongocrypt_cache_key_attr_destroy (_mongocrypt_cache_key_attr_t *attr)
    _mongocrypt_key_alt_name_destroy_all (attr->alt_names);
    bson_free (attr);
 }
+
+
+/* The version of the plaintext written by _mongocrypt_cache_key_export:
+ * { v: 1, keys: [ { keyDoc: <key document>, keyMaterial: <decrypted key
+ * material>, expiresAt: <milliseconds since the epoch> } ] }
+ * The expiration is wall clock time, since the monotonic clock of the
+ * exporting process means nothing to the importing one. */
+#define KEY_CACHE_EXPORT_VERSION 1
+
+typedef struct {
+   bson_t *keys;
+   uint32_t count;
+   int64_t now_ms;
+} _export_ctx_t;
+
+
+static bool
+_export_key (void *attr, void *value, uint64_t ttl_ms, void *ctx_in)
+{
+   _export_ctx_t *ctx;
+   _mongocrypt_cache_key_value_t *key_value;
+   bson_t entry;
+   char *idx;
+
+   (void) attr;
+   ctx = (_export_ctx_t *) ctx_in;
+   key_value = (_mongocrypt_cache_key_value_t *) value;
+
+   idx = bson_strdup_printf ("%" PRIu32, ctx->count++);
+   bson_append_document_begin (ctx->keys, idx, -1, &entry);
+   BSON_APPEND_DOCUMENT (&entry, "keyDoc", &key_value->key_doc->bson);
+   BSON_ASSERT (_mongocrypt_buffer_append (
+      &key_value->decrypted_key_material,
+      &entry,
+      MONGOCRYPT_STR_AND_LEN ("keyMaterial")));
+   BSON_APPEND_INT64 (&entry, "expiresAt", ctx->now_ms + (int64_t) ttl_ms);
+   bson_append_document_end (ctx->keys, &entry);
+   bson_free (idx);
+   return true;
+}
+
+
+bool
+_mongocrypt_cache_key_export (_mongocrypt_cache_t *cache,
+                              _mongocrypt_crypto_t *crypto,
+                              const _mongocrypt_buffer_t *kek,
+                              _mongocrypt_buffer_t *out,
+                              mongocrypt_status_t *status)
+{
+   _export_ctx_t ctx;
+   _mongocrypt_buffer_t plaintext;
+   _mongocrypt_buffer_t iv;
+   struct timeval tp;
+   uint32_t bytes_written;
+   bson_t doc;
+   bson_t keys;
+   bool ret = false;
+
+   BSON_ASSERT (cache);
+   BSON_ASSERT (crypto);
+   BSON_ASSERT (kek);
+   BSON_ASSERT (out);
+
+   _mongocrypt_buffer_init (&plaintext);
+   _mongocrypt_buffer_init (&iv);
+   _mongocrypt_buffer_init (out);
+
+   bson_gettimeofday (&tp);
+   ctx.now_ms = (int64_t) tp.tv_sec * 1000 + tp.tv_usec / 1000;
+   ctx.count = 0;
+   ctx.keys = &keys;
+
+   bson_init (&doc);
+   BSON_APPEND_INT32 (&doc, "v", KEY_CACHE_EXPORT_VERSION);
+   bson_append_array_begin (&doc, "keys", -1, &keys);
+   _mongocrypt_cache_visit (cache, _export_key, &ctx);
+   bson_append_array_end (&doc, &keys);
+   _mongocrypt_buffer_steal_from_bson (&plaintext, &doc);
+
+   if (!_mongocrypt_random_iv (crypto, &iv, status)) {
+      goto done;
+   }
+
+   out->len = _mongocrypt_calculate_ciphertext_len (plaintext.len);
+   out->data = bson_malloc (out->len);
+   BSON_ASSERT (out->data);
+   out->owned = true;
+   if (!_mongocrypt_do_encryption (crypto,
+                                   &iv,
+                                   NULL /* associated data. */,
+                                   kek,
+                                   &plaintext,
+                                   out,
+                                   &bytes_written,
+                                   status)) {
+      goto done;
+   }
+   out->len = bytes_written;
+   ret = true;
+
+done:
+   if (!ret) {
+      _mongocrypt_buffer_cleanup (out);
+   }
+   bson_zero_free (plaintext.data, plaintext.len);
+   _mongocrypt_buffer_cleanup (&iv);
+   return ret;
+}
+
+
+typedef struct {
+   _mongocrypt_key_doc_t *key_doc;
+   _mongocrypt_buffer_t key_material;
+   int64_t expires_at;
+} _import_entry_t;
+
+
+static int
+_cmp_expires_at (const void *a, const void *b)
+{
+   const _import_entry_t *entry_a = (const _import_entry_t *) a;
+   const _import_entry_t *entry_b = (const _import_entry_t *) b;
+
+   if (entry_a->expires_at < entry_b->expires_at) {
+      return -1;
+   }
+   return entry_a->expires_at > entry_b->expires_at ? 1 : 0;
+}
+
+
+/* @iter is iterated to an element of the exported keys array. */
+static bool
+_parse_import_entry (bson_iter_t *iter,
+                     _import_entry_t *out,
+                     mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t key_doc_buf;
+   bson_iter_t child;
+   bson_t key_doc;
+   bool has_key_doc = false;
+   bool has_expires_at = false;
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (iter) || !bson_iter_recurse (iter, &child)) {
+      CLIENT_ERR ("invalid key cache export, expected document");
+      return false;
+   }
+
+   while (bson_iter_next (&child)) {
+      const char *field = bson_iter_key (&child);
+
+      if (0 == strcmp ("keyDoc", field)) {
+         if (!_mongocrypt_buffer_from_document_iter (&key_doc_buf, &child) ||
+             !_mongocrypt_buffer_to_bson (&key_doc_buf, &key_doc)) {
+            CLIENT_ERR ("invalid key cache export, invalid 'keyDoc'");
+            return false;
+         }
+         out->key_doc = _mongocrypt_key_new ();
+         if (!_mongocrypt_key_parse_owned (&key_doc, out->key_doc, status)) {
+            return false;
+         }
+         has_key_doc = true;
+      } else if (0 == strcmp ("keyMaterial", field)) {
+         if (!_mongocrypt_buffer_copy_from_binary_iter (&out->key_material,
+                                                        &child)) {
+            CLIENT_ERR ("invalid key cache export, invalid 'keyMaterial'");
+            return false;
+         }
+      } else if (0 == strcmp ("expiresAt", field)) {
+         if (!BSON_ITER_HOLDS_INT64 (&child)) {
+            CLIENT_ERR ("invalid key cache export, invalid 'expiresAt'");
+            return false;
+         }
+         out->expires_at = bson_iter_int64 (&child);
+         has_expires_at = true;
+      }
+   }
+
+   if (!has_key_doc || !has_expires_at ||
+       out->key_material.len != MONGOCRYPT_KEY_LEN) {
+      CLIENT_ERR ("invalid key cache export, incomplete key");
+      return false;
+   }
+   return true;
+}
+
+
+bool
+_mongocrypt_cache_key_import (_mongocrypt_cache_t *cache,
+                              _mongocrypt_crypto_t *crypto,
+                              const _mongocrypt_buffer_t *kek,
+                              const _mongocrypt_buffer_t *in,
+                              mongocrypt_status_t *status)
+{
+   _mongocrypt_cache_key_attr_t *attr;
+   _mongocrypt_cache_key_value_t *value;
+   _import_entry_t *entries = NULL;
+   _mongocrypt_buffer_t plaintext;
+   struct timeval tp;
+   uint32_t num_entries = 0;
+   uint32_t max_entries = 0;
+   uint32_t bytes_written;
+   uint32_t i;
+   int64_t now_ms;
+   int64_t ttl_ms;
+   bson_iter_t iter;
+   bson_iter_t keys;
+   bson_t doc;
+   bool ret = false;
+
+   BSON_ASSERT (cache);
+   BSON_ASSERT (crypto);
+   BSON_ASSERT (kek);
+   BSON_ASSERT (in);
+
+   _mongocrypt_buffer_init (&plaintext);
+
+   if (in->len < MONGOCRYPT_IV_LEN + MONGOCRYPT_BLOCK_SIZE +
+                    MONGOCRYPT_HMAC_LEN) {
+      CLIENT_ERR ("invalid key cache export, too short");
+      goto done;
+   }
+
+   plaintext.len = _mongocrypt_calculate_plaintext_len (in->len);
+   plaintext.data = bson_malloc (plaintext.len);
+   BSON_ASSERT (plaintext.data);
+   plaintext.owned = true;
+   if (!_mongocrypt_do_decryption (crypto,
+                                   NULL /* associated data. */,
+                                   kek,
+                                   in,
+                                   &plaintext,
+                                   &bytes_written,
+                                   status)) {
+      goto done;
+   }
+
+   if (!bson_init_static (&doc, plaintext.data, bytes_written) ||
+       !bson_iter_init_find (&iter, &doc, "v") ||
+       !BSON_ITER_HOLDS_INT32 (&iter) ||
+       bson_iter_int32 (&iter) != KEY_CACHE_EXPORT_VERSION) {
+      CLIENT_ERR ("invalid key cache export, unsupported version");
+      goto done;
+   }
+   if (!bson_iter_init_find (&iter, &doc, "keys") ||
+       !BSON_ITER_HOLDS_ARRAY (&iter) || !bson_iter_recurse (&iter, &keys)) {
+      CLIENT_ERR ("invalid key cache export, expected 'keys' array");
+      goto done;
+   }
+
+   bson_gettimeofday (&tp);
+   now_ms = (int64_t) tp.tv_sec * 1000 + tp.tv_usec / 1000;
+   while (bson_iter_next (&keys)) {
+      if (num_entries == max_entries) {
+         max_entries = max_entries ? max_entries * 2 : 8;
+         entries = bson_realloc (entries, max_entries * sizeof (*entries));
+      }
+      memset (&entries[num_entries], 0, sizeof (*entries));
+      num_entries++;
+      if (!_parse_import_entry (&keys, &entries[num_entries - 1], status)) {
+         goto done;
+      }
+   }
+
+   /* Add the keys closest to expiring first, since the cache orders pairs by
+    * age. */
+   if (num_entries > 0) {
+      qsort (entries, num_entries, sizeof (*entries), _cmp_expires_at);
+   }
+   for (i = 0; i < num_entries; i++) {
+      ttl_ms = entries[i].expires_at - now_ms;
+      if (ttl_ms <= 0) {
+         continue;
+      }
+      if ((uint64_t) ttl_ms > cache->expiration) {
+         ttl_ms = (int64_t) cache->expiration;
+      }
+
+      attr = _mongocrypt_cache_key_attr_new (&entries[i].key_doc->id,
+                                             entries[i].key_doc->key_alt_names);
+      value = _mongocrypt_cache_key_value_new (entries[i].key_doc,
+                                               &entries[i].key_material);
+      if (!_mongocrypt_cache_add_stolen_aged (
+             cache,
+             attr,
+             value,
+             (int64_t) cache->expiration - ttl_ms,
+             status)) {
+         _mongocrypt_cache_key_attr_destroy (attr);
+         goto done;
+      }
+      _mongocrypt_cache_key_attr_destroy (attr);
+   }
+   ret = true;
+
+done:
+   for (i = 0; i < num_entries; i++) {
+      _mongocrypt_key_destroy (entries[i].key_doc);
+      if (entries[i].key_material.owned) {
+         bson_zero_free (entries[i].key_material.data,
+                         entries[i].key_material.len);
+      }
+   }
+   bson_free (entries);
+   if (plaintext.data) {
+      bson_zero_free (plaintext.data, plaintext.len);
+   }
+   return ret;
+}
+
+
+void
+_mongocrypt_key_fetches_init (_mongocrypt_key_fetches_t *fetches)
+{
+   BSON_ASSERT (fetches);
+
+   memset (fetches, 0, sizeof (*fetches));
+   _mongocrypt_mutex_init (&fetches->mutex);
+}
+
+
+bool
+_mongocrypt_key_fetches_claim (_mongocrypt_key_fetches_t *fetches,
+                               _mongocrypt_cache_key_attr_t *attr,
+                               const void *owner)
+{
+   _mongocrypt_key_fetch_t *fetch;
+   bool ret = false;
+   int cmp;
+
+   BSON_ASSERT (fetches);
+   BSON_ASSERT (attr);
+   BSON_ASSERT (owner);
+
+   _mongocrypt_mutex_lock (&fetches->mutex);
+   for (fetch = fetches->head; NULL != fetch; fetch = fetch->next) {
+      BSON_ASSERT (_cmp_attr (fetch->attr, attr, &cmp));
+      if (0 == cmp && fetch->owner != owner) {
+         goto done;
+      }
+   }
+
+   fetch = bson_malloc0 (sizeof (*fetch));
+   BSON_ASSERT (fetch);
+   fetch->attr = _copy_attr (attr);
+   fetch->owner = owner;
+   fetch->next = fetches->head;
+   fetches->head = fetch;
+   ret = true;
+
+done:
+   _mongocrypt_mutex_unlock (&fetches->mutex);
+   return ret;
+}
+
+
+void
+_mongocrypt_key_fetches_release (_mongocrypt_key_fetches_t *fetches,
+                                 const void *owner)
+{
+   _mongocrypt_key_fetch_t **link;
+   _mongocrypt_key_fetch_t *fetch;
+
+   BSON_ASSERT (fetches);
+
+   _mongocrypt_mutex_lock (&fetches->mutex);
+   link = &fetches->head;
+   while (*link) {
+      fetch = *link;
+      if (fetch->owner == owner) {
+         *link = fetch->next;
+         _mongocrypt_cache_key_attr_destroy (fetch->attr);
+         bson_free (fetch);
+      } else {
+         link = &fetch->next;
+      }
+   }
+   _mongocrypt_mutex_unlock (&fetches->mutex);
+}
+
+
+uint32_t
+_mongocrypt_key_fetches_batch_add (_mongocrypt_key_fetches_t *fetches,
+                                   _mongocrypt_cache_key_attr_t *attr)
+{
+   _mongocrypt_key_fetch_t **link;
+   uint32_t generation;
+   int cmp;
+
+   BSON_ASSERT (fetches);
+   BSON_ASSERT (attr);
+
+   _mongocrypt_mutex_lock (&fetches->mutex);
+   if (!fetches->batch) {
+      fetches->batch_opened_ms = bson_get_monotonic_time () / 1000;
+   }
+   /* Append, so the batch is in request order. */
+   for (link = &fetches->batch; *link; link = &(*link)->next) {
+      BSON_ASSERT (_cmp_attr ((*link)->attr, attr, &cmp));
+      if (0 == cmp) {
+         goto done;
+      }
+   }
+   *link = bson_malloc0 (sizeof (**link));
+   BSON_ASSERT (*link);
+   (*link)->attr = _copy_attr (attr);
+   fetches->batch_len++;
+
+done:
+   generation = fetches->batch_generation;
+   _mongocrypt_mutex_unlock (&fetches->mutex);
+   return generation;
+}
+
+
+bool
+_mongocrypt_key_fetches_batch_open (_mongocrypt_key_fetches_t *fetches,
+                                    uint32_t generation,
+                                    uint64_t window_ms,
+                                    uint32_t max_keys,
+                                    bool *due)
+{
+   int64_t elapsed_ms;
+   bool ret = false;
+
+   BSON_ASSERT (fetches);
+   BSON_ASSERT (due);
+
+   *due = false;
+   _mongocrypt_mutex_lock (&fetches->mutex);
+   if (generation != fetches->batch_generation || !fetches->batch) {
+      goto done;
+   }
+   elapsed_ms = bson_get_monotonic_time () / 1000 - fetches->batch_opened_ms;
+   *due = fetches->batch_len >= max_keys || (uint64_t) elapsed_ms >= window_ms;
+   ret = true;
+
+done:
+   _mongocrypt_mutex_unlock (&fetches->mutex);
+   return ret;
+}
+
+
+bool
+_mongocrypt_key_fetches_batch_take (_mongocrypt_key_fetches_t *fetches,
+                                    uint32_t generation,
+                                    _mongocrypt_key_fetch_t **out)
+{
+   bool ret = false;
+
+   BSON_ASSERT (fetches);
+   BSON_ASSERT (out);
+
+   *out = NULL;
+   _mongocrypt_mutex_lock (&fetches->mutex);
+   if (generation != fetches->batch_generation || !fetches->batch) {
+      goto done;
+   }
+   *out = fetches->batch;
+   fetches->batch = NULL;
+   fetches->batch_len = 0;
+   fetches->batch_generation++;
+   ret = true;
+
+done:
+   _mongocrypt_mutex_unlock (&fetches->mutex);
+   return ret;
+}
+
+
+void
+_mongocrypt_key_fetches_batch_destroy (_mongocrypt_key_fetch_t *batch)
+{
+   _mongocrypt_key_fetch_t *tmp;
+
+   while (batch) {
+      tmp = batch->next;
+      _mongocrypt_cache_key_attr_destroy (batch->attr);
+      bson_free (batch);
+      batch = tmp;
+   }
+}
+
+
+void
+_mongocrypt_key_fetches_cleanup (_mongocrypt_key_fetches_t *fetches)
+{
+   _mongocrypt_key_fetch_t *fetch;
+   _mongocrypt_key_fetch_t *tmp;
+
+   if (!fetches) {
+      return;
+   }
+
+   for (fetch = fetches->head; NULL != fetch; fetch = tmp) {
+      tmp = fetch->next;
+      _mongocrypt_cache_key_attr_destroy (fetch->attr);
+      bson_free (fetch);
+   }
+   _mongocrypt_key_fetches_batch_destroy (fetches->batch);
+   _mongocrypt_mutex_cleanup (&fetches->mutex);
+}
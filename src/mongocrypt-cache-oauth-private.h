@@ -17,13 +17,33 @@
 #ifndef MONGOCRYPT_CACHE_OAUTH_PRIVATE_H
 #define MONGOCRYPT_CACHE_OAUTH_PRIVATE_H
 
+#include "mongocrypt-endpoint-private.h"
+#include "mongocrypt-kek-private.h"
 #include "mongocrypt-mutex-private.h"
+#include "mongocrypt-opts-private.h"
 #include "mongocrypt-status-private.h"
 
-typedef struct {
-   bson_t *entry;
+/* An OAuth access token, for one identity and scope. */
+typedef struct __mongocrypt_cache_oauth_entry_t {
+   char *cache_key;
    char *access_token;
    int64_t expiration_time_us;
+   /* After this time, the first lookup to ask is told to renew the token.
+    * Always before expiration_time_us. */
+   int64_t renewal_time_us;
+   /* Zero, or when a lookup was told to renew the token. The claim lapses
+    * after a quarter of the time between renewal and expiration, in case the
+    * renewal never completes. */
+   int64_t renewal_claimed_us;
+   struct __mongocrypt_cache_oauth_entry_t *next;
+} _mongocrypt_cache_oauth_entry_t;
+
+/* Access tokens for Azure and GCP, keyed by _mongocrypt_cache_oauth_key. */
+typedef struct {
+   _mongocrypt_cache_oauth_entry_t *entries;
+   /* The percent of a token's lifetime after which it is renewed. Zero
+    * disables renewal. */
+   uint32_t renewal_percent;
    mongocrypt_mutex_t mutex; /* global lock of cache. */
 } _mongocrypt_cache_oauth_t;
 
@@ -33,14 +53,38 @@ _mongocrypt_cache_oauth_new (void);
 void
 _mongocrypt_cache_oauth_destroy (_mongocrypt_cache_oauth_t *cache);
 
+/* Returns the cache key of the token used for @provider, which is
+ * MONGOCRYPT_KMS_PROVIDER_AZURE or MONGOCRYPT_KMS_PROVIDER_GCP. It identifies
+ * the credentials in @opts, the identity endpoint, and the scope requested for
+ * @endpoint, which is the Azure key vault or GCP KMS endpoint and may be NULL.
+ */
+char *
+_mongocrypt_cache_oauth_key (_mongocrypt_kms_provider_t provider,
+                             const _mongocrypt_opts_t *opts,
+                             const _mongocrypt_endpoint_t *endpoint);
+
 bool
 _mongocrypt_cache_oauth_add (_mongocrypt_cache_oauth_t *cache,
+                             const char *cache_key,
                              bson_t *oauth_response,
                              mongocrypt_status_t *status);
 
 /* Returns a copy of the base64 encoded oauth token, or NULL if nothing is
- * cached. */
+ * cached. If @renewal_claim is not NULL, it is set to a nonzero claim for the
+ * first caller to get the token after it is due for renewal, and to zero
+ * otherwise. That caller should request a new token while still using this
+ * one. */
 char *
-_mongocrypt_cache_oauth_get (_mongocrypt_cache_oauth_t *cache);
+_mongocrypt_cache_oauth_get (_mongocrypt_cache_oauth_t *cache,
+                             const char *cache_key,
+                             int64_t *renewal_claim);
+
+/* Gives up a renewal claimed by _mongocrypt_cache_oauth_get, so that the next
+ * lookup renews the token instead of waiting for the claim to lapse. Does
+ * nothing if @renewal_claim is zero, or lapsed and was claimed again. */
+void
+_mongocrypt_cache_oauth_release_renewal (_mongocrypt_cache_oauth_t *cache,
+                                         const char *cache_key,
+                                         int64_t renewal_claim);
 
-#endif /* MONGOCRYPT_CACHE_OAUTH_PRIVATE_H */
\ No newline at end of file
+#endif /* MONGOCRYPT_CACHE_OAUTH_PRIVATE_H */
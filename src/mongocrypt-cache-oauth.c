@@ -24,6 +24,29 @@
  */
 #define MONGOCRYPT_OAUTH_CACHE_EVICTION_PERIOD_US 5000 * 1000
 
+static void
+_entry_destroy (_mongocrypt_cache_oauth_entry_t *entry)
+{
+   bson_free (entry->cache_key);
+   bson_free (entry->access_token);
+   bson_free (entry);
+}
+
+/* Caller must hold lock. Returns the link to the entry for @cache_key, or to
+ * the end of the list. */
+static _mongocrypt_cache_oauth_entry_t **
+_find (_mongocrypt_cache_oauth_t *cache, const char *cache_key)
+{
+   _mongocrypt_cache_oauth_entry_t **link;
+
+   for (link = &cache->entries; *link; link = &(*link)->next) {
+      if (0 == strcmp ((*link)->cache_key, cache_key)) {
+         break;
+      }
+   }
+   return link;
+}
+
 _mongocrypt_cache_oauth_t *
 _mongocrypt_cache_oauth_new (void)
 {
@@ -37,21 +60,65 @@ _mongocrypt_cache_oauth_new (void)
 void
 _mongocrypt_cache_oauth_destroy (_mongocrypt_cache_oauth_t *cache)
 {
+   _mongocrypt_cache_oauth_entry_t *entry;
+   _mongocrypt_cache_oauth_entry_t *tmp;
+
    _mongocrypt_mutex_cleanup (&cache->mutex);
-   bson_destroy (cache->entry);
-   bson_free (cache->access_token);
+   for (entry = cache->entries; entry; entry = tmp) {
+      tmp = entry->next;
+      _entry_destroy (entry);
+   }
    bson_free (cache);
 }
 
+char *
+_mongocrypt_cache_oauth_key (_mongocrypt_kms_provider_t provider,
+                             const _mongocrypt_opts_t *opts,
+                             const _mongocrypt_endpoint_t *endpoint)
+{
+   const _mongocrypt_endpoint_t *identity_endpoint;
+
+   BSON_ASSERT (opts);
+
+   /* Fields are separated by newlines, which none of them may contain. The
+    * defaults match those used by the KMS requests, so an endpoint set to the
+    * default shares the token. */
+   if (provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
+      identity_endpoint = opts->kms_provider_azure.identity_platform_endpoint;
+      return bson_strdup_printf (
+         "azure\n%s\n%s\n%s\n%s",
+         opts->kms_provider_azure.tenant_id,
+         opts->kms_provider_azure.client_id,
+         identity_endpoint ? identity_endpoint->host_and_port
+                           : "login.microsoftonline.com",
+         endpoint ? endpoint->domain : "vault.azure.net");
+   }
+
+   BSON_ASSERT (provider == MONGOCRYPT_KMS_PROVIDER_GCP);
+   identity_endpoint = opts->kms_provider_gcp.endpoint;
+   return bson_strdup_printf (
+      "gcp\n%s\n%s\n%s",
+      opts->kms_provider_gcp.email,
+      identity_endpoint ? identity_endpoint->host_and_port
+                        : "oauth2.googleapis.com",
+      endpoint ? endpoint->domain : "googleapis.com");
+}
+
 bool
 _mongocrypt_cache_oauth_add (_mongocrypt_cache_oauth_t *cache,
+                             const char *cache_key,
                              bson_t *oauth_response,
                              mongocrypt_status_t *status)
 {
    bson_iter_t iter;
+   int64_t expires_in_us;
    int64_t expiration_time_us;
    int64_t cache_time_us;
    const char *access_token;
+   _mongocrypt_cache_oauth_entry_t **link;
+   _mongocrypt_cache_oauth_entry_t *entry;
+
+   BSON_ASSERT (cache_key);
 
    if (!bson_iter_init_find (&iter, oauth_response, "expires_in") ||
        !BSON_ITER_HOLDS_INT (&iter)) {
@@ -59,9 +126,9 @@ _mongocrypt_cache_oauth_add (_mongocrypt_cache_oauth_t *cache,
       return false;
    }
    cache_time_us = bson_get_monotonic_time ();
-   expiration_time_us = (bson_iter_as_int64 (&iter) * 1000 * 1000) +
-                        cache_time_us -
-                        MONGOCRYPT_OAUTH_CACHE_EVICTION_PERIOD_US;
+   expires_in_us = bson_iter_as_int64 (&iter) * 1000 * 1000;
+   expiration_time_us =
+      expires_in_us + cache_time_us - MONGOCRYPT_OAUTH_CACHE_EVICTION_PERIOD_US;
 
    if (!bson_iter_init_find (&iter, oauth_response, "access_token") ||
        !BSON_ITER_HOLDS_UTF8 (&iter)) {
@@ -71,12 +138,27 @@ _mongocrypt_cache_oauth_add (_mongocrypt_cache_oauth_t *cache,
    access_token = bson_iter_utf8 (&iter, NULL);
 
    _mongocrypt_mutex_lock (&cache->mutex);
-   if (expiration_time_us > cache->expiration_time_us) {
-      bson_destroy (cache->entry);
-      cache->entry = bson_copy (oauth_response);
-      cache->expiration_time_us = expiration_time_us;
-      bson_free (cache->access_token);
-      cache->access_token = bson_strdup (access_token);
+   link = _find (cache, cache_key);
+   entry = *link;
+   if (!entry) {
+      entry = bson_malloc0 (sizeof (*entry));
+      BSON_ASSERT (entry);
+      entry->cache_key = bson_strdup (cache_key);
+      *link = entry;
+   }
+   if (expiration_time_us > entry->expiration_time_us) {
+      bson_free (entry->access_token);
+      entry->access_token = bson_strdup (access_token);
+      entry->expiration_time_us = expiration_time_us;
+      entry->renewal_time_us = INT64_MAX;
+      if (cache->renewal_percent > 0) {
+         /* A percent of the time the token stays cached, so the renewal is
+          * due before the token is evicted. */
+         entry->renewal_time_us =
+            cache_time_us + (expiration_time_us - cache_time_us) / 100 *
+                               cache->renewal_percent;
+      }
+      entry->renewal_claimed_us = 0;
    }
    _mongocrypt_mutex_unlock (&cache->mutex);
    return true;
@@ -85,25 +167,77 @@ _mongocrypt_cache_oauth_add (_mongocrypt_cache_oauth_t *cache,
 /* Returns a copy of the base64 encoded oauth token, or NULL if nothing is
  * cached. */
 char *
-_mongocrypt_cache_oauth_get (_mongocrypt_cache_oauth_t *cache)
+_mongocrypt_cache_oauth_get (_mongocrypt_cache_oauth_t *cache,
+                             const char *cache_key,
+                             int64_t *renewal_claim)
 {
+   _mongocrypt_cache_oauth_entry_t **link;
+   _mongocrypt_cache_oauth_entry_t *entry;
    char *access_token;
+   int64_t now_us;
+   int64_t lapse_us;
+
+   BSON_ASSERT (cache_key);
+
+   if (renewal_claim) {
+      *renewal_claim = 0;
+   }
 
    _mongocrypt_mutex_lock (&cache->mutex);
-   if (!cache->entry) {
+   link = _find (cache, cache_key);
+   entry = *link;
+   if (!entry) {
       _mongocrypt_mutex_unlock (&cache->mutex);
       return NULL;
    }
 
-   if (bson_get_monotonic_time () >= cache->expiration_time_us) {
-      bson_destroy (cache->entry);
-      cache->expiration_time_us = 0;
+   now_us = bson_get_monotonic_time ();
+   if (now_us >= entry->expiration_time_us) {
+      *link = entry->next;
+      _entry_destroy (entry);
       _mongocrypt_mutex_unlock (&cache->mutex);
       return NULL;
    }
 
-   access_token = bson_strdup (cache->access_token);
+   /* A lapse of at least 1us makes each claim distinct. */
+   lapse_us = (entry->expiration_time_us - entry->renewal_time_us) / 4;
+   if (lapse_us == 0) {
+      lapse_us = 1;
+   }
+   if (renewal_claim && now_us >= entry->renewal_time_us &&
+       (entry->renewal_claimed_us == 0 ||
+        now_us - entry->renewal_claimed_us >= lapse_us)) {
+      /* Only one caller renews at a time. If the renewal fails, the token is
+       * used until it expires. */
+      entry->renewal_claimed_us = now_us;
+      *renewal_claim = now_us;
+   }
+
+   access_token = bson_strdup (entry->access_token);
    _mongocrypt_mutex_unlock (&cache->mutex);
 
    return access_token;
-}
\ No newline at end of file
+}
+
+
+void
+_mongocrypt_cache_oauth_release_renewal (_mongocrypt_cache_oauth_t *cache,
+                                         const char *cache_key,
+                                         int64_t renewal_claim)
+{
+   _mongocrypt_cache_oauth_entry_t *entry;
+
+   BSON_ASSERT (cache_key);
+
+   if (renewal_claim == 0) {
+      return;
+   }
+
+   _mongocrypt_mutex_lock (&cache->mutex);
+   entry = *_find (cache, cache_key);
+   /* Leaves a lapsed claim that another lookup re-claimed. */
+   if (entry && entry->renewal_claimed_us == renewal_claim) {
+      entry->renewal_claimed_us = 0;
+   }
+   _mongocrypt_mutex_unlock (&cache->mutex);
+}
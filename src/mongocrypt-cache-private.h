@@ -26,33 +26,142 @@
  * To avoid overusing the names "key" or "id", the cache contains
  * "attribute-value" pairs.
  * https://en.wikipedia.org/wiki/Attribute%E2%80%93value_pair
+ *
+ * Pairs are indexed in an open addressing hash table, and kept in a list in
+ * order of insertion. Every pair shares the cache's expiration, so that is also
+ * the order they expire in, and eviction only visits expired pairs.
+ *
+ * A cache may also be bounded by a number of entries and a number of bytes.
+ * Lookups run under a shared lock and cannot reorder the list, so eviction
+ * approximates LRU with the second chance (CLOCK) algorithm: it passes over
+ * pairs used since it last considered them.
  */
 typedef bool (*cache_compare_fn) (void *thing_a, void *thing_b, int *out);
 typedef void (*cache_destroy_fn) (void *thing);
 typedef void *(*cache_copy_fn) (void *thing);
 typedef void (*cache_dump_fn) (void *thing);
+/* Approximate heap bytes used by an attribute or value. */
+typedef size_t (*cache_size_fn) (void *thing);
+/* Writes up to @max_hashes hashes of @attr to @hashes, and returns the number
+ * of hashes @attr has. Attributes that compare equal with cmp_attr must share
+ * at least one hash. An attribute may have several, e.g. a key is found by its
+ * id or by any of its key alt names. */
+typedef uint32_t (*cache_hash_fn) (void *attr,
+                                   uint32_t *hashes,
+                                   uint32_t max_hashes);
+
+/* Called for each live pair with the milliseconds it has left. Returns false
+ * to stop visiting. */
+typedef bool (*cache_visit_fn) (void *attr,
+                                void *value,
+                                uint64_t ttl_ms,
+                                void *ctx);
 
 typedef struct __mongocrypt_cache_pair_t {
    void *attr;
    void *value;
+   /* The next older pair. */
    struct __mongocrypt_cache_pair_t *next;
+   /* The next newer pair. */
+   struct __mongocrypt_cache_pair_t *prev;
    int64_t last_updated;
+   /* Orders pairs added within the same millisecond. */
+   uint64_t seq;
+   /* Zero, or the time in milliseconds a lookup in the refresh window claimed
+    * the refresh. The claim lapses after a quarter of the window, in case the
+    * claimant never re-adds the entry. */
+   volatile int64_t refresh_claimed_at;
+   /* Incremented by hits if the cache is bounded. */
+   volatile int32_t hits;
+   /* The value of hits when eviction last passed over this pair. */
+   int32_t hits_seen;
+   uint64_t size;
+   uint32_t *hashes;
+   uint32_t num_hashes;
 } _mongocrypt_cache_pair_t;
 
+/* Lookups take one of several reader-writer locks, picked by thread, so
+ * concurrent readers neither block each other nor contend on the cache line of
+ * a single lock. Writers take all of them. */
+#define CACHE_LOCK_SHARDS 16
+
+typedef union {
+   mongocrypt_rwlock_t lock;
+   uint8_t pad[128]; /* Keep each lock on its own cache lines. */
+} _mongocrypt_cache_lock_t;
+
+/* Lookup counts of the readers sharing a lock. Updated atomically. */
+typedef union {
+   struct {
+      volatile int64_t hits;
+      volatile int64_t misses;
+   } counts;
+   uint8_t pad[128];
+} _mongocrypt_cache_counters_t;
+
+typedef struct {
+   uint64_t hits;
+   uint64_t misses;
+   /* Pairs removed to stay within the limits. */
+   uint64_t evictions;
+   /* Pairs removed after expiring. */
+   uint64_t expirations;
+   uint64_t entries;
+   uint64_t bytes;
+} _mongocrypt_cache_stats_t;
+
+/* A pair is in one slot for each of its hashes. */
+typedef struct {
+   uint32_t hash;
+   _mongocrypt_cache_pair_t *pair; /* NULL if the slot is empty. */
+} _mongocrypt_cache_slot_t;
+
 typedef struct {
    cache_dump_fn dump_attr;
    cache_compare_fn cmp_attr;
+   cache_hash_fn hash_attr;
    cache_copy_fn copy_attr;
    cache_destroy_fn destroy_attr;
    cache_copy_fn copy_value;
    cache_destroy_fn destroy_value;
-   _mongocrypt_cache_pair_t *pair;
-   mongocrypt_mutex_t mutex; /* global lock of cache. */
+   cache_size_fn size_attr;  /* may be NULL */
+   cache_size_fn size_value; /* may be NULL */
+   _mongocrypt_cache_pair_t *pair; /* the newest pair. */
+   _mongocrypt_cache_pair_t *oldest;
+   _mongocrypt_cache_slot_t *slots;
+   uint32_t num_slots; /* zero or a power of two. */
+   uint32_t num_used_slots;
+   uint32_t num_entries;
+   uint64_t next_seq;
+   _mongocrypt_cache_lock_t locks[CACHE_LOCK_SHARDS];
+   _mongocrypt_cache_counters_t counters[CACHE_LOCK_SHARDS];
+   /* Zero for no limit. */
+   uint32_t max_entries;
+   uint64_t max_bytes;
+   uint64_t num_bytes;
+   uint64_t evictions;
+   uint64_t expirations;
    uint64_t expiration;
+   /* Zero, or less than expiration. See _mongocrypt_cache_get. */
+   uint64_t refresh_window;
 } _mongocrypt_cache_t;
 
 
-/* Attempt to get an entry.
+/* Initializes the locks and expiration. The caller sets the callbacks. */
+void
+_mongocrypt_cache_init (_mongocrypt_cache_t *cache);
+
+
+/* FNV-1a, for implementing cache_hash_fn. */
+uint32_t
+_mongocrypt_cache_hash (const void *data, size_t len, uint32_t seed);
+
+
+/* Attempt to get an entry. *value is set with copy_value, which may return a
+ * new reference to a shared value rather than a copy.
+ * If the entry is within the refresh window of expiring, the first lookup to
+ * see it gets a miss, so that caller fetches and re-adds it. Other lookups
+ * keep getting the entry until it expires, or until the claim lapses.
  * Returns boolean indicating success.
  */
 bool
@@ -60,6 +169,27 @@ _mongocrypt_cache_get (_mongocrypt_cache_t *cache,
                        void *attr,
                        void **value) MONGOCRYPT_WARN_UNUSED_RESULT;
 
+
+/* Like _mongocrypt_cache_get. If the lookup missed because it claimed a
+ * refresh, *refresh_claim is set to a nonzero token for
+ * _mongocrypt_cache_release_refresh. Otherwise it is set to zero. */
+bool
+_mongocrypt_cache_get_claim (_mongocrypt_cache_t *cache,
+                             void *attr,
+                             void **value,
+                             int64_t *refresh_claim)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+
+/* Gives up a refresh claimed by _mongocrypt_cache_get_claim, so that the next
+ * lookup claims it instead of waiting for the claim to lapse. Does nothing if
+ * the entry has since been re-added or re-claimed. */
+bool
+_mongocrypt_cache_release_refresh (_mongocrypt_cache_t *cache,
+                                   void *attr,
+                                   int64_t refresh_claim)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
 bool
 _mongocrypt_cache_add_copy (_mongocrypt_cache_t *cache,
                             void *attr,
@@ -78,6 +208,26 @@ _mongocrypt_cache_add_stolen (_mongocrypt_cache_t *cache,
    MONGOCRYPT_WARN_UNUSED_RESULT;
 
 
+/* Like _mongocrypt_cache_add_stolen, but the pair expires @age_ms sooner, e.g.
+ * to restore a pair with its remaining lifetime. Add pairs oldest first: a pair
+ * is never made older than the pairs already in the cache. */
+bool
+_mongocrypt_cache_add_stolen_aged (_mongocrypt_cache_t *cache,
+                                   void *attr,
+                                   void *value,
+                                   int64_t age_ms,
+                                   mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+
+/* Calls @fn on each pair that has not expired, oldest first, under a shared
+ * lock. @fn must not use the cache. */
+void
+_mongocrypt_cache_visit (_mongocrypt_cache_t *cache,
+                         cache_visit_fn fn,
+                         void *ctx);
+
+
 void
 _mongocrypt_cache_cleanup (_mongocrypt_cache_t *cache);
 
@@ -89,8 +239,23 @@ _mongocrypt_cache_dump (_mongocrypt_cache_t *cache);
 void
 _mongocrypt_cache_set_expiration (_mongocrypt_cache_t *cache, uint64_t milli);
 
+void
+_mongocrypt_cache_set_refresh_window (_mongocrypt_cache_t *cache,
+                                      uint64_t milli);
+
 uint32_t
 _mongocrypt_cache_num_entries (_mongocrypt_cache_t *cache);
 
+/* Bounds the number of entries and bytes, evicting pairs if the cache is over
+ * the new limits. Zero means no limit. */
+void
+_mongocrypt_cache_set_limits (_mongocrypt_cache_t *cache,
+                              uint32_t max_entries,
+                              uint64_t max_bytes);
+
+void
+_mongocrypt_cache_stats (_mongocrypt_cache_t *cache,
+                         _mongocrypt_cache_stats_t *stats);
+
 
 #endif /* MONGOCRYPT_CACHE_PRIVATE */
\ No newline at end of file
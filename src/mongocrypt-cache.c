@@ -19,147 +19,467 @@
 #include "mongocrypt-private.h"
 
 
-/* Did the cache pair expire? Caller must hold lock. */
-static bool
-_pair_expired (_mongocrypt_cache_t *cache, _mongocrypt_cache_pair_t *pair)
+#define CACHE_MIN_SLOTS 16
+/* Attributes rarely have more hashes than this, e.g. a key with many key alt
+ * names. */
+#define CACHE_INLINE_HASHES 8
+
+
+void
+_mongocrypt_cache_init (_mongocrypt_cache_t *cache)
 {
-   int64_t current;
+   int i;
 
-   current = bson_get_monotonic_time () / 1000;
-   return (current - pair->last_updated) > (int64_t) cache->expiration;
+   memset (cache, 0, sizeof (*cache));
+   for (i = 0; i < CACHE_LOCK_SHARDS; i++) {
+      _mongocrypt_rwlock_init (&cache->locks[i].lock);
+   }
+   cache->expiration = CACHE_EXPIRATION_MS;
 }
 
 
-/* Return the pair after the one being destroyed. */
-static _mongocrypt_cache_pair_t *
-_destroy_pair (_mongocrypt_cache_t *cache,
-               _mongocrypt_cache_pair_t *prev,
-               _mongocrypt_cache_pair_t *pair)
+/* Picks the lock for the calling thread. Threads run on separate stacks, so
+ * the address of a local spreads threads over the shards. Any choice is
+ * correct, since writers take every lock. */
+static _mongocrypt_cache_lock_t *
+_read_lock (_mongocrypt_cache_t *cache)
 {
-   _mongocrypt_cache_pair_t *tmp;
-   tmp = pair->next;
+   _mongocrypt_cache_lock_t *lock;
+   int local;
+   uint32_t shard;
+
+   shard = (uint32_t) ((uintptr_t) &local >> 16) * 2654435761u;
+   lock = &cache->locks[(shard >> 24) % CACHE_LOCK_SHARDS];
+   _mongocrypt_rwlock_rdlock (&lock->lock);
+   return lock;
+}
 
-   /* Unlink */
-   if (!prev) {
-      cache->pair = cache->pair->next;
-   } else {
-      prev->next = pair->next;
+
+static void
+_write_lock (_mongocrypt_cache_t *cache)
+{
+   int i;
+
+   for (i = 0; i < CACHE_LOCK_SHARDS; i++) {
+      _mongocrypt_rwlock_wrlock (&cache->locks[i].lock);
    }
+}
 
-   /* Destroy pair */
-   cache->destroy_attr (pair->attr);
-   cache->destroy_value (pair->value);
-   bson_free (pair);
 
-   return tmp;
+static void
+_write_unlock (_mongocrypt_cache_t *cache)
+{
+   int i;
+
+   for (i = CACHE_LOCK_SHARDS - 1; i >= 0; i--) {
+      _mongocrypt_rwlock_wrunlock (&cache->locks[i].lock);
+   }
 }
 
-/* Caller must hold mutex. */
-void
-_mongocrypt_cache_evict (_mongocrypt_cache_t *cache)
+
+uint32_t
+_mongocrypt_cache_hash (const void *data, size_t len, uint32_t seed)
 {
-   _mongocrypt_cache_pair_t *pair, *prev;
+   const uint8_t *p = data;
+   uint32_t hash = 2166136261u ^ seed;
 
-   prev = NULL;
-   pair = cache->pair;
-   while (pair) {
-      if (_pair_expired (cache, pair)) {
-         pair = _destroy_pair (cache, prev, pair);
-         continue;
-      }
-      prev = pair;
-      pair = pair->next;
+   for (; len > 0; len--) {
+      hash ^= *p++;
+      hash *= 16777619u;
    }
+   return hash;
 }
 
-/* Caller must hold mutex. */
-static bool
-_mongocrypt_remove_matches (_mongocrypt_cache_t *cache, void *attr)
+
+/* Computes the hashes of @attr. Returns @inline_hashes if they fit, otherwise
+ * an allocated array the caller frees. */
+static uint32_t *
+_hash_attr (_mongocrypt_cache_t *cache,
+            void *attr,
+            uint32_t *inline_hashes,
+            uint32_t *num_hashes)
 {
-   _mongocrypt_cache_pair_t *pair, *prev;
+   uint32_t *hashes;
 
-   prev = NULL;
-   pair = cache->pair;
-   while (pair) {
-      int res;
+   *num_hashes = cache->hash_attr (attr, inline_hashes, CACHE_INLINE_HASHES);
+   if (*num_hashes <= CACHE_INLINE_HASHES) {
+      return inline_hashes;
+   }
+   hashes = bson_malloc (*num_hashes * sizeof (uint32_t));
+   BSON_ASSERT (hashes);
+   BSON_ASSERT (cache->hash_attr (attr, hashes, *num_hashes) == *num_hashes);
+   return hashes;
+}
 
-      if (!cache->cmp_attr (pair->attr, attr, &res)) {
-         return false;
+
+/* Caller must hold the write lock. */
+static void
+_slot_insert (_mongocrypt_cache_t *cache,
+              uint32_t hash,
+              _mongocrypt_cache_pair_t *pair)
+{
+   uint32_t mask = cache->num_slots - 1;
+   uint32_t i;
+
+   for (i = hash & mask; cache->slots[i].pair; i = (i + 1) & mask)
+      ;
+   cache->slots[i].hash = hash;
+   cache->slots[i].pair = pair;
+   cache->num_used_slots++;
+}
+
+
+/* Removes the slot for @hash pointing to @pair. Later slots in the probe
+ * sequence are shifted back, so no tombstones are needed. Caller must hold the
+ * write lock. */
+static void
+_slot_remove (_mongocrypt_cache_t *cache,
+              uint32_t hash,
+              _mongocrypt_cache_pair_t *pair)
+{
+   uint32_t mask = cache->num_slots - 1;
+   uint32_t i, j, ideal;
+
+   for (i = hash & mask;; i = (i + 1) & mask) {
+      BSON_ASSERT (cache->slots[i].pair);
+      if (cache->slots[i].pair == pair && cache->slots[i].hash == hash) {
+         break;
       }
+   }
 
-      if (0 == res) {
-         pair = _destroy_pair (cache, prev, pair);
-         continue;
+   for (j = i;;) {
+      j = (j + 1) & mask;
+      if (!cache->slots[j].pair) {
+         break;
+      }
+      ideal = cache->slots[j].hash & mask;
+      /* Move slot j into the hole unless the hole is before its ideal slot. */
+      if (((j - ideal) & mask) >= ((j - i) & mask)) {
+         cache->slots[i] = cache->slots[j];
+         i = j;
       }
-      prev = pair;
-      pair = pair->next;
    }
+   cache->slots[i].pair = NULL;
+   cache->num_used_slots--;
+}
 
-   return true;
+
+/* Grows the table to keep it at most half full after adding @count slots.
+ * Caller must hold the write lock. */
+static void
+_reserve_slots (_mongocrypt_cache_t *cache, uint32_t count)
+{
+   _mongocrypt_cache_slot_t *old_slots;
+   uint32_t old_num_slots, num_slots, i;
+
+   num_slots = cache->num_slots ? cache->num_slots : CACHE_MIN_SLOTS;
+   while ((uint64_t) (cache->num_used_slots + count) * 2 > num_slots) {
+      BSON_ASSERT (num_slots <= UINT32_MAX / 2);
+      num_slots *= 2;
+   }
+   if (num_slots == cache->num_slots) {
+      return;
+   }
+
+   old_slots = cache->slots;
+   old_num_slots = cache->num_slots;
+   cache->slots = bson_malloc0 (num_slots * sizeof (_mongocrypt_cache_slot_t));
+   BSON_ASSERT (cache->slots);
+   cache->num_slots = num_slots;
+   cache->num_used_slots = 0;
+   for (i = 0; i < old_num_slots; i++) {
+      if (old_slots[i].pair) {
+         _slot_insert (cache, old_slots[i].hash, old_slots[i].pair);
+      }
+   }
+   bson_free (old_slots);
+}
+
+
+/* Did the cache pair expire? Caller must hold a lock. */
+static bool
+_pair_expired (_mongocrypt_cache_t *cache,
+               _mongocrypt_cache_pair_t *pair,
+               int64_t current)
+{
+   return (current - pair->last_updated) > (int64_t) cache->expiration;
+}
+
+
+/* Caller must hold the write lock. */
+static void
+_cache_pair_destroy (_mongocrypt_cache_t *cache, _mongocrypt_cache_pair_t *pair)
+{
+   cache->destroy_attr (pair->attr);
+   cache->destroy_value (pair->value);
+   bson_free (pair->hashes);
+   bson_free (pair);
 }
 
 
+/* Unlinks and destroys a pair. Caller must hold the write lock. */
+static void
+_destroy_pair (_mongocrypt_cache_t *cache, _mongocrypt_cache_pair_t *pair)
+{
+   uint32_t i;
+
+   for (i = 0; i < pair->num_hashes; i++) {
+      _slot_remove (cache, pair->hashes[i], pair);
+   }
+
+   if (pair->prev) {
+      pair->prev->next = pair->next;
+   } else {
+      cache->pair = pair->next;
+   }
+   if (pair->next) {
+      pair->next->prev = pair->prev;
+   } else {
+      cache->oldest = pair->prev;
+   }
+   cache->num_entries--;
+   cache->num_bytes -= pair->size;
+
+   _cache_pair_destroy (cache, pair);
+}
+
+/* Pairs are ordered oldest first from the tail, so this stops at the first
+ * pair that has not expired. Caller must hold the write lock. */
 void
-_mongocrypt_cache_set_expiration (_mongocrypt_cache_t *cache, uint64_t milli)
+_mongocrypt_cache_evict (_mongocrypt_cache_t *cache)
 {
-   cache->expiration = milli;
+   int64_t current;
+
+   current = bson_get_monotonic_time () / 1000;
+   while (cache->oldest && _pair_expired (cache, cache->oldest, current)) {
+      _destroy_pair (cache, cache->oldest);
+      cache->expirations++;
+   }
+}
+
+
+static bool
+_bounded (_mongocrypt_cache_t *cache)
+{
+   return cache->max_entries > 0 || cache->max_bytes > 0;
 }
 
 
-/* caller must hold lock. */
+static bool
+_over_limits (_mongocrypt_cache_t *cache)
+{
+   return (cache->max_entries > 0 && cache->num_entries > cache->max_entries) ||
+          (cache->max_bytes > 0 && cache->num_bytes > cache->max_bytes);
+}
+
+
+/* Evicts pairs until the cache is within its limits. Starting from the oldest,
+ * a pair hit since eviction last passed over it gets a second chance. If every
+ * pair was hit, the oldest is evicted. The newest pair, which was just added,
+ * is only evicted if it is the last one. Caller must hold the write lock. */
+static void
+_evict_over_limits (_mongocrypt_cache_t *cache)
+{
+   _mongocrypt_cache_pair_t *pair;
+   _mongocrypt_cache_pair_t *victim;
+
+   while (_over_limits (cache)) {
+      victim = cache->oldest;
+      for (pair = cache->oldest; pair != cache->pair; pair = pair->prev) {
+         if (pair->hits == pair->hits_seen) {
+            victim = pair;
+            break;
+         }
+         pair->hits_seen = pair->hits;
+      }
+      _destroy_pair (cache, victim);
+      cache->evictions++;
+   }
+}
+
+
+/* Finds the newest pair matching @attr, or sets @out to NULL. Caller must hold
+ * a lock. */
 static bool
 _find_pair (_mongocrypt_cache_t *cache,
             void *attr,
             _mongocrypt_cache_pair_t **out)
 {
+   uint32_t inline_hashes[CACHE_INLINE_HASHES];
+   uint32_t *hashes;
+   uint32_t num_hashes, mask, i, j;
    _mongocrypt_cache_pair_t *pair;
+   bool ret = true;
 
    *out = NULL;
+   if (cache->num_entries == 0) {
+      return true;
+   }
 
-   pair = cache->pair;
-   while (pair) {
-      int res;
-      /* TODO: this is a naive O(n) lookup. Consider optimizing
-         with a hash map (possibly vendor one). */
-      if (!cache->cmp_attr (pair->attr, attr, &res)) {
-         return false;
+   hashes = _hash_attr (cache, attr, inline_hashes, &num_hashes);
+   mask = cache->num_slots - 1;
+   for (i = 0; i < num_hashes; i++) {
+      for (j = hashes[i] & mask; cache->slots[j].pair; j = (j + 1) & mask) {
+         int res;
+
+         pair = cache->slots[j].pair;
+         if (cache->slots[j].hash != hashes[i] ||
+             (*out && (*out)->seq >= pair->seq)) {
+            continue;
+         }
+         if (!cache->cmp_attr (pair->attr, attr, &res)) {
+            ret = false;
+            *out = NULL;
+            goto done;
+         }
+         if (res == 0) {
+            *out = pair;
+         }
       }
+   }
 
-      if (res == 0) {
-         *out = pair;
-         return true;
-      }
-      pair = pair->next;
+done:
+   if (hashes != inline_hashes) {
+      bson_free (hashes);
    }
-   return true;
+   return ret;
 }
 
 
-/* Create a new pair on linked list. Caller must hold lock. */
+/* Create a new pair on linked list. Caller must hold the write lock. */
 static _mongocrypt_cache_pair_t *
 _pair_new (_mongocrypt_cache_t *cache, void *attr)
 {
    _mongocrypt_cache_pair_t *pair;
+   uint32_t inline_hashes[CACHE_INLINE_HASHES];
+   uint32_t *hashes;
+   uint32_t i;
 
    pair = bson_malloc0 (sizeof (_mongocrypt_cache_pair_t));
    BSON_ASSERT (pair);
 
    pair->attr = cache->copy_attr (attr);
+   hashes = _hash_attr (cache, pair->attr, inline_hashes, &pair->num_hashes);
+   if (hashes == inline_hashes && pair->num_hashes > 0) {
+      pair->hashes = bson_malloc (pair->num_hashes * sizeof (uint32_t));
+      BSON_ASSERT (pair->hashes);
+      memcpy (pair->hashes, hashes, pair->num_hashes * sizeof (uint32_t));
+   } else if (hashes != inline_hashes) {
+      pair->hashes = hashes;
+   }
+
+   _reserve_slots (cache, pair->num_hashes);
+   for (i = 0; i < pair->num_hashes; i++) {
+      _slot_insert (cache, pair->hashes[i], pair);
+   }
+
    /* add rest of values. */
    pair->next = cache->pair;
+   if (cache->pair) {
+      cache->pair->prev = pair;
+   } else {
+      cache->oldest = pair;
+   }
    pair->last_updated = bson_get_monotonic_time () / 1000;
+   pair->seq = cache->next_seq++;
    cache->pair = pair;
+   cache->num_entries++;
    return pair;
 }
 
 
-/* Caller must hold lock. */
-static void
-_cache_pair_destroy (_mongocrypt_cache_t *cache, _mongocrypt_cache_pair_t *pair)
+/* Caller must hold the write lock. */
+static bool
+_mongocrypt_remove_matches (_mongocrypt_cache_t *cache, void *attr)
 {
-   cache->destroy_attr (pair->attr);
-   cache->destroy_value (pair->value);
-   bson_free (pair);
+   _mongocrypt_cache_pair_t *match;
+
+   for (;;) {
+      if (!_find_pair (cache, attr, &match)) {
+         return false;
+      }
+      if (!match) {
+         return true;
+      }
+      _destroy_pair (cache, match);
+   }
+}
+
+
+void
+_mongocrypt_cache_set_expiration (_mongocrypt_cache_t *cache, uint64_t milli)
+{
+   cache->expiration = milli;
+}
+
+
+void
+_mongocrypt_cache_set_refresh_window (_mongocrypt_cache_t *cache,
+                                      uint64_t milli)
+{
+   cache->refresh_window = milli;
+}
+
+
+/* Is the pair due for a refresh, and is the caller the first to see it since
+ * the last claim lapsed? Called under a shared lock by concurrent readers, so
+ * the claim is atomic. */
+static bool
+_pair_claim_refresh (_mongocrypt_cache_t *cache,
+                     _mongocrypt_cache_pair_t *pair,
+                     int64_t current)
+{
+   int64_t claimed_at;
+   int64_t lapse;
+
+   if (cache->refresh_window == 0 ||
+       (current - pair->last_updated) <=
+          (int64_t) (cache->expiration - cache->refresh_window)) {
+      return false;
+   }
+
+   /* Leaves time for a few attempts before the entry expires. */
+   lapse = (int64_t) (cache->refresh_window / 4);
+   if (lapse == 0) {
+      lapse = 1;
+   }
+   claimed_at = _mongocrypt_atomic_int64_add (&pair->refresh_claimed_at, 0);
+   if (claimed_at != 0 && current - claimed_at < lapse) {
+      return false;
+   }
+   return _mongocrypt_atomic_int64_cas (
+      &pair->refresh_claimed_at, claimed_at, current);
+}
+
+
+/* Caller must hold a lock. Lookups are counted in @counters. */
+static bool
+_get (_mongocrypt_cache_t *cache,
+      void *attr,
+      void **value,
+      int64_t *refresh_claim,
+      int64_t current,
+      _mongocrypt_cache_counters_t *counters)
+{
+   _mongocrypt_cache_pair_t *match;
+
+   if (!_find_pair (cache, attr, &match)) {
+      return false;
+   }
+
+   if (match && _pair_claim_refresh (cache, match, current)) {
+      *refresh_claim = current;
+      _mongocrypt_atomic_int64_add (&counters->counts.misses, 1);
+   } else if (match) {
+      *value = cache->copy_value (match->value);
+      if (_bounded (cache)) {
+         _mongocrypt_atomic_int32_add (&match->hits, 1);
+      }
+      _mongocrypt_atomic_int64_add (&counters->counts.hits, 1);
+   } else {
+      _mongocrypt_atomic_int64_add (&counters->counts.misses, 1);
+   }
+   return true;
 }
 
 
@@ -168,24 +488,68 @@ _mongocrypt_cache_get (_mongocrypt_cache_t *cache,
                        void *attr, /* attr of cache item */
                        void **value /* copied to. */)
 {
-   _mongocrypt_cache_pair_t *match;
+   int64_t refresh_claim;
+
+   return _mongocrypt_cache_get_claim (cache, attr, value, &refresh_claim);
+}
+
+
+bool
+_mongocrypt_cache_get_claim (_mongocrypt_cache_t *cache,
+                             void *attr,
+                             void **value,
+                             int64_t *refresh_claim)
+{
+   _mongocrypt_cache_lock_t *lock;
+   _mongocrypt_cache_counters_t *counters;
+   int64_t current;
+   bool ret;
 
    *value = NULL;
+   *refresh_claim = 0;
+
+   /* If the oldest pair has not expired, none have, and there is nothing to
+    * evict. Look up under a shared lock. */
+   current = bson_get_monotonic_time () / 1000;
+   lock = _read_lock (cache);
+   counters = &cache->counters[lock - cache->locks];
+   if (!cache->oldest || !_pair_expired (cache, cache->oldest, current)) {
+      ret = _get (cache, attr, value, refresh_claim, current, counters);
+      _mongocrypt_rwlock_rdunlock (&lock->lock);
+      return ret;
+   }
+   _mongocrypt_rwlock_rdunlock (&lock->lock);
 
-   _mongocrypt_mutex_lock (&cache->mutex);
-   /* TODO CDRIVER-3120: optimize the eviction algorithm to avoid unnecessary
-    * O(n) traversal */
+   _write_lock (cache);
    _mongocrypt_cache_evict (cache);
-   if (!_find_pair (cache, attr, &match)) {
-      _mongocrypt_mutex_unlock (&cache->mutex);
-      return false;
+   ret = _get (cache, attr, value, refresh_claim, current, counters);
+   _write_unlock (cache);
+   return ret;
+}
+
+
+bool
+_mongocrypt_cache_release_refresh (_mongocrypt_cache_t *cache,
+                                   void *attr,
+                                   int64_t refresh_claim)
+{
+   _mongocrypt_cache_lock_t *lock;
+   _mongocrypt_cache_pair_t *match;
+   bool ret;
+
+   if (refresh_claim == 0) {
+      return true;
    }
 
-   if (match) {
-      *value = cache->copy_value (match->value);
+   lock = _read_lock (cache);
+   ret = _find_pair (cache, attr, &match);
+   if (ret && match) {
+      /* Fails harmlessly if another lookup re-claimed the lapsed claim. */
+      _mongocrypt_atomic_int64_cas (
+         &match->refresh_claimed_at, refresh_claim, 0);
    }
-   _mongocrypt_mutex_unlock (&cache->mutex);
-   return true;
+   _mongocrypt_rwlock_rdunlock (&lock->lock);
+   return ret;
 }
 
 
@@ -193,27 +557,48 @@ static bool
 _cache_add (_mongocrypt_cache_t *cache,
             void *attr,
             void *value,
+            int64_t age_ms,
             mongocrypt_status_t *status,
             bool steal_value)
 {
    _mongocrypt_cache_pair_t *pair;
+   int64_t last_updated;
 
-   _mongocrypt_mutex_lock (&cache->mutex);
+   _write_lock (cache);
    _mongocrypt_cache_evict (cache);
    if (!_mongocrypt_remove_matches (cache, attr)) {
       CLIENT_ERR ("error removing from cache");
-      _mongocrypt_mutex_unlock (&cache->mutex);
+      _write_unlock (cache);
       return false;
    }
 
    pair = _pair_new (cache, attr);
+   if (age_ms > 0) {
+      /* Expiration and eviction rely on the list being sorted by age, so a
+       * pair is never older than the next older one. */
+      last_updated = pair->last_updated - age_ms;
+      if (pair->next && last_updated < pair->next->last_updated) {
+         last_updated = pair->next->last_updated;
+      }
+      pair->last_updated = last_updated;
+   }
 
    if (steal_value) {
       pair->value = value;
    } else {
       pair->value = cache->copy_value (value);
    }
-   _mongocrypt_mutex_unlock (&cache->mutex);
+
+   pair->size = sizeof (*pair) + pair->num_hashes * sizeof (uint32_t);
+   if (cache->size_attr) {
+      pair->size += cache->size_attr (pair->attr);
+   }
+   if (cache->size_value) {
+      pair->size += cache->size_value (pair->value);
+   }
+   cache->num_bytes += pair->size;
+   _evict_over_limits (cache);
+   _write_unlock (cache);
    return true;
 }
 
@@ -224,7 +609,7 @@ _mongocrypt_cache_add_copy (_mongocrypt_cache_t *cache,
                             void *value,
                             mongocrypt_status_t *status)
 {
-   return _cache_add (cache, attr, value, status, false);
+   return _cache_add (cache, attr, value, 0, status, false);
 }
 
 
@@ -234,13 +619,53 @@ _mongocrypt_cache_add_stolen (_mongocrypt_cache_t *cache,
                               void *value,
                               mongocrypt_status_t *status)
 {
-   return _cache_add (cache, attr, value, status, true);
+   return _cache_add (cache, attr, value, 0, status, true);
+}
+
+
+bool
+_mongocrypt_cache_add_stolen_aged (_mongocrypt_cache_t *cache,
+                                   void *attr,
+                                   void *value,
+                                   int64_t age_ms,
+                                   mongocrypt_status_t *status)
+{
+   return _cache_add (cache, attr, value, age_ms, status, true);
+}
+
+
+void
+_mongocrypt_cache_visit (_mongocrypt_cache_t *cache,
+                         cache_visit_fn fn,
+                         void *ctx)
+{
+   _mongocrypt_cache_lock_t *lock;
+   _mongocrypt_cache_pair_t *pair;
+   int64_t current;
+   int64_t age;
+
+   current = bson_get_monotonic_time () / 1000;
+   lock = _read_lock (cache);
+   for (pair = cache->oldest; NULL != pair; pair = pair->prev) {
+      if (_pair_expired (cache, pair, current)) {
+         continue;
+      }
+      age = current - pair->last_updated;
+      if (!fn (pair->attr,
+               pair->value,
+               cache->expiration - (uint64_t) age,
+               ctx)) {
+         break;
+      }
+   }
+   _mongocrypt_rwlock_rdunlock (&lock->lock);
 }
 
 void
 _mongocrypt_cache_cleanup (_mongocrypt_cache_t *cache)
 {
    _mongocrypt_cache_pair_t *pair, *tmp;
+   int i;
 
    pair = cache->pair;
    while (pair) {
@@ -248,16 +673,21 @@ _mongocrypt_cache_cleanup (_mongocrypt_cache_t *cache)
       _cache_pair_destroy (cache, pair);
       pair = tmp;
    }
+   bson_free (cache->slots);
+   for (i = 0; i < CACHE_LOCK_SHARDS; i++) {
+      _mongocrypt_rwlock_cleanup (&cache->locks[i].lock);
+   }
 }
 
 /* Print the contents of the cache (for debugging purposes) */
 void
 _mongocrypt_cache_dump (_mongocrypt_cache_t *cache)
 {
+   _mongocrypt_cache_lock_t *lock;
    _mongocrypt_cache_pair_t *pair;
    int count;
 
-   _mongocrypt_mutex_lock (&cache->mutex);
+   lock = _read_lock (cache);
    count = 0;
    for (pair = cache->pair; pair != NULL; pair = pair->next) {
       printf ("entry:%d last_updated:%d\n", count, (int) pair->last_updated);
@@ -268,22 +698,54 @@ _mongocrypt_cache_dump (_mongocrypt_cache_t *cache)
       count++;
    }
 
-   _mongocrypt_mutex_unlock (&cache->mutex);
+   _mongocrypt_rwlock_rdunlock (&lock->lock);
 }
 
 
 uint32_t
 _mongocrypt_cache_num_entries (_mongocrypt_cache_t *cache)
 {
-   _mongocrypt_cache_pair_t *pair;
+   _mongocrypt_cache_lock_t *lock;
    uint32_t count;
 
-   _mongocrypt_mutex_lock (&cache->mutex);
-   count = 0;
-   for (pair = cache->pair; pair != NULL; pair = pair->next) {
-      count++;
-   }
-
-   _mongocrypt_mutex_unlock (&cache->mutex);
+   lock = _read_lock (cache);
+   count = cache->num_entries;
+   _mongocrypt_rwlock_rdunlock (&lock->lock);
    return count;
-}
\ No newline at end of file
+}
+
+
+void
+_mongocrypt_cache_set_limits (_mongocrypt_cache_t *cache,
+                              uint32_t max_entries,
+                              uint64_t max_bytes)
+{
+   _write_lock (cache);
+   cache->max_entries = max_entries;
+   cache->max_bytes = max_bytes;
+   _evict_over_limits (cache);
+   _write_unlock (cache);
+}
+
+
+void
+_mongocrypt_cache_stats (_mongocrypt_cache_t *cache,
+                         _mongocrypt_cache_stats_t *stats)
+{
+   _mongocrypt_cache_lock_t *lock;
+   int i;
+
+   memset (stats, 0, sizeof (*stats));
+   lock = _read_lock (cache);
+   for (i = 0; i < CACHE_LOCK_SHARDS; i++) {
+      stats->hits += (uint64_t) _mongocrypt_atomic_int64_add (
+         &cache->counters[i].counts.hits, 0);
+      stats->misses += (uint64_t) _mongocrypt_atomic_int64_add (
+         &cache->counters[i].counts.misses, 0);
+   }
+   stats->evictions = cache->evictions;
+   stats->expirations = cache->expirations;
+   stats->entries = cache->num_entries;
+   stats->bytes = cache->num_bytes;
+   _mongocrypt_rwlock_rdunlock (&lock->lock);
+}
@@ -47,10 +47,23 @@ _mongocrypt_serialize_ciphertext (_mongocrypt_ciphertext_t *ciphertext,
                                   _mongocrypt_buffer_t *out)
    MONGOCRYPT_WARN_UNUSED_RESULT;
 
+/* The length of the associated data: the blob subtype, the 16 byte key id,
+ * and the original BSON type. */
+#define MONGOCRYPT_ASSOCIATED_DATA_LEN (1 + 16 + 1)
+
 bool
 _mongocrypt_ciphertext_serialize_associated_data (
    _mongocrypt_ciphertext_t *ciphertext,
    _mongocrypt_buffer_t *out) MONGOCRYPT_WARN_UNUSED_RESULT;
 
+/* Serializes the associated data into @storage, which has room for
+ * MONGOCRYPT_ASSOCIATED_DATA_LEN bytes, instead of allocating. @out views
+ * @storage. */
+bool
+_mongocrypt_ciphertext_serialize_associated_data_to (
+   _mongocrypt_ciphertext_t *ciphertext,
+   uint8_t *storage,
+   _mongocrypt_buffer_t *out) MONGOCRYPT_WARN_UNUSED_RESULT;
+
 
 #endif /* MONGOCRYPT_CIPHERTEXT_PRIVATE_H */
@@ -156,6 +156,31 @@ A = Associated Data = fle_blob_subtype + key_uuid[16] + original_bson_type
 bool
 _mongocrypt_ciphertext_serialize_associated_data (
    _mongocrypt_ciphertext_t *ciphertext, _mongocrypt_buffer_t *out)
+{
+   uint8_t storage[MONGOCRYPT_ASSOCIATED_DATA_LEN];
+   _mongocrypt_buffer_t view;
+
+   if (!out) {
+      return false;
+   }
+
+   _mongocrypt_buffer_init (out);
+
+   if (!_mongocrypt_ciphertext_serialize_associated_data_to (
+          ciphertext, storage, &view)) {
+      return false;
+   }
+
+   _mongocrypt_buffer_copy_to (&view, out);
+   return true;
+}
+
+
+bool
+_mongocrypt_ciphertext_serialize_associated_data_to (
+   _mongocrypt_ciphertext_t *ciphertext,
+   uint8_t *storage,
+   _mongocrypt_buffer_t *out)
 {
    int32_t bytes_written;
 
@@ -179,11 +204,8 @@ _mongocrypt_ciphertext_serialize_associated_data (
       return false;
    }
 
-   out->len = 1 + ciphertext->key_id.len + 1;
-   out->data = bson_malloc (out->len);
-   BSON_ASSERT (out->data);
-
-   out->owned = true;
+   out->len = MONGOCRYPT_ASSOCIATED_DATA_LEN;
+   out->data = storage;
    memcpy (out->data, &ciphertext->blob_subtype, 1);
    bytes_written = 1;
    memcpy (out->data + bytes_written,
@@ -18,7 +18,9 @@
 #define MONGOCRYPT_CRYPTO_PRIVATE_H
 
 #include "mongocrypt.h"
+#include "mongocrypt-binary-private.h"
 #include "mongocrypt-buffer-private.h"
+#include "mongocrypt-mutex-private.h"
 
 #define MONGOCRYPT_KEY_LEN 96
 #define MONGOCRYPT_IV_KEY_LEN 32
@@ -29,6 +31,40 @@
 #define MONGOCRYPT_HMAC_LEN 32
 #define MONGOCRYPT_BLOCK_SIZE 16
 
+/* Size of the chunks fetched by the random pool. Holds 256 IVs. */
+#define MONGOCRYPT_RANDOM_POOL_LEN 4096
+
+/* A pool of random bytes for IVs, refilled with one call to the random
+ * function or hook when exhausted. IVs are public, so handing them out from a
+ * buffer exposes nothing that the ciphertext does not. Data keys do not use
+ * the pool.
+ * The pool is shared by all contexts of a mongocrypt_t and is protected by
+ * @mutex. A child process discards the pool inherited from its parent, so the
+ * two never hand out the same IVs. */
+typedef struct {
+   mongocrypt_mutex_t mutex;
+   uint8_t data[MONGOCRYPT_RANDOM_POOL_LEN];
+   /* Offset of the first unused byte. The pool starts out empty. */
+   uint32_t pos;
+   /* The process that filled the pool. */
+   int pid;
+   /* Number of IVs handed out. */
+   uint64_t requests;
+   /* Number of calls to the random function or hook made to fill the pool. */
+   uint64_t fills;
+} _mongocrypt_random_pool_t;
+
+void
+_mongocrypt_random_pool_init (_mongocrypt_random_pool_t *pool);
+
+void
+_mongocrypt_random_pool_cleanup (_mongocrypt_random_pool_t *pool);
+
+/* Returns the number of calls to the random function or hook that the pool
+ * avoided. */
+uint64_t
+_mongocrypt_random_pool_calls_saved (_mongocrypt_random_pool_t *pool);
+
 typedef struct {
    int hooks_enabled;
    mongocrypt_crypto_fn aes_256_cbc_encrypt;
@@ -38,8 +74,45 @@ typedef struct {
    mongocrypt_hmac_fn hmac_sha_256;
    mongocrypt_hash_fn sha_256;
    void *ctx;
+   /* Optional. Used by the batch functions in place of the single operation
+    * hooks for AES and HMAC-SHA-512. */
+   mongocrypt_crypto_batch_fn batch;
+   void *batch_ctx;
+   /* Owned by the mongocrypt_t. NULL to call the random function for every
+    * IV. */
+   _mongocrypt_random_pool_t *random_pool;
 } _mongocrypt_crypto_t;
 
+struct _mongocrypt_crypto_op_t {
+   mongocrypt_crypto_op_type_t type;
+   mongocrypt_binary_t key;
+   mongocrypt_binary_t iv;
+   mongocrypt_binary_t in;
+   mongocrypt_binary_t out;
+   uint32_t bytes_written;
+};
+
+/* Opaque per-key contexts supplied by the native crypto implementation. */
+typedef struct __native_crypto_aes_256_cbc_ctx_t
+   _native_crypto_aes_256_cbc_ctx_t;
+typedef struct __native_crypto_hmac_sha_512_ctx_t
+   _native_crypto_hmac_sha_512_ctx_t;
+
+/* Precomputed state for a 96 byte data key.
+ * Setting up the cipher and HMAC contexts (expanding the AES key schedule and
+ * keying the HMAC inner/outer pads) is done once in
+ * _mongocrypt_key_state_set, then reused for every field encrypted or
+ * decrypted with the key.
+ * The native contexts are NULL if crypto hooks are enabled or the native crypto
+ * implementation does not support precomputed contexts. In that case the raw
+ * key is used. A key state is not thread safe. */
+typedef struct {
+   _mongocrypt_buffer_t key;
+   _native_crypto_aes_256_cbc_ctx_t *aes;
+   _native_crypto_hmac_sha_512_ctx_t *mac;
+   _native_crypto_hmac_sha_512_ctx_t *iv_mac;
+} _mongocrypt_key_state_t;
+
 uint32_t
 _mongocrypt_calculate_ciphertext_len (uint32_t plaintext_len);
 
@@ -73,7 +146,14 @@ _mongocrypt_random (_mongocrypt_crypto_t *crypto,
                     uint32_t count,
                     mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
 
-/* Returns 0 if equal, non-zero otherwise */
+/* Fills @iv, of length MONGOCRYPT_IV_LEN, from the random pool. */
+bool
+_mongocrypt_random_iv (_mongocrypt_crypto_t *crypto,
+                       _mongocrypt_buffer_t *iv,
+                       mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Compares in constant time. Returns 0 if equal, 1 otherwise. */
 int
 _mongocrypt_memequal (const void *const b1, const void *const b2, size_t len);
 
@@ -86,6 +166,193 @@ _mongocrypt_calculate_deterministic_iv (
    _mongocrypt_buffer_t *out,
    mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
 
+void
+_mongocrypt_key_state_init (_mongocrypt_key_state_t *state);
+
+/* Copies @key and creates the native contexts. */
+bool
+_mongocrypt_key_state_set (_mongocrypt_crypto_t *crypto,
+                           _mongocrypt_key_state_t *state,
+                           const _mongocrypt_buffer_t *key,
+                           mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+void
+_mongocrypt_key_state_cleanup (_mongocrypt_key_state_t *state);
+
+/* Like _mongocrypt_do_encryption, but reuses the precomputed @key_state. */
+bool
+_mongocrypt_do_encryption_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_buffer_t *iv,
+   const _mongocrypt_buffer_t *associated_data,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *plaintext,
+   _mongocrypt_buffer_t *ciphertext,
+   uint32_t *bytes_written,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* One field of a batch passed to _mongocrypt_do_encryption_batch. */
+typedef struct {
+   const _mongocrypt_key_state_t *key_state;
+   const _mongocrypt_buffer_t *iv;
+   /* May be NULL. */
+   const _mongocrypt_buffer_t *associated_data;
+   const _mongocrypt_buffer_t *plaintext;
+   /* Pre-allocated with _mongocrypt_calculate_ciphertext_len bytes. */
+   _mongocrypt_buffer_t *ciphertext;
+   /* Set to the number of bytes written to ciphertext. */
+   uint32_t bytes_written;
+} _mongocrypt_encryption_t;
+
+/* Encrypts @count independent fields in one call. */
+bool
+_mongocrypt_do_encryption_batch (_mongocrypt_crypto_t *crypto,
+                                 _mongocrypt_encryption_t *encryptions,
+                                 uint32_t count,
+                                 mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* One field of a batch passed to _mongocrypt_do_decryption_batch. */
+typedef struct {
+   const _mongocrypt_key_state_t *key_state;
+   /* May be NULL. */
+   const _mongocrypt_buffer_t *associated_data;
+   const _mongocrypt_buffer_t *ciphertext;
+   /* Pre-allocated with _mongocrypt_calculate_plaintext_len bytes. */
+   _mongocrypt_buffer_t *plaintext;
+   /* Set to the length of the plaintext, excluding padding. */
+   uint32_t bytes_written;
+} _mongocrypt_decryption_t;
+
+/* Decrypts @count independent fields in one call. Fails if any field fails to
+ * authenticate. */
+bool
+_mongocrypt_do_decryption_batch (_mongocrypt_crypto_t *crypto,
+                                 _mongocrypt_decryption_t *decryptions,
+                                 uint32_t count,
+                                 mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Like _mongocrypt_do_decryption, but reuses the precomputed @key_state. */
+bool
+_mongocrypt_do_decryption_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_buffer_t *associated_data,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *ciphertext,
+   _mongocrypt_buffer_t *plaintext,
+   uint32_t *bytes_written,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Computes the HMAC-SHA-512 of @associated_data and @plaintext under the IV key
+ * of @key_state. The deterministic IV is its first MONGOCRYPT_IV_LEN bytes.
+ * @out must be pre-allocated with MONGOCRYPT_HMAC_SHA512_LEN bytes. */
+bool
+_mongocrypt_calculate_deterministic_digest_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *plaintext,
+   const _mongocrypt_buffer_t *associated_data,
+   _mongocrypt_buffer_t *out,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* One field of a batch passed to
+ * _mongocrypt_calculate_deterministic_digest_batch. */
+typedef struct {
+   const _mongocrypt_key_state_t *key_state;
+   const _mongocrypt_buffer_t *plaintext;
+   const _mongocrypt_buffer_t *associated_data;
+   /* Pre-allocated with MONGOCRYPT_HMAC_SHA512_LEN bytes. */
+   _mongocrypt_buffer_t *out;
+} _mongocrypt_digest_t;
+
+/* Computes @count deterministic digests in one call. */
+bool
+_mongocrypt_calculate_deterministic_digest_batch (
+   _mongocrypt_crypto_t *crypto,
+   _mongocrypt_digest_t *digests,
+   uint32_t count,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Like _mongocrypt_calculate_deterministic_iv, but reuses the precomputed
+ * @key_state. */
+bool
+_mongocrypt_calculate_deterministic_iv_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *plaintext,
+   const _mongocrypt_buffer_t *associated_data,
+   _mongocrypt_buffer_t *out,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Incremental encryption or decryption of one value, for values too large to
+ * hold in memory. Only the CBC chaining block, the running HMAC, and a few
+ * blocks of input are kept between calls. Each call appends its output to
+ * @out, and the concatenated output of an encryption is the same as
+ * _mongocrypt_do_encryption with the same IV.
+ * The HMAC context of the key state is used for the running HMAC, so the key
+ * state must not be used for anything else until the stream is finished. */
+typedef struct {
+   _mongocrypt_crypto_t *crypto;
+   const _mongocrypt_key_state_t *key_state;
+   bool encrypt;
+   /* Set once the IV has been written (encryption) or read (decryption). */
+   bool have_iv;
+   uint32_t associated_data_len;
+   /* The previous ciphertext block, which is the IV of the next block. */
+   uint8_t chain[MONGOCRYPT_BLOCK_SIZE];
+   /* Input held back until a whole block is available. Decryption also holds
+    * back the last block and the tag. */
+   uint8_t pending[2 * MONGOCRYPT_BLOCK_SIZE + MONGOCRYPT_HMAC_LEN];
+   uint32_t pending_len;
+} _mongocrypt_crypto_stream_t;
+
+void
+_mongocrypt_crypto_stream_init (_mongocrypt_crypto_stream_t *stream);
+
+/* Starts an encryption, and appends @iv to @out. Fails if the key state has no
+ * native HMAC context. */
+bool
+_mongocrypt_crypto_stream_encrypt_start (
+   _mongocrypt_crypto_stream_t *stream,
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *iv,
+   const _mongocrypt_buffer_t *associated_data,
+   _mongocrypt_buffer_t *out,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Starts a decryption. The input is the ciphertext, starting with the IV. */
+bool
+_mongocrypt_crypto_stream_decrypt_start (
+   _mongocrypt_crypto_stream_t *stream,
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *associated_data,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Processes the next @len bytes of input. Decrypted output is not
+ * authenticated until _mongocrypt_crypto_stream_final succeeds. */
+bool
+_mongocrypt_crypto_stream_update (_mongocrypt_crypto_stream_t *stream,
+                                  const uint8_t *data,
+                                  uint32_t len,
+                                  _mongocrypt_buffer_t *out,
+                                  mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Encryption appends the padded last block and the tag. Decryption verifies
+ * the tag, then appends the last block without padding. */
+bool
+_mongocrypt_crypto_stream_final (_mongocrypt_crypto_stream_t *stream,
+                                 _mongocrypt_buffer_t *out,
+                                 mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+void
+_mongocrypt_crypto_stream_cleanup (_mongocrypt_crypto_stream_t *stream);
+
 /* Crypto implementations must implement these functions. */
 
 /* This variable must be defined in implementation
@@ -128,4 +395,77 @@ _native_crypto_random (_mongocrypt_buffer_t *out,
                        mongocrypt_status_t *status)
    MONGOCRYPT_WARN_UNUSED_RESULT;
 
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+/* kms-message is built without a crypto library when using the builtin
+ * backend, so KMS requests are signed with these. */
+bool
+_native_crypto_hmac_sha_256 (const _mongocrypt_buffer_t *key,
+                             const _mongocrypt_buffer_t *in,
+                             _mongocrypt_buffer_t *out,
+                             mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+bool
+_native_crypto_sha_256 (const _mongocrypt_buffer_t *in,
+                        _mongocrypt_buffer_t *out,
+                        mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+#endif
+
+/* Precomputed per-key contexts. Implementations that do not support them
+ * return NULL (without setting an error) from the _new functions, and callers
+ * fall back to the functions taking a raw key above. */
+_native_crypto_aes_256_cbc_ctx_t *
+_native_crypto_aes_256_cbc_ctx_new (const _mongocrypt_buffer_t *key,
+                                    mongocrypt_status_t *status);
+
+bool
+_native_crypto_aes_256_cbc_ctx_encrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+bool
+_native_crypto_aes_256_cbc_ctx_decrypt (_native_crypto_aes_256_cbc_ctx_t *ctx,
+                                        const _mongocrypt_buffer_t *iv,
+                                        const _mongocrypt_buffer_t *in,
+                                        _mongocrypt_buffer_t *out,
+                                        uint32_t *bytes_written,
+                                        mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+void
+_native_crypto_aes_256_cbc_ctx_destroy (_native_crypto_aes_256_cbc_ctx_t *ctx);
+
+_native_crypto_hmac_sha_512_ctx_t *
+_native_crypto_hmac_sha_512_ctx_new (const _mongocrypt_buffer_t *key,
+                                     mongocrypt_status_t *status);
+
+/* Streaming HMAC with a precomputed context. _init starts a new HMAC with the
+ * context's key, _update may be called any number of times, and _final writes
+ * the 64 byte tag to @out. */
+bool
+_native_crypto_hmac_sha_512_ctx_init (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                      mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+bool
+_native_crypto_hmac_sha_512_ctx_update (
+   _native_crypto_hmac_sha_512_ctx_t *ctx,
+   const _mongocrypt_buffer_t *in,
+   mongocrypt_status_t *status) MONGOCRYPT_WARN_UNUSED_RESULT;
+
+bool
+_native_crypto_hmac_sha_512_ctx_final (_native_crypto_hmac_sha_512_ctx_t *ctx,
+                                       _mongocrypt_buffer_t *out,
+                                       mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+void
+_native_crypto_hmac_sha_512_ctx_destroy (
+   _native_crypto_hmac_sha_512_ctx_t *ctx);
+
 #endif /* MONGOCRYPT_CRYPTO_PRIVATE_H */
@@ -28,10 +28,25 @@
 #include "mongocrypt-private.h"
 #include "mongocrypt-status-private.h"
 
+#if defined(BSON_OS_UNIX)
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+   (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MONGOCRYPT_MEMEQUAL_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MONGOCRYPT_MEMEQUAL_NEON
+#endif
+
 /* Crypto primitives. These either call the native built in crypto primitives or
- * user supplied hooks. */
+ * user supplied hooks. If a precomputed native context is passed (non-NULL),
+ * it is used instead of the raw key. */
 static bool
 _crypto_aes_256_cbc_encrypt (_mongocrypt_crypto_t *crypto,
+                             _native_crypto_aes_256_cbc_ctx_t *aes_ctx,
                              const _mongocrypt_buffer_t *enc_key,
                              const _mongocrypt_buffer_t *iv,
                              const _mongocrypt_buffer_t *in,
@@ -67,6 +82,10 @@ _crypto_aes_256_cbc_encrypt (_mongocrypt_crypto_t *crypto,
                                          status);
       return ret;
    }
+   if (aes_ctx) {
+      return _native_crypto_aes_256_cbc_ctx_encrypt (
+         aes_ctx, iv, in, out, bytes_written, status);
+   }
    return _native_crypto_aes_256_cbc_encrypt (
       enc_key, iv, in, out, bytes_written, status);
 }
@@ -74,6 +93,7 @@ _crypto_aes_256_cbc_encrypt (_mongocrypt_crypto_t *crypto,
 
 static bool
 _crypto_aes_256_cbc_decrypt (_mongocrypt_crypto_t *crypto,
+                             _native_crypto_aes_256_cbc_ctx_t *aes_ctx,
                              const _mongocrypt_buffer_t *iv,
                              const _mongocrypt_buffer_t *enc_key,
                              const _mongocrypt_buffer_t *in,
@@ -104,18 +124,35 @@ _crypto_aes_256_cbc_decrypt (_mongocrypt_crypto_t *crypto,
                                          status);
       return ret;
    }
+   if (aes_ctx) {
+      return _native_crypto_aes_256_cbc_ctx_decrypt (
+         aes_ctx, iv, in, out, bytes_written, status);
+   }
    return _native_crypto_aes_256_cbc_decrypt (
       enc_key, iv, in, out, bytes_written, status);
 }
 
 
+/* Computes the HMAC of the concatenation of the @in_count buffers in @in.
+ * With native crypto the buffers are fed to a streaming HMAC and never copied.
+ * Crypto hooks and native implementations without precomputed contexts take a
+ * single input, so the buffers are concatenated first. */
 static bool
 _crypto_hmac_sha_512 (_mongocrypt_crypto_t *crypto,
+                      _native_crypto_hmac_sha_512_ctx_t *hmac_ctx,
                       const _mongocrypt_buffer_t *hmac_key,
                       const _mongocrypt_buffer_t *in,
+                      uint32_t in_count,
                       _mongocrypt_buffer_t *out,
                       mongocrypt_status_t *status)
 {
+   _native_crypto_hmac_sha_512_ctx_t *tmp_ctx = NULL;
+   _mongocrypt_buffer_t to_hmac;
+   uint32_t i;
+   bool ret = false;
+
+   _mongocrypt_buffer_init (&to_hmac);
+
    if (hmac_key->len != MONGOCRYPT_MAC_KEY_LEN) {
       CLIENT_ERR ("invalid hmac key length");
       return false;
@@ -126,19 +163,54 @@ _crypto_hmac_sha_512 (_mongocrypt_crypto_t *crypto,
       return false;
    }
 
+   if (!crypto->hooks_enabled && !hmac_ctx) {
+      /* No precomputed context for this key, key one for this call. */
+      tmp_ctx = _native_crypto_hmac_sha_512_ctx_new (hmac_key, status);
+      if (!tmp_ctx && !mongocrypt_status_ok (status)) {
+         return false;
+      }
+      hmac_ctx = tmp_ctx;
+   }
+
+   if (!crypto->hooks_enabled && hmac_ctx) {
+      if (!_native_crypto_hmac_sha_512_ctx_init (hmac_ctx, status)) {
+         goto done;
+      }
+      for (i = 0; i < in_count; i++) {
+         if (!_native_crypto_hmac_sha_512_ctx_update (
+                hmac_ctx, &in[i], status)) {
+            goto done;
+         }
+      }
+      if (!_native_crypto_hmac_sha_512_ctx_final (hmac_ctx, out, status)) {
+         goto done;
+      }
+      ret = true;
+      goto done;
+   }
+
+   if (!_mongocrypt_buffer_concat (&to_hmac, in, in_count)) {
+      CLIENT_ERR ("failed to allocate buffer");
+      goto done;
+   }
+
    if (crypto->hooks_enabled) {
       mongocrypt_binary_t hmac_key_bin, out_bin, in_bin;
-      bool ret;
 
       _mongocrypt_buffer_to_binary (hmac_key, &hmac_key_bin);
       _mongocrypt_buffer_to_binary (out, &out_bin);
-      _mongocrypt_buffer_to_binary (in, &in_bin);
+      _mongocrypt_buffer_to_binary (&to_hmac, &in_bin);
 
       ret = crypto->hmac_sha_512 (
          crypto->ctx, &hmac_key_bin, &in_bin, &out_bin, status);
-      return ret;
+      goto done;
    }
-   return _native_crypto_hmac_sha_512 (hmac_key, in, out, status);
+   ret = _native_crypto_hmac_sha_512 (hmac_key, &to_hmac, out, status);
+
+done:
+   _native_crypto_hmac_sha_512_ctx_destroy (tmp_ctx);
+   _mongocrypt_buffer_cleanup (&to_hmac);
+   return ret;
 }
 
 
@@ -163,20 +235,181 @@ _crypto_random (_mongocrypt_crypto_t *crypto,
 }
 
 
+/* Batched crypto hooks. With a batch hook, the batch functions collect one
+ * step of every field, and hand all of the operations to the hook in a single
+ * call. The hook takes single inputs, so multi-part inputs are concatenated
+ * and the plaintext is padded up front. */
+static void
+_crypto_op_init (mongocrypt_crypto_op_t *op,
+                 mongocrypt_crypto_op_type_t type,
+                 const _mongocrypt_buffer_t *key,
+                 const _mongocrypt_buffer_t *iv,
+                 const _mongocrypt_buffer_t *in,
+                 const _mongocrypt_buffer_t *out)
+{
+   memset (op, 0, sizeof (*op));
+   op->type = type;
+   _mongocrypt_buffer_to_binary (key, &op->key);
+   if (iv) {
+      _mongocrypt_buffer_to_binary (iv, &op->iv);
+   }
+   _mongocrypt_buffer_to_binary (in, &op->in);
+   _mongocrypt_buffer_to_binary (out, &op->out);
+}
+
+
+static bool
+_crypto_batch (_mongocrypt_crypto_t *crypto,
+               mongocrypt_crypto_op_t *ops,
+               uint32_t count,
+               mongocrypt_status_t *status)
+{
+   mongocrypt_crypto_op_t **op_ptrs;
+   uint32_t i;
+   bool ret = false;
+
+   BSON_ASSERT (crypto->batch);
+
+   if (count == 0) {
+      return true;
+   }
+
+   op_ptrs = bson_malloc (count * sizeof (*op_ptrs));
+   BSON_ASSERT (op_ptrs);
+   for (i = 0; i < count; i++) {
+      op_ptrs[i] = &ops[i];
+   }
+
+   if (!crypto->batch (crypto->batch_ctx, op_ptrs, count, status)) {
+      goto done;
+   }
+
+   for (i = 0; i < count; i++) {
+      if (ops[i].type != MONGOCRYPT_CRYPTO_OP_HMAC_SHA_512 &&
+          ops[i].bytes_written != ops[i].in.len) {
+         CLIENT_ERR ("crypto batch hook wrote %" PRIu32
+                     " bytes, expected %" PRIu32,
+                     ops[i].bytes_written,
+                     ops[i].in.len);
+         goto done;
+      }
+   }
+
+   ret = true;
+
+done:
+   bson_free (op_ptrs);
+   return ret;
+}
+
+
+mongocrypt_crypto_op_type_t
+mongocrypt_crypto_op_type (mongocrypt_crypto_op_t *op)
+{
+   BSON_ASSERT (op);
+   return op->type;
+}
+
+
+mongocrypt_binary_t *
+mongocrypt_crypto_op_key (mongocrypt_crypto_op_t *op)
+{
+   BSON_ASSERT (op);
+   return &op->key;
+}
+
+
+mongocrypt_binary_t *
+mongocrypt_crypto_op_iv (mongocrypt_crypto_op_t *op)
+{
+   BSON_ASSERT (op);
+   if (op->type == MONGOCRYPT_CRYPTO_OP_HMAC_SHA_512) {
+      return NULL;
+   }
+   return &op->iv;
+}
+
+
+mongocrypt_binary_t *
+mongocrypt_crypto_op_in (mongocrypt_crypto_op_t *op)
+{
+   BSON_ASSERT (op);
+   return &op->in;
+}
+
+
+mongocrypt_binary_t *
+mongocrypt_crypto_op_out (mongocrypt_crypto_op_t *op)
+{
+   BSON_ASSERT (op);
+   return &op->out;
+}
+
+
+void
+mongocrypt_crypto_op_set_bytes_written (mongocrypt_crypto_op_t *op,
+                                        uint32_t bytes_written)
+{
+   BSON_ASSERT (op);
+   op->bytes_written = bytes_written;
+}
+
+
 /*
- * Secure memcmp copied from the C driver.
+ * Constant time comparison. The differences are OR-ed together sixteen bytes
+ * at a time with SIMD where available, then a word at a time, then a byte at a
+ * time. Nothing branches on the data, so the running time depends only on
+ * @len.
  */
 int
 _mongocrypt_memequal (const void *const b1, const void *const b2, size_t len)
 {
-   const unsigned char *p1 = b1, *p2 = b2;
-   int ret = 0;
+   const uint8_t *p1 = b1, *p2 = b2;
+   uint64_t acc = 0;
+   uint64_t w1, w2;
+
+#if defined(MONGOCRYPT_MEMEQUAL_SSE2)
+   if (len >= 16) {
+      __m128i vacc = _mm_setzero_si128 ();
+      uint64_t lanes[2];
+
+      for (; len >= 16; len -= 16, p1 += 16, p2 += 16) {
+         vacc = _mm_or_si128 (
+            vacc,
+            _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *) p1),
+                           _mm_loadu_si128 ((const __m128i *) p2)));
+      }
+      _mm_storeu_si128 ((__m128i *) lanes, vacc);
+      acc |= lanes[0] | lanes[1];
+   }
+#elif defined(MONGOCRYPT_MEMEQUAL_NEON)
+   if (len >= 16) {
+      uint8x16_t vacc = vdupq_n_u8 (0);
+      uint64_t lanes[2];
+
+      for (; len >= 16; len -= 16, p1 += 16, p2 += 16) {
+         vacc = vorrq_u8 (vacc, veorq_u8 (vld1q_u8 (p1), vld1q_u8 (p2)));
+      }
+      vst1q_u8 ((uint8_t *) lanes, vacc);
+      acc |= lanes[0] | lanes[1];
+   }
+#endif
+
+   for (; len >= sizeof (uint64_t);
+        len -= sizeof (uint64_t), p1 += sizeof (uint64_t),
+        p2 += sizeof (uint64_t)) {
+      /* memcpy, since the buffers may be unaligned. */
+      memcpy (&w1, p1, sizeof (uint64_t));
+      memcpy (&w2, p2, sizeof (uint64_t));
+      acc |= w1 ^ w2;
+   }
 
    for (; len > 0; len--) {
-      ret |= *p1++ ^ *p2++;
+      acc |= (uint64_t) (*p1++ ^ *p2++);
    }
 
-   return ret;
+   /* Fold to 0 or 1 without a branch. */
+   return (int) ((acc | (0 - acc)) >> 63);
 }
 
 /* ----------------------------------------------------------------------------
@@ -237,6 +470,7 @@ _mongocrypt_calculate_plaintext_len (uint32_t ciphertext_len)
  *    Encrypts using AES256 CBC using a secret key and a known IV.
  *
  * Parameters:
+ *    @aes_ctx a precomputed context for @enc_key. May be NULL.
  *    @iv a 16 byte IV.
  *    @enc_key a 32 byte key.
  *    @plaintext the plaintext to encrypt.
@@ -260,6 +494,7 @@ _mongocrypt_calculate_plaintext_len (uint32_t ciphertext_len)
  */
 static bool
 _encrypt_step (_mongocrypt_crypto_t *crypto,
+               _native_crypto_aes_256_cbc_ctx_t *aes_ctx,
                const _mongocrypt_buffer_t *iv,
                const _mongocrypt_buffer_t *enc_key,
                const _mongocrypt_buffer_t *plaintext,
@@ -268,13 +503,13 @@ _encrypt_step (_mongocrypt_crypto_t *crypto,
                mongocrypt_status_t *status)
 {
    uint32_t unaligned;
+   uint32_t aligned_len;
    uint32_t padding_byte;
-   _mongocrypt_buffer_t intermediates[2];
-   _mongocrypt_buffer_t to_encrypt;
+   uint32_t block_bytes_written;
+   _mongocrypt_buffer_t chain_iv;
+   _mongocrypt_buffer_t in;
+   _mongocrypt_buffer_t out;
    uint8_t final_block_storage[MONGOCRYPT_BLOCK_SIZE];
-   bool ret = false;
-
-   _mongocrypt_buffer_init (&to_encrypt);
 
    BSON_ASSERT (bytes_written);
    *bytes_written = 0;
@@ -283,74 +518,96 @@ _encrypt_step (_mongocrypt_crypto_t *crypto,
       CLIENT_ERR ("IV should have length %d, but has length %d",
                   MONGOCRYPT_IV_LEN,
                   iv->len);
-      goto done;
+      return false;
    }
 
    if (MONGOCRYPT_ENC_KEY_LEN != enc_key->len) {
       CLIENT_ERR ("Encryption key should have length %d, but has length %d",
                   MONGOCRYPT_ENC_KEY_LEN,
                   enc_key->len);
-      goto done;
+      return false;
    }
 
    /* calculate how many extra bytes there are after a block boundary */
    unaligned = plaintext->len % MONGOCRYPT_BLOCK_SIZE;
+   aligned_len = plaintext->len - unaligned;
 
-   /* Some crypto providers disallow variable length inputs, and require
-    * the input to be a multiple of the block size. So add everything up
-    * to but excluding the last block if not block aligned, then add
-    * the last block with padding. */
-   _mongocrypt_buffer_init (&intermediates[0]);
-   _mongocrypt_buffer_init (&intermediates[1]);
-   intermediates[0].data = (uint8_t *) plaintext->data;
-   intermediates[0].len = plaintext->len - unaligned;
-   intermediates[1].data = final_block_storage;
-   intermediates[1].len = sizeof (final_block_storage);
+   if (ciphertext->len < aligned_len + MONGOCRYPT_BLOCK_SIZE) {
+      CLIENT_ERR ("output ciphertext should have been allocated with %d bytes",
+                  aligned_len + MONGOCRYPT_BLOCK_SIZE);
+      return false;
+   }
 
    /* [MCGREW]: "Prior to CBC encryption, the plaintext P is padded by appending
     * a padding string PS to that data, to ensure that len(P || PS) is a
-    * multiple of 128". This is also known as PKCS #7 padding. */
-   if (unaligned) {
-      /* Copy the unaligned bytes. */
-      memcpy (intermediates[1].data,
-              plaintext->data + (plaintext->len - unaligned),
-              unaligned);
-      /* Fill the rest with the padding byte. */
-      padding_byte = MONGOCRYPT_BLOCK_SIZE - unaligned;
-      memset (intermediates[1].data + unaligned, padding_byte, padding_byte);
-   } else {
-      /* Fill the rest with the padding byte. */
-      padding_byte = MONGOCRYPT_BLOCK_SIZE;
-      memset (intermediates[1].data, padding_byte, padding_byte);
-   }
+    * multiple of 128". This is also known as PKCS #7 padding.
+    * Only the last block is padded, on the stack. */
+   memcpy (final_block_storage, plaintext->data + aligned_len, unaligned);
+   padding_byte = MONGOCRYPT_BLOCK_SIZE - unaligned;
+   memset (final_block_storage + unaligned, padding_byte, padding_byte);
 
-   if (!_mongocrypt_buffer_concat (&to_encrypt, intermediates, 2)) {
-      CLIENT_ERR ("failed to allocate buffer");
-      goto done;
+   /* Some crypto providers disallow variable length inputs, and require
+    * the input to be a multiple of the block size. So encrypt everything up
+    * to but excluding the last block if not block aligned directly from the
+    * plaintext, then encrypt the padded last block. */
+   _mongocrypt_buffer_init (&chain_iv);
+   chain_iv.data = iv->data;
+   chain_iv.len = iv->len;
+   _mongocrypt_buffer_init (&in);
+   _mongocrypt_buffer_init (&out);
+
+   if (aligned_len > 0) {
+      in.data = plaintext->data;
+      in.len = aligned_len;
+      out.data = ciphertext->data;
+      out.len = aligned_len;
+      if (!_crypto_aes_256_cbc_encrypt (crypto,
+                                        aes_ctx,
+                                        enc_key,
+                                        &chain_iv,
+                                        &in,
+                                        &out,
+                                        &block_bytes_written,
+                                        status)) {
+         return false;
+      }
+
+      if (block_bytes_written != aligned_len) {
+         CLIENT_ERR ("encryption failure, wrote %d bytes, expected %d",
+                     block_bytes_written,
+                     aligned_len);
+         return false;
+      }
+
+      /* CBC chains blocks by using the previous ciphertext block as the IV of
+       * the next. */
+      chain_iv.data = ciphertext->data + aligned_len - MONGOCRYPT_BLOCK_SIZE;
    }
 
+   in.data = final_block_storage;
+   in.len = sizeof (final_block_storage);
+   out.data = ciphertext->data + aligned_len;
+   out.len = MONGOCRYPT_BLOCK_SIZE;
    if (!_crypto_aes_256_cbc_encrypt (crypto,
+                                     aes_ctx,
                                      enc_key,
-                                     iv,
-                                     &to_encrypt,
-                                     ciphertext,
-                                     bytes_written,
+                                     &chain_iv,
+                                     &in,
+                                     &out,
+                                     &block_bytes_written,
                                      status)) {
-      goto done;
+      return false;
    }
 
-
-   if (*bytes_written % MONGOCRYPT_BLOCK_SIZE != 0) {
-      CLIENT_ERR ("encryption failure, wrote %d bytes, not a multiple of %d",
-                  *bytes_written,
+   if (block_bytes_written != MONGOCRYPT_BLOCK_SIZE) {
+      CLIENT_ERR ("encryption failure, wrote %d bytes, expected %d",
+                  block_bytes_written,
                   MONGOCRYPT_BLOCK_SIZE);
-      goto done;
+      return false;
    }
 
-   ret = true;
-done:
-   _mongocrypt_buffer_cleanup (&to_encrypt);
-   return ret;
+   *bytes_written = aligned_len + MONGOCRYPT_BLOCK_SIZE;
+   return true;
 }
 
 
@@ -361,6 +618,7 @@ done:
  *    Compute the SHA512 HMAC with a secret key.
  *
  * Parameters:
+ *    @hmac_ctx a precomputed context for @mac_key. May be NULL.
  *    @mac_key a 32 byte key.
  *    @associated_data associated data to add into the HMAC. This may be
  *    an empty buffer.
@@ -381,6 +639,7 @@ done:
  */
 static bool
 _hmac_step (_mongocrypt_crypto_t *crypto,
+            _native_crypto_hmac_sha_512_ctx_t *hmac_ctx,
             const _mongocrypt_buffer_t *mac_key,
             const _mongocrypt_buffer_t *associated_data,
             const _mongocrypt_buffer_t *ciphertext,
@@ -388,22 +647,18 @@ _hmac_step (_mongocrypt_crypto_t *crypto,
             mongocrypt_status_t *status)
 {
    _mongocrypt_buffer_t intermediates[3];
-   _mongocrypt_buffer_t to_hmac;
    uint64_t associated_data_len_be;
    uint8_t tag_storage[64];
    _mongocrypt_buffer_t tag;
-   bool ret = false;
-
-   _mongocrypt_buffer_init (&to_hmac);
 
    if (MONGOCRYPT_MAC_KEY_LEN != mac_key->len) {
       CLIENT_ERR ("HMAC key wrong length: %d", mac_key->len);
-      goto done;
+      return false;
    }
 
    if (out->len != MONGOCRYPT_HMAC_LEN) {
       CLIENT_ERR ("out wrong length: %d", out->len);
-      goto done;
+      return false;
    }
 
    /* [MCGREW]:
@@ -435,71 +690,35 @@ _hmac_step (_mongocrypt_crypto_t *crypto,
    tag.data = tag_storage;
    tag.len = sizeof (tag_storage);
 
-
-   if (!_mongocrypt_buffer_concat (&to_hmac, intermediates, 3)) {
-      CLIENT_ERR ("failed to allocate buffer");
-      goto done;
-   }
-   if (!_crypto_hmac_sha_512 (crypto, mac_key, &to_hmac, &tag, status)) {
-      goto done;
+   if (!_crypto_hmac_sha_512 (
+          crypto, hmac_ctx, mac_key, intermediates, 3, &tag, status)) {
+      return false;
    }
 
    /* [MCGREW 2.7] "The HMAC-SHA-512 value is truncated to T_LEN=32 octets" */
    memcpy (out->data, tag.data, MONGOCRYPT_HMAC_LEN);
-   ret = true;
-done:
-   _mongocrypt_buffer_cleanup (&to_hmac);
-   return ret;
+   return true;
 }
 
-/* ----------------------------------------------------------------------------
- *
- * _mongocrypt_do_encryption --
- *
- *    Defer encryption to whichever crypto library libmongocrypt is using.
- *
- * Parameters:
- *    @iv a 16 byte IV.
- *    @associated_data associated data for the HMAC. May be NULL.
- *    @key a 96 byte key.
- *    @plaintext the plaintext to encrypt.
- *    @ciphertext a location for the resulting ciphertext and HMAC tag.
- *    @bytes_written a location for the resulting bytes written.
- *    @status set on error.
- *
- * Returns:
- *    True on success. On error, sets @status and returns false.
- *
- * Preconditions:
- *    1. ciphertext->data has been pre-allocated with enough space for the
- *    resulting ciphertext. Use _mongocrypt_calculate_ciphertext_len.
- *
- * Postconditions:
- *    1. bytes_written is set to the length of the written ciphertext. This
- *    is the same as _mongocrypt_calculate_ciphertext_len (plaintext->len).
- *
- * ----------------------------------------------------------------------------
- */
-bool
-_mongocrypt_do_encryption (_mongocrypt_crypto_t *crypto,
-                           const _mongocrypt_buffer_t *iv,
-                           const _mongocrypt_buffer_t *associated_data,
-                           const _mongocrypt_buffer_t *key,
-                           const _mongocrypt_buffer_t *plaintext,
-                           _mongocrypt_buffer_t *ciphertext,
-                           uint32_t *bytes_written,
-                           mongocrypt_status_t *status)
+/* Validates the lengths of one field, and clears its output. */
+static bool
+_encryption_check (_mongocrypt_encryption_t *encryption,
+                   mongocrypt_status_t *status)
 {
-   _mongocrypt_buffer_t mac_key = {0}, enc_key = {0}, intermediate = {0},
-                        intermediate_hmac = {0}, empty_buffer = {0};
-   uint32_t intermediate_bytes_written = 0;
-
-   memset (ciphertext->data, 0, ciphertext->len);
+   const _mongocrypt_buffer_t *key;
+   const _mongocrypt_buffer_t *iv = encryption->iv;
+   const _mongocrypt_buffer_t *plaintext = encryption->plaintext;
+   _mongocrypt_buffer_t *ciphertext = encryption->ciphertext;
 
    BSON_ASSERT (iv);
-   BSON_ASSERT (key);
+   BSON_ASSERT (encryption->key_state);
+   key = &encryption->key_state->key;
    BSON_ASSERT (plaintext);
    BSON_ASSERT (ciphertext);
+
+   encryption->bytes_written = 0;
+   memset (ciphertext->data, 0, ciphertext->len);
+
    if (ciphertext->len !=
        _mongocrypt_calculate_ciphertext_len (plaintext->len)) {
       CLIENT_ERR ("output ciphertext should have been allocated with %d bytes",
@@ -507,8 +726,6 @@ _mongocrypt_do_encryption (_mongocrypt_crypto_t *crypto,
       return false;
    }
 
-   *bytes_written = 0;
-
    if (MONGOCRYPT_IV_LEN != iv->len) {
       CLIENT_ERR ("IV should have length %d, but has length %d",
                   MONGOCRYPT_IV_LEN,
@@ -522,14 +739,34 @@ _mongocrypt_do_encryption (_mongocrypt_crypto_t *crypto,
       return false;
    }
 
+   return true;
+}
+
+
+/* [MCGREW]: Steps 1, 2 & 3. Prepend the IV and encrypt. */
+static bool
+_encryption_cipher_step (_mongocrypt_crypto_t *crypto,
+                         _mongocrypt_encryption_t *encryption,
+                         mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t enc_key = {0}, intermediate = {0};
+   const _mongocrypt_buffer_t *key;
+   const _mongocrypt_buffer_t *iv = encryption->iv;
+   const _mongocrypt_buffer_t *plaintext = encryption->plaintext;
+   _mongocrypt_buffer_t *ciphertext = encryption->ciphertext;
+   uint32_t intermediate_bytes_written = 0;
+
+   if (!_encryption_check (encryption, status)) {
+      return false;
+   }
+   key = &encryption->key_state->key;
+
    intermediate.len = ciphertext->len;
    intermediate.data = ciphertext->data;
 
    /* [MCGREW]: Step 1. "MAC_KEY consists of the initial MAC_KEY_LEN octets of
     * K, in order. ENC_KEY consists of the final ENC_KEY_LEN octets of K, in
     * order." */
-   mac_key.data = (uint8_t *) key->data;
-   mac_key.len = MONGOCRYPT_MAC_KEY_LEN;
    enc_key.data = (uint8_t *) key->data + MONGOCRYPT_MAC_KEY_LEN;
    enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
 
@@ -537,10 +774,11 @@ _mongocrypt_do_encryption (_mongocrypt_crypto_t *crypto,
    memcpy (intermediate.data, iv->data, iv->len);
    intermediate.data += iv->len;
    intermediate.len -= iv->len;
-   *bytes_written += iv->len;
+   encryption->bytes_written += iv->len;
 
    /* [MCGREW]: Steps 2 & 3. */
    if (!_encrypt_step (crypto,
+                       encryption->key_state->aes,
                        iv,
                        &enc_key,
                        plaintext,
@@ -550,61 +788,378 @@ _mongocrypt_do_encryption (_mongocrypt_crypto_t *crypto,
       return false;
    }
 
-   *bytes_written += intermediate_bytes_written;
+   encryption->bytes_written += intermediate_bytes_written;
+   return true;
+}
+
+
+/* [MCGREW]: Steps 4 & 5. Append the HMAC tag of the IV and ciphertext. */
+static bool
+_encryption_mac_step (_mongocrypt_crypto_t *crypto,
+                      _mongocrypt_encryption_t *encryption,
+                      mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t mac_key = {0}, intermediate = {0},
+                        intermediate_hmac = {0}, empty_buffer = {0};
+   _mongocrypt_buffer_t *ciphertext = encryption->ciphertext;
+
+   mac_key.data = (uint8_t *) encryption->key_state->key.data;
+   mac_key.len = MONGOCRYPT_MAC_KEY_LEN;
 
    /* Append the HMAC tag. */
-   intermediate_hmac.data = ciphertext->data + *bytes_written;
+   intermediate_hmac.data = ciphertext->data + encryption->bytes_written;
    intermediate_hmac.len = MONGOCRYPT_HMAC_LEN;
 
    intermediate.data = ciphertext->data;
-   intermediate.len = *bytes_written;
+   intermediate.len = encryption->bytes_written;
 
-   /* [MCGREW]: Steps 4 & 5, compute the HMAC. */
    if (!_hmac_step (crypto,
+                    encryption->key_state->mac,
                     &mac_key,
-                    associated_data ? associated_data : &empty_buffer,
+                    encryption->associated_data ? encryption->associated_data
+                                                : &empty_buffer,
                     &intermediate,
                     &intermediate_hmac,
                     status)) {
       return false;
    }
 
-   *bytes_written += MONGOCRYPT_HMAC_LEN;
+   encryption->bytes_written += MONGOCRYPT_HMAC_LEN;
    return true;
 }
 
 
+/* Associated data, input, and associated data length in bits. This is the
+ * order of the HMAC input for both the tag and the deterministic IV, with the
+ * input and length swapped for the latter. */
+static bool
+_concat_hmac_input (_mongocrypt_buffer_t *out,
+                    const _mongocrypt_buffer_t *associated_data,
+                    const _mongocrypt_buffer_t *in,
+                    bool length_last)
+{
+   _mongocrypt_buffer_t parts[3];
+   uint64_t associated_data_len_be;
+
+   _mongocrypt_buffer_init (&parts[0]);
+   _mongocrypt_buffer_init (&parts[1]);
+   _mongocrypt_buffer_init (&parts[2]);
+   associated_data_len_be = 8 * (uint64_t) associated_data->len;
+   associated_data_len_be = BSON_UINT64_TO_BE (associated_data_len_be);
+
+   parts[0].data = associated_data->data;
+   parts[0].len = associated_data->len;
+   parts[length_last ? 1 : 2].data = in->data;
+   parts[length_last ? 1 : 2].len = in->len;
+   parts[length_last ? 2 : 1].data = (uint8_t *) &associated_data_len_be;
+   parts[length_last ? 2 : 1].len = sizeof (uint64_t);
+
+   _mongocrypt_buffer_cleanup (out);
+   return _mongocrypt_buffer_concat (out, parts, 3);
+}
+
+
+/* Like _mongocrypt_do_encryption_batch, but with one call to the batch hook
+ * for all AES operations and one for all HMAC tags. */
+static bool
+_encryption_batch_with_hook (_mongocrypt_crypto_t *crypto,
+                             _mongocrypt_encryption_t *encryptions,
+                             uint32_t count,
+                             mongocrypt_status_t *status)
+{
+   mongocrypt_crypto_op_t *ops;
+   _mongocrypt_buffer_t *inputs;
+   uint8_t *tags;
+   _mongocrypt_buffer_t empty_buffer = {0};
+   uint32_t i;
+   bool ret = false;
+
+   if (count == 0) {
+      return true;
+   }
+
+   ops = bson_malloc0 (count * sizeof (*ops));
+   BSON_ASSERT (ops);
+   inputs = bson_malloc0 (count * sizeof (*inputs));
+   BSON_ASSERT (inputs);
+   tags = bson_malloc (count * MONGOCRYPT_HMAC_SHA512_LEN);
+   BSON_ASSERT (tags);
+
+   /* [MCGREW]: Steps 1, 2 & 3. Prepend the IV, and encrypt the padded
+    * plaintext. */
+   for (i = 0; i < count; i++) {
+      _mongocrypt_encryption_t *encryption = &encryptions[i];
+      const _mongocrypt_buffer_t *plaintext = encryption->plaintext;
+      _mongocrypt_buffer_t enc_key = {0}, out = {0};
+      uint32_t padding_byte;
+
+      if (!_encryption_check (encryption, status)) {
+         goto done;
+      }
+
+      padding_byte =
+         MONGOCRYPT_BLOCK_SIZE - (plaintext->len % MONGOCRYPT_BLOCK_SIZE);
+      _mongocrypt_buffer_resize (&inputs[i], plaintext->len + padding_byte);
+      memcpy (inputs[i].data, plaintext->data, plaintext->len);
+      memset (inputs[i].data + plaintext->len, padding_byte, padding_byte);
+
+      memcpy (encryption->ciphertext->data,
+              encryption->iv->data,
+              MONGOCRYPT_IV_LEN);
+
+      enc_key.data =
+         (uint8_t *) encryption->key_state->key.data + MONGOCRYPT_MAC_KEY_LEN;
+      enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
+      out.data = encryption->ciphertext->data + MONGOCRYPT_IV_LEN;
+      out.len = inputs[i].len;
+      _crypto_op_init (&ops[i],
+                       MONGOCRYPT_CRYPTO_OP_AES_256_CBC_ENCRYPT,
+                       &enc_key,
+                       encryption->iv,
+                       &inputs[i],
+                       &out);
+   }
+
+   if (!_crypto_batch (crypto, ops, count, status)) {
+      goto done;
+   }
+
+   /* [MCGREW]: Steps 4 & 5. Append the HMAC tag of the IV and ciphertext. */
+   for (i = 0; i < count; i++) {
+      _mongocrypt_encryption_t *encryption = &encryptions[i];
+      _mongocrypt_buffer_t mac_key = {0}, intermediate = {0}, tag = {0};
+
+      encryption->bytes_written = MONGOCRYPT_IV_LEN + ops[i].bytes_written;
+
+      intermediate.data = encryption->ciphertext->data;
+      intermediate.len = encryption->bytes_written;
+      if (!_concat_hmac_input (&inputs[i],
+                               encryption->associated_data
+                                  ? encryption->associated_data
+                                  : &empty_buffer,
+                               &intermediate,
+                               true)) {
+         CLIENT_ERR ("failed to allocate buffer");
+         goto done;
+      }
+
+      mac_key.data = (uint8_t *) encryption->key_state->key.data;
+      mac_key.len = MONGOCRYPT_MAC_KEY_LEN;
+      tag.data = tags + i * MONGOCRYPT_HMAC_SHA512_LEN;
+      tag.len = MONGOCRYPT_HMAC_SHA512_LEN;
+      _crypto_op_init (&ops[i],
+                       MONGOCRYPT_CRYPTO_OP_HMAC_SHA_512,
+                       &mac_key,
+                       NULL,
+                       &inputs[i],
+                       &tag);
+   }
+
+   if (!_crypto_batch (crypto, ops, count, status)) {
+      goto done;
+   }
+
+   for (i = 0; i < count; i++) {
+      _mongocrypt_encryption_t *encryption = &encryptions[i];
+
+      /* [MCGREW 2.7] "The HMAC-SHA-512 value is truncated to T_LEN=32 octets"
+       */
+      memcpy (encryption->ciphertext->data + encryption->bytes_written,
+              tags + i * MONGOCRYPT_HMAC_SHA512_LEN,
+              MONGOCRYPT_HMAC_LEN);
+      encryption->bytes_written += MONGOCRYPT_HMAC_LEN;
+   }
+
+   ret = true;
+
+done:
+   for (i = 0; i < count; i++) {
+      _mongocrypt_buffer_cleanup (&inputs[i]);
+   }
+   bson_free (inputs);
+   bson_free (tags);
+   bson_free (ops);
+   return ret;
+}
+
+
 /* ----------------------------------------------------------------------------
  *
- * _aes256_cbc_decrypt --
+ * _mongocrypt_do_encryption_batch --
  *
- *    Decrypts using AES256 CBC using a secret key and a known IV.
+ *    Encrypt a batch of independent fields.
+ *
+ *    All fields are encrypted with AES-256-CBC first, then all HMAC tags are
+ *    computed. Running one primitive over the whole batch keeps its code and
+ *    key schedules hot, and lets a native implementation pipeline the
+ *    independent CBC chains.
  *
  * Parameters:
- *    @enc_key a 32 byte key.
- *    @ciphertext the ciphertext to decrypt.
- *    @plaintext the resulting plaintext.
- *    @bytes_written a location for the resulting number of bytes written into
- *    plaintext->data.
+ *    @encryptions an array of @count fields to encrypt.
  *    @status set on error.
  *
  * Returns:
  *    True on success. On error, sets @status and returns false.
  *
  * Preconditions:
- *    1. plaintext->data has been pre-allocated with enough space for the
- *    resulting plaintext.
+ *    1. Each ciphertext->data has been pre-allocated with enough space for the
+ *    resulting ciphertext. Use _mongocrypt_calculate_ciphertext_len.
  *
  * Postconditions:
- *    1. bytes_written is set to the length of the written plaintext, excluding
- *    padding. This may be less than
- *    _mongocrypt_calculate_plaintext_len (ciphertext->len).
+ *    1. Each bytes_written is set to the length of the written ciphertext.
+ *    This is the same as _mongocrypt_calculate_ciphertext_len
+ *    (plaintext->len).
  *
  * ----------------------------------------------------------------------------
  */
-static bool
-_decrypt_step (_mongocrypt_crypto_t *crypto,
-               const _mongocrypt_buffer_t *iv,
+bool
+_mongocrypt_do_encryption_batch (_mongocrypt_crypto_t *crypto,
+                                 _mongocrypt_encryption_t *encryptions,
+                                 uint32_t count,
+                                 mongocrypt_status_t *status)
+{
+   uint32_t i;
+
+   BSON_ASSERT (encryptions || count == 0);
+
+   if (crypto->hooks_enabled && crypto->batch) {
+      return _encryption_batch_with_hook (crypto, encryptions, count, status);
+   }
+
+   for (i = 0; i < count; i++) {
+      if (!_encryption_cipher_step (crypto, &encryptions[i], status)) {
+         return false;
+      }
+   }
+
+   for (i = 0; i < count; i++) {
+      if (!_encryption_mac_step (crypto, &encryptions[i], status)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _mongocrypt_do_encryption_with_state --
+ *
+ *    Defer encryption to whichever crypto library libmongocrypt is using.
+ *
+ * Parameters:
+ *    @iv a 16 byte IV.
+ *    @associated_data associated data for the HMAC. May be NULL.
+ *    @key_state the state of a 96 byte key.
+ *    @plaintext the plaintext to encrypt.
+ *    @ciphertext a location for the resulting ciphertext and HMAC tag.
+ *    @bytes_written a location for the resulting bytes written.
+ *    @status set on error.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ * Preconditions:
+ *    1. ciphertext->data has been pre-allocated with enough space for the
+ *    resulting ciphertext. Use _mongocrypt_calculate_ciphertext_len.
+ *
+ * Postconditions:
+ *    1. bytes_written is set to the length of the written ciphertext. This
+ *    is the same as _mongocrypt_calculate_ciphertext_len (plaintext->len).
+ *
+ * ----------------------------------------------------------------------------
+ */
+bool
+_mongocrypt_do_encryption_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_buffer_t *iv,
+   const _mongocrypt_buffer_t *associated_data,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *plaintext,
+   _mongocrypt_buffer_t *ciphertext,
+   uint32_t *bytes_written,
+   mongocrypt_status_t *status)
+{
+   _mongocrypt_encryption_t encryption;
+   bool ret;
+
+   BSON_ASSERT (bytes_written);
+
+   encryption.key_state = key_state;
+   encryption.iv = iv;
+   encryption.associated_data = associated_data;
+   encryption.plaintext = plaintext;
+   encryption.ciphertext = ciphertext;
+   encryption.bytes_written = 0;
+
+   ret = _mongocrypt_do_encryption_batch (crypto, &encryption, 1, status);
+   *bytes_written = encryption.bytes_written;
+   return ret;
+}
+
+
+bool
+_mongocrypt_do_encryption (_mongocrypt_crypto_t *crypto,
+                           const _mongocrypt_buffer_t *iv,
+                           const _mongocrypt_buffer_t *associated_data,
+                           const _mongocrypt_buffer_t *key,
+                           const _mongocrypt_buffer_t *plaintext,
+                           _mongocrypt_buffer_t *ciphertext,
+                           uint32_t *bytes_written,
+                           mongocrypt_status_t *status)
+{
+   _mongocrypt_key_state_t key_state;
+
+   BSON_ASSERT (key);
+
+   /* Use the raw key without precomputed contexts. */
+   _mongocrypt_key_state_init (&key_state);
+   _mongocrypt_buffer_set_to (key, &key_state.key);
+   return _mongocrypt_do_encryption_with_state (crypto,
+                                                iv,
+                                                associated_data,
+                                                &key_state,
+                                                plaintext,
+                                                ciphertext,
+                                                bytes_written,
+                                                status);
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _aes256_cbc_decrypt --
+ *
+ *    Decrypts using AES256 CBC using a secret key and a known IV.
+ *
+ * Parameters:
+ *    @aes_ctx a precomputed context for @enc_key. May be NULL.
+ *    @enc_key a 32 byte key.
+ *    @ciphertext the ciphertext to decrypt.
+ *    @plaintext the resulting plaintext.
+ *    @bytes_written a location for the resulting number of bytes written into
+ *    plaintext->data.
+ *    @status set on error.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ * Preconditions:
+ *    1. plaintext->data has been pre-allocated with enough space for the
+ *    resulting plaintext.
+ *
+ * Postconditions:
+ *    1. bytes_written is set to the length of the written plaintext, excluding
+ *    padding. This may be less than
+ *    _mongocrypt_calculate_plaintext_len (ciphertext->len).
+ *
+ * ----------------------------------------------------------------------------
+ */
+static bool
+_decrypt_step (_mongocrypt_crypto_t *crypto,
+               _native_crypto_aes_256_cbc_ctx_t *aes_ctx,
+               const _mongocrypt_buffer_t *iv,
                const _mongocrypt_buffer_t *enc_key,
                const _mongocrypt_buffer_t *ciphertext,
                _mongocrypt_buffer_t *plaintext,
@@ -635,8 +1190,14 @@ _decrypt_step (_mongocrypt_crypto_t *crypto,
       return false;
    }
 
-   if (!_crypto_aes_256_cbc_decrypt (
-          crypto, iv, enc_key, ciphertext, plaintext, bytes_written, status)) {
+   if (!_crypto_aes_256_cbc_decrypt (crypto,
+                                     aes_ctx,
+                                     iv,
+                                     enc_key,
+                                     ciphertext,
+                                     plaintext,
+                                     bytes_written,
+                                     status)) {
       return false;
    }
 
@@ -650,53 +1211,21 @@ _decrypt_step (_mongocrypt_crypto_t *crypto,
 }
 
 
-/* ----------------------------------------------------------------------------
- *
- * _mongocrypt_do_decryption --
- *
- *    Defer decryption to whichever crypto library libmongocrypt is using.
- *
- * Parameters:
- *    @associated_data associated data for the HMAC. May be NULL.
- *    @key a 96 byte key.
- *    @ciphertext the ciphertext to decrypt. This contains the IV prepended.
- *    @plaintext a location for the resulting plaintext.
- *    @bytes_written a location for the resulting bytes written.
- *    @status set on error.
- *
- * Returns:
- *    True on success. On error, sets @status and returns false.
- *
- *  Preconditions:
- *    1. plaintext->data has been pre-allocated with enough space for the
- *    resulting plaintext and padding. See _mongocrypt_calculate_plaintext_len.
- *
- *  Postconditions:
- *    1. bytes_written is set to the length of the written plaintext, excluding
- *    padding. This may be less than
- *    _mongocrypt_calculate_plaintext_len (ciphertext->len).
- *
- * ----------------------------------------------------------------------------
- */
-bool
-_mongocrypt_do_decryption (_mongocrypt_crypto_t *crypto,
-                           const _mongocrypt_buffer_t *associated_data,
-                           const _mongocrypt_buffer_t *key,
-                           const _mongocrypt_buffer_t *ciphertext,
-                           _mongocrypt_buffer_t *plaintext,
-                           uint32_t *bytes_written,
-                           mongocrypt_status_t *status)
+/* [MCGREW 2.2]: Steps 1 & 2. Validate the lengths. */
+static bool
+_decryption_check (_mongocrypt_decryption_t *decryption,
+                   mongocrypt_status_t *status)
 {
-   bool ret = false;
-   _mongocrypt_buffer_t mac_key = {0}, enc_key = {0}, intermediate = {0},
-                        hmac_tag = {0}, iv = {0}, empty_buffer = {0};
-   uint8_t hmac_tag_storage[MONGOCRYPT_HMAC_LEN];
+   const _mongocrypt_buffer_t *key;
+   const _mongocrypt_buffer_t *ciphertext = decryption->ciphertext;
+   _mongocrypt_buffer_t *plaintext = decryption->plaintext;
 
-   BSON_ASSERT (key);
+   BSON_ASSERT (decryption->key_state);
+   key = &decryption->key_state->key;
    BSON_ASSERT (ciphertext);
    BSON_ASSERT (plaintext);
-   BSON_ASSERT (bytes_written);
-   BSON_ASSERT (status);
+
+   decryption->bytes_written = 0;
 
    if (plaintext->len !=
        _mongocrypt_calculate_plaintext_len (ciphertext->len)) {
@@ -719,16 +1248,33 @@ _mongocrypt_do_decryption (_mongocrypt_crypto_t *crypto,
       CLIENT_ERR ("corrupt ciphertext - must be > %d bytes",
                   MONGOCRYPT_HMAC_LEN + MONGOCRYPT_IV_LEN +
                      MONGOCRYPT_BLOCK_SIZE);
-      goto done;
+      return false;
+   }
+
+   return true;
+}
+
+
+/* [MCGREW 2.2]: Steps 1, 2 & 3. Validate the lengths and verify the HMAC tag.
+ */
+static bool
+_decryption_mac_step (_mongocrypt_crypto_t *crypto,
+                      _mongocrypt_decryption_t *decryption,
+                      mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t mac_key = {0}, intermediate = {0}, hmac_tag = {0},
+                        empty_buffer = {0};
+   const _mongocrypt_buffer_t *key;
+   const _mongocrypt_buffer_t *ciphertext = decryption->ciphertext;
+   uint8_t hmac_tag_storage[MONGOCRYPT_HMAC_LEN];
+
+   if (!_decryption_check (decryption, status)) {
+      return false;
    }
+   key = &decryption->key_state->key;
 
    mac_key.data = (uint8_t *) key->data;
    mac_key.len = MONGOCRYPT_MAC_KEY_LEN;
-   enc_key.data = (uint8_t *) key->data + MONGOCRYPT_MAC_KEY_LEN;
-   enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
-
-   iv.data = ciphertext->data;
-   iv.len = MONGOCRYPT_IV_LEN;
 
    intermediate.data = (uint8_t *) ciphertext->data;
    intermediate.len = ciphertext->len - MONGOCRYPT_HMAC_LEN;
@@ -738,12 +1284,14 @@ _mongocrypt_do_decryption (_mongocrypt_crypto_t *crypto,
 
    /* [MCGREW 2.2]: Step 3: HMAC check. */
    if (!_hmac_step (crypto,
+                    decryption->key_state->mac,
                     &mac_key,
-                    associated_data ? associated_data : &empty_buffer,
+                    decryption->associated_data ? decryption->associated_data
+                                                : &empty_buffer,
                     &intermediate,
                     &hmac_tag,
                     status)) {
-      goto done;
+      return false;
    }
 
    /* [MCGREW] "using a comparison routine that takes constant time". */
@@ -752,109 +1300,517 @@ _mongocrypt_do_decryption (_mongocrypt_crypto_t *crypto,
                                      (ciphertext->len - MONGOCRYPT_HMAC_LEN),
                                   MONGOCRYPT_HMAC_LEN)) {
       CLIENT_ERR ("HMAC validation failure");
-      goto done;
+      return false;
    }
 
+   return true;
+}
+
+
+/* [MCGREW 2.2]: Step 4. Decrypt a ciphertext with a verified HMAC tag. */
+static bool
+_decryption_cipher_step (_mongocrypt_crypto_t *crypto,
+                         _mongocrypt_decryption_t *decryption,
+                         mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t enc_key = {0}, intermediate = {0}, iv = {0};
+   const _mongocrypt_buffer_t *ciphertext = decryption->ciphertext;
+
+   enc_key.data =
+      (uint8_t *) decryption->key_state->key.data + MONGOCRYPT_MAC_KEY_LEN;
+   enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
+
+   iv.data = ciphertext->data;
+   iv.len = MONGOCRYPT_IV_LEN;
+
    /* Decrypt data excluding IV + HMAC. */
    intermediate.data = (uint8_t *) ciphertext->data + MONGOCRYPT_IV_LEN;
    intermediate.len =
       ciphertext->len - (MONGOCRYPT_IV_LEN + MONGOCRYPT_HMAC_LEN);
 
-   if (!_decrypt_step (crypto,
-                       &iv,
+   return _decrypt_step (crypto,
+                         decryption->key_state->aes,
+                         &iv,
+                         &enc_key,
+                         &intermediate,
+                         decryption->plaintext,
+                         &decryption->bytes_written,
+                         status);
+}
+
+
+/* Like _mongocrypt_do_decryption_batch, but with one call to the batch hook
+ * for all HMAC tags and one for all AES operations. */
+static bool
+_decryption_batch_with_hook (_mongocrypt_crypto_t *crypto,
+                             _mongocrypt_decryption_t *decryptions,
+                             uint32_t count,
+                             mongocrypt_status_t *status)
+{
+   mongocrypt_crypto_op_t *ops;
+   _mongocrypt_buffer_t *inputs;
+   uint8_t *tags;
+   _mongocrypt_buffer_t empty_buffer = {0};
+   uint32_t i;
+   bool ret = false;
+
+   if (count == 0) {
+      return true;
+   }
+
+   ops = bson_malloc0 (count * sizeof (*ops));
+   BSON_ASSERT (ops);
+   inputs = bson_malloc0 (count * sizeof (*inputs));
+   BSON_ASSERT (inputs);
+   tags = bson_malloc (count * MONGOCRYPT_HMAC_SHA512_LEN);
+   BSON_ASSERT (tags);
+
+   /* [MCGREW 2.2]: Steps 1, 2 & 3. Verify every HMAC tag. */
+   for (i = 0; i < count; i++) {
+      _mongocrypt_decryption_t *decryption = &decryptions[i];
+      _mongocrypt_buffer_t mac_key = {0}, intermediate = {0}, tag = {0};
+
+      if (!_decryption_check (decryption, status)) {
+         goto done;
+      }
+
+      intermediate.data = decryption->ciphertext->data;
+      intermediate.len = decryption->ciphertext->len - MONGOCRYPT_HMAC_LEN;
+      if (!_concat_hmac_input (&inputs[i],
+                               decryption->associated_data
+                                  ? decryption->associated_data
+                                  : &empty_buffer,
+                               &intermediate,
+                               true)) {
+         CLIENT_ERR ("failed to allocate buffer");
+         goto done;
+      }
+
+      mac_key.data = (uint8_t *) decryption->key_state->key.data;
+      mac_key.len = MONGOCRYPT_MAC_KEY_LEN;
+      tag.data = tags + i * MONGOCRYPT_HMAC_SHA512_LEN;
+      tag.len = MONGOCRYPT_HMAC_SHA512_LEN;
+      _crypto_op_init (&ops[i],
+                       MONGOCRYPT_CRYPTO_OP_HMAC_SHA_512,
+                       &mac_key,
+                       NULL,
+                       &inputs[i],
+                       &tag);
+   }
+
+   if (!_crypto_batch (crypto, ops, count, status)) {
+      goto done;
+   }
+
+   for (i = 0; i < count; i++) {
+      const _mongocrypt_buffer_t *ciphertext = decryptions[i].ciphertext;
+
+      /* [MCGREW] "using a comparison routine that takes constant time". */
+      if (0 != _mongocrypt_memequal (tags + i * MONGOCRYPT_HMAC_SHA512_LEN,
+                                     ciphertext->data +
+                                        (ciphertext->len - MONGOCRYPT_HMAC_LEN),
+                                     MONGOCRYPT_HMAC_LEN)) {
+         CLIENT_ERR ("HMAC validation failure");
+         goto done;
+      }
+   }
+
+   /* [MCGREW 2.2]: Step 4. Decrypt the data between the IV and the tag. */
+   for (i = 0; i < count; i++) {
+      _mongocrypt_decryption_t *decryption = &decryptions[i];
+      const _mongocrypt_buffer_t *ciphertext = decryption->ciphertext;
+      _mongocrypt_buffer_t enc_key = {0}, iv = {0}, intermediate = {0};
+
+      enc_key.data =
+         (uint8_t *) decryption->key_state->key.data + MONGOCRYPT_MAC_KEY_LEN;
+      enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
+      iv.data = ciphertext->data;
+      iv.len = MONGOCRYPT_IV_LEN;
+      intermediate.data = (uint8_t *) ciphertext->data + MONGOCRYPT_IV_LEN;
+      intermediate.len =
+         ciphertext->len - (MONGOCRYPT_IV_LEN + MONGOCRYPT_HMAC_LEN);
+
+      if (intermediate.len % MONGOCRYPT_BLOCK_SIZE > 0) {
+         CLIENT_ERR (
+            "error, ciphertext length is not a multiple of block size");
+         goto done;
+      }
+
+      _crypto_op_init (&ops[i],
+                       MONGOCRYPT_CRYPTO_OP_AES_256_CBC_DECRYPT,
                        &enc_key,
+                       &iv,
                        &intermediate,
-                       plaintext,
-                       bytes_written,
-                       status)) {
+                       decryption->plaintext);
+   }
+
+   if (!_crypto_batch (crypto, ops, count, status)) {
       goto done;
    }
 
+   for (i = 0; i < count; i++) {
+      _mongocrypt_decryption_t *decryption = &decryptions[i];
+      uint8_t padding_byte;
+
+      decryption->bytes_written = ops[i].bytes_written;
+      padding_byte =
+         decryption->plaintext->data[decryption->bytes_written - 1];
+      if (padding_byte > 16) {
+         CLIENT_ERR ("error, ciphertext malformed padding");
+         goto done;
+      }
+      decryption->bytes_written -= padding_byte;
+   }
+
    ret = true;
+
 done:
+   for (i = 0; i < count; i++) {
+      _mongocrypt_buffer_cleanup (&inputs[i]);
+   }
+   bson_free (inputs);
+   bson_free (tags);
+   bson_free (ops);
    return ret;
 }
 
 
 /* ----------------------------------------------------------------------------
  *
- * _mongocrypt_random --
+ * _mongocrypt_do_decryption_batch --
  *
- *    Generates a string of random bytes.
+ *    Decrypt a batch of independent fields.
+ *
+ *    The HMAC tags of all fields are verified first, then all fields are
+ *    decrypted. No plaintext is produced unless every tag in the batch is
+ *    valid.
  *
  * Parameters:
- *    @out an output buffer that has been pre-allocated.
+ *    @decryptions an array of @count fields to decrypt.
  *    @status set on error.
- *    @count the size of the random string in bytes.
  *
  * Returns:
  *    True on success. On error, sets @status and returns false.
  *
  *  Preconditions:
- *    1. out has been pre-allocated with at least 'count' bytes of space.
+ *    1. Each plaintext->data has been pre-allocated with enough space for the
+ *    resulting plaintext and padding. See _mongocrypt_calculate_plaintext_len.
+ *
+ *  Postconditions:
+ *    1. Each bytes_written is set to the length of the written plaintext,
+ *    excluding padding.
  *
  * ----------------------------------------------------------------------------
  */
 bool
-_mongocrypt_random (_mongocrypt_crypto_t *crypto,
-                    _mongocrypt_buffer_t *out,
-                    uint32_t count,
-                    mongocrypt_status_t *status)
+_mongocrypt_do_decryption_batch (_mongocrypt_crypto_t *crypto,
+                                 _mongocrypt_decryption_t *decryptions,
+                                 uint32_t count,
+                                 mongocrypt_status_t *status)
 {
-   BSON_ASSERT (out);
+   uint32_t i;
+
+   BSON_ASSERT (decryptions || count == 0);
    BSON_ASSERT (status);
-   if (count != out->len) {
-      CLIENT_ERR (
-         "out should have length %d, but has length %d", count, out->len);
-      return false;
+
+   if (crypto->hooks_enabled && crypto->batch) {
+      return _decryption_batch_with_hook (crypto, decryptions, count, status);
    }
 
-   return _crypto_random (crypto, out, count, status);
+   for (i = 0; i < count; i++) {
+      if (!_decryption_mac_step (crypto, &decryptions[i], status)) {
+         return false;
+      }
+   }
+
+   for (i = 0; i < count; i++) {
+      if (!_decryption_cipher_step (crypto, &decryptions[i], status)) {
+         return false;
+      }
+   }
+
+   return true;
 }
 
 
 /* ----------------------------------------------------------------------------
  *
- * _mongocrypt_calculate_deterministic_iv --
+ * _mongocrypt_do_decryption_with_state --
  *
- *    Compute the IV for deterministic encryption from the plaintext and IV
- *    key by using HMAC function.
+ *    Defer decryption to whichever crypto library libmongocrypt is using.
  *
  * Parameters:
- *    @key the 96 byte key. The last 32 represent the IV key.
- *    @plaintext the plaintext to be encrypted.
- *    @associated_data associated data to include in the HMAC.
- *    @out an output buffer that has been pre-allocated.
+ *    @associated_data associated data for the HMAC. May be NULL.
+ *    @key_state the state of a 96 byte key.
+ *    @ciphertext the ciphertext to decrypt. This contains the IV prepended.
+ *    @plaintext a location for the resulting plaintext.
+ *    @bytes_written a location for the resulting bytes written.
  *    @status set on error.
  *
  * Returns:
  *    True on success. On error, sets @status and returns false.
  *
  *  Preconditions:
- *    1. out has been pre-allocated with at least MONGOCRYPT_IV_LEN bytes.
+ *    1. plaintext->data has been pre-allocated with enough space for the
+ *    resulting plaintext and padding. See _mongocrypt_calculate_plaintext_len.
+ *
+ *  Postconditions:
+ *    1. bytes_written is set to the length of the written plaintext, excluding
+ *    padding. This may be less than
+ *    _mongocrypt_calculate_plaintext_len (ciphertext->len).
  *
  * ----------------------------------------------------------------------------
  */
 bool
-_mongocrypt_calculate_deterministic_iv (
+_mongocrypt_do_decryption_with_state (
    _mongocrypt_crypto_t *crypto,
-   const _mongocrypt_buffer_t *key,
+   const _mongocrypt_buffer_t *associated_data,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *ciphertext,
+   _mongocrypt_buffer_t *plaintext,
+   uint32_t *bytes_written,
+   mongocrypt_status_t *status)
+{
+   _mongocrypt_decryption_t decryption;
+   bool ret;
+
+   BSON_ASSERT (bytes_written);
+
+   decryption.key_state = key_state;
+   decryption.associated_data = associated_data;
+   decryption.ciphertext = ciphertext;
+   decryption.plaintext = plaintext;
+   decryption.bytes_written = 0;
+
+   ret = _mongocrypt_do_decryption_batch (crypto, &decryption, 1, status);
+   *bytes_written = decryption.bytes_written;
+   return ret;
+}
+
+
+bool
+_mongocrypt_do_decryption (_mongocrypt_crypto_t *crypto,
+                           const _mongocrypt_buffer_t *associated_data,
+                           const _mongocrypt_buffer_t *key,
+                           const _mongocrypt_buffer_t *ciphertext,
+                           _mongocrypt_buffer_t *plaintext,
+                           uint32_t *bytes_written,
+                           mongocrypt_status_t *status)
+{
+   _mongocrypt_key_state_t key_state;
+
+   BSON_ASSERT (key);
+
+   /* Use the raw key without precomputed contexts. */
+   _mongocrypt_key_state_init (&key_state);
+   _mongocrypt_buffer_set_to (key, &key_state.key);
+   return _mongocrypt_do_decryption_with_state (crypto,
+                                                associated_data,
+                                                &key_state,
+                                                ciphertext,
+                                                plaintext,
+                                                bytes_written,
+                                                status);
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _mongocrypt_random --
+ *
+ *    Generates a string of random bytes.
+ *
+ * Parameters:
+ *    @out an output buffer that has been pre-allocated.
+ *    @status set on error.
+ *    @count the size of the random string in bytes.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ *  Preconditions:
+ *    1. out has been pre-allocated with at least 'count' bytes of space.
+ *
+ * ----------------------------------------------------------------------------
+ */
+bool
+_mongocrypt_random (_mongocrypt_crypto_t *crypto,
+                    _mongocrypt_buffer_t *out,
+                    uint32_t count,
+                    mongocrypt_status_t *status)
+{
+   BSON_ASSERT (out);
+   BSON_ASSERT (status);
+   if (count != out->len) {
+      CLIENT_ERR (
+         "out should have length %d, but has length %d", count, out->len);
+      return false;
+   }
+
+   return _crypto_random (crypto, out, count, status);
+}
+
+
+static int
+_current_pid (void)
+{
+#if defined(BSON_OS_UNIX)
+   return (int) getpid ();
+#else
+   /* There is no fork on Windows. */
+   return 0;
+#endif
+}
+
+
+void
+_mongocrypt_random_pool_init (_mongocrypt_random_pool_t *pool)
+{
+   BSON_ASSERT (pool);
+
+   memset (pool, 0, sizeof (*pool));
+   _mongocrypt_mutex_init (&pool->mutex);
+   pool->pos = MONGOCRYPT_RANDOM_POOL_LEN;
+}
+
+
+void
+_mongocrypt_random_pool_cleanup (_mongocrypt_random_pool_t *pool)
+{
+   if (!pool) {
+      return;
+   }
+
+   _mongocrypt_mutex_cleanup (&pool->mutex);
+}
+
+
+uint64_t
+_mongocrypt_random_pool_calls_saved (_mongocrypt_random_pool_t *pool)
+{
+   uint64_t saved;
+
+   BSON_ASSERT (pool);
+
+   _mongocrypt_mutex_lock (&pool->mutex);
+   saved = pool->requests > pool->fills ? pool->requests - pool->fills : 0;
+   _mongocrypt_mutex_unlock (&pool->mutex);
+   return saved;
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _mongocrypt_random_iv --
+ *
+ *    Generates a random IV from the random pool of @crypto. The pool is
+ *    refilled when it cannot satisfy the request, or when the process has
+ *    forked since it was filled.
+ *
+ * Parameters:
+ *    @iv an output buffer that has been pre-allocated with
+ *    MONGOCRYPT_IV_LEN bytes.
+ *    @status set on error.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ * ----------------------------------------------------------------------------
+ */
+bool
+_mongocrypt_random_iv (_mongocrypt_crypto_t *crypto,
+                       _mongocrypt_buffer_t *iv,
+                       mongocrypt_status_t *status)
+{
+   _mongocrypt_random_pool_t *pool;
+   _mongocrypt_buffer_t chunk;
+   bool ret = false;
+   int pid;
+
+   BSON_ASSERT (crypto);
+   BSON_ASSERT (iv);
+   BSON_ASSERT (status);
+
+   if (iv->len != MONGOCRYPT_IV_LEN) {
+      CLIENT_ERR ("out should have length %d, but has length %d",
+                  MONGOCRYPT_IV_LEN,
+                  iv->len);
+      return false;
+   }
+
+   pool = crypto->random_pool;
+   if (!pool) {
+      return _crypto_random (crypto, iv, MONGOCRYPT_IV_LEN, status);
+   }
+
+   pid = _current_pid ();
+   _mongocrypt_mutex_lock (&pool->mutex);
+   if (pool->pos + MONGOCRYPT_IV_LEN > MONGOCRYPT_RANDOM_POOL_LEN ||
+       pool->pid != pid) {
+      _mongocrypt_buffer_init (&chunk);
+      chunk.data = pool->data;
+      chunk.len = MONGOCRYPT_RANDOM_POOL_LEN;
+      if (!_crypto_random (
+             crypto, &chunk, MONGOCRYPT_RANDOM_POOL_LEN, status)) {
+         /* Leave the pool empty so the next request tries again. */
+         pool->pos = MONGOCRYPT_RANDOM_POOL_LEN;
+         goto done;
+      }
+      pool->fills++;
+      pool->pos = 0;
+      pool->pid = pid;
+   }
+
+   memcpy (iv->data, pool->data + pool->pos, MONGOCRYPT_IV_LEN);
+   pool->pos += MONGOCRYPT_IV_LEN;
+   pool->requests++;
+   ret = true;
+
+done:
+   _mongocrypt_mutex_unlock (&pool->mutex);
+   return ret;
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _mongocrypt_calculate_deterministic_digest_with_state --
+ *
+ *    Compute the full HMAC from which the deterministic IV is taken. This is a
+ *    keyed hash of the associated data and plaintext under the IV key.
+ *
+ * Parameters:
+ *    @key_state the state of a 96 byte key. The last 32 bytes of the key
+ *    represent the IV key.
+ *    @plaintext the plaintext to be encrypted.
+ *    @associated_data associated data to include in the HMAC.
+ *    @out an output buffer that has been pre-allocated.
+ *    @status set on error.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ *  Preconditions:
+ *    1. out has been pre-allocated with MONGOCRYPT_HMAC_SHA512_LEN bytes.
+ *
+ * ----------------------------------------------------------------------------
+ */
+bool
+_mongocrypt_calculate_deterministic_digest_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
    const _mongocrypt_buffer_t *plaintext,
    const _mongocrypt_buffer_t *associated_data,
    _mongocrypt_buffer_t *out,
    mongocrypt_status_t *status)
 {
    _mongocrypt_buffer_t intermediates[3];
-   _mongocrypt_buffer_t to_hmac;
    _mongocrypt_buffer_t iv_key;
+   const _mongocrypt_buffer_t *key;
    uint64_t associated_data_len_be;
-   uint8_t tag_storage[64];
-   _mongocrypt_buffer_t tag;
-   bool ret = false;
 
-   _mongocrypt_buffer_init (&to_hmac);
-
-   BSON_ASSERT (key);
+   BSON_ASSERT (key_state);
+   key = &key_state->key;
    BSON_ASSERT (plaintext);
    BSON_ASSERT (associated_data);
    BSON_ASSERT (out);
@@ -864,13 +1820,13 @@ _mongocrypt_calculate_deterministic_iv (
       CLIENT_ERR ("key should have length %d, but has length %d\n",
                   MONGOCRYPT_KEY_LEN,
                   key->len);
-      goto done;
+      return false;
    }
-   if (MONGOCRYPT_IV_LEN != out->len) {
+   if (MONGOCRYPT_HMAC_SHA512_LEN != out->len) {
       CLIENT_ERR ("out should have length %d, but has length %d\n",
-                  MONGOCRYPT_IV_LEN,
+                  MONGOCRYPT_HMAC_SHA512_LEN,
                   out->len);
-      goto done;
+      return false;
    }
 
    _mongocrypt_buffer_init (&iv_key);
@@ -892,23 +1848,672 @@ _mongocrypt_calculate_deterministic_iv (
    intermediates[2].data = (uint8_t *) plaintext->data;
    intermediates[2].len = plaintext->len;
 
-   tag.data = tag_storage;
-   tag.len = sizeof (tag_storage);
+   return _crypto_hmac_sha_512 (
+      crypto, key_state->iv_mac, &iv_key, intermediates, 3, out, status);
+}
 
-   if (!_mongocrypt_buffer_concat (&to_hmac, intermediates, 3)) {
-      CLIENT_ERR ("failed to allocate buffer");
-      goto done;
+
+bool
+_mongocrypt_calculate_deterministic_digest_batch (
+   _mongocrypt_crypto_t *crypto,
+   _mongocrypt_digest_t *digests,
+   uint32_t count,
+   mongocrypt_status_t *status)
+{
+   mongocrypt_crypto_op_t *ops;
+   _mongocrypt_buffer_t *inputs;
+   uint32_t i;
+   bool ret = false;
+
+   BSON_ASSERT (digests || count == 0);
+   BSON_ASSERT (status);
+
+   if (!crypto->hooks_enabled || !crypto->batch) {
+      for (i = 0; i < count; i++) {
+         if (!_mongocrypt_calculate_deterministic_digest_with_state (
+                crypto,
+                digests[i].key_state,
+                digests[i].plaintext,
+                digests[i].associated_data,
+                digests[i].out,
+                status)) {
+            return false;
+         }
+      }
+      return true;
    }
 
-   if (!_crypto_hmac_sha_512 (crypto, &iv_key, &to_hmac, &tag, status)) {
-      goto done;
+   if (count == 0) {
+      return true;
    }
 
-   /* Truncate to IV length */
-   memcpy (out->data, tag.data, MONGOCRYPT_IV_LEN);
+   ops = bson_malloc0 (count * sizeof (*ops));
+   BSON_ASSERT (ops);
+   inputs = bson_malloc0 (count * sizeof (*inputs));
+   BSON_ASSERT (inputs);
+
+   for (i = 0; i < count; i++) {
+      const _mongocrypt_buffer_t *key = &digests[i].key_state->key;
+      _mongocrypt_buffer_t iv_key;
+
+      if (MONGOCRYPT_KEY_LEN != key->len) {
+         CLIENT_ERR ("key should have length %d, but has length %d\n",
+                     MONGOCRYPT_KEY_LEN,
+                     key->len);
+         goto done;
+      }
+      if (MONGOCRYPT_HMAC_SHA512_LEN != digests[i].out->len) {
+         CLIENT_ERR ("out should have length %d, but has length %d\n",
+                     MONGOCRYPT_HMAC_SHA512_LEN,
+                     digests[i].out->len);
+         goto done;
+      }
+
+      if (!_concat_hmac_input (&inputs[i],
+                               digests[i].associated_data,
+                               digests[i].plaintext,
+                               false)) {
+         CLIENT_ERR ("failed to allocate buffer");
+         goto done;
+      }
+
+      _mongocrypt_buffer_init (&iv_key);
+      iv_key.data = key->data + MONGOCRYPT_ENC_KEY_LEN + MONGOCRYPT_MAC_KEY_LEN;
+      iv_key.len = MONGOCRYPT_IV_KEY_LEN;
+      _crypto_op_init (&ops[i],
+                       MONGOCRYPT_CRYPTO_OP_HMAC_SHA_512,
+                       &iv_key,
+                       NULL,
+                       &inputs[i],
+                       digests[i].out);
+   }
+
+   ret = _crypto_batch (crypto, ops, count, status);
 
-   ret = true;
 done:
-   _mongocrypt_buffer_cleanup (&to_hmac);
+   for (i = 0; i < count; i++) {
+      _mongocrypt_buffer_cleanup (&inputs[i]);
+   }
+   bson_free (inputs);
+   bson_free (ops);
    return ret;
-}
\ No newline at end of file
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _mongocrypt_calculate_deterministic_iv_with_state --
+ *
+ *    Compute the IV for deterministic encryption from the plaintext and IV
+ *    key by using HMAC function.
+ *
+ * Parameters:
+ *    @key_state the state of a 96 byte key. The last 32 bytes of the key
+ *    represent the IV key.
+ *    @plaintext the plaintext to be encrypted.
+ *    @associated_data associated data to include in the HMAC.
+ *    @out an output buffer that has been pre-allocated.
+ *    @status set on error.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ *  Preconditions:
+ *    1. out has been pre-allocated with at least MONGOCRYPT_IV_LEN bytes.
+ *
+ * ----------------------------------------------------------------------------
+ */
+bool
+_mongocrypt_calculate_deterministic_iv_with_state (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *plaintext,
+   const _mongocrypt_buffer_t *associated_data,
+   _mongocrypt_buffer_t *out,
+   mongocrypt_status_t *status)
+{
+   uint8_t tag_storage[MONGOCRYPT_HMAC_SHA512_LEN];
+   _mongocrypt_buffer_t tag;
+
+   BSON_ASSERT (out);
+   BSON_ASSERT (status);
+
+   if (MONGOCRYPT_IV_LEN != out->len) {
+      CLIENT_ERR ("out should have length %d, but has length %d\n",
+                  MONGOCRYPT_IV_LEN,
+                  out->len);
+      return false;
+   }
+
+   _mongocrypt_buffer_init (&tag);
+   tag.data = tag_storage;
+   tag.len = sizeof (tag_storage);
+
+   if (!_mongocrypt_calculate_deterministic_digest_with_state (
+          crypto, key_state, plaintext, associated_data, &tag, status)) {
+      return false;
+   }
+
+   /* Truncate to IV length */
+   memcpy (out->data, tag.data, MONGOCRYPT_IV_LEN);
+   return true;
+}
+
+
+bool
+_mongocrypt_calculate_deterministic_iv (
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_buffer_t *key,
+   const _mongocrypt_buffer_t *plaintext,
+   const _mongocrypt_buffer_t *associated_data,
+   _mongocrypt_buffer_t *out,
+   mongocrypt_status_t *status)
+{
+   _mongocrypt_key_state_t key_state;
+
+   BSON_ASSERT (key);
+
+   /* Use the raw key without precomputed contexts. */
+   _mongocrypt_key_state_init (&key_state);
+   _mongocrypt_buffer_set_to (key, &key_state.key);
+   return _mongocrypt_calculate_deterministic_iv_with_state (
+      crypto, &key_state, plaintext, associated_data, out, status);
+}
+
+
+void
+_mongocrypt_key_state_init (_mongocrypt_key_state_t *state)
+{
+   BSON_ASSERT (state);
+
+   memset (state, 0, sizeof (*state));
+}
+
+
+/* ----------------------------------------------------------------------------
+ *
+ * _mongocrypt_key_state_set --
+ *
+ *    Copy a 96 byte key into a key state and precompute the native contexts
+ *    for each part of the key: the AES-256-CBC context for the encryption key
+ *    and HMAC-SHA-512 contexts for the MAC key and the IV key.
+ *
+ * Parameters:
+ *    @state an initialized key state. Previous contents are cleaned up.
+ *    @key a 96 byte key.
+ *    @status set on error.
+ *
+ * Returns:
+ *    True on success. On error, sets @status and returns false.
+ *
+ * Postconditions:
+ *    1. If crypto hooks are enabled, or the native crypto implementation does
+ *    not support precomputed contexts, only the key is copied.
+ *
+ * ----------------------------------------------------------------------------
+ */
+bool
+_mongocrypt_key_state_set (_mongocrypt_crypto_t *crypto,
+                           _mongocrypt_key_state_t *state,
+                           const _mongocrypt_buffer_t *key,
+                           mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t mac_key, enc_key, iv_key;
+
+   BSON_ASSERT (crypto);
+   BSON_ASSERT (state);
+   BSON_ASSERT (key);
+
+   _mongocrypt_key_state_cleanup (state);
+   _mongocrypt_key_state_init (state);
+
+   if (MONGOCRYPT_KEY_LEN != key->len) {
+      CLIENT_ERR ("key should have length %d, but has length %d",
+                  MONGOCRYPT_KEY_LEN,
+                  key->len);
+      return false;
+   }
+
+   _mongocrypt_buffer_copy_to (key, &state->key);
+
+   if (crypto->hooks_enabled) {
+      return true;
+   }
+
+   _mongocrypt_buffer_init (&mac_key);
+   mac_key.data = state->key.data;
+   mac_key.len = MONGOCRYPT_MAC_KEY_LEN;
+   _mongocrypt_buffer_init (&enc_key);
+   enc_key.data = state->key.data + MONGOCRYPT_MAC_KEY_LEN;
+   enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
+   _mongocrypt_buffer_init (&iv_key);
+   iv_key.data =
+      state->key.data + MONGOCRYPT_MAC_KEY_LEN + MONGOCRYPT_ENC_KEY_LEN;
+   iv_key.len = MONGOCRYPT_IV_KEY_LEN;
+
+   /* The _new functions return NULL without an error if unsupported. */
+   state->aes = _native_crypto_aes_256_cbc_ctx_new (&enc_key, status);
+   if (!state->aes && !mongocrypt_status_ok (status)) {
+      return false;
+   }
+   state->mac = _native_crypto_hmac_sha_512_ctx_new (&mac_key, status);
+   if (!state->mac && !mongocrypt_status_ok (status)) {
+      return false;
+   }
+   state->iv_mac = _native_crypto_hmac_sha_512_ctx_new (&iv_key, status);
+   if (!state->iv_mac && !mongocrypt_status_ok (status)) {
+      return false;
+   }
+   return true;
+}
+
+
+void
+_mongocrypt_key_state_cleanup (_mongocrypt_key_state_t *state)
+{
+   if (!state) {
+      return;
+   }
+
+   _native_crypto_aes_256_cbc_ctx_destroy (state->aes);
+   _native_crypto_hmac_sha_512_ctx_destroy (state->mac);
+   _native_crypto_hmac_sha_512_ctx_destroy (state->iv_mac);
+   _mongocrypt_buffer_cleanup (&state->key);
+   _mongocrypt_key_state_init (state);
+}
+
+
+void
+_mongocrypt_crypto_stream_init (_mongocrypt_crypto_stream_t *stream)
+{
+   BSON_ASSERT (stream);
+
+   memset (stream, 0, sizeof (*stream));
+}
+
+
+static bool
+_stream_hmac_update (_mongocrypt_crypto_stream_t *stream,
+                     const uint8_t *data,
+                     uint32_t len,
+                     mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t in;
+
+   _mongocrypt_buffer_init (&in);
+   in.data = (uint8_t *) data;
+   in.len = len;
+   return _native_crypto_hmac_sha_512_ctx_update (
+      stream->key_state->mac, &in, status);
+}
+
+
+static bool
+_stream_start (_mongocrypt_crypto_stream_t *stream,
+               _mongocrypt_crypto_t *crypto,
+               const _mongocrypt_key_state_t *key_state,
+               const _mongocrypt_buffer_t *associated_data,
+               bool encrypt,
+               mongocrypt_status_t *status)
+{
+   BSON_ASSERT (stream);
+   BSON_ASSERT (crypto);
+   BSON_ASSERT (key_state);
+   BSON_ASSERT (associated_data);
+
+   if (MONGOCRYPT_KEY_LEN != key_state->key.len) {
+      CLIENT_ERR ("key should have length %d, but has length %d",
+                  MONGOCRYPT_KEY_LEN,
+                  key_state->key.len);
+      return false;
+   }
+
+   /* Crypto hooks and some native implementations only compute an HMAC over
+    * a single buffer, which would need the whole ciphertext in memory. */
+   if (!key_state->mac) {
+      CLIENT_ERR ("streaming encryption requires an incremental HMAC, which "
+                  "is not supported with crypto hooks or this crypto library");
+      return false;
+   }
+
+   _mongocrypt_crypto_stream_init (stream);
+   stream->crypto = crypto;
+   stream->key_state = key_state;
+   stream->encrypt = encrypt;
+   stream->associated_data_len = associated_data->len;
+
+   /* [MCGREW]: the tag is computed over A, then S, then AL. */
+   if (!_native_crypto_hmac_sha_512_ctx_init (key_state->mac, status)) {
+      return false;
+   }
+   return _stream_hmac_update (
+      stream, associated_data->data, associated_data->len, status);
+}
+
+
+bool
+_mongocrypt_crypto_stream_encrypt_start (
+   _mongocrypt_crypto_stream_t *stream,
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *iv,
+   const _mongocrypt_buffer_t *associated_data,
+   _mongocrypt_buffer_t *out,
+   mongocrypt_status_t *status)
+{
+   BSON_ASSERT (iv);
+   BSON_ASSERT (out);
+
+   if (MONGOCRYPT_IV_LEN != iv->len) {
+      CLIENT_ERR ("IV should have length %d, but has length %d",
+                  MONGOCRYPT_IV_LEN,
+                  iv->len);
+      return false;
+   }
+
+   if (!_stream_start (
+          stream, crypto, key_state, associated_data, true, status)) {
+      return false;
+   }
+
+   /* The ciphertext S starts with the IV. */
+   memcpy (stream->chain, iv->data, MONGOCRYPT_IV_LEN);
+   memcpy (_mongocrypt_buffer_append_space (out, MONGOCRYPT_IV_LEN),
+           iv->data,
+           MONGOCRYPT_IV_LEN);
+   stream->have_iv = true;
+   return _stream_hmac_update (stream, iv->data, MONGOCRYPT_IV_LEN, status);
+}
+
+
+bool
+_mongocrypt_crypto_stream_decrypt_start (
+   _mongocrypt_crypto_stream_t *stream,
+   _mongocrypt_crypto_t *crypto,
+   const _mongocrypt_key_state_t *key_state,
+   const _mongocrypt_buffer_t *associated_data,
+   mongocrypt_status_t *status)
+{
+   return _stream_start (
+      stream, crypto, key_state, associated_data, false, status);
+}
+
+
+/* Runs @len bytes, a multiple of the block size, through the cipher and the
+ * HMAC, and appends the result to @out. When decrypting, the first block of
+ * the stream is the IV, and produces no output. */
+static bool
+_stream_blocks (_mongocrypt_crypto_stream_t *stream,
+                const uint8_t *data,
+                uint32_t len,
+                _mongocrypt_buffer_t *out,
+                mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t enc_key, iv, in, block_out;
+   uint32_t bytes_written;
+   bool ret;
+
+   BSON_ASSERT (len % MONGOCRYPT_BLOCK_SIZE == 0);
+
+   if (!stream->have_iv && len > 0) {
+      memcpy (stream->chain, data, MONGOCRYPT_IV_LEN);
+      if (!_stream_hmac_update (stream, data, MONGOCRYPT_IV_LEN, status)) {
+         return false;
+      }
+      stream->have_iv = true;
+      data += MONGOCRYPT_IV_LEN;
+      len -= MONGOCRYPT_IV_LEN;
+   }
+
+   if (len == 0) {
+      return true;
+   }
+
+   _mongocrypt_buffer_init (&enc_key);
+   enc_key.data = stream->key_state->key.data + MONGOCRYPT_MAC_KEY_LEN;
+   enc_key.len = MONGOCRYPT_ENC_KEY_LEN;
+   _mongocrypt_buffer_init (&iv);
+   iv.data = stream->chain;
+   iv.len = MONGOCRYPT_IV_LEN;
+   _mongocrypt_buffer_init (&in);
+   in.data = (uint8_t *) data;
+   in.len = len;
+   _mongocrypt_buffer_init (&block_out);
+   block_out.data = _mongocrypt_buffer_append_space (out, len);
+   block_out.len = len;
+
+   if (stream->encrypt) {
+      ret = _crypto_aes_256_cbc_encrypt (stream->crypto,
+                                         stream->key_state->aes,
+                                         &enc_key,
+                                         &iv,
+                                         &in,
+                                         &block_out,
+                                         &bytes_written,
+                                         status);
+   } else {
+      ret = _stream_hmac_update (stream, data, len, status) &&
+            _crypto_aes_256_cbc_decrypt (stream->crypto,
+                                         stream->key_state->aes,
+                                         &iv,
+                                         &enc_key,
+                                         &in,
+                                         &block_out,
+                                         &bytes_written,
+                                         status);
+   }
+   if (!ret) {
+      return false;
+   }
+
+   if (bytes_written != len) {
+      CLIENT_ERR ("%s failure, wrote %d bytes, expected %d",
+                  stream->encrypt ? "encryption" : "decryption",
+                  bytes_written,
+                  len);
+      return false;
+   }
+
+   /* CBC chains blocks by using the previous ciphertext block as the IV of the
+    * next. */
+   if (stream->encrypt) {
+      memcpy (stream->chain,
+              block_out.data + len - MONGOCRYPT_BLOCK_SIZE,
+              MONGOCRYPT_BLOCK_SIZE);
+      return _stream_hmac_update (stream, block_out.data, len, status);
+   }
+   memcpy (stream->chain,
+           data + len - MONGOCRYPT_BLOCK_SIZE,
+           MONGOCRYPT_BLOCK_SIZE);
+   return true;
+}
+
+
+bool
+_mongocrypt_crypto_stream_update (_mongocrypt_crypto_stream_t *stream,
+                                  const uint8_t *data,
+                                  uint32_t len,
+                                  _mongocrypt_buffer_t *out,
+                                  mongocrypt_status_t *status)
+{
+   uint32_t hold;
+   uint32_t process;
+   uint32_t from_pending;
+   uint64_t total;
+
+   BSON_ASSERT (stream);
+   BSON_ASSERT (stream->key_state);
+   BSON_ASSERT (data || len == 0);
+   BSON_ASSERT (out);
+
+   /* Decryption holds back the last block, which has the padding, and the
+    * tag until _mongocrypt_crypto_stream_final. */
+   hold = stream->encrypt ? 0 : MONGOCRYPT_BLOCK_SIZE + MONGOCRYPT_HMAC_LEN;
+   total = (uint64_t) stream->pending_len + len;
+   if (total <= hold) {
+      memcpy (stream->pending + stream->pending_len, data, len);
+      stream->pending_len += len;
+      return true;
+   }
+   process = (uint32_t) (total - hold);
+   process -= process % MONGOCRYPT_BLOCK_SIZE;
+
+   /* Complete the blocks started by earlier calls. */
+   from_pending = stream->pending_len + MONGOCRYPT_BLOCK_SIZE - 1;
+   from_pending -= from_pending % MONGOCRYPT_BLOCK_SIZE;
+   if (from_pending > process) {
+      from_pending = process;
+   }
+   if (from_pending > 0) {
+      if (from_pending > stream->pending_len) {
+         uint32_t fill = from_pending - stream->pending_len;
+
+         memcpy (stream->pending + stream->pending_len, data, fill);
+         stream->pending_len += fill;
+         data += fill;
+         len -= fill;
+      }
+      if (!_stream_blocks (
+             stream, stream->pending, from_pending, out, status)) {
+         return false;
+      }
+      stream->pending_len -= from_pending;
+      memmove (stream->pending,
+               stream->pending + from_pending,
+               stream->pending_len);
+      process -= from_pending;
+   }
+
+   /* Whole blocks are processed in place, without copying. */
+   if (!_stream_blocks (stream, data, process, out, status)) {
+      return false;
+   }
+   data += process;
+   len -= process;
+
+   BSON_ASSERT (stream->pending_len + len <= sizeof (stream->pending));
+   memcpy (stream->pending + stream->pending_len, data, len);
+   stream->pending_len += len;
+   return true;
+}
+
+
+static bool
+_stream_tag (_mongocrypt_crypto_stream_t *stream,
+             uint8_t *tag,
+             mongocrypt_status_t *status)
+{
+   uint64_t associated_data_len_be;
+   uint8_t tag_storage[MONGOCRYPT_HMAC_SHA512_LEN];
+   _mongocrypt_buffer_t tag_buf;
+
+   /* [MCGREW]: AL is the number of bits in A as a 64-bit unsigned integer in
+    * network byte order. */
+   associated_data_len_be = 8 * (uint64_t) stream->associated_data_len;
+   associated_data_len_be = BSON_UINT64_TO_BE (associated_data_len_be);
+   if (!_stream_hmac_update (stream,
+                             (const uint8_t *) &associated_data_len_be,
+                             sizeof (associated_data_len_be),
+                             status)) {
+      return false;
+   }
+
+   _mongocrypt_buffer_init (&tag_buf);
+   tag_buf.data = tag_storage;
+   tag_buf.len = sizeof (tag_storage);
+   if (!_native_crypto_hmac_sha_512_ctx_final (
+          stream->key_state->mac, &tag_buf, status)) {
+      return false;
+   }
+
+   /* [MCGREW 2.7] "The HMAC-SHA-512 value is truncated to T_LEN=32 octets" */
+   memcpy (tag, tag_storage, MONGOCRYPT_HMAC_LEN);
+   return true;
+}
+
+
+bool
+_mongocrypt_crypto_stream_final (_mongocrypt_crypto_stream_t *stream,
+                                 _mongocrypt_buffer_t *out,
+                                 mongocrypt_status_t *status)
+{
+   uint8_t tag[MONGOCRYPT_HMAC_LEN];
+   uint8_t padding_byte;
+   uint32_t offset;
+
+   BSON_ASSERT (stream);
+   BSON_ASSERT (stream->key_state);
+   BSON_ASSERT (out);
+
+   if (stream->encrypt) {
+      /* PKCS #7 pad the last block, which may be all padding. */
+      BSON_ASSERT (stream->pending_len < MONGOCRYPT_BLOCK_SIZE);
+      padding_byte = (uint8_t) (MONGOCRYPT_BLOCK_SIZE - stream->pending_len);
+      memset (
+         stream->pending + stream->pending_len, padding_byte, padding_byte);
+      if (!_stream_blocks (
+             stream, stream->pending, MONGOCRYPT_BLOCK_SIZE, out, status)) {
+         return false;
+      }
+      stream->pending_len = 0;
+      return _stream_tag (
+         stream,
+         _mongocrypt_buffer_append_space (out, MONGOCRYPT_HMAC_LEN),
+         status);
+   }
+
+   if (!stream->have_iv ||
+       stream->pending_len != MONGOCRYPT_BLOCK_SIZE + MONGOCRYPT_HMAC_LEN) {
+      CLIENT_ERR ("corrupt ciphertext - length must be a multiple of %d and "
+                  "at least %d bytes",
+                  MONGOCRYPT_BLOCK_SIZE,
+                  MONGOCRYPT_HMAC_LEN + MONGOCRYPT_IV_LEN +
+                     MONGOCRYPT_BLOCK_SIZE);
+      return false;
+   }
+
+   /* The last block is decrypted, but not returned until the tag is verified.
+    */
+   offset = out->len;
+   if (!_stream_blocks (
+          stream, stream->pending, MONGOCRYPT_BLOCK_SIZE, out, status)) {
+      return false;
+   }
+
+   if (!_stream_tag (stream, tag, status)) {
+      out->len = offset;
+      return false;
+   }
+
+   /* [MCGREW] "using a comparison routine that takes constant time". */
+   if (0 != _mongocrypt_memequal (tag,
+                                  stream->pending + MONGOCRYPT_BLOCK_SIZE,
+                                  MONGOCRYPT_HMAC_LEN)) {
+      memset (out->data + offset, 0, MONGOCRYPT_BLOCK_SIZE);
+      out->len = offset;
+      CLIENT_ERR ("HMAC validation failure");
+      return false;
+   }
+
+   padding_byte = out->data[out->len - 1];
+   if (padding_byte == 0 || padding_byte > MONGOCRYPT_BLOCK_SIZE) {
+      out->len = offset;
+      CLIENT_ERR ("error, ciphertext malformed padding");
+      return false;
+   }
+   out->len -= padding_byte;
+   stream->pending_len = 0;
+   return true;
+}
+
+
+void
+_mongocrypt_crypto_stream_cleanup (_mongocrypt_crypto_stream_t *stream)
+{
+   if (!stream) {
+      return;
+   }
+
+   /* Pending input may be plaintext. */
+   _mongocrypt_crypto_stream_init (stream);
+}
@@ -29,6 +29,7 @@ _cleanup (mongocrypt_ctx_t *ctx)
    _mongocrypt_kms_ctx_cleanup (&dkctx->kms);
    _mongocrypt_buffer_cleanup (&dkctx->encrypted_key_material);
    _mongocrypt_buffer_cleanup (&dkctx->plaintext_key_material);
+   bson_free (dkctx->oauth_cache_key);
 }
 
 
@@ -85,8 +86,7 @@ _kms_start (mongocrypt_ctx_t *ctx)
 
       iv.len = MONGOCRYPT_IV_LEN;
       iv.owned = true;
-      if (!_mongocrypt_random (
-             ctx->crypt->crypto, &iv, MONGOCRYPT_IV_LEN, ctx->status)) {
+      if (!_mongocrypt_random_iv (ctx->crypt->crypto, &iv, ctx->status)) {
          _mongocrypt_buffer_cleanup (&iv);
          _mongocrypt_ctx_fail (ctx);
          goto done;
@@ -123,8 +123,8 @@ _kms_start (mongocrypt_ctx_t *ctx)
 
       ctx->state = MONGOCRYPT_CTX_NEED_KMS;
    } else if (ctx->opts.kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
-      access_token =
-         _mongocrypt_cache_oauth_get (ctx->crypt->cache_oauth_azure);
+      access_token = _mongocrypt_cache_oauth_get (
+         ctx->crypt->cache_oauth, dkctx->oauth_cache_key, NULL);
       if (access_token) {
          if (!_mongocrypt_kms_ctx_init_azure_wrapkey (
                 &dkctx->kms,
@@ -150,7 +150,8 @@ _kms_start (mongocrypt_ctx_t *ctx)
       }
       ctx->state = MONGOCRYPT_CTX_NEED_KMS;
    } else if (ctx->opts.kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_GCP) {
-      access_token = _mongocrypt_cache_oauth_get (ctx->crypt->cache_oauth_gcp);
+      access_token = _mongocrypt_cache_oauth_get (
+         ctx->crypt->cache_oauth, dkctx->oauth_cache_key, NULL);
       if (access_token) {
          if (!_mongocrypt_kms_ctx_init_gcp_encrypt (
                 &dkctx->kms,
@@ -209,8 +210,10 @@ _kms_done (mongocrypt_ctx_t *ctx)
 
       BSON_ASSERT (
          _mongocrypt_buffer_to_bson (&dkctx->kms.result, &oauth_response));
-      if (!_mongocrypt_cache_oauth_add (
-             ctx->crypt->cache_oauth_azure, &oauth_response, status)) {
+      if (!_mongocrypt_cache_oauth_add (ctx->crypt->cache_oauth,
+                                        dkctx->oauth_cache_key,
+                                        &oauth_response,
+                                        status)) {
          return _mongocrypt_ctx_fail (ctx);
       }
       return _kms_start (ctx);
@@ -219,8 +222,10 @@ _kms_done (mongocrypt_ctx_t *ctx)
 
       BSON_ASSERT (
          _mongocrypt_buffer_to_bson (&dkctx->kms.result, &oauth_response));
-      if (!_mongocrypt_cache_oauth_add (
-             ctx->crypt->cache_oauth_gcp, &oauth_response, status)) {
+      if (!_mongocrypt_cache_oauth_add (ctx->crypt->cache_oauth,
+                                        dkctx->oauth_cache_key,
+                                        &oauth_response,
+                                        status)) {
          return _mongocrypt_ctx_fail (ctx);
       }
       return _kms_start (ctx);
@@ -380,6 +385,18 @@ mongocrypt_ctx_datakey_init (mongocrypt_ctx_t *ctx)
       goto done;
    }
 
+   if (ctx->opts.kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
+      dkctx->oauth_cache_key = _mongocrypt_cache_oauth_key (
+         MONGOCRYPT_KMS_PROVIDER_AZURE,
+         &ctx->crypt->opts,
+         ctx->opts.kek.provider.azure.key_vault_endpoint);
+   } else if (ctx->opts.kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_GCP) {
+      dkctx->oauth_cache_key =
+         _mongocrypt_cache_oauth_key (MONGOCRYPT_KMS_PROVIDER_GCP,
+                                      &ctx->crypt->opts,
+                                      ctx->opts.kek.provider.gcp.endpoint);
+   }
+
    if (!_kms_start (ctx)) {
       goto done;
    }
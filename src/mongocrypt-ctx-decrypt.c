@@ -19,85 +19,176 @@
 #include "mongocrypt-ctx-private.h"
 #include "mongocrypt-traverse-util-private.h"
 
+/* The ciphertexts of a document, collected to be decrypted in one batch. */
+typedef struct {
+   _mongocrypt_ciphertext_t *ciphertexts;
+   _mongocrypt_buffer_t *plaintexts;
+   uint32_t len;
+   uint32_t allocated;
+   /* The next plaintext to replace a ciphertext with. */
+   uint32_t replaced;
+} _ciphertext_batch_t;
+
+
+static void
+_ciphertext_batch_cleanup (_ciphertext_batch_t *batch)
+{
+   uint32_t i;
+
+   if (batch->plaintexts) {
+      for (i = 0; i < batch->len; i++) {
+         _mongocrypt_buffer_cleanup (&batch->plaintexts[i]);
+      }
+   }
+   bson_free (batch->ciphertexts);
+   bson_free (batch->plaintexts);
+}
+
+
 static bool
-_replace_ciphertext_with_plaintext (void *ctx,
-                                    _mongocrypt_buffer_t *in,
-                                    bson_value_t *out,
-                                    mongocrypt_status_t *status)
+_collect_ciphertext (void *ctx,
+                     _mongocrypt_buffer_t *in,
+                     mongocrypt_status_t *status)
 {
-   _mongocrypt_key_broker_t *kb;
-   _mongocrypt_ciphertext_t ciphertext;
-   _mongocrypt_buffer_t plaintext;
-   _mongocrypt_buffer_t key_material;
-   _mongocrypt_buffer_t associated_data;
-   uint32_t bytes_written;
-   bool ret = false;
+   _ciphertext_batch_t *batch;
 
    BSON_ASSERT (ctx);
    BSON_ASSERT (in);
-   BSON_ASSERT (out);
 
-   _mongocrypt_buffer_init (&plaintext);
-   _mongocrypt_buffer_init (&associated_data);
-   _mongocrypt_buffer_init (&key_material);
-   kb = (_mongocrypt_key_broker_t *) ctx;
+   batch = (_ciphertext_batch_t *) ctx;
+   if (batch->len == batch->allocated) {
+      batch->allocated = batch->allocated ? batch->allocated * 2 : 8;
+      batch->ciphertexts =
+         bson_realloc (batch->ciphertexts,
+                       batch->allocated * sizeof (_mongocrypt_ciphertext_t));
+   }
 
-   if (!_mongocrypt_ciphertext_parse_unowned (in, &ciphertext, status)) {
-      goto fail;
+   /* The ciphertext references @in, which stays valid until finalize returns.
+    */
+   if (!_mongocrypt_ciphertext_parse_unowned (
+          in, &batch->ciphertexts[batch->len], status)) {
+      return false;
    }
+   batch->len++;
+   return true;
+}
 
-   /* look up the key */
-   if (!_mongocrypt_key_broker_decrypted_key_by_id (
-          kb, &ciphertext.key_id, &key_material)) {
-      CLIENT_ERR ("key not found");
-      goto fail;
+
+/* Decrypts all collected ciphertexts with one bulk decryption. */
+static bool
+_decrypt_ciphertext_batch (_mongocrypt_key_broker_t *kb,
+                           _ciphertext_batch_t *batch,
+                           mongocrypt_status_t *status)
+{
+   _mongocrypt_decryption_t *decryptions = NULL;
+   _mongocrypt_buffer_t *associated_data = NULL;
+   _mongocrypt_ciphertext_t *ciphertext;
+   _mongocrypt_buffer_t *plaintext;
+   _mongocrypt_key_handle_t key;
+   uint32_t i;
+   bool ret = false;
+
+   if (batch->len == 0) {
+      return true;
    }
 
-   plaintext.len = _mongocrypt_calculate_plaintext_len (ciphertext.data.len);
-   plaintext.data = bson_malloc0 (plaintext.len);
-   BSON_ASSERT (plaintext.data);
+   batch->plaintexts =
+      bson_malloc0 (batch->len * sizeof (_mongocrypt_buffer_t));
+   BSON_ASSERT (batch->plaintexts);
+   associated_data = bson_malloc0 (batch->len * sizeof (_mongocrypt_buffer_t));
+   BSON_ASSERT (associated_data);
+   decryptions = bson_malloc0 (batch->len * sizeof (_mongocrypt_decryption_t));
+   BSON_ASSERT (decryptions);
+
+   for (i = 0; i < batch->len; i++) {
+      ciphertext = &batch->ciphertexts[i];
+      plaintext = &batch->plaintexts[i];
+
+      /* look up the key */
+      if (!_mongocrypt_key_broker_key_by_id (kb, &ciphertext->key_id, &key)) {
+         CLIENT_ERR ("key not found");
+         goto fail;
+      }
 
-   plaintext.owned = true;
+      plaintext->len =
+         _mongocrypt_calculate_plaintext_len (ciphertext->data.len);
+      plaintext->data = bson_malloc0 (plaintext->len);
+      BSON_ASSERT (plaintext->data);
 
-   if (!_mongocrypt_ciphertext_serialize_associated_data (&ciphertext,
-                                                          &associated_data)) {
-      CLIENT_ERR ("could not serialize associated data");
-      goto fail;
+      plaintext->owned = true;
+
+      if (!_mongocrypt_ciphertext_serialize_associated_data (
+             ciphertext, &associated_data[i])) {
+         CLIENT_ERR ("could not serialize associated data");
+         goto fail;
+      }
+
+      decryptions[i].key_state = key.key_state;
+      decryptions[i].associated_data = &associated_data[i];
+      decryptions[i].ciphertext = &ciphertext->data;
+      decryptions[i].plaintext = plaintext;
    }
 
-   if (!_mongocrypt_do_decryption (kb->crypt->crypto,
-                                   &associated_data,
-                                   &key_material,
-                                   &ciphertext.data,
-                                   &plaintext,
-                                   &bytes_written,
-                                   status)) {
+   if (!_mongocrypt_do_decryption_batch (
+          kb->crypt->crypto, decryptions, batch->len, status)) {
       goto fail;
    }
 
-   plaintext.len = bytes_written;
-
-   if (!_mongocrypt_buffer_to_bson_value (
-          &plaintext, ciphertext.original_bson_type, out)) {
-      CLIENT_ERR ("malformed encrypted bson");
-      goto fail;
+   for (i = 0; i < batch->len; i++) {
+      batch->plaintexts[i].len = decryptions[i].bytes_written;
    }
+
    ret = true;
 
 fail:
-   _mongocrypt_buffer_cleanup (&plaintext);
-   _mongocrypt_buffer_cleanup (&associated_data);
-   _mongocrypt_buffer_cleanup (&key_material);
+   for (i = 0; i < batch->len; i++) {
+      _mongocrypt_buffer_cleanup (&associated_data[i]);
+   }
+   bson_free (associated_data);
+   bson_free (decryptions);
    return ret;
 }
 
 
+static bool
+_replace_ciphertext_with_plaintext (void *ctx,
+                                    _mongocrypt_buffer_t *in,
+                                    bson_value_t *out,
+                                    mongocrypt_status_t *status)
+{
+   _ciphertext_batch_t *batch;
+   uint32_t i;
+
+   BSON_ASSERT (ctx);
+   BSON_ASSERT (in);
+   BSON_ASSERT (out);
+
+   /* Ciphertexts are visited in the same order they were collected. */
+   batch = (_ciphertext_batch_t *) ctx;
+   if (batch->replaced >= batch->len) {
+      CLIENT_ERR ("unexpected ciphertext");
+      return false;
+   }
+
+   i = batch->replaced++;
+   if (!_mongocrypt_buffer_to_bson_value (
+          &batch->plaintexts[i],
+          batch->ciphertexts[i].original_bson_type,
+          out)) {
+      CLIENT_ERR ("malformed encrypted bson");
+      return false;
+   }
+   return true;
+}
+
+
 static bool
 _finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
 {
    bson_t as_bson, final_bson;
    bson_iter_t iter;
    _mongocrypt_ctx_decrypt_t *dctx;
+   _ciphertext_batch_t batch;
    bool res;
 
    if (!ctx) {
@@ -121,26 +212,47 @@ _finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
          return _mongocrypt_ctx_fail_w_msg (ctx, "malformed bson");
       }
 
+      /* Collect all ciphertexts, decrypt them in one batch, then replace
+       * each ciphertext with its plaintext. */
+      memset (&batch, 0, sizeof (batch));
+      bson_iter_init (&iter, &as_bson);
+      if (!_mongocrypt_traverse_binary_in_bson (_collect_ciphertext,
+                                                &batch,
+                                                TRAVERSE_MATCH_CIPHERTEXT,
+                                                &iter,
+                                                ctx->status) ||
+          !_decrypt_ciphertext_batch (&ctx->kb, &batch, ctx->status)) {
+         _ciphertext_batch_cleanup (&batch);
+         return _mongocrypt_ctx_fail (ctx);
+      }
+
       bson_iter_init (&iter, &as_bson);
       bson_init (&final_bson);
       res = _mongocrypt_transform_binary_in_bson (
          _replace_ciphertext_with_plaintext,
-         &ctx->kb,
+         &batch,
          TRAVERSE_MATCH_CIPHERTEXT,
          &iter,
          &final_bson,
          ctx->status);
+      _ciphertext_batch_cleanup (&batch);
       if (!res) {
+         bson_destroy (&final_bson);
          return _mongocrypt_ctx_fail (ctx);
       }
    } else {
       /* For explicit decryption, we just have a single value */
       bson_value_t value;
 
-      if (!_replace_ciphertext_with_plaintext (
-             &ctx->kb, &dctx->unwrapped_doc, &value, ctx->status)) {
+      memset (&batch, 0, sizeof (batch));
+      if (!_collect_ciphertext (&batch, &dctx->unwrapped_doc, ctx->status) ||
+          !_decrypt_ciphertext_batch (&ctx->kb, &batch, ctx->status) ||
+          !_replace_ciphertext_with_plaintext (
+             &batch, &dctx->unwrapped_doc, &value, ctx->status)) {
+         _ciphertext_batch_cleanup (&batch);
          return _mongocrypt_ctx_fail (ctx);
       }
+      _ciphertext_batch_cleanup (&batch);
 
       bson_init (&final_bson);
       bson_append_value (&final_bson, MONGOCRYPT_STR_AND_LEN ("v"), &value);
@@ -188,6 +300,8 @@ _cleanup (mongocrypt_ctx_t *ctx)
    dctx = (_mongocrypt_ctx_decrypt_t *) ctx;
    _mongocrypt_buffer_cleanup (&dctx->original_doc);
    _mongocrypt_buffer_cleanup (&dctx->decrypted_doc);
+   _mongocrypt_crypto_stream_cleanup (&dctx->crypto_stream);
+   _mongocrypt_buffer_cleanup (&dctx->stream_out);
 }
 
 
@@ -259,6 +373,156 @@ mongocrypt_ctx_explicit_decrypt_init (mongocrypt_ctx_t *ctx,
 }
 
 
+/* Starts the decryption on the first call once the key is decrypted, and
+ * decrypts the bytes after the header that were passed to init. */
+static bool
+_stream_start (mongocrypt_ctx_t *ctx)
+{
+   _mongocrypt_ctx_decrypt_t *dctx;
+   _mongocrypt_ciphertext_t ciphertext;
+   _mongocrypt_buffer_t associated_data;
+   _mongocrypt_key_handle_t key;
+   mongocrypt_status_t *status = ctx->status;
+   bool ret = false;
+
+   dctx = (_mongocrypt_ctx_decrypt_t *) ctx;
+   if (dctx->stream_started) {
+      return true;
+   }
+
+   _mongocrypt_buffer_init (&associated_data);
+
+   if (!_mongocrypt_ciphertext_parse_unowned (
+          &dctx->original_doc, &ciphertext, status)) {
+      goto done;
+   }
+
+   if (!_mongocrypt_key_broker_key_by_id (&ctx->kb, &ciphertext.key_id, &key)) {
+      _mongocrypt_status_copy_to (ctx->kb.status, status);
+      goto done;
+   }
+
+   if (!_mongocrypt_ciphertext_serialize_associated_data (&ciphertext,
+                                                         &associated_data)) {
+      CLIENT_ERR ("could not serialize associated data");
+      goto done;
+   }
+
+   if (!_mongocrypt_crypto_stream_decrypt_start (&dctx->crypto_stream,
+                                                 ctx->crypt->crypto,
+                                                 key.key_state,
+                                                 &associated_data,
+                                                 status)) {
+      goto done;
+   }
+
+   if (!_mongocrypt_crypto_stream_update (&dctx->crypto_stream,
+                                          ciphertext.data.data,
+                                          ciphertext.data.len,
+                                          &dctx->stream_out,
+                                          status)) {
+      goto done;
+   }
+
+   dctx->stream_started = true;
+   ret = true;
+
+done:
+   _mongocrypt_buffer_cleanup (&associated_data);
+   return ret;
+}
+
+
+static bool
+_stream_update (mongocrypt_ctx_t *ctx,
+                mongocrypt_binary_t *in,
+                mongocrypt_binary_t *out)
+{
+   _mongocrypt_ctx_decrypt_t *dctx;
+
+   dctx = (_mongocrypt_ctx_decrypt_t *) ctx;
+   dctx->stream_out.len = 0;
+
+   if (!_stream_start (ctx)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   if (!_mongocrypt_crypto_stream_update (&dctx->crypto_stream,
+                                          in->data,
+                                          in->len,
+                                          &dctx->stream_out,
+                                          ctx->status)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   _mongocrypt_buffer_to_binary (&dctx->stream_out, out);
+   return true;
+}
+
+
+static bool
+_stream_finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
+{
+   _mongocrypt_ctx_decrypt_t *dctx;
+
+   dctx = (_mongocrypt_ctx_decrypt_t *) ctx;
+   dctx->stream_out.len = 0;
+
+   if (!_stream_start (ctx)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   if (!_mongocrypt_crypto_stream_final (
+          &dctx->crypto_stream, &dctx->stream_out, ctx->status)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   _mongocrypt_buffer_to_binary (&dctx->stream_out, out);
+   ctx->state = MONGOCRYPT_CTX_DONE;
+   return true;
+}
+
+
+bool
+mongocrypt_ctx_explicit_decrypt_stream_init (mongocrypt_ctx_t *ctx,
+                                             mongocrypt_binary_t *msg)
+{
+   _mongocrypt_ctx_decrypt_t *dctx;
+   _mongocrypt_ctx_opts_spec_t opts_spec;
+
+   if (!ctx) {
+      return false;
+   }
+   memset (&opts_spec, 0, sizeof (opts_spec));
+   if (!_mongocrypt_ctx_init (ctx, &opts_spec)) {
+      return false;
+   }
+
+   if (!msg || !msg->data) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "invalid msg");
+   }
+
+   dctx = (_mongocrypt_ctx_decrypt_t *) ctx;
+   dctx->explicit = true;
+   dctx->stream = true;
+   ctx->type = _MONGOCRYPT_TYPE_DECRYPT;
+   ctx->vtable.stream_update = _stream_update;
+   ctx->vtable.stream_finalize = _stream_finalize;
+   ctx->vtable.cleanup = _cleanup;
+
+   _mongocrypt_buffer_copy_from_binary (&dctx->original_doc, msg);
+
+   /* Parse out our one key id */
+   if (!_collect_key_from_ciphertext (
+          &ctx->kb, &dctx->original_doc, ctx->status)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   (void) _mongocrypt_key_broker_requests_done (&ctx->kb);
+   return _mongocrypt_ctx_state_from_key_broker (ctx);
+}
+
+
 bool
 mongocrypt_ctx_decrypt_init (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *doc)
 {
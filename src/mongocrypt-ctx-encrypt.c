@@ -37,54 +37,25 @@ _mongo_op_collinfo (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
    return true;
 }
 
+/* Takes ownership of @collinfo. */
 static bool
-_set_schema_from_collinfo (mongocrypt_ctx_t *ctx, bson_t *collinfo)
+_set_schema_from_collinfo (mongocrypt_ctx_t *ctx,
+                           _mongocrypt_cache_collinfo_value_t *collinfo)
 {
-   bson_iter_t iter;
    _mongocrypt_ctx_encrypt_t *ectx;
-   bool found_jsonschema = false;
 
-   /* Parse out the schema. */
    ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
+   _mongocrypt_buffer_cleanup (&ectx->schema);
+   _mongocrypt_cache_collinfo_value_destroy (ectx->collinfo);
+   ectx->collinfo = collinfo;
 
    /* Disallow views. */
-   if (bson_iter_init_find (&iter, collinfo, "type") &&
-       BSON_ITER_HOLDS_UTF8 (&iter) && bson_iter_utf8 (&iter, NULL) &&
-       0 == strcmp ("view", bson_iter_utf8 (&iter, NULL))) {
+   if (collinfo->is_view) {
       return _mongocrypt_ctx_fail_w_msg (ctx, "cannot auto encrypt a view");
    }
 
-   if (!bson_iter_init (&iter, collinfo)) {
-      return _mongocrypt_ctx_fail_w_msg (ctx, "BSON malformed");
-   }
-
-   if (bson_iter_find_descendant (&iter, "options.validator", &iter) &&
-       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
-      if (!bson_iter_recurse (&iter, &iter)) {
-         return _mongocrypt_ctx_fail_w_msg (ctx, "BSON malformed");
-      }
-      while (bson_iter_next (&iter)) {
-         const char *key;
-
-         key = bson_iter_key (&iter);
-         BSON_ASSERT (key);
-         if (0 == strcmp ("$jsonSchema", key)) {
-            if (found_jsonschema) {
-               return _mongocrypt_ctx_fail_w_msg (
-                  ctx, "duplicate $jsonSchema fields found");
-            }
-            if (!_mongocrypt_buffer_copy_from_document_iter (&ectx->schema,
-                                                             &iter)) {
-               return _mongocrypt_ctx_fail_w_msg (ctx, "malformed $jsonSchema");
-            }
-            found_jsonschema = true;
-         } else {
-            ectx->collinfo_has_siblings = true;
-         }
-      }
-   }
-
-
+   _mongocrypt_buffer_set_to (&collinfo->schema, &ectx->schema);
+   ectx->collinfo_has_siblings = collinfo->has_siblings;
    return true;
 }
 
@@ -92,6 +63,7 @@ static bool
 _mongo_feed_collinfo (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *in)
 {
    bson_t as_bson;
+   _mongocrypt_cache_collinfo_value_t *collinfo;
 
    _mongocrypt_ctx_encrypt_t *ectx;
 
@@ -100,17 +72,19 @@ _mongo_feed_collinfo (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *in)
       return _mongocrypt_ctx_fail_w_msg (ctx, "BSON malformed");
    }
 
-   /* Cache the received collinfo. */
-   if (!_mongocrypt_cache_add_copy (
-          &ctx->crypt->cache_collinfo, ectx->ns, &as_bson, ctx->status)) {
+   collinfo = _mongocrypt_cache_collinfo_value_new (&as_bson, ctx->status);
+   if (!collinfo) {
       return _mongocrypt_ctx_fail (ctx);
    }
 
-   if (!_set_schema_from_collinfo (ctx, &as_bson)) {
-      return false;
+   /* Cache the received collinfo. */
+   if (!_mongocrypt_cache_add_copy (
+          &ctx->crypt->cache_collinfo, ectx->ns, collinfo, ctx->status)) {
+      _mongocrypt_cache_collinfo_value_destroy (collinfo);
+      return _mongocrypt_ctx_fail (ctx);
    }
 
-   return true;
+   return _set_schema_from_collinfo (ctx, collinfo);
 }
 
 
@@ -196,6 +170,25 @@ _collect_key_from_marking (void *ctx,
 }
 
 
+/* Caches the collinfo marked as not requiring encryption, so contexts on the
+ * same namespace skip mongocryptd until the entry expires. */
+static bool
+_cache_no_encryption_needed (mongocrypt_ctx_t *ctx)
+{
+   _mongocrypt_ctx_encrypt_t *ectx;
+   _mongocrypt_cache_collinfo_value_t *marked;
+
+   ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
+   /* ectx->collinfo is NULL if the collection does not exist. */
+   marked = _mongocrypt_cache_collinfo_value_no_encryption (ectx->collinfo);
+   if (!_mongocrypt_cache_add_stolen (
+          &ctx->crypt->cache_collinfo, ectx->ns, marked, ctx->status)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+   return true;
+}
+
+
 static bool
 _mongo_feed_markings (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *in)
 {
@@ -211,16 +204,15 @@ _mongo_feed_markings (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *in)
 
    if (bson_iter_init_find (&iter, &as_bson, "schemaRequiresEncryption") &&
        !bson_iter_as_bool (&iter)) {
-      /* TODO: update cache: this schema does not require encryption. */
-
       /* If using a local schema, warn if there are no encrypted fields. */
       if (ectx->used_local_schema) {
          _mongocrypt_log (
             &ctx->crypt->log,
             MONGOCRYPT_LOG_LEVEL_WARNING,
             "local schema used but does not have encryption specifiers");
+         return true;
       }
-      return true;
+      return _cache_no_encryption_needed (ctx);
    } else {
       /* if the schema requires encryption, but has sibling validators, error.
        */
@@ -270,6 +262,32 @@ _mongo_done_markings (mongocrypt_ctx_t *ctx)
 }
 
 
+/* Serializes @ciphertext into @out. */
+static bool
+_ciphertext_to_bson_value (_mongocrypt_ciphertext_t *ciphertext,
+                           bson_value_t *out,
+                           mongocrypt_status_t *status)
+{
+   _mongocrypt_buffer_t serialized_ciphertext = {0};
+
+   BSON_ASSERT (out);
+
+   if (!_mongocrypt_serialize_ciphertext (ciphertext,
+                                          &serialized_ciphertext)) {
+      CLIENT_ERR ("malformed ciphertext");
+      return false;
+   };
+
+   /* ownership of serialized_ciphertext is transferred to caller. */
+   out->value_type = BSON_TYPE_BINARY;
+   out->value.v_binary.data = serialized_ciphertext.data;
+   out->value.v_binary.data_len = serialized_ciphertext.len;
+   out->value.v_binary.subtype = (bson_subtype_t) 6;
+
+   return true;
+}
+
+
 static bool
 _marking_to_bson_value (void *ctx,
                         _mongocrypt_marking_t *marking,
@@ -277,7 +295,6 @@ _marking_to_bson_value (void *ctx,
                         mongocrypt_status_t *status)
 {
    _mongocrypt_ciphertext_t ciphertext;
-   _mongocrypt_buffer_t serialized_ciphertext = {0};
    bool ret = false;
 
    BSON_ASSERT (out);
@@ -288,17 +305,9 @@ _marking_to_bson_value (void *ctx,
       goto fail;
    }
 
-   if (!_mongocrypt_serialize_ciphertext (&ciphertext,
-                                          &serialized_ciphertext)) {
-      CLIENT_ERR ("malformed ciphertext");
+   if (!_ciphertext_to_bson_value (&ciphertext, out, status)) {
       goto fail;
-   };
-
-   /* ownership of serialized_ciphertext is transferred to caller. */
-   out->value_type = BSON_TYPE_BINARY;
-   out->value.v_binary.data = serialized_ciphertext.data;
-   out->value.v_binary.data_len = serialized_ciphertext.len;
-   out->value.v_binary.subtype = (bson_subtype_t) 6;
+   }
 
    ret = true;
 
@@ -308,35 +317,91 @@ fail:
 }
 
 
+/* The markings of a command, collected to be encrypted in one batch. */
+typedef struct {
+   _mongocrypt_marking_t *markings;
+   _mongocrypt_ciphertext_t *ciphertexts;
+   uint32_t len;
+   uint32_t allocated;
+   /* The next ciphertext to replace a marking with. */
+   uint32_t replaced;
+} _marking_batch_t;
+
+
+static void
+_marking_batch_cleanup (_marking_batch_t *batch)
+{
+   uint32_t i;
+
+   for (i = 0; i < batch->len; i++) {
+      _mongocrypt_marking_cleanup (&batch->markings[i]);
+      if (batch->ciphertexts) {
+         _mongocrypt_ciphertext_cleanup (&batch->ciphertexts[i]);
+      }
+   }
+   bson_free (batch->markings);
+   bson_free (batch->ciphertexts);
+}
+
+
+static bool
+_collect_marking (void *ctx,
+                  _mongocrypt_buffer_t *in,
+                  mongocrypt_status_t *status)
+{
+   _marking_batch_t *batch;
+
+   BSON_ASSERT (ctx);
+   BSON_ASSERT (in);
+
+   batch = (_marking_batch_t *) ctx;
+   if (batch->len == batch->allocated) {
+      batch->allocated = batch->allocated ? batch->allocated * 2 : 8;
+      batch->markings = bson_realloc (
+         batch->markings, batch->allocated * sizeof (_mongocrypt_marking_t));
+   }
+
+   /* The marking references @in, which stays valid until finalize returns. */
+   if (!_mongocrypt_marking_parse_unowned (
+          in, &batch->markings[batch->len], status)) {
+      _mongocrypt_marking_cleanup (&batch->markings[batch->len]);
+      return false;
+   }
+   batch->len++;
+   return true;
+}
+
+
 static bool
 _replace_marking_with_ciphertext (void *ctx,
                                   _mongocrypt_buffer_t *in,
                                   bson_value_t *out,
                                   mongocrypt_status_t *status)
 {
-   _mongocrypt_marking_t marking;
-   bool ret;
+   _marking_batch_t *batch;
 
+   BSON_ASSERT (ctx);
    BSON_ASSERT (in);
 
-   memset (&marking, 0, sizeof (marking));
-
-   if (!_mongocrypt_marking_parse_unowned (in, &marking, status)) {
-      _mongocrypt_marking_cleanup (&marking);
+   /* Markings are visited in the same order they were collected. */
+   batch = (_marking_batch_t *) ctx;
+   if (batch->replaced >= batch->len) {
+      CLIENT_ERR ("unexpected marking");
       return false;
    }
 
-   ret = _marking_to_bson_value (ctx, &marking, out, status);
-   _mongocrypt_marking_cleanup (&marking);
-   return ret;
+   return _ciphertext_to_bson_value (
+      &batch->ciphertexts[batch->replaced++], out, status);
 }
 
+
 static bool
 _finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
 {
    bson_t as_bson, converted;
    bson_iter_t iter;
    _mongocrypt_ctx_encrypt_t *ectx;
+   _marking_batch_t batch;
    bool res;
 
    ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
@@ -351,15 +416,42 @@ _finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
          return _mongocrypt_ctx_fail_w_msg (ctx, "malformed bson");
       }
 
+      /* Collect all markings, encrypt them in one batch, then replace each
+       * marking with its ciphertext. */
+      memset (&batch, 0, sizeof (batch));
+      bson_iter_init (&iter, &as_bson);
+      if (!_mongocrypt_traverse_binary_in_bson (_collect_marking,
+                                                &batch,
+                                                TRAVERSE_MATCH_MARKING,
+                                                &iter,
+                                                ctx->status)) {
+         _marking_batch_cleanup (&batch);
+         return _mongocrypt_ctx_fail (ctx);
+      }
+
+      batch.ciphertexts =
+         bson_malloc0 (batch.len * sizeof (_mongocrypt_ciphertext_t));
+      if (!_mongocrypt_markings_to_ciphertexts (&ctx->kb,
+                                                batch.markings,
+                                                batch.ciphertexts,
+                                                batch.len,
+                                                ctx->status)) {
+         _marking_batch_cleanup (&batch);
+         return _mongocrypt_ctx_fail (ctx);
+      }
+
       bson_iter_init (&iter, &as_bson);
       bson_init (&converted);
-      if (!_mongocrypt_transform_binary_in_bson (
-             _replace_marking_with_ciphertext,
-             &ctx->kb,
-             TRAVERSE_MATCH_MARKING,
-             &iter,
-             &converted,
-             ctx->status)) {
+      res = _mongocrypt_transform_binary_in_bson (
+         _replace_marking_with_ciphertext,
+         &batch,
+         TRAVERSE_MATCH_MARKING,
+         &iter,
+         &converted,
+         ctx->status);
+      _marking_batch_cleanup (&batch);
+      if (!res) {
+         bson_destroy (&converted);
          return _mongocrypt_ctx_fail (ctx);
       }
    } else {
@@ -424,10 +516,13 @@ _cleanup (mongocrypt_ctx_t *ctx)
    bson_free (ectx->coll_name);
    _mongocrypt_buffer_cleanup (&ectx->list_collections_filter);
    _mongocrypt_buffer_cleanup (&ectx->schema);
+   _mongocrypt_cache_collinfo_value_destroy (ectx->collinfo);
    _mongocrypt_buffer_cleanup (&ectx->original_cmd);
    _mongocrypt_buffer_cleanup (&ectx->mongocryptd_cmd);
    _mongocrypt_buffer_cleanup (&ectx->marked_cmd);
    _mongocrypt_buffer_cleanup (&ectx->encrypted_cmd);
+   _mongocrypt_crypto_stream_cleanup (&ectx->crypto_stream);
+   _mongocrypt_buffer_cleanup (&ectx->stream_out);
 }
 
 
@@ -468,7 +563,7 @@ static bool
 _try_schema_from_cache (mongocrypt_ctx_t *ctx)
 {
    _mongocrypt_ctx_encrypt_t *ectx;
-   bson_t *collinfo = NULL;
+   _mongocrypt_cache_collinfo_value_t *collinfo = NULL;
 
    ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
 
@@ -480,17 +575,24 @@ _try_schema_from_cache (mongocrypt_ctx_t *ctx)
       return _mongocrypt_ctx_fail_w_msg (ctx, "failed to retrieve from cache");
    }
 
-   if (collinfo) {
-      if (!_set_schema_from_collinfo (ctx, collinfo)) {
-         return _mongocrypt_ctx_fail (ctx);
-      }
-      ctx->state = MONGOCRYPT_CTX_NEED_MONGO_MARKINGS;
-   } else {
+   if (!collinfo) {
       /* we need to get it. */
       ctx->state = MONGOCRYPT_CTX_NEED_MONGO_COLLINFO;
+      return true;
    }
 
-   bson_destroy (collinfo);
+   if (!collinfo->requires_encryption) {
+      /* mongocryptd already reported that nothing needs encryption. */
+      _mongocrypt_cache_collinfo_value_destroy (collinfo);
+      ctx->nothing_to_do = true;
+      ctx->state = MONGOCRYPT_CTX_READY;
+      return true;
+   }
+
+   if (!_set_schema_from_collinfo (ctx, collinfo)) {
+      return false;
+   }
+   ctx->state = MONGOCRYPT_CTX_NEED_MONGO_MARKINGS;
    return true;
 }
 
@@ -629,6 +731,240 @@ mongocrypt_ctx_explicit_encrypt_init (mongocrypt_ctx_t *ctx,
    return _mongocrypt_ctx_state_from_key_broker (ctx);
 }
 
+/* Starts the encryption on the first call once the key is decrypted. The
+ * output starts with the associated data, which is the header of the
+ * ciphertext. */
+static bool
+_stream_start (mongocrypt_ctx_t *ctx)
+{
+   _mongocrypt_ctx_encrypt_t *ectx;
+   _mongocrypt_ciphertext_t ciphertext;
+   _mongocrypt_buffer_t associated_data, iv;
+   _mongocrypt_key_handle_t key;
+   bool ok;
+   mongocrypt_status_t *status = ctx->status;
+   bool ret = false;
+
+   ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
+   if (ectx->crypto_stream.key_state) {
+      return true;
+   }
+
+   _mongocrypt_ciphertext_init (&ciphertext);
+   _mongocrypt_buffer_init (&associated_data);
+   _mongocrypt_buffer_init (&iv);
+
+   if (ctx->opts.key_alt_names) {
+      ok = _mongocrypt_key_broker_key_by_name (
+         &ctx->kb, &ctx->opts.key_alt_names->value, &key);
+   } else {
+      ok = _mongocrypt_key_broker_key_by_id (&ctx->kb, &ctx->opts.key_id, &key);
+   }
+   if (!ok) {
+      _mongocrypt_status_copy_to (ctx->kb.status, status);
+      goto done;
+   }
+   _mongocrypt_buffer_set_to (key.key_id, &ciphertext.key_id);
+
+   ciphertext.blob_subtype = MONGOCRYPT_ENCRYPTION_ALGORITHM_RANDOM;
+   ciphertext.original_bson_type = ectx->stream_bson_type;
+   if (!_mongocrypt_ciphertext_serialize_associated_data (&ciphertext,
+                                                         &associated_data)) {
+      CLIENT_ERR ("could not serialize associated data");
+      goto done;
+   }
+
+   _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
+   if (!_mongocrypt_random_iv (ctx->crypt->crypto, &iv, status)) {
+      goto done;
+   }
+
+   memcpy (_mongocrypt_buffer_append_space (&ectx->stream_out,
+                                            associated_data.len),
+           associated_data.data,
+           associated_data.len);
+   if (!_mongocrypt_crypto_stream_encrypt_start (&ectx->crypto_stream,
+                                                 ctx->crypt->crypto,
+                                                 key.key_state,
+                                                 &iv,
+                                                 &associated_data,
+                                                 &ectx->stream_out,
+                                                 status)) {
+      goto done;
+   }
+
+   ret = true;
+
+done:
+   _mongocrypt_ciphertext_cleanup (&ciphertext);
+   _mongocrypt_buffer_cleanup (&associated_data);
+   _mongocrypt_buffer_cleanup (&iv);
+   return ret;
+}
+
+
+static bool
+_stream_update (mongocrypt_ctx_t *ctx,
+                mongocrypt_binary_t *in,
+                mongocrypt_binary_t *out)
+{
+   _mongocrypt_ctx_encrypt_t *ectx;
+   uint32_t head_len;
+
+   ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
+   ectx->stream_out.len = 0;
+
+   if (!_stream_start (ctx)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   /* Leave room for the header, IV, padding, and tag in a BSON binary. */
+   if (ectx->stream_value_len + in->len > (uint64_t) INT32_MAX - 128) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "value too large to encrypt");
+   }
+
+   /* Keep what is needed to check the value when finalizing. */
+   if (ectx->stream_value_len < sizeof (ectx->stream_value_head)) {
+      head_len = (uint32_t) (sizeof (ectx->stream_value_head) -
+                             ectx->stream_value_len);
+      if (head_len > in->len) {
+         head_len = in->len;
+      }
+      memcpy (ectx->stream_value_head + ectx->stream_value_len,
+              in->data,
+              head_len);
+   }
+   if (in->len > 0) {
+      ectx->stream_value_last = in->data[in->len - 1];
+   }
+   ectx->stream_value_len += in->len;
+
+   if (!_mongocrypt_crypto_stream_update (&ectx->crypto_stream,
+                                          in->data,
+                                          in->len,
+                                          &ectx->stream_out,
+                                          ctx->status)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   _mongocrypt_buffer_to_binary (&ectx->stream_out, out);
+   return true;
+}
+
+
+/* Checks that the streamed bytes are a single string or binary value. */
+static bool
+_stream_value_valid (_mongocrypt_ctx_encrypt_t *ectx)
+{
+   uint32_t len;
+
+   if (ectx->stream_value_len < sizeof (ectx->stream_value_head)) {
+      return false;
+   }
+
+   memcpy (&len, ectx->stream_value_head, sizeof (len));
+   len = BSON_UINT32_FROM_LE (len);
+   if (len > INT32_MAX) {
+      return false;
+   }
+
+   if (ectx->stream_bson_type == BSON_TYPE_UTF8) {
+      return ectx->stream_value_len == (uint64_t) len + 4 &&
+             ectx->stream_value_last == 0;
+   }
+
+   /* A binary has a subtype byte after the length. */
+   return ectx->stream_value_len == (uint64_t) len + 5;
+}
+
+
+static bool
+_stream_finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
+{
+   _mongocrypt_ctx_encrypt_t *ectx;
+
+   ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
+   ectx->stream_out.len = 0;
+
+   if (!_stream_start (ctx)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   if (!_stream_value_valid (ectx)) {
+      return _mongocrypt_ctx_fail_w_msg (
+         ctx, "streamed value does not match its length prefix");
+   }
+
+   if (ectx->stream_bson_type == BSON_TYPE_BINARY &&
+       ectx->stream_value_head[4] == 6) {
+      return _mongocrypt_ctx_fail_w_msg (
+         ctx, "BSON binary subtype 6 is invalid for encryption");
+   }
+
+   if (!_mongocrypt_crypto_stream_final (
+          &ectx->crypto_stream, &ectx->stream_out, ctx->status)) {
+      return _mongocrypt_ctx_fail (ctx);
+   }
+
+   _mongocrypt_buffer_to_binary (&ectx->stream_out, out);
+   ctx->state = MONGOCRYPT_CTX_DONE;
+   return true;
+}
+
+
+bool
+mongocrypt_ctx_explicit_encrypt_stream_init (mongocrypt_ctx_t *ctx,
+                                             uint8_t bson_type)
+{
+   _mongocrypt_ctx_encrypt_t *ectx;
+   _mongocrypt_ctx_opts_spec_t opts_spec;
+
+   if (!ctx) {
+      return false;
+   }
+   memset (&opts_spec, 0, sizeof (opts_spec));
+   opts_spec.key_descriptor = OPT_REQUIRED;
+   opts_spec.algorithm = OPT_REQUIRED;
+
+   if (!_mongocrypt_ctx_init (ctx, &opts_spec)) {
+      return false;
+   }
+
+   ectx = (_mongocrypt_ctx_encrypt_t *) ctx;
+   ctx->type = _MONGOCRYPT_TYPE_ENCRYPT;
+   ectx->explicit = true;
+   ectx->stream = true;
+   ectx->stream_bson_type = bson_type;
+   ctx->vtable.stream_update = _stream_update;
+   ctx->vtable.stream_finalize = _stream_finalize;
+   ctx->vtable.cleanup = _cleanup;
+
+   /* A deterministic IV is a digest of the whole value. */
+   if (ctx->opts.algorithm != MONGOCRYPT_ENCRYPTION_ALGORITHM_RANDOM) {
+      return _mongocrypt_ctx_fail_w_msg (
+         ctx, "streaming encryption requires the random algorithm");
+   }
+
+   if (bson_type != BSON_TYPE_UTF8 && bson_type != BSON_TYPE_BINARY) {
+      return _mongocrypt_ctx_fail_w_msg (
+         ctx, "streaming encryption requires a string or binary value");
+   }
+
+   if (ctx->opts.key_alt_names) {
+      if (!_mongocrypt_key_broker_request_name (
+             &ctx->kb, &ctx->opts.key_alt_names->value)) {
+         return _mongocrypt_ctx_fail (ctx);
+      }
+   } else {
+      if (!_mongocrypt_key_broker_request_id (&ctx->kb, &ctx->opts.key_id)) {
+         return _mongocrypt_ctx_fail (ctx);
+      }
+   }
+
+   (void) _mongocrypt_key_broker_requests_done (&ctx->kb);
+   return _mongocrypt_ctx_state_from_key_broker (ctx);
+}
+
 static bool
 _check_cmd_for_auto_encrypt (mongocrypt_binary_t *cmd,
                              bool *bypass,
@@ -892,8 +1228,123 @@ mongocrypt_ctx_encrypt_init (mongocrypt_ctx_t *ctx,
    }
 
    /* Otherwise, we need the the driver to fetch the schema. */
-   if (_mongocrypt_buffer_empty (&ectx->schema)) {
+   if (!ctx->nothing_to_do && _mongocrypt_buffer_empty (&ectx->schema)) {
       ctx->state = MONGOCRYPT_CTX_NEED_MONGO_COLLINFO;
    }
    return true;
 }
+
+
+/* Requests the key if @iter is a UUID. */
+static bool
+_request_schema_key (_mongocrypt_key_broker_t *kb, bson_iter_t *iter)
+{
+   _mongocrypt_buffer_t key_id;
+
+   if (!_mongocrypt_buffer_from_uuid_iter (&key_id, iter)) {
+      return true;
+   }
+   return _mongocrypt_key_broker_request_id (kb, &key_id);
+}
+
+
+/* Requests the UUIDs of every "keyId" in a JSON schema. A keyId that is a
+ * JSON pointer names the key by a field of the document, which is only known
+ * once mongocryptd marks the command. */
+static bool
+_request_schema_keys (_mongocrypt_key_broker_t *kb, bson_iter_t *iter)
+{
+   bson_iter_t child;
+
+   while (bson_iter_next (iter)) {
+      if (0 == strcmp (bson_iter_key (iter), "keyId")) {
+         if (!BSON_ITER_HOLDS_ARRAY (iter)) {
+            if (!_request_schema_key (kb, iter)) {
+               return false;
+            }
+            continue;
+         }
+         if (!bson_iter_recurse (iter, &child)) {
+            return false;
+         }
+         while (bson_iter_next (&child)) {
+            if (!_request_schema_key (kb, &child)) {
+               return false;
+            }
+         }
+      } else if (BSON_ITER_HOLDS_DOCUMENT (iter) ||
+                 BSON_ITER_HOLDS_ARRAY (iter)) {
+         if (!bson_iter_recurse (iter, &child) ||
+             !_request_schema_keys (kb, &child)) {
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+
+static bool
+_prefetch_finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
+{
+   static const uint8_t empty[] = {5, 0, 0, 0, 0};
+
+   /* The fetched keys are in the key cache. There is nothing to output. */
+   out->data = (uint8_t *) empty;
+   out->len = sizeof (empty);
+   ctx->state = MONGOCRYPT_CTX_DONE;
+   return true;
+}
+
+
+bool
+mongocrypt_ctx_prefetch_keys_init (mongocrypt_ctx_t *ctx,
+                                   mongocrypt_ctx_t *encrypt_ctx)
+{
+   _mongocrypt_ctx_encrypt_t *ectx;
+   _mongocrypt_ctx_opts_spec_t opts_spec;
+   bson_t schema;
+   bson_iter_t iter;
+
+   if (!ctx) {
+      return false;
+   }
+   memset (&opts_spec, 0, sizeof (opts_spec));
+   if (!_mongocrypt_ctx_init (ctx, &opts_spec)) {
+      return false;
+   }
+
+   ctx->type = _MONGOCRYPT_TYPE_PREFETCH_KEYS;
+   ctx->vtable.finalize = _prefetch_finalize;
+
+   if (!encrypt_ctx || encrypt_ctx->type != _MONGOCRYPT_TYPE_ENCRYPT) {
+      return _mongocrypt_ctx_fail_w_msg (ctx,
+                                         "expected an auto encryption context");
+   }
+   if (encrypt_ctx->crypt != ctx->crypt) {
+      return _mongocrypt_ctx_fail_w_msg (
+         ctx, "encryption context belongs to a different mongocrypt_t");
+   }
+   if (encrypt_ctx->state != MONGOCRYPT_CTX_NEED_MONGO_MARKINGS) {
+      return _mongocrypt_ctx_fail_w_msg (ctx,
+                                         "encryption context must be in "
+                                         "MONGOCRYPT_CTX_NEED_MONGO_MARKINGS");
+   }
+
+   ectx = (_mongocrypt_ctx_encrypt_t *) encrypt_ctx;
+   if (!_mongocrypt_buffer_empty (&ectx->schema)) {
+      if (!_mongocrypt_buffer_to_bson (&ectx->schema, &schema) ||
+          !bson_iter_init (&iter, &schema)) {
+         return _mongocrypt_ctx_fail_w_msg (ctx, "invalid BSON schema");
+      }
+      if (!_request_schema_keys (&ctx->kb, &iter)) {
+         if (_mongocrypt_key_broker_status (&ctx->kb, ctx->status)) {
+            return _mongocrypt_ctx_fail_w_msg (ctx, "malformed JSON schema");
+         }
+         return _mongocrypt_ctx_fail (ctx);
+      }
+   }
+
+   (void) _mongocrypt_key_broker_requests_done (&ctx->kb);
+   return _mongocrypt_ctx_state_from_key_broker (ctx);
+}
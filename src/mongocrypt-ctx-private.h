@@ -20,6 +20,7 @@
 #include "mongocrypt.h"
 #include "mongocrypt-private.h"
 #include "mongocrypt-buffer-private.h"
+#include "mongocrypt-cache-collinfo-private.h"
 #include "mongocrypt-key-broker-private.h"
 #include "mongocrypt-key-private.h"
 #include "mongocrypt-endpoint-private.h"
@@ -29,6 +30,7 @@ typedef enum {
    _MONGOCRYPT_TYPE_ENCRYPT,
    _MONGOCRYPT_TYPE_DECRYPT,
    _MONGOCRYPT_TYPE_CREATE_DATA_KEY,
+   _MONGOCRYPT_TYPE_PREFETCH_KEYS,
 } _mongocrypt_ctx_type_t;
 
 /* Option values are validated when set.
@@ -57,6 +59,10 @@ typedef struct {
    mongocrypt_kms_ctx_t *(*next_kms_ctx) (mongocrypt_ctx_t *ctx);
    bool (*kms_done) (mongocrypt_ctx_t *ctx);
    bool (*finalize) (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out);
+   bool (*stream_update) (mongocrypt_ctx_t *ctx,
+                          mongocrypt_binary_t *in,
+                          mongocrypt_binary_t *out);
+   bool (*stream_finalize) (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out);
    void (*cleanup) (mongocrypt_ctx_t *ctx);
 } _mongocrypt_vtable_t;
 
@@ -110,10 +116,23 @@ typedef struct {
    _mongocrypt_buffer_t marked_cmd;
    _mongocrypt_buffer_t encrypted_cmd;
    _mongocrypt_buffer_t key_id;
+   /* collinfo is the parsed listCollections result the schema came from.
+    * A remote schema is borrowed from it rather than copied. */
+   _mongocrypt_cache_collinfo_value_t *collinfo;
    bool used_local_schema;
    /* collinfo_has_siblings is true if the schema came from a remote JSON
     * schema, and there were siblings. */
    bool collinfo_has_siblings;
+   /* Streaming explicit encryption only. stream_out holds the output of the
+    * last call. */
+   bool stream;
+   uint8_t stream_bson_type;
+   _mongocrypt_crypto_stream_t crypto_stream;
+   _mongocrypt_buffer_t stream_out;
+   /* The int32 length and binary subtype at the start of the value. */
+   uint8_t stream_value_head[5];
+   uint64_t stream_value_len;
+   uint8_t stream_value_last;
 } _mongocrypt_ctx_encrypt_t;
 
 
@@ -127,6 +146,12 @@ typedef struct {
    _mongocrypt_buffer_t original_doc;
    _mongocrypt_buffer_t unwrapped_doc; /* explicit only */
    _mongocrypt_buffer_t decrypted_doc;
+   /* Streaming explicit decryption only. original_doc holds the message passed
+    * to init. stream_out holds the output of the last call. */
+   bool stream;
+   bool stream_started;
+   _mongocrypt_crypto_stream_t crypto_stream;
+   _mongocrypt_buffer_t stream_out;
 } _mongocrypt_ctx_decrypt_t;
 
 
@@ -137,6 +162,8 @@ typedef struct {
    _mongocrypt_buffer_t key_doc;
    _mongocrypt_buffer_t plaintext_key_material;
    _mongocrypt_buffer_t encrypted_key_material;
+   /* Azure and GCP only. The key of the OAuth token in the OAuth cache. */
+   char *oauth_cache_key;
 } _mongocrypt_ctx_datakey_t;
 
 
@@ -489,6 +489,31 @@ mongocrypt_ctx_kms_done (mongocrypt_ctx_t *ctx)
 }
 
 
+bool
+mongocrypt_ctx_check_pending_keys (mongocrypt_ctx_t *ctx)
+{
+   if (!ctx) {
+      return false;
+   }
+   if (!ctx->initialized) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "ctx NULL or uninitialized");
+   }
+
+   switch (ctx->state) {
+   case MONGOCRYPT_CTX_KEYS_PENDING:
+      if (!_mongocrypt_key_broker_check_pending (&ctx->kb)) {
+         BSON_ASSERT (!_mongocrypt_key_broker_status (&ctx->kb, ctx->status));
+         return _mongocrypt_ctx_fail (ctx);
+      }
+      return _mongocrypt_ctx_state_from_key_broker (ctx);
+   case MONGOCRYPT_CTX_ERROR:
+      return false;
+   default:
+      return _mongocrypt_ctx_fail_w_msg (ctx, "wrong state");
+   }
+}
+
+
 bool
 mongocrypt_ctx_finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
 {
@@ -517,6 +542,65 @@ mongocrypt_ctx_finalize (mongocrypt_ctx_t *ctx, mongocrypt_binary_t *out)
    }
 }
 
+bool
+mongocrypt_ctx_stream_update (mongocrypt_ctx_t *ctx,
+                              mongocrypt_binary_t *in,
+                              mongocrypt_binary_t *out)
+{
+   if (!ctx) {
+      return false;
+   }
+   if (!ctx->initialized) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "ctx NULL or uninitialized");
+   }
+
+   if (!in || !out || (!in->data && in->len > 0)) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "invalid NULL input");
+   }
+
+   if (!ctx->vtable.stream_update) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "not applicable to context");
+   }
+
+   switch (ctx->state) {
+   case MONGOCRYPT_CTX_READY:
+      return ctx->vtable.stream_update (ctx, in, out);
+   case MONGOCRYPT_CTX_ERROR:
+      return false;
+   default:
+      return _mongocrypt_ctx_fail_w_msg (ctx, "wrong state");
+   }
+}
+
+bool
+mongocrypt_ctx_stream_finalize (mongocrypt_ctx_t *ctx,
+                                mongocrypt_binary_t *out)
+{
+   if (!ctx) {
+      return false;
+   }
+   if (!ctx->initialized) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "ctx NULL or uninitialized");
+   }
+
+   if (!out) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "invalid NULL input");
+   }
+
+   if (!ctx->vtable.stream_finalize) {
+      return _mongocrypt_ctx_fail_w_msg (ctx, "not applicable to context");
+   }
+
+   switch (ctx->state) {
+   case MONGOCRYPT_CTX_READY:
+      return ctx->vtable.stream_finalize (ctx, out);
+   case MONGOCRYPT_CTX_ERROR:
+      return false;
+   default:
+      return _mongocrypt_ctx_fail_w_msg (ctx, "wrong state");
+   }
+}
+
 bool
 mongocrypt_ctx_status (mongocrypt_ctx_t *ctx, mongocrypt_status_t *out)
 {
@@ -769,6 +853,11 @@ _mongocrypt_ctx_state_from_key_broker (mongocrypt_ctx_t *ctx)
       new_state = MONGOCRYPT_CTX_ERROR;
       ret = false;
       break;
+   case KB_KEYS_PENDING:
+      /* Another context is fetching keys. */
+      new_state = MONGOCRYPT_CTX_KEYS_PENDING;
+      ret = true;
+      break;
    case KB_ADDING_DOCS:
       /* Require key documents from driver. */
       new_state = MONGOCRYPT_CTX_NEED_MONGO_KEYS;
@@ -27,6 +27,7 @@
 #include "mongocrypt-binary-private.h"
 #include "mongocrypt-opts-private.h"
 #include "mongocrypt-cache-private.h"
+#include "mongocrypt-crypto-private.h"
 
 /* The key broker acts as a middle-man between an encrypt/decrypt request and
  * the key cache.
@@ -53,6 +54,9 @@ typedef enum {
    /* Starting state. Accept requests for keys to be added (either by id or
       name) */
    KB_REQUESTING,
+   /* Another key broker on the same mongocrypt_t is fetching some of the keys
+    * requested. Wait for it to cache them. */
+   KB_KEYS_PENDING,
    /* Accept key documents fetched from the key vault collection. */
    KB_ADDING_DOCS,
    /* Getting oauth token(s) from KMS providers. */
@@ -70,6 +74,12 @@ typedef struct _key_request_t {
    _mongocrypt_buffer_t id;
    _mongocrypt_key_alt_name_t *alt_name;
    bool satisfied; /* true if satisfied by a cache entry or a key returned. */
+   /* true if fetched for another key broker of a batch. Not required to be
+    * satisfied. */
+   bool batched;
+   /* Nonzero if the cache lookup claimed a refresh of the cached key. Released
+    * if the key broker fails or is destroyed before re-caching the key. */
+   int64_t refresh_claim;
    struct _key_request_t *next;
 } key_request_t;
 
@@ -77,21 +87,58 @@ typedef struct _key_request_t {
 typedef struct _key_returned_t {
    _mongocrypt_key_doc_t *doc;
    _mongocrypt_buffer_t decrypted_key_material;
+   /* Set for a key from the cache. doc and decrypted_key_material then borrow
+    * from this shared cache entry, which is released on destroy. */
+   _mongocrypt_cache_key_value_t *cached;
 
    mongocrypt_kms_ctx_t kms;
    bool decrypted;
+   /* Precomputed contexts for decrypted_key_material. Set lazily the first
+    * time the key is used to encrypt or decrypt. */
+   _mongocrypt_key_state_t key_state;
 
    bool needs_auth;
 
    struct _key_returned_t *next;
 } key_returned_t;
 
+/* A request for an OAuth token. A renewal is for a token that is still cached,
+ * so it is sent alongside the requests to decrypt key material instead of
+ * before them. */
 typedef struct _auth_request_t {
    mongocrypt_kms_ctx_t kms;
+   /* The key of the token in the OAuth cache. */
+   char *cache_key;
    bool returned;
-   bool initialized;
+   bool renewal;
+   /* Nonzero if this key broker was told to renew the token, and has not yet
+    * cached a new one or given up the renewal. */
+   int64_t renewal_claim;
+   /* true once the reply was added to the OAuth cache. */
+   bool cached;
+   struct _auth_request_t *next;
 } auth_request_t;
 
+/* An entry of a key index, for one id or key alt name of an item. */
+typedef struct _key_index_entry_t {
+   uint32_t hash;
+   /* Exactly one is set. Both borrow from the item. */
+   const _mongocrypt_buffer_t *id;
+   const char *name;
+   /* A key_request_t or key_returned_t. */
+   void *item;
+   struct _key_index_entry_t *next;
+} key_index_entry_t;
+
+/* A hash index of requests or keys by id and by key alt name, so documents
+ * referencing many keys do not make lookups quadratic. Each bucket lists the
+ * newest entries first. */
+typedef struct {
+   key_index_entry_t **buckets;
+   uint32_t num_buckets; /* zero or a power of two. */
+   uint32_t num_entries;
+} key_index_t;
+
 typedef struct {
    key_broker_state_t state;
    mongocrypt_status_t *status;
@@ -104,12 +151,18 @@ typedef struct {
     */
    key_returned_t *keys_returned;
    key_returned_t *keys_cached;
+   /* Indexes of key_requests, keys_returned, and keys_cached. */
+   key_index_t key_requests_index;
+   key_index_t keys_returned_index;
+   key_index_t keys_cached_index;
    _mongocrypt_buffer_t filter;
    mongocrypt_t *crypt;
 
    key_returned_t *decryptor_iter;
-   auth_request_t auth_request_azure;
-   auth_request_t auth_request_gcp;
+   auth_request_t *auth_requests;
+   /* Set while the unsatisfied requests wait in a batch of key fetches. */
+   bool in_batch;
+   uint32_t batch_generation;
 } _mongocrypt_key_broker_t;
 
 void
@@ -132,6 +185,12 @@ _mongocrypt_key_broker_request_name (_mongocrypt_key_broker_t *kb,
 bool
 _mongocrypt_key_broker_requests_done (_mongocrypt_key_broker_t *kb);
 
+/* Retry the requests pending on other key brokers. Satisfies them from the
+ * cache if they have been fetched, or claims them if the other key broker
+ * stopped fetching them. */
+bool
+_mongocrypt_key_broker_check_pending (_mongocrypt_key_broker_t *kb);
+
 /* Get the find command filter. */
 bool
 _mongocrypt_key_broker_filter (_mongocrypt_key_broker_t *kb,
@@ -159,17 +218,42 @@ bool
 _mongocrypt_key_broker_kms_done (_mongocrypt_key_broker_t *kb);
 
 
-/* Get the final decrypted key material from a key by looking up with a key_id.
- * @out is always initialized, even on error. */
+/* A decrypted key, borrowed from the key broker. The pointers are valid until
+ * the key broker is cleaned up, so encrypting or decrypting a field with a
+ * handle copies nothing. */
+typedef struct {
+   const _mongocrypt_buffer_t *key_id;
+   const _mongocrypt_buffer_t *key_material;
+   /* Precomputed on the first lookup of the key. */
+   const _mongocrypt_key_state_t *key_state;
+} _mongocrypt_key_handle_t;
+
+/* Look up a decrypted key by key_id. Does not allocate once the key state is
+ * computed. @out is zeroed on error. */
+bool
+_mongocrypt_key_broker_key_by_id (_mongocrypt_key_broker_t *kb,
+                                  const _mongocrypt_buffer_t *key_id,
+                                  _mongocrypt_key_handle_t *out)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Like _mongocrypt_key_broker_key_by_id, but looks up with a keyAltName. */
+bool
+_mongocrypt_key_broker_key_by_name (_mongocrypt_key_broker_t *kb,
+                                    const bson_value_t *key_alt_name,
+                                    _mongocrypt_key_handle_t *out)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
+/* Get a copy of the final decrypted key material from a key by looking up with
+ * a key_id. @out is always initialized, even on error. */
 bool
 _mongocrypt_key_broker_decrypted_key_by_id (_mongocrypt_key_broker_t *kb,
                                             const _mongocrypt_buffer_t *key_id,
                                             _mongocrypt_buffer_t *out)
    MONGOCRYPT_WARN_UNUSED_RESULT;
 
-/* Get the final decrypted key material from a key, and optionally its key_id.
- * @key_id_out may be NULL. @out and @key_id_out (if not NULL) are always
- * initialized, even on error. */
+/* Get a copy of the final decrypted key material from a key, and optionally
+ * its key_id. @key_id_out may be NULL. @out and @key_id_out (if not NULL) are
+ * always initialized, even on error. */
 bool
 _mongocrypt_key_broker_decrypted_key_by_name (_mongocrypt_key_broker_t *kb,
                                               const bson_value_t *key_alt_name,
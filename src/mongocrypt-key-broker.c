@@ -26,26 +26,233 @@ _mongocrypt_key_broker_init (_mongocrypt_key_broker_t *kb, mongocrypt_t *crypt)
    kb->status = mongocrypt_status_new ();
 }
 
+/* Key indexes. Entries are looked up by id or key alt name with the hashes of
+ * the key cache. */
+static uint32_t
+_key_index_hash_id (const _mongocrypt_buffer_t *id)
+{
+   return _mongocrypt_cache_hash (id->data, id->len, 'i');
+}
+
+static uint32_t
+_key_index_hash_name (const char *name)
+{
+   return _mongocrypt_cache_hash (name, strlen (name), 'n');
+}
+
+static void
+_key_index_insert (key_index_t *index, key_index_entry_t *entry)
+{
+   key_index_entry_t **bucket;
+
+   bucket = &index->buckets[entry->hash & (index->num_buckets - 1)];
+   entry->next = *bucket;
+   *bucket = entry;
+}
+
+/* Doubles the buckets once there are more entries than buckets. */
+static void
+_key_index_grow (key_index_t *index)
+{
+   key_index_entry_t **old_buckets;
+   key_index_entry_t *entry;
+   key_index_entry_t *tmp;
+   uint32_t old_num_buckets;
+   uint32_t i;
+
+   if (index->num_entries < index->num_buckets) {
+      return;
+   }
+
+   old_buckets = index->buckets;
+   old_num_buckets = index->num_buckets;
+   index->num_buckets = old_num_buckets ? old_num_buckets * 2 : 16;
+   index->buckets =
+      bson_malloc0 (index->num_buckets * sizeof (*index->buckets));
+   BSON_ASSERT (index->buckets);
+
+   /* Reinsert the oldest entries of each bucket first to keep the newest
+    * first. */
+   for (i = 0; i < old_num_buckets; i++) {
+      key_index_entry_t *reversed = NULL;
+
+      for (entry = old_buckets[i]; NULL != entry; entry = tmp) {
+         tmp = entry->next;
+         entry->next = reversed;
+         reversed = entry;
+      }
+      for (entry = reversed; NULL != entry; entry = tmp) {
+         tmp = entry->next;
+         _key_index_insert (index, entry);
+      }
+   }
+   bson_free (old_buckets);
+}
+
+static void
+_key_index_add_entry (key_index_t *index,
+                      uint32_t hash,
+                      const _mongocrypt_buffer_t *id,
+                      const char *name,
+                      void *item)
+{
+   key_index_entry_t *entry;
+
+   _key_index_grow (index);
+   entry = bson_malloc0 (sizeof (*entry));
+   BSON_ASSERT (entry);
+   entry->hash = hash;
+   entry->id = id;
+   entry->name = name;
+   entry->item = item;
+   _key_index_insert (index, entry);
+   index->num_entries++;
+}
+
+/* Indexes @item by @id, unless empty, and by each of @alt_names. @id and
+ * @alt_names must live as long as @item. */
+static void
+_key_index_add (key_index_t *index,
+                const _mongocrypt_buffer_t *id,
+                _mongocrypt_key_alt_name_t *alt_names,
+                void *item)
+{
+   _mongocrypt_key_alt_name_t *alt_name;
+   const char *name;
+
+   if (id && !_mongocrypt_buffer_empty (id)) {
+      _key_index_add_entry (index, _key_index_hash_id (id), id, NULL, item);
+   }
+   for (alt_name = alt_names; NULL != alt_name; alt_name = alt_name->next) {
+      name = _mongocrypt_key_alt_name_get_string (alt_name);
+      _key_index_add_entry (
+         index, _key_index_hash_name (name), NULL, name, item);
+   }
+}
+
+/* Returns the first entry from @entry on matching @id or @name, one of which is
+ * NULL. */
+static key_index_entry_t *
+_key_index_next_match (key_index_entry_t *entry,
+                       uint32_t hash,
+                       const _mongocrypt_buffer_t *id,
+                       const char *name)
+{
+   for (; NULL != entry; entry = entry->next) {
+      if (entry->hash != hash) {
+         continue;
+      }
+      if (id && entry->id && _mongocrypt_buffer_equal (id, entry->id)) {
+         return entry;
+      }
+      if (name && entry->name && 0 == strcmp (name, entry->name)) {
+         return entry;
+      }
+   }
+   return NULL;
+}
+
+static key_index_entry_t *
+_key_index_bucket (key_index_t *index, uint32_t hash)
+{
+   if (index->num_buckets == 0) {
+      return NULL;
+   }
+   return index->buckets[hash & (index->num_buckets - 1)];
+}
+
+/* Calls @fn on each item matching @key_id or any of @key_alt_names, both
+ * NULLable, until it returns false. An item matching several times is visited
+ * several times. */
+static void
+_key_index_visit (key_index_t *index,
+                  const _mongocrypt_buffer_t *key_id,
+                  _mongocrypt_key_alt_name_t *key_alt_names,
+                  bool (*fn) (void *item, void *ctx),
+                  void *ctx)
+{
+   _mongocrypt_key_alt_name_t *alt_name;
+   key_index_entry_t *entry;
+   const char *name;
+   uint32_t hash;
+
+   if (key_id && !_mongocrypt_buffer_empty (key_id)) {
+      hash = _key_index_hash_id (key_id);
+      for (entry = _key_index_next_match (
+              _key_index_bucket (index, hash), hash, key_id, NULL);
+           NULL != entry;
+           entry = _key_index_next_match (entry->next, hash, key_id, NULL)) {
+         if (!fn (entry->item, ctx)) {
+            return;
+         }
+      }
+   }
+   for (alt_name = key_alt_names; NULL != alt_name; alt_name = alt_name->next) {
+      name = _mongocrypt_key_alt_name_get_string (alt_name);
+      hash = _key_index_hash_name (name);
+      for (entry = _key_index_next_match (
+              _key_index_bucket (index, hash), hash, NULL, name);
+           NULL != entry;
+           entry = _key_index_next_match (entry->next, hash, NULL, name)) {
+         if (!fn (entry->item, ctx)) {
+            return;
+         }
+      }
+   }
+}
+
+static bool
+_key_index_take_first (void *item, void *ctx)
+{
+   *(void **) ctx = item;
+   return false;
+}
+
+/* Find the first (if any) item matching either a key_id or a list of
+ * key_alt_names (both are NULLable). Matches by id are preferred. */
+static void *
+_key_index_find_one (key_index_t *index,
+                     const _mongocrypt_buffer_t *key_id,
+                     _mongocrypt_key_alt_name_t *key_alt_names)
+{
+   void *found = NULL;
+
+   _key_index_visit (
+      index, key_id, key_alt_names, _key_index_take_first, &found);
+   return found;
+}
+
+static void
+_key_index_cleanup (key_index_t *index)
+{
+   key_index_entry_t *entry;
+   key_index_entry_t *tmp;
+   uint32_t i;
+
+   for (i = 0; i < index->num_buckets; i++) {
+      for (entry = index->buckets[i]; NULL != entry; entry = tmp) {
+         tmp = entry->next;
+         bson_free (entry);
+      }
+   }
+   bson_free (index->buckets);
+}
+
 /*
- * Creates a new key_returned_t and prepends it to a list.
+ * Creates a new key_returned_t without a key document and prepends it to a
+ * list.
  *
  * Side effects:
  * - updates *list to point to a new head.
  */
 static key_returned_t *
-_key_returned_prepend (_mongocrypt_key_broker_t *kb,
-                       key_returned_t **list,
-                       _mongocrypt_key_doc_t *key_doc)
+_key_returned_link (_mongocrypt_key_broker_t *kb, key_returned_t **list)
 {
    key_returned_t *key_returned;
 
-   BSON_ASSERT (key_doc);
-
    key_returned = bson_malloc0 (sizeof (*key_returned));
    BSON_ASSERT (key_returned);
-
-   key_returned->doc = _mongocrypt_key_new ();
-   _mongocrypt_key_doc_copy_to (key_doc, key_returned->doc);
+   _mongocrypt_key_state_init (&key_returned->key_state);
 
    /* Prepend and update the head of the list. */
    key_returned->next = *list;
@@ -56,31 +263,30 @@ _key_returned_prepend (_mongocrypt_key_broker_t *kb,
    return key_returned;
 }
 
-/* Find the first (if any) key_returned_t matching either a key_id or a list of
- * key_alt_names (both are NULLable) */
+/*
+ * Creates a new key_returned_t with a copy of key_doc, prepends it to a list,
+ * and indexes it in keys_returned_index.
+ *
+ * Side effects:
+ * - updates *list to point to a new head.
+ */
 static key_returned_t *
-_key_returned_find_one (key_returned_t *list,
-                        _mongocrypt_buffer_t *key_id,
-                        _mongocrypt_key_alt_name_t *key_alt_names)
+_key_returned_prepend (_mongocrypt_key_broker_t *kb,
+                       key_returned_t **list,
+                       _mongocrypt_key_doc_t *key_doc)
 {
    key_returned_t *key_returned;
 
-   for (key_returned = list; NULL != key_returned;
-        key_returned = key_returned->next) {
-      if (key_id) {
-         if (0 == _mongocrypt_buffer_cmp (key_id, &key_returned->doc->id)) {
-            return key_returned;
-         }
-      }
-      if (key_alt_names) {
-         if (_mongocrypt_key_alt_name_intersects (
-                key_alt_names, key_returned->doc->key_alt_names)) {
-            return key_returned;
-         }
-      }
-   }
+   BSON_ASSERT (key_doc);
 
-   return NULL;
+   key_returned = _key_returned_link (kb, list);
+   key_returned->doc = _mongocrypt_key_new ();
+   _mongocrypt_key_doc_copy_to (key_doc, key_returned->doc);
+   _key_index_add (&kb->keys_returned_index,
+                   &key_returned->doc->id,
+                   key_returned->doc->key_alt_names,
+                   key_returned);
+   return key_returned;
 }
 
 /* Find the first (if any) key_request_t in the key broker matching either a
@@ -89,35 +295,114 @@ static key_request_t *
 _key_request_find_one (_mongocrypt_key_broker_t *kb,
                        const _mongocrypt_buffer_t *key_id,
                        _mongocrypt_key_alt_name_t *key_alt_names)
+{
+   return _key_index_find_one (
+      &kb->key_requests_index, key_id, key_alt_names);
+}
+
+static bool
+_all_key_requests_satisfied (_mongocrypt_key_broker_t *kb)
 {
    key_request_t *key_request;
 
    for (key_request = kb->key_requests; NULL != key_request;
         key_request = key_request->next) {
-      if (key_id) {
-         if (0 == _mongocrypt_buffer_cmp (key_id, &key_request->id)) {
-            return key_request;
-         }
+      if (!key_request->satisfied && !key_request->batched) {
+         return false;
       }
-      if (key_alt_names) {
-         if (_mongocrypt_key_alt_name_intersects (key_alt_names,
-                                                  key_request->alt_name)) {
-            return key_request;
-         }
+   }
+   return true;
+}
+
+/* Drops the claims on keys this key broker was fetching, so that other key
+ * brokers waiting on them can proceed. */
+static void
+_release_key_fetches (_mongocrypt_key_broker_t *kb)
+{
+   /* crypt is unset if the context was never initialized. */
+   if (kb->crypt && kb->crypt->opts.coalesce_key_fetches) {
+      _mongocrypt_key_fetches_release (&kb->crypt->key_fetches, kb);
+   }
+}
+
+/* Gives up the key cache refreshes this key broker claimed, so that the next
+ * context refreshes the keys instead of waiting for the claims to lapse. Keys
+ * this key broker re-cached are not affected. */
+static void
+_release_refresh_claims (_mongocrypt_key_broker_t *kb)
+{
+   key_request_t *req;
+   _mongocrypt_cache_key_attr_t *attr;
+
+   /* crypt is unset if the context was never initialized. */
+   if (!kb->crypt) {
+      return;
+   }
+
+   for (req = kb->key_requests; NULL != req; req = req->next) {
+      if (req->refresh_claim == 0) {
+         continue;
       }
+
+      attr = _mongocrypt_cache_key_attr_new (&req->id, req->alt_name);
+      BSON_ASSERT (attr);
+      /* A failure only leaves the claim to lapse. */
+      (void) _mongocrypt_cache_release_refresh (
+         &kb->crypt->cache_key, attr, req->refresh_claim);
+      _mongocrypt_cache_key_attr_destroy (attr);
+      req->refresh_claim = 0;
    }
+}
 
-   return NULL;
+/* Gives up an OAuth token renewal this key broker was told to make and did
+ * not complete, so that the next context renews the token instead of waiting
+ * for the claim to lapse. */
+static void
+_release_renewal (_mongocrypt_key_broker_t *kb, auth_request_t *auth_request)
+{
+   _mongocrypt_cache_oauth_release_renewal (kb->crypt->cache_oauth,
+                                            auth_request->cache_key,
+                                            auth_request->renewal_claim);
+   auth_request->renewal_claim = 0;
 }
 
+static void
+_release_renewals (_mongocrypt_key_broker_t *kb)
+{
+   auth_request_t *auth_request;
+
+   for (auth_request = kb->auth_requests; NULL != auth_request;
+        auth_request = auth_request->next) {
+      _release_renewal (kb, auth_request);
+   }
+}
+
+/* Claims every unsatisfied request for this key broker to fetch. Claims all
+ * or none, so that a key broker never waits while holding claims. Returns
+ * false if another key broker is fetching any of them. */
 static bool
-_all_key_requests_satisfied (_mongocrypt_key_broker_t *kb)
+_claim_key_fetches (_mongocrypt_key_broker_t *kb)
 {
-   key_request_t *key_request;
+   key_request_t *req;
+   _mongocrypt_cache_key_attr_t *attr;
+   bool claimed;
 
-   for (key_request = kb->key_requests; NULL != key_request;
-        key_request = key_request->next) {
-      if (!key_request->satisfied) {
+   if (!kb->crypt->opts.coalesce_key_fetches) {
+      return true;
+   }
+
+   for (req = kb->key_requests; NULL != req; req = req->next) {
+      if (req->satisfied || req->batched) {
+         continue;
+      }
+
+      attr = _mongocrypt_cache_key_attr_new (&req->id, req->alt_name);
+      BSON_ASSERT (attr);
+      claimed =
+         _mongocrypt_key_fetches_claim (&kb->crypt->key_fetches, attr, kb);
+      _mongocrypt_cache_key_attr_destroy (attr);
+      if (!claimed) {
+         _release_key_fetches (kb);
          return false;
       }
    }
@@ -129,6 +414,9 @@ _key_broker_fail_w_msg (_mongocrypt_key_broker_t *kb, const char *msg)
 {
    mongocrypt_status_t *status;
 
+   _release_key_fetches (kb);
+   _release_refresh_claims (kb);
+   _release_renewals (kb);
    kb->state = KB_ERROR;
    status = kb->status;
    CLIENT_ERR (msg);
@@ -142,6 +430,9 @@ _key_broker_fail (_mongocrypt_key_broker_t *kb)
       return _key_broker_fail_w_msg (
          kb, "unexpected, failing but no error status set");
    }
+   _release_key_fetches (kb);
+   _release_refresh_claims (kb);
+   _release_renewals (kb);
    kb->state = KB_ERROR;
    return false;
 }
@@ -151,19 +442,27 @@ _try_satisfying_from_cache (_mongocrypt_key_broker_t *kb, key_request_t *req)
 {
    _mongocrypt_cache_key_attr_t *attr = NULL;
    _mongocrypt_cache_key_value_t *value = NULL;
+   int64_t refresh_claim;
    bool ret = false;
 
-   if (kb->state != KB_REQUESTING) {
+   if (kb->state != KB_REQUESTING && kb->state != KB_KEYS_PENDING) {
       _key_broker_fail_w_msg (
          kb, "trying to retrieve key from cache in invalid state");
       goto cleanup;
    }
 
    attr = _mongocrypt_cache_key_attr_new (&req->id, req->alt_name);
-   if (!_mongocrypt_cache_get (&kb->crypt->cache_key, attr, (void **) &value)) {
+   if (!_mongocrypt_cache_get_claim (&kb->crypt->cache_key,
+                                     attr,
+                                     (void **) &value,
+                                     &refresh_claim)) {
       _key_broker_fail_w_msg (kb, "failed to retrieve from cache");
       goto cleanup;
    }
+   /* A pending request is looked up again, and keeps any earlier claim. */
+   if (refresh_claim != 0) {
+      req->refresh_claim = refresh_claim;
+   }
 
    if (value) {
       key_returned_t *key_returned;
@@ -175,17 +474,23 @@ _try_satisfying_from_cache (_mongocrypt_key_broker_t *kb, key_request_t *req)
          goto cleanup;
       }
 
-      /* Add the cached key to our locally copied list.
+      /* Add the cached key to our local list. It keeps the reference from
+       * _mongocrypt_cache_get instead of copying the entry.
        * Note, we deduplicate requests, but *not* keys from the cache,
        * because the state of the cache may change between each call to
        * _mongocrypt_cache_get.
        */
-      key_returned =
-         _key_returned_prepend (kb, &kb->keys_cached, value->key_doc);
-      _mongocrypt_buffer_init (&key_returned->decrypted_key_material);
-      _mongocrypt_buffer_copy_to (&value->decrypted_key_material,
-                                  &key_returned->decrypted_key_material);
+      key_returned = _key_returned_link (kb, &kb->keys_cached);
+      key_returned->cached = value;
+      key_returned->doc = value->key_doc;
+      _key_index_add (&kb->keys_cached_index,
+                      &key_returned->doc->id,
+                      key_returned->doc->key_alt_names,
+                      key_returned);
+      _mongocrypt_buffer_set_to (&value->decrypted_key_material,
+                                 &key_returned->decrypted_key_material);
       key_returned->decrypted = true;
+      value = NULL;
    }
 
    ret = true;
@@ -248,6 +553,7 @@ _mongocrypt_key_broker_request_id (_mongocrypt_key_broker_t *kb,
    _mongocrypt_buffer_copy_to (key_id, &req->id);
    req->next = kb->key_requests;
    kb->key_requests = req;
+   _key_index_add (&kb->key_requests_index, &req->id, NULL, req);
    if (!_try_satisfying_from_cache (kb, req)) {
       return false;
    }
@@ -281,12 +587,132 @@ _mongocrypt_key_broker_request_name (_mongocrypt_key_broker_t *kb,
    req->alt_name = key_alt_name /* takes ownership */;
    req->next = kb->key_requests;
    kb->key_requests = req;
+   _key_index_add (&kb->key_requests_index, NULL, req->alt_name, req);
    if (!_try_satisfying_from_cache (kb, req)) {
       return false;
    }
    return true;
 }
 
+/* Adds the unsatisfied requests to the open batch of key fetches. */
+static void
+_join_key_batch (_mongocrypt_key_broker_t *kb)
+{
+   key_request_t *req;
+   _mongocrypt_cache_key_attr_t *attr;
+
+   for (req = kb->key_requests; NULL != req; req = req->next) {
+      if (req->satisfied) {
+         continue;
+      }
+
+      attr = _mongocrypt_cache_key_attr_new (&req->id, req->alt_name);
+      BSON_ASSERT (attr);
+      kb->batch_generation =
+         _mongocrypt_key_fetches_batch_add (&kb->crypt->key_fetches, attr);
+      _mongocrypt_cache_key_attr_destroy (attr);
+   }
+   kb->in_batch = true;
+}
+
+/* Adds the requests of the batch of key fetches to this key broker, which has
+ * claimed its own. Requests for keys that were cached or claimed since they
+ * joined the batch are skipped. */
+static bool
+_take_key_batch (_mongocrypt_key_broker_t *kb)
+{
+   _mongocrypt_key_fetch_t *batch;
+   _mongocrypt_key_fetch_t *fetch;
+   _mongocrypt_buffer_t *id;
+   key_request_t *req;
+   bool ret = false;
+
+   if (!_mongocrypt_key_fetches_batch_take (
+          &kb->crypt->key_fetches, kb->batch_generation, &batch)) {
+      /* Another key broker took it first. */
+      return true;
+   }
+
+   for (fetch = batch; NULL != fetch; fetch = fetch->next) {
+      id = _mongocrypt_buffer_empty (&fetch->attr->id) ? NULL
+                                                        : &fetch->attr->id;
+      if (_key_request_find_one (kb, id, fetch->attr->alt_names)) {
+         continue;
+      }
+
+      req = bson_malloc0 (sizeof *req);
+      BSON_ASSERT (req);
+      req->batched = true;
+      if (id) {
+         _mongocrypt_buffer_copy_to (id, &req->id);
+      } else {
+         req->alt_name =
+            _mongocrypt_key_alt_name_copy_all (fetch->attr->alt_names);
+      }
+
+      if (!_try_satisfying_from_cache (kb, req) || req->satisfied ||
+          !_mongocrypt_key_fetches_claim (
+             &kb->crypt->key_fetches, fetch->attr, kb)) {
+         _mongocrypt_buffer_cleanup (&req->id);
+         _mongocrypt_key_alt_name_destroy_all (req->alt_name);
+         bson_free (req);
+         if (kb->state == KB_ERROR) {
+            goto done;
+         }
+         continue;
+      }
+
+      req->next = kb->key_requests;
+      kb->key_requests = req;
+      _key_index_add (
+         &kb->key_requests_index, id ? &req->id : NULL, req->alt_name, req);
+   }
+   ret = true;
+
+done:
+   _mongocrypt_key_fetches_batch_destroy (batch);
+   return ret;
+}
+
+/* Moves to KB_ADDING_DOCS if this key broker may fetch its unsatisfied
+ * requests, and otherwise waits in KB_KEYS_PENDING. A key broker in an open
+ * batch waits until the batch is due, then fetches it. */
+static bool
+_fetch_or_wait (_mongocrypt_key_broker_t *kb)
+{
+   bool due;
+
+   if (kb->in_batch) {
+      if (_mongocrypt_key_fetches_batch_open (
+             &kb->crypt->key_fetches,
+             kb->batch_generation,
+             kb->crypt->opts.key_fetch_batch_window_ms,
+             kb->crypt->opts.key_fetch_batch_max_keys,
+             &due)) {
+         if (!due || !_claim_key_fetches (kb)) {
+            kb->state = KB_KEYS_PENDING;
+            return true;
+         }
+         kb->in_batch = false;
+         if (!_take_key_batch (kb)) {
+            return false;
+         }
+         kb->state = KB_ADDING_DOCS;
+         return true;
+      }
+      /* Another key broker took the batch, and claimed the keys it had not
+       * been fetching already. */
+      kb->in_batch = false;
+   }
+
+   if (_claim_key_fetches (kb)) {
+      kb->state = KB_ADDING_DOCS;
+   } else {
+      kb->state = KB_KEYS_PENDING;
+   }
+   return true;
+}
+
 bool
 _mongocrypt_key_broker_requests_done (_mongocrypt_key_broker_t *kb)
 {
@@ -301,7 +727,10 @@ _mongocrypt_key_broker_requests_done (_mongocrypt_key_broker_t *kb)
       if (_all_key_requests_satisfied (kb)) {
          kb->state = KB_DONE;
       } else {
-         kb->state = KB_ADDING_DOCS;
+         if (kb->crypt->opts.key_fetch_batch_max_keys) {
+            _join_key_batch (kb);
+         }
+         return _fetch_or_wait (kb);
       }
    } else {
       kb->state = KB_DONE;
@@ -309,6 +738,29 @@ _mongocrypt_key_broker_requests_done (_mongocrypt_key_broker_t *kb)
    return true;
 }
 
+bool
+_mongocrypt_key_broker_check_pending (_mongocrypt_key_broker_t *kb)
+{
+   key_request_t *req;
+
+   if (kb->state != KB_KEYS_PENDING) {
+      return _key_broker_fail_w_msg (
+         kb, "attempting to check pending keys, but in wrong state");
+   }
+
+   for (req = kb->key_requests; NULL != req; req = req->next) {
+      if (!req->satisfied && !_try_satisfying_from_cache (kb, req)) {
+         return false;
+      }
+   }
+
+   if (_all_key_requests_satisfied (kb)) {
+      kb->state = KB_DONE;
+      return true;
+   }
+   return _fetch_or_wait (kb);
+}
+
 bool
 _mongocrypt_key_broker_filter (_mongocrypt_key_broker_t *kb,
                                mongocrypt_binary_t *out)
@@ -446,6 +898,172 @@ _decrypt_with_local_kms (_mongocrypt_key_broker_t *kb,
    return true;
 }
 
+/* Returns the OAuth cache key of the token needed to decrypt @key_doc, which
+ * is an Azure or GCP key. */
+static char *
+_oauth_cache_key (_mongocrypt_key_broker_t *kb,
+                  const _mongocrypt_key_doc_t *key_doc)
+{
+   if (key_doc->kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
+      return _mongocrypt_cache_oauth_key (
+         MONGOCRYPT_KMS_PROVIDER_AZURE,
+         &kb->crypt->opts,
+         key_doc->kek.provider.azure.key_vault_endpoint);
+   }
+   return _mongocrypt_cache_oauth_key (MONGOCRYPT_KMS_PROVIDER_GCP,
+                                       &kb->crypt->opts,
+                                       key_doc->kek.provider.gcp.endpoint);
+}
+
+
+/* Adds a request for the token for @cache_key, unless one exists. A renewal
+ * becomes a regular request if a key needs the token to be decrypted.
+ * @renewal_claim is the claim of the renewal, or zero. */
+static bool
+_add_auth_request (_mongocrypt_key_broker_t *kb,
+                   const _mongocrypt_key_doc_t *key_doc,
+                   const char *cache_key,
+                   bool renewal,
+                   int64_t renewal_claim)
+{
+   auth_request_t *auth_request;
+   bool ok;
+
+   for (auth_request = kb->auth_requests; NULL != auth_request;
+        auth_request = auth_request->next) {
+      if (0 == strcmp (auth_request->cache_key, cache_key)) {
+         auth_request->renewal = auth_request->renewal && renewal;
+         if (renewal_claim) {
+            /* A claim is only given again once the previous one lapsed. */
+            auth_request->renewal_claim = renewal_claim;
+         }
+         return true;
+      }
+   }
+
+   auth_request = bson_malloc0 (sizeof (*auth_request));
+   BSON_ASSERT (auth_request);
+   auth_request->cache_key = bson_strdup (cache_key);
+   auth_request->renewal = renewal;
+   auth_request->renewal_claim = renewal_claim;
+   auth_request->next = kb->auth_requests;
+   kb->auth_requests = auth_request;
+
+   if (key_doc->kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
+      ok = _mongocrypt_kms_ctx_init_azure_auth (
+         &auth_request->kms,
+         &kb->crypt->log,
+         &kb->crypt->opts,
+         /* The key vault endpoint is used to determine the scope. */
+         key_doc->kek.provider.azure.key_vault_endpoint);
+   } else {
+      ok = _mongocrypt_kms_ctx_init_gcp_auth (
+         &auth_request->kms,
+         &kb->crypt->log,
+         &kb->crypt->opts,
+         key_doc->kek.provider.gcp.endpoint);
+   }
+   if (!ok) {
+      mongocrypt_kms_ctx_status (&auth_request->kms, kb->status);
+      return _key_broker_fail (kb);
+   }
+   return true;
+}
+
+
+/* Creates the request to decrypt an Azure or GCP key with @access_token. */
+static bool
+_init_oauth_decrypt (_mongocrypt_key_broker_t *kb,
+                     key_returned_t *key_returned,
+                     const char *access_token)
+{
+   bool ok;
+
+   if (key_returned->doc->kek.kms_provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
+      ok = _mongocrypt_kms_ctx_init_azure_unwrapkey (&key_returned->kms,
+                                                     &kb->crypt->opts,
+                                                     (char *) access_token,
+                                                     key_returned->doc,
+                                                     &kb->crypt->log);
+   } else {
+      ok = _mongocrypt_kms_ctx_init_gcp_decrypt (&key_returned->kms,
+                                                 &kb->crypt->opts,
+                                                 (char *) access_token,
+                                                 key_returned->doc,
+                                                 &kb->crypt->log);
+   }
+   if (!ok) {
+      mongocrypt_kms_ctx_status (&key_returned->kms, kb->status);
+      return _key_broker_fail (kb);
+   }
+   return true;
+}
+
+
+/* Adds the tokens from completed auth requests to the OAuth cache. A failed
+ * renewal is not an error, since the cached token is still valid. */
+static bool
+_cache_auth_results (_mongocrypt_key_broker_t *kb)
+{
+   auth_request_t *auth_request;
+   _mongocrypt_buffer_t oauth_response_buf;
+   bson_t oauth_response;
+
+   for (auth_request = kb->auth_requests; NULL != auth_request;
+        auth_request = auth_request->next) {
+      if (!auth_request->returned || auth_request->cached) {
+         continue;
+      }
+      auth_request->cached = true;
+
+      if (!_mongocrypt_kms_ctx_result (&auth_request->kms,
+                                       &oauth_response_buf)) {
+         if (auth_request->renewal) {
+            _mongocrypt_log (&kb->crypt->log,
+                             MONGOCRYPT_LOG_LEVEL_WARNING,
+                             "failed to renew OAuth token: %s",
+                             mongocrypt_status_message (
+                                auth_request->kms.status, NULL));
+            _release_renewal (kb, auth_request);
+            continue;
+         }
+         mongocrypt_kms_ctx_status (&auth_request->kms, kb->status);
+         return _key_broker_fail (kb);
+      }
+
+      /* Cache returned tokens. */
+      BSON_ASSERT (
+         _mongocrypt_buffer_to_bson (&oauth_response_buf, &oauth_response));
+      if (!_mongocrypt_cache_oauth_add (kb->crypt->cache_oauth,
+                                        auth_request->cache_key,
+                                        &oauth_response,
+                                        kb->status)) {
+         if (auth_request->renewal) {
+            _mongocrypt_log (&kb->crypt->log,
+                             MONGOCRYPT_LOG_LEVEL_WARNING,
+                             "failed to renew OAuth token: %s",
+                             mongocrypt_status_message (kb->status, NULL));
+            _mongocrypt_status_reset (kb->status);
+            _release_renewal (kb, auth_request);
+            continue;
+         }
+         return _key_broker_fail (kb);
+      }
+      /* The new token replaced the one due for renewal. */
+      auth_request->renewal_claim = 0;
+   }
+   return true;
+}
+
+
+static bool
+_satisfy_request (void *item, void *ctx)
+{
+   (void) ctx;
+   ((key_request_t *) item)->satisfied = true;
+   return true;
+}
+
 bool
 _mongocrypt_key_broker_add_doc (_mongocrypt_key_broker_t *kb,
                                 const _mongocrypt_buffer_t *doc)
@@ -453,10 +1071,10 @@ _mongocrypt_key_broker_add_doc (_mongocrypt_key_broker_t *kb,
    bool ret = false;
    bson_t doc_bson;
    _mongocrypt_key_doc_t *key_doc = NULL;
-   key_request_t *key_request;
    key_returned_t *key_returned;
    _mongocrypt_kms_provider_t kek_provider;
-   char* access_token = NULL;
+   char *access_token = NULL;
+   char *oauth_cache_key = NULL;
 
    if (kb->state != KB_ADDING_DOCS) {
       _key_broker_fail_w_msg (
@@ -489,8 +1107,8 @@ _mongocrypt_key_broker_add_doc (_mongocrypt_key_broker_t *kb,
 
    /* Check if there are other keys_returned with intersecting altnames or
     * equal id. This is an error. Do *not* check cached keys. */
-   if (_key_returned_find_one (
-          kb->keys_returned, &key_doc->id, key_doc->key_alt_names)) {
+   if (_key_index_find_one (
+          &kb->keys_returned_index, &key_doc->id, key_doc->key_alt_names)) {
       _key_broker_fail_w_msg (
          kb, "keys returned have duplicate keyAltNames or _id");
       goto done;
@@ -528,66 +1146,27 @@ _mongocrypt_key_broker_add_doc (_mongocrypt_key_broker_t *kb,
          _key_broker_fail (kb);
          goto done;
       }
-   } else if (kek_provider == MONGOCRYPT_KMS_PROVIDER_AZURE) {
-
-      access_token = _mongocrypt_cache_oauth_get (kb->crypt->cache_oauth_azure);
-      if (!access_token) {
-         key_returned->needs_auth = true;
-         /* Create an oauth request if one does not exist. */
-         if (!kb->auth_request_azure.initialized) {
-            if (!_mongocrypt_kms_ctx_init_azure_auth (
-                   &kb->auth_request_azure.kms,
-                   &kb->crypt->log,
-                   &kb->crypt->opts,
-                   /* The key vault endpoint is used to determine the scope. */
-                   key_doc->kek.provider.azure.key_vault_endpoint)) {
-               mongocrypt_kms_ctx_status (&kb->auth_request_azure.kms,
-                                          kb->status);
-               _key_broker_fail (kb);
-               goto done;
-            }
-            kb->auth_request_azure.initialized = true;
-         }
-      } else {
-         if (!_mongocrypt_kms_ctx_init_azure_unwrapkey (&key_returned->kms,
-                                                        &kb->crypt->opts,
-                                                        access_token,
-                                                        key_doc,
-                                                        &kb->crypt->log)) {
-            mongocrypt_kms_ctx_status (&key_returned->kms, kb->status);
-            _key_broker_fail (kb);
+   } else if (kek_provider == MONGOCRYPT_KMS_PROVIDER_AZURE ||
+              kek_provider == MONGOCRYPT_KMS_PROVIDER_GCP) {
+      int64_t renewal_claim;
+
+      oauth_cache_key = _oauth_cache_key (kb, key_doc);
+      access_token = _mongocrypt_cache_oauth_get (
+         kb->crypt->cache_oauth, oauth_cache_key, &renewal_claim);
+      if (!access_token || renewal_claim) {
+         /* Without a cached token, decrypting waits for a new one. */
+         key_returned->needs_auth = !access_token;
+         if (!_add_auth_request (kb,
+                                 key_doc,
+                                 oauth_cache_key,
+                                 NULL != access_token,
+                                 renewal_claim)) {
             goto done;
          }
       }
-   } else if (kek_provider == MONGOCRYPT_KMS_PROVIDER_GCP) {
-
-      access_token = _mongocrypt_cache_oauth_get (kb->crypt->cache_oauth_gcp);
-      if (!access_token) {
-         key_returned->needs_auth = true;
-         /* Create an oauth request if one does not exist. */
-         if (!kb->auth_request_gcp.initialized) {
-            if (!_mongocrypt_kms_ctx_init_gcp_auth (
-                   &kb->auth_request_gcp.kms,
-                   &kb->crypt->log,
-                   &kb->crypt->opts,
-                   key_doc->kek.provider.gcp.endpoint)) {
-               mongocrypt_kms_ctx_status (&kb->auth_request_gcp.kms,
-                                          kb->status);
-               _key_broker_fail (kb);
-               goto done;
-            }
-            kb->auth_request_gcp.initialized = true;
-         }
-      } else {
-         if (!_mongocrypt_kms_ctx_init_gcp_decrypt (&key_returned->kms,
-                                                    &kb->crypt->opts,
-                                                    access_token,
-                                                    key_doc,
-                                                    &kb->crypt->log)) {
-            mongocrypt_kms_ctx_status (&key_returned->kms, kb->status);
-            _key_broker_fail (kb);
-            goto done;
-         }
+      if (access_token &&
+          !_init_oauth_decrypt (kb, key_returned, access_token)) {
+         goto done;
       }
    } else {
       _key_broker_fail_w_msg (kb, "unrecognized kms provider");
@@ -595,20 +1174,16 @@ _mongocrypt_key_broker_add_doc (_mongocrypt_key_broker_t *kb,
    }
 
    /* Mark all matching key requests as satisfied. */
-   for (key_request = kb->key_requests; NULL != key_request;
-        key_request = key_request->next) {
-      if (0 == _mongocrypt_buffer_cmp (&key_doc->id, &key_request->id)) {
-         key_request->satisfied = true;
-      }
-      if (_mongocrypt_key_alt_name_intersects (key_doc->key_alt_names,
-                                               key_request->alt_name)) {
-         key_request->satisfied = true;
-      }
-   }
+   _key_index_visit (&kb->key_requests_index,
+                     &key_doc->id,
+                     key_doc->key_alt_names,
+                     _satisfy_request,
+                     NULL);
 
    ret = true;
 done:
    bson_free (access_token);
+   bson_free (oauth_cache_key);
    _mongocrypt_key_destroy (key_doc);
    return ret;
 }
@@ -657,6 +1232,7 @@ _mongocrypt_key_broker_docs_done (_mongocrypt_key_broker_t *kb)
    } else if (needs_decryption) {
       kb->state = KB_DECRYPTING_KEY_MATERIAL;
    } else {
+      _release_key_fetches (kb);
       kb->state = KB_DONE;
    }
    return true;
@@ -665,6 +1241,8 @@ _mongocrypt_key_broker_docs_done (_mongocrypt_key_broker_t *kb)
 mongocrypt_kms_ctx_t *
 _mongocrypt_key_broker_next_kms (_mongocrypt_key_broker_t *kb)
 {
+   auth_request_t *auth_request;
+
    if (kb->state != KB_DECRYPTING_KEY_MATERIAL &&
        kb->state != KB_AUTHENTICATING) {
       _key_broker_fail_w_msg (
@@ -675,25 +1253,24 @@ _mongocrypt_key_broker_next_kms (_mongocrypt_key_broker_t *kb)
       return NULL;
    }
 
-   if (kb->state == KB_AUTHENTICATING) {
-      if (!kb->auth_request_azure.initialized &&
-          !kb->auth_request_gcp.initialized) {
-         _key_broker_fail_w_msg (kb,
-                                 "unexpected, attempting to authenticate but "
-                                 "KMS request not initialized");
-         return NULL;
-      }
-      if (kb->auth_request_azure.initialized &&
-          !kb->auth_request_azure.returned) {
-         kb->auth_request_azure.returned = true;
-         return &kb->auth_request_azure.kms;
-      }
+   if (kb->state == KB_AUTHENTICATING && !kb->auth_requests) {
+      _key_broker_fail_w_msg (kb,
+                              "unexpected, attempting to authenticate but "
+                              "KMS request not initialized");
+      return NULL;
+   }
 
-      if (kb->auth_request_gcp.initialized && !kb->auth_request_gcp.returned) {
-         kb->auth_request_gcp.returned = true;
-         return &kb->auth_request_gcp.kms;
+   /* While authenticating, these are the requests for missing tokens. Any
+    * renewals not sent then are sent with the decrypt requests. */
+   for (auth_request = kb->auth_requests; NULL != auth_request;
+        auth_request = auth_request->next) {
+      if (!auth_request->returned) {
+         auth_request->returned = true;
+         return &auth_request->kms;
       }
+   }
 
+   if (kb->state == KB_AUTHENTICATING) {
       return NULL;
    }
 
@@ -723,101 +1300,47 @@ _mongocrypt_key_broker_kms_done (_mongocrypt_key_broker_t *kb)
          kb, "attempting to complete KMS requests, but in wrong state");
    }
 
-   if (kb->state == KB_AUTHENTICATING) {
-      bson_t oauth_response;
-      _mongocrypt_buffer_t oauth_response_buf;
-
-      if (kb->auth_request_azure.initialized) {
-         if (!_mongocrypt_kms_ctx_result (&kb->auth_request_azure.kms,
-                                          &oauth_response_buf)) {
-            mongocrypt_kms_ctx_status (&kb->auth_request_azure.kms, kb->status);
-            return _key_broker_fail (kb);
-         }
-
-         /* Cache returned tokens. */
-         BSON_ASSERT (
-            _mongocrypt_buffer_to_bson (&oauth_response_buf, &oauth_response));
-         if (!_mongocrypt_cache_oauth_add (
-                kb->crypt->cache_oauth_azure, &oauth_response, kb->status)) {
-            return false;
-         }
-      }
-
-      if (kb->auth_request_gcp.initialized) {
-         if (!_mongocrypt_kms_ctx_result (&kb->auth_request_gcp.kms,
-                                          &oauth_response_buf)) {
-            mongocrypt_kms_ctx_status (&kb->auth_request_gcp.kms, kb->status);
-            return _key_broker_fail (kb);
-         }
-
-         /* Cache returned tokens. */
-         BSON_ASSERT (
-            _mongocrypt_buffer_to_bson (&oauth_response_buf, &oauth_response));
-         if (!_mongocrypt_cache_oauth_add (
-                kb->crypt->cache_oauth_gcp, &oauth_response, kb->status)) {
-            return false;
-         }
-      }
+   if (!_cache_auth_results (kb)) {
+      return false;
+   }
 
+   if (kb->state == KB_AUTHENTICATING) {
       /* Auth should be finished, create any remaining KMS requests. */
       for (key_returned = kb->keys_returned; NULL != key_returned;
            key_returned = key_returned->next) {
+         char *oauth_cache_key;
          char *access_token;
+         bool ok;
 
          if (!key_returned->needs_auth) {
             continue;
          }
 
-         if (key_returned->doc->kek.kms_provider ==
-             MONGOCRYPT_KMS_PROVIDER_AZURE) {
-            access_token =
-               _mongocrypt_cache_oauth_get (kb->crypt->cache_oauth_azure);
-
-            if (!access_token) {
-               return _key_broker_fail_w_msg (
-                  kb, "authentication failed, no oauth token");
-            }
-
-            if (!_mongocrypt_kms_ctx_init_azure_unwrapkey (&key_returned->kms,
-                                                           &kb->crypt->opts,
-                                                           access_token,
-                                                           key_returned->doc,
-                                                           &kb->crypt->log)) {
-               mongocrypt_kms_ctx_status (&key_returned->kms, kb->status);
-               bson_free (access_token);
-               return _key_broker_fail (kb);
-            }
-
-            key_returned->needs_auth = false;
-            bson_free (access_token);
-         } else if (key_returned->doc->kek.kms_provider ==
-                    MONGOCRYPT_KMS_PROVIDER_GCP) {
-            access_token =
-               _mongocrypt_cache_oauth_get (kb->crypt->cache_oauth_gcp);
-
-            if (!access_token) {
-               return _key_broker_fail_w_msg (
-                  kb, "authentication failed, no oauth token");
-            }
-
-            if (!_mongocrypt_kms_ctx_init_gcp_decrypt (&key_returned->kms,
-                                                       &kb->crypt->opts,
-                                                       access_token,
-                                                       key_returned->doc,
-                                                       &kb->crypt->log)) {
-               mongocrypt_kms_ctx_status (&key_returned->kms, kb->status);
-               bson_free (access_token);
-               return _key_broker_fail (kb);
-            }
-
-            key_returned->needs_auth = false;
-            bson_free (access_token);
-         } else {
+         if (key_returned->doc->kek.kms_provider !=
+                MONGOCRYPT_KMS_PROVIDER_AZURE &&
+             key_returned->doc->kek.kms_provider !=
+                MONGOCRYPT_KMS_PROVIDER_GCP) {
             return _key_broker_fail_w_msg (kb,
                                            "unexpected, authenticating but "
                                            "no requests require "
                                            "authentication");
          }
+
+         oauth_cache_key = _oauth_cache_key (kb, key_returned->doc);
+         access_token = _mongocrypt_cache_oauth_get (
+            kb->crypt->cache_oauth, oauth_cache_key, NULL);
+         bson_free (oauth_cache_key);
+         if (!access_token) {
+            return _key_broker_fail_w_msg (
+               kb, "authentication failed, no oauth token");
+         }
+
+         ok = _init_oauth_decrypt (kb, key_returned, access_token);
+         bson_free (access_token);
+         if (!ok) {
+            return false;
+         }
+         key_returned->needs_auth = false;
       }
 
       kb->state = KB_DECRYPTING_KEY_MATERIAL;
@@ -862,63 +1385,125 @@ _mongocrypt_key_broker_kms_done (_mongocrypt_key_broker_t *kb)
       }
    }
 
+   _release_key_fetches (kb);
    kb->state = KB_DONE;
    return true;
 }
 
 
-bool
-_get_decrypted_key_material (_mongocrypt_key_broker_t *kb,
-                             _mongocrypt_buffer_t *key_id,
-                             _mongocrypt_key_alt_name_t *key_alt_name,
-                             _mongocrypt_buffer_t *out,
-                             _mongocrypt_buffer_t *key_id_out)
+static key_returned_t *
+_find_decrypted_key (_mongocrypt_key_broker_t *kb,
+                     const _mongocrypt_buffer_t *key_id,
+                     _mongocrypt_key_alt_name_t *key_alt_name)
 {
    key_returned_t *key_returned;
 
-   _mongocrypt_buffer_init (out);
-   if (key_id_out) {
-      _mongocrypt_buffer_init (key_id_out);
-   }
    /* Search both keys_returned and keys_cached. */
-
    key_returned =
-      _key_returned_find_one (kb->keys_returned, key_id, key_alt_name);
+      _key_index_find_one (&kb->keys_returned_index, key_id, key_alt_name);
    if (!key_returned) {
       /* Try the keys retrieved from the cache. */
       key_returned =
-         _key_returned_find_one (kb->keys_cached, key_id, key_alt_name);
+         _key_index_find_one (&kb->keys_cached_index, key_id, key_alt_name);
    }
 
    if (!key_returned) {
-      return _key_broker_fail_w_msg (kb, "could not find key");
+      _key_broker_fail_w_msg (kb, "could not find key");
+      return NULL;
    }
 
    if (!key_returned->decrypted) {
-      return _key_broker_fail_w_msg (kb, "unexpected, key not decrypted");
+      _key_broker_fail_w_msg (kb, "unexpected, key not decrypted");
+      return NULL;
    }
 
-   _mongocrypt_buffer_copy_to (&key_returned->decrypted_key_material, out);
-   if (key_id_out) {
-      _mongocrypt_buffer_copy_to (&key_returned->doc->id, key_id_out);
+   return key_returned;
+}
+
+/* Points @alt_name at @value without copying, for a lookup. */
+static void
+_borrow_key_alt_name (const bson_value_t *value,
+                      _mongocrypt_key_alt_name_t *alt_name)
+{
+   memcpy (&alt_name->value, value, sizeof (*value));
+   alt_name->next = NULL;
+}
+
+static bool
+_get_key_handle (_mongocrypt_key_broker_t *kb,
+                 const _mongocrypt_buffer_t *key_id,
+                 const bson_value_t *key_alt_name_value,
+                 _mongocrypt_key_handle_t *out)
+{
+   _mongocrypt_key_alt_name_t key_alt_name;
+   key_returned_t *key_returned;
+
+   memset (out, 0, sizeof (*out));
+
+   if (kb->state != KB_DONE) {
+      return _key_broker_fail_w_msg (
+         kb, "attempting retrieve decrypted key material, but in wrong state");
+   }
+
+   if (key_alt_name_value) {
+      if (key_alt_name_value->value_type != BSON_TYPE_UTF8) {
+         return _key_broker_fail_w_msg (kb, "key alt name must be a UTF8");
+      }
+      _borrow_key_alt_name (key_alt_name_value, &key_alt_name);
+   }
+
+   key_returned = _find_decrypted_key (
+      kb, key_id, key_alt_name_value ? &key_alt_name : NULL);
+   if (!key_returned) {
+      return false;
+   }
+
+   /* Precompute the contexts on first use, then reuse them for every field
+    * using this key. */
+   if (_mongocrypt_buffer_empty (&key_returned->key_state.key) &&
+       !_mongocrypt_key_state_set (kb->crypt->crypto,
+                                   &key_returned->key_state,
+                                   &key_returned->decrypted_key_material,
+                                   kb->status)) {
+      return _key_broker_fail (kb);
    }
+
+   out->key_id = &key_returned->doc->id;
+   out->key_material = &key_returned->decrypted_key_material;
+   out->key_state = &key_returned->key_state;
    return true;
 }
 
+bool
+_mongocrypt_key_broker_key_by_id (_mongocrypt_key_broker_t *kb,
+                                  const _mongocrypt_buffer_t *key_id,
+                                  _mongocrypt_key_handle_t *out)
+{
+   return _get_key_handle (kb, key_id, NULL /* key alt name */, out);
+}
+
+bool
+_mongocrypt_key_broker_key_by_name (_mongocrypt_key_broker_t *kb,
+                                    const bson_value_t *key_alt_name,
+                                    _mongocrypt_key_handle_t *out)
+{
+   return _get_key_handle (kb, NULL /* key id */, key_alt_name, out);
+}
+
+
 bool
 _mongocrypt_key_broker_decrypted_key_by_id (_mongocrypt_key_broker_t *kb,
                                             const _mongocrypt_buffer_t *key_id,
                                             _mongocrypt_buffer_t *out)
 {
-   if (kb->state != KB_DONE) {
-      return _key_broker_fail_w_msg (
-         kb, "attempting retrieve decrypted key material, but in wrong state");
+   _mongocrypt_key_handle_t handle;
+
+   _mongocrypt_buffer_init (out);
+   if (!_mongocrypt_key_broker_key_by_id (kb, key_id, &handle)) {
+      return false;
    }
-   return _get_decrypted_key_material (kb,
-                                       (_mongocrypt_buffer_t *) key_id,
-                                       NULL /* key alt name */,
-                                       out,
-                                       NULL /* key id out */);
+   _mongocrypt_buffer_copy_to (handle.key_material, out);
+   return true;
 }
 
 bool
@@ -928,18 +1513,20 @@ _mongocrypt_key_broker_decrypted_key_by_name (
    _mongocrypt_buffer_t *out,
    _mongocrypt_buffer_t *key_id_out)
 {
-   bool ret;
-   _mongocrypt_key_alt_name_t *key_alt_name;
+   _mongocrypt_key_handle_t handle;
 
-   if (kb->state != KB_DONE) {
-      return _key_broker_fail_w_msg (
-         kb, "attempting retrieve decrypted key material, but in wrong state");
+   _mongocrypt_buffer_init (out);
+   if (key_id_out) {
+      _mongocrypt_buffer_init (key_id_out);
    }
-
-   key_alt_name = _mongocrypt_key_alt_name_new (key_alt_name_value);
-   ret = _get_decrypted_key_material (kb, NULL, key_alt_name, out, key_id_out);
-   _mongocrypt_key_alt_name_destroy_all (key_alt_name);
-   return ret;
+   if (!_mongocrypt_key_broker_key_by_name (kb, key_alt_name_value, &handle)) {
+      return false;
+   }
+   _mongocrypt_buffer_copy_to (handle.key_material, out);
+   if (key_id_out) {
+      _mongocrypt_buffer_copy_to (handle.key_id, key_id_out);
+   }
+   return true;
 }
 
 bool
@@ -981,8 +1568,13 @@ _destroy_keys_returned (key_returned_t *head)
    while (head) {
       tmp = head->next;
 
-      _mongocrypt_key_destroy (head->doc);
-      _mongocrypt_buffer_cleanup (&head->decrypted_key_material);
+      if (head->cached) {
+         _mongocrypt_cache_key_value_destroy (head->cached);
+      } else {
+         _mongocrypt_key_destroy (head->doc);
+         _mongocrypt_buffer_cleanup (&head->decrypted_key_material);
+      }
+      _mongocrypt_key_state_cleanup (&head->key_state);
       _mongocrypt_kms_ctx_cleanup (&head->kms);
 
       bson_free (head);
@@ -990,17 +1582,36 @@ _destroy_keys_returned (key_returned_t *head)
    }
 }
 
+static void
+_destroy_auth_requests (auth_request_t *head)
+{
+   auth_request_t *tmp;
+
+   while (head) {
+      tmp = head->next;
+      _mongocrypt_kms_ctx_cleanup (&head->kms);
+      bson_free (head->cache_key);
+      bson_free (head);
+      head = tmp;
+   }
+}
+
 void
 _mongocrypt_key_broker_cleanup (_mongocrypt_key_broker_t *kb)
 {
+   _release_key_fetches (kb);
+   _release_refresh_claims (kb);
+   _release_renewals (kb);
    mongocrypt_status_destroy (kb->status);
    _mongocrypt_buffer_cleanup (&kb->filter);
    /* Delete all linked lists */
    _destroy_keys_returned (kb->keys_returned);
    _destroy_keys_returned (kb->keys_cached);
    _destroy_key_requests (kb->key_requests);
-   _mongocrypt_kms_ctx_cleanup (&kb->auth_request_azure.kms);
-   _mongocrypt_kms_ctx_cleanup (&kb->auth_request_gcp.kms);
+   _destroy_auth_requests (kb->auth_requests);
+   _key_index_cleanup (&kb->key_requests_index);
+   _key_index_cleanup (&kb->keys_returned_index);
+   _key_index_cleanup (&kb->keys_cached_index);
 }
 
 void
@@ -48,6 +48,17 @@ struct _mongocrypt_kms_ctx_t {
    _mongocrypt_buffer_t result;
    char *endpoint;
    _mongocrypt_log_t *log;
+   /* The number of attempts started. retryable is set if the last one failed
+    * in a way worth retrying. */
+   uint32_t attempts;
+   uint32_t max_retries;
+   bool retryable;
+   /* Monotonic times in microseconds. An attempt starts when its message is
+    * first retrieved, and ends when the last byte of the response is fed.
+    * Zero until then. */
+   int64_t timeout_us;
+   int64_t attempt_start_us;
+   int64_t attempt_end_us;
 };
 
 
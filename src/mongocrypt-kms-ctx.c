@@ -54,7 +54,22 @@ _sha256 (void *ctx, const char *input, size_t len, unsigned char *hash_out)
    out->data = hash_out;
    out->len = SHA256_LEN;
 
-   ret = crypto->sha_256 (crypto->ctx, plaintext, out, ctx_with_status->status);
+   if (crypto->hooks_enabled) {
+      ret = crypto->sha_256 (
+         crypto->ctx, plaintext, out, ctx_with_status->status);
+   } else {
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+      _mongocrypt_buffer_t in_buf, out_buf;
+
+      _mongocrypt_buffer_from_binary (&in_buf, plaintext);
+      _mongocrypt_buffer_from_binary (&out_buf, out);
+      ret = _native_crypto_sha_256 (&in_buf, &out_buf, ctx_with_status->status);
+#else
+      /* kms-message only calls back when hooks are enabled. */
+      BSON_ASSERT (false);
+      ret = false;
+#endif
+   }
 
    mongocrypt_binary_destroy (plaintext);
    mongocrypt_binary_destroy (out);
@@ -85,8 +100,24 @@ _sha256_hmac (void *ctx,
    out->data = hash_out;
    out->len = SHA256_LEN;
 
-   ret = crypto->hmac_sha_256 (
-      crypto->ctx, key, plaintext, out, ctx_with_status->status);
+   if (crypto->hooks_enabled) {
+      ret = crypto->hmac_sha_256 (
+         crypto->ctx, key, plaintext, out, ctx_with_status->status);
+   } else {
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+      _mongocrypt_buffer_t key_buf, in_buf, out_buf;
+
+      _mongocrypt_buffer_from_binary (&key_buf, key);
+      _mongocrypt_buffer_from_binary (&in_buf, plaintext);
+      _mongocrypt_buffer_from_binary (&out_buf, out);
+      ret = _native_crypto_hmac_sha_256 (
+         &key_buf, &in_buf, &out_buf, ctx_with_status->status);
+#else
+      /* kms-message only calls back when hooks are enabled. */
+      BSON_ASSERT (false);
+      ret = false;
+#endif
+   }
 
    mongocrypt_binary_destroy (key);
    mongocrypt_binary_destroy (plaintext);
@@ -99,15 +130,23 @@ _set_kms_crypto_hooks (_mongocrypt_crypto_t *crypto,
                        ctx_with_status_t *ctx_with_status,
                        kms_request_opt_t *opts)
 {
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+   /* kms-message is built without a crypto library, so it always needs the
+    * hooks. They use the builtin SHA-256 unless crypto hooks are set. */
+   kms_request_opt_set_crypto_hooks (
+      opts, _sha256, _sha256_hmac, ctx_with_status);
+#else
    if (crypto->hooks_enabled) {
       kms_request_opt_set_crypto_hooks (
          opts, _sha256, _sha256_hmac, ctx_with_status);
    }
+#endif
 }
 
 static void
 _init_common (mongocrypt_kms_ctx_t *kms,
               _mongocrypt_log_t *log,
+              _mongocrypt_opts_t *crypt_opts,
               _kms_request_type_t kms_type)
 {
    kms->parser = kms_response_parser_new ();
@@ -115,6 +154,9 @@ _init_common (mongocrypt_kms_ctx_t *kms,
    kms->status = mongocrypt_status_new ();
    kms->req_type = kms_type;
    _mongocrypt_buffer_init (&kms->result);
+   kms->attempts = 1;
+   kms->max_retries = crypt_opts->kms_max_retries;
+   kms->timeout_us = (int64_t) crypt_opts->kms_timeout_ms * 1000;
 }
 
 bool
@@ -129,7 +171,7 @@ _mongocrypt_kms_ctx_init_aws_decrypt (mongocrypt_kms_ctx_t *kms,
    ctx_with_status_t ctx_with_status;
    bool ret = false;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_AWS_DECRYPT);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_AWS_DECRYPT);
    status = kms->status;
    ctx_with_status.ctx = crypto;
    ctx_with_status.status = mongocrypt_status_new ();
@@ -261,7 +303,7 @@ _mongocrypt_kms_ctx_init_aws_encrypt (
    ctx_with_status_t ctx_with_status;
    bool ret = false;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_AWS_ENCRYPT);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_AWS_ENCRYPT);
    status = kms->status;
    ctx_with_status.ctx = crypto;
    ctx_with_status.status = mongocrypt_status_new ();
@@ -792,6 +834,8 @@ mongocrypt_kms_ctx_feed (mongocrypt_kms_ctx_t *kms, mongocrypt_binary_t *bytes)
    }
 
    if (!kms_response_parser_feed (kms->parser, bytes->data, bytes->len)) {
+      /* The response may have been corrupted in transit. */
+      kms->retryable = true;
       CLIENT_ERR ("KMS response parser error with status %d, error: '%s'",
                   kms_response_parser_status (kms->parser),
                   kms_response_parser_error (kms->parser));
@@ -799,6 +843,11 @@ mongocrypt_kms_ctx_feed (mongocrypt_kms_ctx_t *kms, mongocrypt_binary_t *bytes)
    }
 
    if (0 == mongocrypt_kms_ctx_bytes_needed (kms)) {
+      int http_status = kms_response_parser_status (kms->parser);
+
+      kms->attempt_end_us = bson_get_monotonic_time ();
+      /* Throttling and server errors may succeed on another attempt. */
+      kms->retryable = http_status == 429 || http_status >= 500;
       if (kms->req_type == MONGOCRYPT_KMS_AWS_ENCRYPT) {
          return _ctx_done_aws (kms, "CiphertextBlob");
       } else if (kms->req_type == MONGOCRYPT_KMS_AWS_DECRYPT) {
@@ -902,12 +951,91 @@ mongocrypt_kms_ctx_message (mongocrypt_kms_ctx_t *kms, mongocrypt_binary_t *msg)
       CLIENT_ERR ("argument 'msg' is required");
       return false;
    }
+   if (!kms->attempt_start_us) {
+      kms->attempt_start_us = bson_get_monotonic_time ();
+   }
    msg->data = kms->msg.data;
    msg->len = kms->msg.len;
    return true;
 }
 
 
+bool
+mongocrypt_kms_ctx_fail (mongocrypt_kms_ctx_t *kms)
+{
+   mongocrypt_status_t *status;
+
+   if (!kms) {
+      return false;
+   }
+
+   status = kms->status;
+   if (mongocrypt_status_ok (status)) {
+      /* The driver could not complete the attempt: a network error, or the
+       * deadline passed. */
+      kms->retryable = true;
+      if (kms->attempts > kms->max_retries) {
+         CLIENT_ERR ("KMS request failed after %" PRIu32 " attempts",
+                     kms->attempts);
+         return false;
+      }
+   }
+
+   if (!kms->retryable || kms->attempts > kms->max_retries) {
+      return false;
+   }
+
+   /* Reset for another attempt with the same message. */
+   kms_response_parser_destroy (kms->parser);
+   kms->parser = kms_response_parser_new ();
+   _mongocrypt_status_reset (status);
+   _mongocrypt_buffer_cleanup (&kms->result);
+   _mongocrypt_buffer_init (&kms->result);
+   kms->retryable = false;
+   kms->attempts++;
+   kms->attempt_start_us = 0;
+   kms->attempt_end_us = 0;
+   return true;
+}
+
+
+int64_t
+mongocrypt_kms_ctx_remaining_ms (mongocrypt_kms_ctx_t *kms)
+{
+   int64_t remaining_us;
+
+   if (!kms || !kms->timeout_us) {
+      return -1;
+   }
+   if (!kms->attempt_start_us) {
+      return kms->timeout_us / 1000;
+   }
+   remaining_us =
+      kms->attempt_start_us + kms->timeout_us - bson_get_monotonic_time ();
+   return remaining_us > 0 ? remaining_us / 1000 : 0;
+}
+
+
+uint32_t
+mongocrypt_kms_ctx_attempts (mongocrypt_kms_ctx_t *kms)
+{
+   if (!kms) {
+      return 0;
+   }
+   return kms->attempts;
+}
+
+
+int64_t
+mongocrypt_kms_ctx_latency_us (mongocrypt_kms_ctx_t *kms)
+{
+   if (!kms || !kms->attempt_start_us || !kms->attempt_end_us) {
+      return -1;
+   }
+   return kms->attempt_end_us - kms->attempt_start_us;
+}
+
+
 bool
 mongocrypt_kms_ctx_endpoint (mongocrypt_kms_ctx_t *kms, const char **endpoint)
 {
@@ -937,7 +1065,7 @@ _mongocrypt_kms_ctx_init_azure_auth (mongocrypt_kms_ctx_t *kms,
    char *request_string;
    bool ret = false;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_AZURE_OAUTH);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_AZURE_OAUTH);
    status = kms->status;
    identity_platform_endpoint =
       crypt_opts->kms_provider_azure.identity_platform_endpoint;
@@ -1013,7 +1141,7 @@ _mongocrypt_kms_ctx_init_azure_wrapkey (
    bool ret = false;
    char *bearer_token_value = NULL;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_AZURE_WRAPKEY);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_AZURE_WRAPKEY);
    status = kms->status;
 
    kms->endpoint = bson_strdup (
@@ -1075,7 +1203,7 @@ _mongocrypt_kms_ctx_init_azure_unwrapkey (mongocrypt_kms_ctx_t *kms,
    bool ret = false;
    char *bearer_token_value = NULL;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_AZURE_UNWRAPKEY);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_AZURE_UNWRAPKEY);
    status = kms->status;
 
    kms->endpoint =
@@ -1172,7 +1300,7 @@ _mongocrypt_kms_ctx_init_gcp_auth (mongocrypt_kms_ctx_t *kms,
    bool ret = false;
    ctx_with_status_t ctx_with_status;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_GCP_OAUTH);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_GCP_OAUTH);
    status = kms->status;
    auth_endpoint = crypt_opts->kms_provider_gcp.endpoint;
    ctx_with_status.ctx = crypt_opts;
@@ -1258,7 +1386,7 @@ _mongocrypt_kms_ctx_init_gcp_encrypt (
    bool ret = false;
    char *bearer_token_value = NULL;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_GCP_ENCRYPT);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_GCP_ENCRYPT);
    status = kms->status;
 
    if (ctx_opts->kek.provider.gcp.endpoint) {
@@ -1328,7 +1456,7 @@ _mongocrypt_kms_ctx_init_gcp_decrypt (mongocrypt_kms_ctx_t *kms,
    bool ret = false;
    char *bearer_token_value = NULL;
 
-   _init_common (kms, log, MONGOCRYPT_KMS_GCP_DECRYPT);
+   _init_common (kms, log, crypt_opts, MONGOCRYPT_KMS_GCP_DECRYPT);
    status = kms->status;
 
    if (key->kek.provider.gcp.endpoint) {
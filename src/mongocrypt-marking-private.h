@@ -49,5 +49,16 @@ _mongocrypt_marking_to_ciphertext (void *ctx,
                                    mongocrypt_status_t *status)
    MONGOCRYPT_WARN_UNUSED_RESULT;
 
+/* Encrypts @count markings into @ciphertexts in one batch. @ciphertexts must
+ * have room for @count elements, each is initialized. On error, the caller
+ * must still clean up all @count ciphertexts. */
+bool
+_mongocrypt_markings_to_ciphertexts (void *ctx,
+                                     _mongocrypt_marking_t *markings,
+                                     _mongocrypt_ciphertext_t *ciphertexts,
+                                     uint32_t count,
+                                     mongocrypt_status_t *status)
+   MONGOCRYPT_WARN_UNUSED_RESULT;
+
 
 #endif /* MONGOCRYPT_MARKING_PRIVATE_H */
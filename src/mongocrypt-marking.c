@@ -153,129 +153,245 @@ _mongocrypt_marking_cleanup (_mongocrypt_marking_t *marking)
 }
 
 
-bool
-_mongocrypt_marking_to_ciphertext (void *ctx,
-                                   _mongocrypt_marking_t *marking,
-                                   _mongocrypt_ciphertext_t *ciphertext,
-                                   mongocrypt_status_t *status)
-{
+/* Per-field storage for a marking being encrypted. The fixed size buffers
+ * view the arrays after them, so a field only allocates its plaintext and
+ * ciphertext. */
+typedef struct {
+   const _mongocrypt_key_state_t *key_state;
    _mongocrypt_buffer_t plaintext;
    _mongocrypt_buffer_t iv;
-   _mongocrypt_key_broker_t *kb;
    _mongocrypt_buffer_t associated_data;
-   _mongocrypt_buffer_t key_material;
-   _mongocrypt_buffer_t key_id;
-   bool ret = false;
-   bool key_found;
-   uint32_t bytes_written;
-
-   BSON_ASSERT (marking);
-   BSON_ASSERT (ciphertext);
-   BSON_ASSERT (status);
-   BSON_ASSERT (ctx);
-
-   _mongocrypt_buffer_init (&plaintext);
-   _mongocrypt_buffer_init (&associated_data);
-   _mongocrypt_buffer_init (&iv);
-   _mongocrypt_buffer_init (&key_id);
-   _mongocrypt_buffer_init (&key_material);
-
-   kb = (_mongocrypt_key_broker_t *) ctx;
+   /* Set for deterministic encryption. The IV is its prefix. */
+   _mongocrypt_buffer_t digest;
+   /* True if the ciphertext came from the deterministic cache. */
+   bool cached;
+   uint8_t iv_storage[MONGOCRYPT_IV_LEN];
+   uint8_t associated_data_storage[MONGOCRYPT_ASSOCIATED_DATA_LEN];
+   uint8_t digest_storage[MONGOCRYPT_HMAC_SHA512_LEN];
+} _marking_encryption_t;
+
+
+/* Looks up the key for @marking, and prepares everything but the IV and
+ * ciphertext. Random IVs are drawn here. Deterministic IVs are computed
+ * afterwards for all fields at once. */
+static bool
+_marking_prepare_encryption (_mongocrypt_key_broker_t *kb,
+                             _mongocrypt_marking_t *marking,
+                             _mongocrypt_ciphertext_t *ciphertext,
+                             _marking_encryption_t *storage,
+                             mongocrypt_status_t *status)
+{
+   _mongocrypt_key_handle_t key;
+   bool ok;
 
-   /* Get the decrypted key for this marking. */
+   /* Get the decrypted key for this marking. It is borrowed from the key
+    * broker, as is the key id of the ciphertext. */
    if (marking->has_alt_name) {
-      key_found = _mongocrypt_key_broker_decrypted_key_by_name (
-         kb, &marking->key_alt_name, &key_material, &key_id);
+      ok =
+         _mongocrypt_key_broker_key_by_name (kb, &marking->key_alt_name, &key);
    } else if (!_mongocrypt_buffer_empty (&marking->key_id)) {
-      key_found = _mongocrypt_key_broker_decrypted_key_by_id (
-         kb, &marking->key_id, &key_material);
-      _mongocrypt_buffer_copy_to (&marking->key_id, &key_id);
+      ok = _mongocrypt_key_broker_key_by_id (kb, &marking->key_id, &key);
    } else {
       CLIENT_ERR ("marking must have either key_id or key_alt_name");
-      goto fail;
+      return false;
    }
 
-   if (!key_found) {
+   if (!ok) {
       _mongocrypt_status_copy_to (kb->status, status);
-      goto fail;
+      return false;
    }
+   storage->key_state = key.key_state;
 
-   _mongocrypt_ciphertext_init (ciphertext);
    ciphertext->original_bson_type = (uint8_t) bson_iter_type (&marking->v_iter);
    ciphertext->blob_subtype = marking->algorithm;
-   _mongocrypt_buffer_copy_to (&key_id, &ciphertext->key_id);
-   if (!_mongocrypt_ciphertext_serialize_associated_data (ciphertext,
-                                                          &associated_data)) {
+   _mongocrypt_buffer_set_to (key.key_id, &ciphertext->key_id);
+   if (!_mongocrypt_ciphertext_serialize_associated_data_to (
+          ciphertext,
+          storage->associated_data_storage,
+          &storage->associated_data)) {
       CLIENT_ERR ("could not serialize associated data");
-      goto fail;
+      return false;
    }
 
-   _mongocrypt_buffer_from_iter (&plaintext, &marking->v_iter);
-   ciphertext->data.len = _mongocrypt_calculate_ciphertext_len (plaintext.len);
-   ciphertext->data.data = bson_malloc (ciphertext->data.len);
-   BSON_ASSERT (ciphertext->data.data);
-
-   ciphertext->data.owned = true;
+   _mongocrypt_buffer_from_iter (&storage->plaintext, &marking->v_iter);
 
+   storage->iv.data = storage->iv_storage;
+   storage->iv.len = MONGOCRYPT_IV_LEN;
    switch (marking->algorithm) {
    case MONGOCRYPT_ENCRYPTION_ALGORITHM_DETERMINISTIC:
-      /* Use deterministic encryption. */
-      _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
-      ret = _mongocrypt_calculate_deterministic_iv (kb->crypt->crypto,
-                                                    &key_material,
-                                                    &plaintext,
-                                                    &associated_data,
-                                                    &iv,
-                                                    status);
-      if (!ret) {
-         goto fail;
-      }
-
-      ret = _mongocrypt_do_encryption (kb->crypt->crypto,
-                                       &iv,
-                                       &associated_data,
-                                       &key_material,
-                                       &plaintext,
-                                       &ciphertext->data,
-                                       &bytes_written,
-                                       status);
+      /* Use deterministic encryption. The IV is the prefix of a keyed digest
+       * of the plaintext, which also identifies the ciphertext in the
+       * cache. */
+      storage->digest.data = storage->digest_storage;
+      storage->digest.len = MONGOCRYPT_HMAC_SHA512_LEN;
       break;
    case MONGOCRYPT_ENCRYPTION_ALGORITHM_RANDOM:
       /* Use randomized encryption.
        * In this case, we must generate a new, random iv. */
-      _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
-      if (!_mongocrypt_random (
-             kb->crypt->crypto, &iv, MONGOCRYPT_IV_LEN, status)) {
-         goto fail;
+      if (!_mongocrypt_random_iv (kb->crypt->crypto, &storage->iv, status)) {
+         return false;
       }
-      ret = _mongocrypt_do_encryption (kb->crypt->crypto,
-                                       &iv,
-                                       &associated_data,
-                                       &key_material,
-                                       &plaintext,
-                                       &ciphertext->data,
-                                       &bytes_written,
-                                       status);
       break;
    default:
       /* Error. */
       CLIENT_ERR ("Unsupported value for encryption algorithm");
+      return false;
+   }
+
+   return true;
+}
+
+
+/* Prepares @encryption once the IV is known. If the deterministic cache has
+ * the ciphertext, @ciphertext is filled in and @storage->cached is set
+ * instead. */
+static void
+_marking_finish_encryption (_mongocrypt_key_broker_t *kb,
+                            _mongocrypt_marking_t *marking,
+                            _mongocrypt_ciphertext_t *ciphertext,
+                            _marking_encryption_t *storage,
+                            _mongocrypt_encryption_t *encryption)
+{
+   if (marking->algorithm == MONGOCRYPT_ENCRYPTION_ALGORITHM_DETERMINISTIC) {
+      memcpy (storage->iv.data, storage->digest.data, MONGOCRYPT_IV_LEN);
+
+      if (_mongocrypt_cache_deterministic_get (&kb->crypt->cache_deterministic,
+                                               &ciphertext->key_id,
+                                               storage->digest.data,
+                                               &ciphertext->data)) {
+         storage->cached = true;
+         return;
+      }
+   }
+
+   ciphertext->data.len =
+      _mongocrypt_calculate_ciphertext_len (storage->plaintext.len);
+   ciphertext->data.data = bson_malloc (ciphertext->data.len);
+   BSON_ASSERT (ciphertext->data.data);
+
+   ciphertext->data.owned = true;
+
+   encryption->key_state = storage->key_state;
+   encryption->iv = &storage->iv;
+   encryption->associated_data = &storage->associated_data;
+   encryption->plaintext = &storage->plaintext;
+   encryption->ciphertext = &ciphertext->data;
+   encryption->bytes_written = 0;
+}
+
+
+bool
+_mongocrypt_markings_to_ciphertexts (void *ctx,
+                                     _mongocrypt_marking_t *markings,
+                                     _mongocrypt_ciphertext_t *ciphertexts,
+                                     uint32_t count,
+                                     mongocrypt_status_t *status)
+{
+   _mongocrypt_key_broker_t *kb;
+   _marking_encryption_t *storage;
+   _mongocrypt_digest_t *digests;
+   _mongocrypt_encryption_t *encryptions;
+   uint32_t num_digests = 0;
+   uint32_t num_encryptions = 0;
+   uint32_t i;
+   bool ret = false;
+
+   BSON_ASSERT (markings || count == 0);
+   BSON_ASSERT (ciphertexts || count == 0);
+   BSON_ASSERT (status);
+   BSON_ASSERT (ctx);
+
+   kb = (_mongocrypt_key_broker_t *) ctx;
+
+   for (i = 0; i < count; i++) {
+      _mongocrypt_ciphertext_init (&ciphertexts[i]);
+   }
+
+   if (count == 0) {
+      return true;
+   }
+
+   storage = bson_malloc0 (count * sizeof (*storage));
+   BSON_ASSERT (storage);
+   digests = bson_malloc0 (count * sizeof (*digests));
+   BSON_ASSERT (digests);
+   encryptions = bson_malloc0 (count * sizeof (*encryptions));
+   BSON_ASSERT (encryptions);
+
+   for (i = 0; i < count; i++) {
+      if (!_marking_prepare_encryption (
+             kb, &markings[i], &ciphertexts[i], &storage[i], status)) {
+         goto fail;
+      }
+      if (markings[i].algorithm ==
+          MONGOCRYPT_ENCRYPTION_ALGORITHM_DETERMINISTIC) {
+         digests[num_digests].key_state = storage[i].key_state;
+         digests[num_digests].plaintext = &storage[i].plaintext;
+         digests[num_digests].associated_data = &storage[i].associated_data;
+         digests[num_digests].out = &storage[i].digest;
+         num_digests++;
+      }
+   }
+
+   if (!_mongocrypt_calculate_deterministic_digest_batch (
+          kb->crypt->crypto, digests, num_digests, status)) {
       goto fail;
    }
 
-   if (!ret) {
+   for (i = 0; i < count; i++) {
+      _marking_finish_encryption (kb,
+                                  &markings[i],
+                                  &ciphertexts[i],
+                                  &storage[i],
+                                  &encryptions[num_encryptions]);
+      if (!storage[i].cached) {
+         num_encryptions++;
+      }
+   }
+
+   if (!_mongocrypt_do_encryption_batch (
+          kb->crypt->crypto, encryptions, num_encryptions, status)) {
       goto fail;
    }
 
-   BSON_ASSERT (bytes_written == ciphertext->data.len);
+   for (i = 0; i < num_encryptions; i++) {
+      BSON_ASSERT (encryptions[i].bytes_written ==
+                   encryptions[i].ciphertext->len);
+   }
+
+   for (i = 0; i < count; i++) {
+      if (markings[i].algorithm ==
+             MONGOCRYPT_ENCRYPTION_ALGORITHM_DETERMINISTIC &&
+          !storage[i].cached) {
+         _mongocrypt_cache_deterministic_add (&kb->crypt->cache_deterministic,
+                                              &ciphertexts[i].key_id,
+                                              storage[i].digest.data,
+                                              &ciphertexts[i].data);
+      }
+   }
 
    ret = true;
 
 fail:
-   _mongocrypt_buffer_cleanup (&iv);
-   _mongocrypt_buffer_cleanup (&key_id);
-   _mongocrypt_buffer_cleanup (&plaintext);
-   _mongocrypt_buffer_cleanup (&associated_data);
-   _mongocrypt_buffer_cleanup (&key_material);
+   for (i = 0; i < count; i++) {
+      _mongocrypt_buffer_cleanup (&storage[i].plaintext);
+   }
+   bson_free (storage);
+   bson_free (digests);
+   bson_free (encryptions);
    return ret;
 }
+
+
+bool
+_mongocrypt_marking_to_ciphertext (void *ctx,
+                                   _mongocrypt_marking_t *marking,
+                                   _mongocrypt_ciphertext_t *ciphertext,
+                                   mongocrypt_status_t *status)
+{
+   BSON_ASSERT (marking);
+   BSON_ASSERT (ciphertext);
+
+   return _mongocrypt_markings_to_ciphertexts (
+      ctx, marking, ciphertext, 1, status);
+}
@@ -22,8 +22,10 @@
 #if defined(BSON_OS_UNIX)
 #include <pthread.h>
 #define mongocrypt_mutex_t pthread_mutex_t
+#define mongocrypt_rwlock_t pthread_rwlock_t
 #else
 #define mongocrypt_mutex_t CRITICAL_SECTION
+#define mongocrypt_rwlock_t SRWLOCK
 #endif
 
 void
@@ -38,4 +40,36 @@ _mongocrypt_mutex_lock (mongocrypt_mutex_t *mutex);
 void
 _mongocrypt_mutex_unlock (mongocrypt_mutex_t *mutex);
 
+void
+_mongocrypt_rwlock_init (mongocrypt_rwlock_t *rwlock);
+
+void
+_mongocrypt_rwlock_cleanup (mongocrypt_rwlock_t *rwlock);
+
+void
+_mongocrypt_rwlock_rdlock (mongocrypt_rwlock_t *rwlock);
+
+void
+_mongocrypt_rwlock_rdunlock (mongocrypt_rwlock_t *rwlock);
+
+void
+_mongocrypt_rwlock_wrlock (mongocrypt_rwlock_t *rwlock);
+
+void
+_mongocrypt_rwlock_wrunlock (mongocrypt_rwlock_t *rwlock);
+
+/* Atomically adds @n to @value and returns the result. A full barrier. */
+int32_t
+_mongocrypt_atomic_int32_add (volatile int32_t *value, int32_t n);
+
+int64_t
+_mongocrypt_atomic_int64_add (volatile int64_t *value, int64_t n);
+
+/* Atomically sets @value to @desired if it equals @expected. Returns true if
+ * it was set. A full barrier. */
+bool
+_mongocrypt_atomic_int64_cas (volatile int64_t *value,
+                              int64_t expected,
+                              int64_t desired);
+
 #endif /* MONGOCRYPT_MUTEX_PRIVATE_H */
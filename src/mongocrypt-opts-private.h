@@ -60,6 +60,18 @@ typedef struct {
    _mongocrypt_opts_kms_provider_gcp_t kms_provider_gcp;
    mongocrypt_hmac_fn sign_rsaes_pkcs1_v1_5;
    void *sign_ctx;
+   bool coalesce_key_fetches;
+   /* Key fetches are batched if key_fetch_batch_max_keys is non-zero. */
+   uint64_t key_fetch_batch_window_ms;
+   uint32_t key_fetch_batch_max_keys;
+   /* Attempts allowed for each KMS request after the first, and the time
+    * allowed for each attempt in milliseconds, or zero for no limit. */
+   uint32_t kms_max_retries;
+   uint64_t kms_timeout_ms;
+   /* Keys to load into the key cache on init, and the key they are encrypted
+    * with. Empty if unset. */
+   _mongocrypt_buffer_t key_cache_import;
+   _mongocrypt_buffer_t key_cache_kek;
 } _mongocrypt_opts_t;
 
 
@@ -71,6 +83,11 @@ void
 _mongocrypt_opts_cleanup (_mongocrypt_opts_t *opts);
 
 
+/* Zero-frees the key cache KEK and frees the key cache export to import. */
+void
+_mongocrypt_opts_key_cache_import_cleanup (_mongocrypt_opts_t *opts);
+
+
 bool
 _mongocrypt_opts_validate (_mongocrypt_opts_t *opts,
                            mongocrypt_status_t *status)
@@ -58,6 +58,19 @@ _mongocrypt_opts_cleanup (_mongocrypt_opts_t *opts)
    _mongocrypt_buffer_cleanup (&opts->schema_map);
    _mongocrypt_opts_kms_provider_azure_cleanup (&opts->kms_provider_azure);
    _mongocrypt_opts_kms_provider_gcp_cleanup (&opts->kms_provider_gcp);
+   _mongocrypt_opts_key_cache_import_cleanup (opts);
+}
+
+
+void
+_mongocrypt_opts_key_cache_import_cleanup (_mongocrypt_opts_t *opts)
+{
+   if (opts->key_cache_kek.owned) {
+      bson_zero_free (opts->key_cache_kek.data, opts->key_cache_kek.len);
+   }
+   _mongocrypt_buffer_init (&opts->key_cache_kek);
+   _mongocrypt_buffer_cleanup (&opts->key_cache_import);
+   _mongocrypt_buffer_init (&opts->key_cache_import);
 }
 
 
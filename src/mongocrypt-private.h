@@ -29,6 +29,7 @@
 #include "mongocrypt-opts-private.h"
 #include "mongocrypt-crypto-private.h"
 #include "mongocrypt-cache-oauth-private.h"
+#include "mongocrypt-cache-deterministic-private.h"
 
 
 #define MONGOCRYPT_GENERIC_ERROR_CODE 1
@@ -82,8 +83,14 @@ struct _mongocrypt_t {
    _mongocrypt_crypto_t *crypto;
    /* A counter, protected by mutex, for generating unique context ids */
    uint32_t ctx_counter;
-   _mongocrypt_cache_oauth_t *cache_oauth_azure;
-   _mongocrypt_cache_oauth_t *cache_oauth_gcp;
+   /* OAuth tokens for Azure and GCP. */
+   _mongocrypt_cache_oauth_t *cache_oauth;
+   /* Random bytes for IVs. Referenced by crypto. */
+   _mongocrypt_random_pool_t random_pool;
+   /* Deterministic ciphertexts. Disabled by default. */
+   _mongocrypt_cache_deterministic_t cache_deterministic;
+   /* Keys being fetched, if key fetches are coalesced. */
+   _mongocrypt_key_fetches_t key_fetches;
 };
 
 typedef enum {
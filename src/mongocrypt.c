@@ -123,8 +123,10 @@ mongocrypt_new (void)
    _mongocrypt_opts_init (&crypt->opts);
    _mongocrypt_log_init (&crypt->log);
    crypt->ctx_counter = 1;
-   crypt->cache_oauth_azure = _mongocrypt_cache_oauth_new ();
-   crypt->cache_oauth_gcp = _mongocrypt_cache_oauth_new ();
+   crypt->cache_oauth = _mongocrypt_cache_oauth_new ();
+   _mongocrypt_random_pool_init (&crypt->random_pool);
+   _mongocrypt_cache_deterministic_init (&crypt->cache_deterministic);
+   _mongocrypt_key_fetches_init (&crypt->key_fetches);
 
    if (0 != _mongocrypt_once (_mongocrypt_do_init) ||
        !(_native_crypto_initialized)) {
@@ -304,6 +306,285 @@ mongocrypt_setopt_schema_map (mongocrypt_t *crypt,
 }
 
 
+bool
+mongocrypt_setopt_deterministic_cache_size (mongocrypt_t *crypt,
+                                            uint32_t max_entries)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (max_entries > (UINT32_MAX >> 1) + 1) {
+      CLIENT_ERR ("deterministic cache size must be at most %" PRIu32,
+                  (UINT32_MAX >> 1) + 1);
+      return false;
+   }
+
+   _mongocrypt_cache_deterministic_set_max_entries (&crypt->cache_deterministic,
+                                                    max_entries);
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_key_cache_ttl_ms (mongocrypt_t *crypt, uint64_t ttl_ms)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (ttl_ms == 0 || ttl_ms > INT64_MAX) {
+      CLIENT_ERR ("key cache TTL must be positive and at most %" PRId64,
+                  INT64_MAX);
+      return false;
+   }
+
+   _mongocrypt_cache_set_expiration (&crypt->cache_key, ttl_ms);
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_key_cache_refresh_window_ms (mongocrypt_t *crypt,
+                                               uint64_t window_ms)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   /* Checked against the TTL in mongocrypt_init, since either may be set
+    * first. */
+   _mongocrypt_cache_set_refresh_window (&crypt->cache_key, window_ms);
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_coalesce_key_fetches (mongocrypt_t *crypt, bool enable)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   crypt->opts.coalesce_key_fetches = enable;
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_key_fetch_batch (mongocrypt_t *crypt,
+                                   uint64_t window_ms,
+                                   uint32_t max_keys)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (max_keys == 0) {
+      CLIENT_ERR ("max_keys must be positive");
+      return false;
+   }
+
+   /* Contexts wait on the fetches of the batch like on coalesced fetches. */
+   crypt->opts.coalesce_key_fetches = true;
+   crypt->opts.key_fetch_batch_window_ms = window_ms;
+   crypt->opts.key_fetch_batch_max_keys = max_keys;
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_kms_retry (mongocrypt_t *crypt,
+                             uint32_t max_retries,
+                             uint64_t timeout_ms)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (timeout_ms > INT64_MAX / 1000) {
+      CLIENT_ERR ("timeout_ms is too large");
+      return false;
+   }
+
+   crypt->opts.kms_max_retries = max_retries;
+   crypt->opts.kms_timeout_ms = timeout_ms;
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_oauth_renewal_percent (mongocrypt_t *crypt,
+                                         uint32_t percent)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (percent >= 100) {
+      CLIENT_ERR ("OAuth renewal percent must be less than 100");
+      return false;
+   }
+
+   crypt->cache_oauth->renewal_percent = percent;
+   return true;
+}
+
+
+bool
+mongocrypt_setopt_cache_limits (mongocrypt_t *crypt,
+                                mongocrypt_cache_type_t cache,
+                                uint32_t max_entries,
+                                uint64_t max_bytes)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   switch (cache) {
+   case MONGOCRYPT_CACHE_TYPE_KEY:
+      _mongocrypt_cache_set_limits (&crypt->cache_key, max_entries, max_bytes);
+      return true;
+   case MONGOCRYPT_CACHE_TYPE_COLLINFO:
+      _mongocrypt_cache_set_limits (
+         &crypt->cache_collinfo, max_entries, max_bytes);
+      return true;
+   case MONGOCRYPT_CACHE_TYPE_DETERMINISTIC:
+      CLIENT_ERR ("use mongocrypt_setopt_deterministic_cache_size to limit the "
+                  "deterministic cache");
+      return false;
+   default:
+      CLIENT_ERR ("unrecognized cache type");
+      return false;
+   }
+}
+
+
+bool
+mongocrypt_cache_stat (mongocrypt_t *crypt,
+                       mongocrypt_cache_type_t cache,
+                       mongocrypt_cache_stat_t stat,
+                       uint64_t *value)
+{
+   mongocrypt_status_t *status;
+   _mongocrypt_cache_stats_t stats;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (!value) {
+      CLIENT_ERR ("invalid NULL value");
+      return false;
+   }
+
+   switch (cache) {
+   case MONGOCRYPT_CACHE_TYPE_KEY:
+      _mongocrypt_cache_stats (&crypt->cache_key, &stats);
+      break;
+   case MONGOCRYPT_CACHE_TYPE_COLLINFO:
+      _mongocrypt_cache_stats (&crypt->cache_collinfo, &stats);
+      break;
+   case MONGOCRYPT_CACHE_TYPE_DETERMINISTIC:
+      _mongocrypt_cache_deterministic_stats (&crypt->cache_deterministic,
+                                             &stats);
+      break;
+   default:
+      CLIENT_ERR ("unrecognized cache type");
+      return false;
+   }
+
+   switch (stat) {
+   case MONGOCRYPT_CACHE_STAT_HITS:
+      *value = stats.hits;
+      return true;
+   case MONGOCRYPT_CACHE_STAT_MISSES:
+      *value = stats.misses;
+      return true;
+   case MONGOCRYPT_CACHE_STAT_EVICTIONS:
+      *value = stats.evictions;
+      return true;
+   case MONGOCRYPT_CACHE_STAT_EXPIRATIONS:
+      *value = stats.expirations;
+      return true;
+   case MONGOCRYPT_CACHE_STAT_ENTRIES:
+      *value = stats.entries;
+      return true;
+   case MONGOCRYPT_CACHE_STAT_BYTES:
+      *value = stats.bytes;
+      return true;
+   default:
+      CLIENT_ERR ("unrecognized cache statistic");
+      return false;
+   }
+}
+
+
 bool
 mongocrypt_setopt_kms_provider_local (mongocrypt_t *crypt,
                                       mongocrypt_binary_t *key)
@@ -355,10 +636,85 @@ mongocrypt_setopt_kms_provider_local (mongocrypt_t *crypt,
 }
 
 
+bool
+mongocrypt_setopt_key_cache_import (mongocrypt_t *crypt,
+                                    mongocrypt_binary_t *kek,
+                                    mongocrypt_binary_t *in)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (!kek || !in) {
+      CLIENT_ERR ("passed null key or key cache export");
+      return false;
+   }
+
+   if (mongocrypt_binary_len (kek) != MONGOCRYPT_KEY_LEN) {
+      CLIENT_ERR ("key cache key must be %d bytes", MONGOCRYPT_KEY_LEN);
+      return false;
+   }
+
+   _mongocrypt_opts_key_cache_import_cleanup (&crypt->opts);
+   _mongocrypt_buffer_copy_from_binary (&crypt->opts.key_cache_kek, kek);
+   _mongocrypt_buffer_copy_from_binary (&crypt->opts.key_cache_import, in);
+   return true;
+}
+
+
+mongocrypt_binary_t *
+mongocrypt_key_cache_export (mongocrypt_t *crypt, mongocrypt_binary_t *kek)
+{
+   mongocrypt_status_t *status;
+   _mongocrypt_buffer_t kek_buf;
+   _mongocrypt_buffer_t exported;
+   mongocrypt_binary_t *out;
+
+   if (!crypt) {
+      return NULL;
+   }
+   status = crypt->status;
+
+   if (!crypt->initialized) {
+      CLIENT_ERR ("mongocrypt_t must be initialized");
+      return NULL;
+   }
+
+   if (!kek) {
+      CLIENT_ERR ("passed null key");
+      return NULL;
+   }
+
+   if (mongocrypt_binary_len (kek) != MONGOCRYPT_KEY_LEN) {
+      CLIENT_ERR ("key cache key must be %d bytes", MONGOCRYPT_KEY_LEN);
+      return NULL;
+   }
+
+   _mongocrypt_buffer_from_binary (&kek_buf, kek);
+   if (!_mongocrypt_cache_key_export (
+          &crypt->cache_key, crypt->crypto, &kek_buf, &exported, status)) {
+      return NULL;
+   }
+
+   out = _mongocrypt_binary_new_copy (exported.data, exported.len);
+   _mongocrypt_buffer_cleanup (&exported);
+   return out;
+}
+
+
 bool
 mongocrypt_init (mongocrypt_t *crypt)
 {
    mongocrypt_status_t *status;
+   bool imported;
 
    if (!crypt) {
       return false;
@@ -379,6 +735,12 @@ mongocrypt_init (mongocrypt_t *crypt)
       return false;
    }
 
+   if (crypt->cache_key.refresh_window >= crypt->cache_key.expiration) {
+      CLIENT_ERR ("key cache refresh window must be less than the key cache "
+                  "TTL");
+      return false;
+   }
+
    if (crypt->opts.log_fn) {
       _mongocrypt_log_set_fn (
          &crypt->log, crypt->opts.log_fn, crypt->opts.log_ctx);
@@ -396,6 +758,21 @@ mongocrypt_init (mongocrypt_t *crypt)
 
 #endif
    }
+
+   crypt->crypto->random_pool = &crypt->random_pool;
+
+   if (!_mongocrypt_buffer_empty (&crypt->opts.key_cache_import)) {
+      imported = _mongocrypt_cache_key_import (&crypt->cache_key,
+                                               crypt->crypto,
+                                               &crypt->opts.key_cache_kek,
+                                               &crypt->opts.key_cache_import,
+                                               status);
+      /* Do not keep the key and the export for the life of crypt. */
+      _mongocrypt_opts_key_cache_import_cleanup (&crypt->opts);
+      if (!imported) {
+         return false;
+      }
+   }
    return true;
 }
 
@@ -435,8 +812,10 @@ mongocrypt_destroy (mongocrypt_t *crypt)
    _mongocrypt_log_cleanup (&crypt->log);
    mongocrypt_status_destroy (crypt->status);
    bson_free (crypt->crypto);
-   _mongocrypt_cache_oauth_destroy (crypt->cache_oauth_azure);
-   _mongocrypt_cache_oauth_destroy (crypt->cache_oauth_gcp);
+   _mongocrypt_cache_oauth_destroy (crypt->cache_oauth);
+   _mongocrypt_random_pool_cleanup (&crypt->random_pool);
+   _mongocrypt_cache_deterministic_cleanup (&crypt->cache_deterministic);
+   _mongocrypt_key_fetches_cleanup (&crypt->key_fetches);
    bson_free (crypt);
 }
 
@@ -568,6 +947,45 @@ mongocrypt_setopt_crypto_hook_sign_rsaes_pkcs1_v1_5 (
    return true;
 }
 
+
+bool
+mongocrypt_setopt_crypto_hook_batch (mongocrypt_t *crypt,
+                                     mongocrypt_crypto_batch_fn batch,
+                                     void *batch_ctx)
+{
+   mongocrypt_status_t *status;
+
+   if (!crypt) {
+      return false;
+   }
+
+   status = crypt->status;
+
+   if (crypt->initialized) {
+      CLIENT_ERR ("options cannot be set after initialization");
+      return false;
+   }
+
+   if (!crypt->crypto || !crypt->crypto->hooks_enabled) {
+      CLIENT_ERR ("crypto_hooks must be set before the batch hook");
+      return false;
+   }
+
+   if (crypt->crypto->batch) {
+      CLIENT_ERR ("batch hook already set");
+      return false;
+   }
+
+   if (!batch) {
+      CLIENT_ERR ("batch not set");
+      return false;
+   }
+
+   crypt->crypto->batch = batch;
+   crypt->crypto->batch_ctx = batch_ctx;
+   return true;
+}
+
 bool
 mongocrypt_setopt_kms_providers (mongocrypt_t *crypt,
                                  mongocrypt_binary_t *kms_providers)
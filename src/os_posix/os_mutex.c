@@ -54,4 +54,78 @@ _mongocrypt_mutex_unlock (mongocrypt_mutex_t *mutex)
    }
 }
 
+void
+_mongocrypt_rwlock_init (mongocrypt_rwlock_t *rwlock)
+{
+   int ret = pthread_rwlock_init (rwlock, NULL);
+   if (ret) {
+      abort ();
+   }
+}
+
+void
+_mongocrypt_rwlock_cleanup (mongocrypt_rwlock_t *rwlock)
+{
+   int ret = pthread_rwlock_destroy (rwlock);
+   if (ret) {
+      abort ();
+   }
+}
+
+void
+_mongocrypt_rwlock_rdlock (mongocrypt_rwlock_t *rwlock)
+{
+   int ret = pthread_rwlock_rdlock (rwlock);
+   if (ret) {
+      abort ();
+   }
+}
+
+void
+_mongocrypt_rwlock_rdunlock (mongocrypt_rwlock_t *rwlock)
+{
+   int ret = pthread_rwlock_unlock (rwlock);
+   if (ret) {
+      abort ();
+   }
+}
+
+void
+_mongocrypt_rwlock_wrlock (mongocrypt_rwlock_t *rwlock)
+{
+   int ret = pthread_rwlock_wrlock (rwlock);
+   if (ret) {
+      abort ();
+   }
+}
+
+void
+_mongocrypt_rwlock_wrunlock (mongocrypt_rwlock_t *rwlock)
+{
+   int ret = pthread_rwlock_unlock (rwlock);
+   if (ret) {
+      abort ();
+   }
+}
+
+int32_t
+_mongocrypt_atomic_int32_add (volatile int32_t *value, int32_t n)
+{
+   return __sync_add_and_fetch (value, n);
+}
+
+int64_t
+_mongocrypt_atomic_int64_add (volatile int64_t *value, int64_t n)
+{
+   return __sync_add_and_fetch (value, n);
+}
+
+bool
+_mongocrypt_atomic_int64_cas (volatile int64_t *value,
+                              int64_t expected,
+                              int64_t desired)
+{
+   return __sync_bool_compare_and_swap (value, expected, desired);
+}
+
 #endif /* _WIN32 */
\ No newline at end of file
@@ -42,4 +42,62 @@ _mongocrypt_mutex_unlock (mongocrypt_mutex_t *mutex)
    LeaveCriticalSection (mutex);
 }
 
+void
+_mongocrypt_rwlock_init (mongocrypt_rwlock_t *rwlock)
+{
+   InitializeSRWLock (rwlock);
+}
+
+void
+_mongocrypt_rwlock_cleanup (mongocrypt_rwlock_t *rwlock)
+{
+   /* SRW locks need no cleanup. */
+   (void) rwlock;
+}
+
+void
+_mongocrypt_rwlock_rdlock (mongocrypt_rwlock_t *rwlock)
+{
+   AcquireSRWLockShared (rwlock);
+}
+
+void
+_mongocrypt_rwlock_rdunlock (mongocrypt_rwlock_t *rwlock)
+{
+   ReleaseSRWLockShared (rwlock);
+}
+
+void
+_mongocrypt_rwlock_wrlock (mongocrypt_rwlock_t *rwlock)
+{
+   AcquireSRWLockExclusive (rwlock);
+}
+
+void
+_mongocrypt_rwlock_wrunlock (mongocrypt_rwlock_t *rwlock)
+{
+   ReleaseSRWLockExclusive (rwlock);
+}
+
+int32_t
+_mongocrypt_atomic_int32_add (volatile int32_t *value, int32_t n)
+{
+   return InterlockedExchangeAdd ((volatile LONG *) value, n) + n;
+}
+
+int64_t
+_mongocrypt_atomic_int64_add (volatile int64_t *value, int64_t n)
+{
+   return InterlockedExchangeAdd64 ((volatile LONG64 *) value, n) + n;
+}
+
+bool
+_mongocrypt_atomic_int64_cas (volatile int64_t *value,
+                              int64_t expected,
+                              int64_t desired)
+{
+   return expected == InterlockedCompareExchange64 (
+                         (volatile LONG64 *) value, desired, expected);
+}
+
 #endif /* _WIN32 */
\ No newline at end of file
@@ -0,0 +1,807 @@
+/*
+ * Copyright 2020-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Microbenchmarks for libmongocrypt internals.
+ *
+ * Usage: benchmark-mongocrypt [benchmark name...]
+ * With no arguments, all benchmarks are run. Each benchmark prints one line per
+ * size: the benchmark name, the payload size in bytes (or the number of cache
+ * entries), the number of operations, and the operations per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bson/bson.h>
+#include <mongocrypt.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "mongocrypt-private.h"
+#include "mongocrypt-crypto-private.h"
+
+#define BENCHMARK_ITERATIONS 20000
+
+/* Zero terminated. */
+static const uint32_t _sizes[] = {16, 64, 256, 1024, 16384, 0};
+static const uint32_t _thread_counts[] = {1, 2, 4, 8, 16, 32, 0};
+static const uint32_t _key_counts[] = {1, 16, 256, 1024, 0};
+/* Large enough that a leak shows over the timer resolution. */
+static const uint32_t _timing_sizes[] = {4096, 0};
+
+/* The number of keys in the cache for the multithreaded cache benchmark. */
+#define BENCHMARK_CACHE_KEYS 1024
+
+#define ASSERT_OR_PRINT(_statement, _status)                     \
+   do {                                                          \
+      if (!(_statement)) {                                       \
+         fprintf (stderr,                                        \
+                  "%s failed with msg: %s\n",                    \
+                  #_statement,                                   \
+                  mongocrypt_status_message (_status, NULL));    \
+         abort ();                                               \
+      }                                                          \
+   } while (0)
+
+typedef struct {
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+   _mongocrypt_buffer_t key;
+   _mongocrypt_buffer_t iv;
+   _mongocrypt_buffer_t associated_data;
+   _mongocrypt_buffer_t plaintext;
+   _mongocrypt_buffer_t ciphertext;
+   _mongocrypt_key_state_t key_state;
+   /* One attribute per cache entry, for the cache benchmarks. */
+   uint32_t num_cache_attrs;
+   _mongocrypt_cache_key_attr_t **cache_attrs;
+   /* Key documents under the local KMS provider, and the same keys exported
+    * from the key cache, for the key cache warm up benchmarks. */
+   uint32_t num_key_docs;
+   bson_t *key_docs;
+   _mongocrypt_buffer_t key_cache_export;
+} _benchmark_ctx_t;
+
+typedef void (*_benchmark_fn) (_benchmark_ctx_t *bctx, uint32_t iterations);
+
+typedef struct {
+   const char *name;
+   _benchmark_fn fn;
+   /* What the size is a count of. */
+   const char *unit;
+   /* Sizes to run with, if not _sizes. */
+   const uint32_t *sizes;
+} _benchmark_t;
+
+
+static mongocrypt_t *
+_benchmark_mongocrypt (void)
+{
+   mongocrypt_t *crypt;
+   uint8_t localkey_data[MONGOCRYPT_KEY_LEN] = {0};
+   mongocrypt_binary_t *localkey;
+
+   crypt = mongocrypt_new ();
+   localkey = mongocrypt_binary_new_from_data (localkey_data,
+                                               sizeof localkey_data);
+   mongocrypt_setopt_kms_provider_local (crypt, localkey);
+   mongocrypt_binary_destroy (localkey);
+   if (!mongocrypt_init (crypt)) {
+      fprintf (stderr, "failed to initialize mongocrypt_t\n");
+      abort ();
+   }
+   return crypt;
+}
+
+
+static void
+_benchmark_ctx_init (_benchmark_ctx_t *bctx, uint32_t size)
+{
+   uint32_t bytes_written;
+   uint32_t i;
+
+   memset (bctx, 0, sizeof (*bctx));
+   bctx->crypt = _benchmark_mongocrypt ();
+   bctx->status = mongocrypt_status_new ();
+
+   _mongocrypt_buffer_resize (&bctx->key, MONGOCRYPT_KEY_LEN);
+   for (i = 0; i < bctx->key.len; i++) {
+      bctx->key.data[i] = (uint8_t) i;
+   }
+   _mongocrypt_buffer_resize (&bctx->iv, MONGOCRYPT_IV_LEN);
+   memset (bctx->iv.data, 0x11, bctx->iv.len);
+   /* The associated data is the size of a serialized ciphertext header. */
+   _mongocrypt_buffer_resize (&bctx->associated_data, 18);
+   memset (bctx->associated_data.data, 0x22, bctx->associated_data.len);
+   _mongocrypt_buffer_resize (&bctx->plaintext, size);
+   memset (bctx->plaintext.data, 0x33, bctx->plaintext.len);
+
+   /* Prepare a ciphertext for the decryption benchmarks. */
+   _mongocrypt_buffer_resize (&bctx->ciphertext,
+                              _mongocrypt_calculate_ciphertext_len (size));
+   _mongocrypt_key_state_init (&bctx->key_state);
+   ASSERT_OR_PRINT (_mongocrypt_key_state_set (bctx->crypt->crypto,
+                                               &bctx->key_state,
+                                               &bctx->key,
+                                               bctx->status),
+                    bctx->status);
+   ASSERT_OR_PRINT (
+      _mongocrypt_do_encryption_with_state (bctx->crypt->crypto,
+                                            &bctx->iv,
+                                            &bctx->associated_data,
+                                            &bctx->key_state,
+                                            &bctx->plaintext,
+                                            &bctx->ciphertext,
+                                            &bytes_written,
+                                            bctx->status),
+      bctx->status);
+}
+
+
+static void
+_benchmark_ctx_cleanup (_benchmark_ctx_t *bctx)
+{
+   uint32_t i;
+
+   for (i = 0; i < bctx->num_cache_attrs; i++) {
+      _mongocrypt_cache_key_attr_destroy (bctx->cache_attrs[i]);
+   }
+   bson_free (bctx->cache_attrs);
+   for (i = 0; i < bctx->num_key_docs; i++) {
+      bson_destroy (&bctx->key_docs[i]);
+   }
+   bson_free (bctx->key_docs);
+   _mongocrypt_buffer_cleanup (&bctx->key_cache_export);
+   _mongocrypt_key_state_cleanup (&bctx->key_state);
+   _mongocrypt_buffer_cleanup (&bctx->key);
+   _mongocrypt_buffer_cleanup (&bctx->iv);
+   _mongocrypt_buffer_cleanup (&bctx->associated_data);
+   _mongocrypt_buffer_cleanup (&bctx->plaintext);
+   _mongocrypt_buffer_cleanup (&bctx->ciphertext);
+   mongocrypt_status_destroy (bctx->status);
+   mongocrypt_destroy (bctx->crypt);
+}
+
+
+/* Encrypt one field per iteration, setting up the cipher and HMAC from the raw
+ * key each time. */
+static void
+_benchmark_encrypt_raw_key (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _mongocrypt_buffer_t ciphertext;
+   uint32_t bytes_written;
+   uint32_t i;
+
+   _mongocrypt_buffer_init (&ciphertext);
+   _mongocrypt_buffer_resize (&ciphertext, bctx->ciphertext.len);
+   for (i = 0; i < iterations; i++) {
+      ASSERT_OR_PRINT (_mongocrypt_do_encryption (bctx->crypt->crypto,
+                                                  &bctx->iv,
+                                                  &bctx->associated_data,
+                                                  &bctx->key,
+                                                  &bctx->plaintext,
+                                                  &ciphertext,
+                                                  &bytes_written,
+                                                  bctx->status),
+                       bctx->status);
+   }
+   _mongocrypt_buffer_cleanup (&ciphertext);
+}
+
+
+/* Encrypt one field per iteration, reusing the precomputed key state. */
+static void
+_benchmark_encrypt_key_state (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _mongocrypt_buffer_t ciphertext;
+   uint32_t bytes_written;
+   uint32_t i;
+
+   _mongocrypt_buffer_init (&ciphertext);
+   _mongocrypt_buffer_resize (&ciphertext, bctx->ciphertext.len);
+   for (i = 0; i < iterations; i++) {
+      ASSERT_OR_PRINT (
+         _mongocrypt_do_encryption_with_state (bctx->crypt->crypto,
+                                               &bctx->iv,
+                                               &bctx->associated_data,
+                                               &bctx->key_state,
+                                               &bctx->plaintext,
+                                               &ciphertext,
+                                               &bytes_written,
+                                               bctx->status),
+         bctx->status);
+   }
+   _mongocrypt_buffer_cleanup (&ciphertext);
+}
+
+
+static void
+_benchmark_decrypt_raw_key (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _mongocrypt_buffer_t plaintext;
+   uint32_t bytes_written;
+   uint32_t i;
+
+   _mongocrypt_buffer_init (&plaintext);
+   _mongocrypt_buffer_resize (
+      &plaintext, _mongocrypt_calculate_plaintext_len (bctx->ciphertext.len));
+   for (i = 0; i < iterations; i++) {
+      ASSERT_OR_PRINT (_mongocrypt_do_decryption (bctx->crypt->crypto,
+                                                  &bctx->associated_data,
+                                                  &bctx->key,
+                                                  &bctx->ciphertext,
+                                                  &plaintext,
+                                                  &bytes_written,
+                                                  bctx->status),
+                       bctx->status);
+   }
+   _mongocrypt_buffer_cleanup (&plaintext);
+}
+
+
+static void
+_benchmark_decrypt_key_state (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _mongocrypt_buffer_t plaintext;
+   uint32_t bytes_written;
+   uint32_t i;
+
+   _mongocrypt_buffer_init (&plaintext);
+   _mongocrypt_buffer_resize (
+      &plaintext, _mongocrypt_calculate_plaintext_len (bctx->ciphertext.len));
+   for (i = 0; i < iterations; i++) {
+      ASSERT_OR_PRINT (
+         _mongocrypt_do_decryption_with_state (bctx->crypt->crypto,
+                                               &bctx->associated_data,
+                                               &bctx->key_state,
+                                               &bctx->ciphertext,
+                                               &plaintext,
+                                               &bytes_written,
+                                               bctx->status),
+         bctx->status);
+   }
+   _mongocrypt_buffer_cleanup (&plaintext);
+}
+
+
+/* Generate one IV per iteration with a call to the random function. */
+static void
+_benchmark_random_iv_direct (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   uint32_t i;
+
+   for (i = 0; i < iterations; i++) {
+      ASSERT_OR_PRINT (_mongocrypt_random (bctx->crypt->crypto,
+                                           &bctx->iv,
+                                           MONGOCRYPT_IV_LEN,
+                                           bctx->status),
+                       bctx->status);
+   }
+}
+
+
+/* Generate one IV per iteration from the random pool. */
+static void
+_benchmark_random_iv_pool (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   uint32_t i;
+
+   for (i = 0; i < iterations; i++) {
+      ASSERT_OR_PRINT (
+         _mongocrypt_random_iv (bctx->crypt->crypto, &bctx->iv, bctx->status),
+         bctx->status);
+   }
+}
+
+
+/* The byte at a time constant time comparison _mongocrypt_memequal replaced,
+ * kept as a baseline. */
+static int
+_memequal_bytewise (const void *const b1, const void *const b2, size_t len)
+{
+   const unsigned char *p1 = b1, *p2 = b2;
+   int ret = 0;
+
+   for (; len > 0; len--) {
+      ret |= *p1++ ^ *p2++;
+   }
+
+   return ret;
+}
+
+
+/* Compare the plaintext with the ciphertext, which differs at every length. */
+static void
+_benchmark_memequal_bytewise (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   volatile int sink = 0;
+   uint32_t i;
+
+   for (i = 0; i < iterations; i++) {
+      sink |= _memequal_bytewise (
+         bctx->plaintext.data, bctx->ciphertext.data, bctx->plaintext.len);
+   }
+}
+
+
+static void
+_benchmark_memequal (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   volatile int sink = 0;
+   uint32_t i;
+
+   for (i = 0; i < iterations; i++) {
+      sink |= _mongocrypt_memequal (
+         bctx->plaintext.data, bctx->ciphertext.data, bctx->plaintext.len);
+   }
+}
+
+
+/* A dudect-style check that _mongocrypt_memequal runs in constant time. Each
+ * iteration times a batch of comparisons of either equal buffers or buffers
+ * differing in the first byte, chosen at random, and the two classes are
+ * compared with Welch's t-test. A comparison that stops at the first
+ * difference gives a large t. As in dudect, only |t| > 10 counts as a leak, so
+ * scheduling noise does not abort the run. */
+#define MEMEQUAL_TIMING_CALLS 64
+#define MEMEQUAL_TIMING_MAX_T 10.0
+
+static void
+_benchmark_memequal_timing (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   uint8_t *a, *b[2];
+   double n[2] = {0}, sum[2] = {0}, sum_sq[2] = {0};
+   double mean[2], var[2], diff, elapsed;
+   uint32_t rand_state = 0x2545f491;
+   uint32_t len;
+   volatile int sink = 0;
+   int64_t start_us;
+   uint32_t i, j;
+   int cls;
+
+   len = bctx->plaintext.len;
+   a = bctx->plaintext.data;
+   b[0] = bson_malloc (len);
+   b[1] = bson_malloc (len);
+   memcpy (b[0], a, len);
+   memcpy (b[1], a, len);
+   b[1][0] ^= 1;
+
+   for (i = 0; i < iterations; i++) {
+      /* xorshift32, so the classes are interleaved without a pattern. */
+      rand_state ^= rand_state << 13;
+      rand_state ^= rand_state >> 17;
+      rand_state ^= rand_state << 5;
+      cls = (int) (rand_state & 1);
+
+      start_us = bson_get_monotonic_time ();
+      for (j = 0; j < MEMEQUAL_TIMING_CALLS; j++) {
+         sink |= _mongocrypt_memequal (a, b[cls], len);
+      }
+      elapsed = (double) (bson_get_monotonic_time () - start_us);
+
+      n[cls] += 1;
+      sum[cls] += elapsed;
+      sum_sq[cls] += elapsed * elapsed;
+   }
+
+   for (cls = 0; cls < 2; cls++) {
+      if (n[cls] < 2) {
+         goto done;
+      }
+      mean[cls] = sum[cls] / n[cls];
+      var[cls] = (sum_sq[cls] - n[cls] * mean[cls] * mean[cls]) / (n[cls] - 1);
+   }
+   diff = mean[0] - mean[1];
+   /* Compare t squared, to avoid depending on libm for sqrt. */
+   if (diff * diff > MEMEQUAL_TIMING_MAX_T * MEMEQUAL_TIMING_MAX_T *
+                        (var[0] / n[0] + var[1] / n[1])) {
+      fprintf (stderr,
+               "_mongocrypt_memequal is not constant time: equal buffers took "
+               "%.2fus per batch, unequal took %.2fus\n",
+               mean[0],
+               mean[1]);
+      abort ();
+   }
+
+done:
+   bson_free (b[0]);
+   bson_free (b[1]);
+}
+
+
+/* Adds @count keys to the key cache, unless already added. */
+static void
+_cache_key_fill (_benchmark_ctx_t *bctx, uint32_t count)
+{
+   _mongocrypt_cache_key_value_t *value;
+   _mongocrypt_key_doc_t *key_doc;
+   _mongocrypt_buffer_t id;
+   uint32_t i;
+
+   if (bctx->cache_attrs) {
+      return;
+   }
+
+   bctx->num_cache_attrs = count;
+   bctx->cache_attrs = bson_malloc (count * sizeof (*bctx->cache_attrs));
+   key_doc = _mongocrypt_key_new ();
+   _mongocrypt_buffer_init (&id);
+   _mongocrypt_buffer_resize (&id, 16);
+   memset (id.data, 0, id.len);
+   for (i = 0; i < count; i++) {
+      memcpy (id.data, &i, sizeof (i));
+      bctx->cache_attrs[i] = _mongocrypt_cache_key_attr_new (&id, NULL);
+      value = _mongocrypt_cache_key_value_new (key_doc, &bctx->key);
+      ASSERT_OR_PRINT (
+         _mongocrypt_cache_add_stolen (
+            &bctx->crypt->cache_key, bctx->cache_attrs[i], value, bctx->status),
+         bctx->status);
+   }
+   _mongocrypt_buffer_cleanup (&id);
+   _mongocrypt_key_destroy (key_doc);
+}
+
+
+static void
+_cache_key_get_loop (_benchmark_ctx_t *bctx,
+                     uint32_t start,
+                     uint32_t iterations)
+{
+   _mongocrypt_cache_key_value_t *value;
+   uint32_t i;
+
+   for (i = start; i < start + iterations; i++) {
+      if (!_mongocrypt_cache_get (
+             &bctx->crypt->cache_key,
+             bctx->cache_attrs[i % bctx->num_cache_attrs],
+             (void **) &value) ||
+          !value) {
+         fprintf (stderr, "key not found in cache\n");
+         abort ();
+      }
+      _mongocrypt_cache_key_value_destroy (value);
+   }
+}
+
+
+/* Look up keys by id in a key cache holding as many keys as the size. The
+ * cache is filled on the first call, which is the warm up. */
+static void
+_benchmark_cache_key_get (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _cache_key_fill (bctx, bctx->plaintext.len);
+   _cache_key_get_loop (bctx, 0, iterations);
+}
+
+
+typedef struct {
+   _benchmark_ctx_t *bctx;
+   uint32_t start;
+   uint32_t iterations;
+} _benchmark_thread_t;
+
+
+#ifdef _WIN32
+static DWORD WINAPI
+_cache_key_get_thread (LPVOID arg)
+#else
+static void *
+_cache_key_get_thread (void *arg)
+#endif
+{
+   _benchmark_thread_t *thread = arg;
+
+   _cache_key_get_loop (thread->bctx, thread->start, thread->iterations);
+   return 0;
+}
+
+
+/* Look up keys from as many threads as the size, each doing every iteration,
+ * so the reported rate is per thread. It stays flat if lookups scale linearly
+ * with the number of threads. */
+static void
+_benchmark_cache_key_get_threads (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _benchmark_thread_t args[32];
+#ifdef _WIN32
+   HANDLE threads[32];
+#else
+   pthread_t threads[32];
+#endif
+   uint32_t num_threads = bctx->plaintext.len;
+   uint32_t i;
+
+   BSON_ASSERT (num_threads <= 32);
+   _cache_key_fill (bctx, BENCHMARK_CACHE_KEYS);
+   for (i = 0; i < num_threads; i++) {
+      args[i].bctx = bctx;
+      args[i].start = i * (BENCHMARK_CACHE_KEYS / num_threads);
+      args[i].iterations = iterations;
+#ifdef _WIN32
+      threads[i] =
+         CreateThread (NULL, 0, _cache_key_get_thread, &args[i], 0, NULL);
+      BSON_ASSERT (threads[i]);
+#else
+      BSON_ASSERT (0 == pthread_create (
+                           &threads[i], NULL, _cache_key_get_thread, &args[i]));
+#endif
+   }
+   for (i = 0; i < num_threads; i++) {
+#ifdef _WIN32
+      WaitForSingleObject (threads[i], INFINITE);
+      CloseHandle (threads[i]);
+#else
+      pthread_join (threads[i], NULL);
+#endif
+   }
+}
+
+
+/* Creates @count key documents whose key material is bctx->key encrypted with
+ * the local KMS key, caches them, and exports the cache. Done once. */
+static void
+_key_cache_export_init (_benchmark_ctx_t *bctx, uint32_t count)
+{
+   _mongocrypt_cache_key_value_t *value;
+   _mongocrypt_cache_key_attr_t *attr;
+   _mongocrypt_key_doc_t *key_doc;
+   _mongocrypt_buffer_t key_material;
+   _mongocrypt_buffer_t id;
+   uint32_t bytes_written;
+   bson_t master_key;
+   uint32_t i;
+
+   if (bctx->key_docs) {
+      return;
+   }
+
+   _mongocrypt_buffer_init (&key_material);
+   _mongocrypt_buffer_resize (
+      &key_material, _mongocrypt_calculate_ciphertext_len (bctx->key.len));
+   ASSERT_OR_PRINT (
+      _mongocrypt_do_encryption (bctx->crypt->crypto,
+                                 &bctx->iv,
+                                 NULL /* associated data. */,
+                                 &bctx->crypt->opts.kms_provider_local.key,
+                                 &bctx->key,
+                                 &key_material,
+                                 &bytes_written,
+                                 bctx->status),
+      bctx->status);
+   key_material.len = bytes_written;
+   key_material.subtype = BSON_SUBTYPE_BINARY;
+
+   _mongocrypt_buffer_init (&id);
+   _mongocrypt_buffer_resize (&id, 16);
+   memset (id.data, 0, id.len);
+   id.subtype = BSON_SUBTYPE_UUID;
+
+   bctx->num_key_docs = count;
+   bctx->key_docs = bson_malloc (count * sizeof (*bctx->key_docs));
+   for (i = 0; i < count; i++) {
+      memcpy (id.data, &i, sizeof (i));
+      bson_init (&bctx->key_docs[i]);
+      BSON_ASSERT (_mongocrypt_buffer_append (
+         &id, &bctx->key_docs[i], MONGOCRYPT_STR_AND_LEN ("_id")));
+      BSON_ASSERT (
+         _mongocrypt_buffer_append (&key_material,
+                                    &bctx->key_docs[i],
+                                    MONGOCRYPT_STR_AND_LEN ("keyMaterial")));
+      BSON_APPEND_DATE_TIME (&bctx->key_docs[i], "creationDate", 1234567890);
+      BSON_APPEND_DATE_TIME (&bctx->key_docs[i], "updateDate", 1234567890);
+      BSON_APPEND_INT32 (&bctx->key_docs[i], "status", 0);
+      BSON_APPEND_DOCUMENT_BEGIN (&bctx->key_docs[i], "masterKey", &master_key);
+      BSON_APPEND_UTF8 (&master_key, "provider", "local");
+      bson_append_document_end (&bctx->key_docs[i], &master_key);
+
+      key_doc = _mongocrypt_key_new ();
+      ASSERT_OR_PRINT (_mongocrypt_key_parse_owned (
+                          &bctx->key_docs[i], key_doc, bctx->status),
+                       bctx->status);
+      attr = _mongocrypt_cache_key_attr_new (&key_doc->id, NULL);
+      value = _mongocrypt_cache_key_value_new (key_doc, &bctx->key);
+      ASSERT_OR_PRINT (
+         _mongocrypt_cache_add_stolen (
+            &bctx->crypt->cache_key, attr, value, bctx->status),
+         bctx->status);
+      _mongocrypt_cache_key_attr_destroy (attr);
+      _mongocrypt_key_destroy (key_doc);
+   }
+
+   ASSERT_OR_PRINT (
+      _mongocrypt_cache_key_export (&bctx->crypt->cache_key,
+                                    bctx->crypt->crypto,
+                                    &bctx->crypt->opts.kms_provider_local.key,
+                                    &bctx->key_cache_export,
+                                    bctx->status),
+      bctx->status);
+   _mongocrypt_buffer_cleanup (&id);
+   _mongocrypt_buffer_cleanup (&key_material);
+}
+
+
+/* Make keys ready for the first encryption the cold way, as the key broker does
+ * for keys under the local KMS provider: parse each key document, decrypt its
+ * key material, and cache it. Keys under a remote KMS provider also cost a
+ * round trip each. One operation is one key. */
+static void
+_benchmark_key_cache_cold (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   _mongocrypt_cache_key_value_t *value;
+   _mongocrypt_cache_key_attr_t *attr;
+   _mongocrypt_key_doc_t *key_doc;
+   _mongocrypt_buffer_t decrypted;
+   uint32_t bytes_written;
+   uint32_t i;
+
+   _key_cache_export_init (bctx, bctx->plaintext.len);
+   _mongocrypt_buffer_init (&decrypted);
+   _mongocrypt_buffer_resize (&decrypted, MONGOCRYPT_KEY_LEN + 16);
+   for (i = 0; i < iterations; i++) {
+      key_doc = _mongocrypt_key_new ();
+      ASSERT_OR_PRINT (
+         _mongocrypt_key_parse_owned (
+            &bctx->key_docs[i % bctx->num_key_docs], key_doc, bctx->status),
+         bctx->status);
+      ASSERT_OR_PRINT (
+         _mongocrypt_do_decryption (bctx->crypt->crypto,
+                                    NULL /* associated data. */,
+                                    &bctx->crypt->opts.kms_provider_local.key,
+                                    &key_doc->key_material,
+                                    &decrypted,
+                                    &bytes_written,
+                                    bctx->status),
+         bctx->status);
+      decrypted.len = bytes_written;
+      attr = _mongocrypt_cache_key_attr_new (&key_doc->id, NULL);
+      value = _mongocrypt_cache_key_value_new (key_doc, &decrypted);
+      ASSERT_OR_PRINT (
+         _mongocrypt_cache_add_stolen (
+            &bctx->crypt->cache_key, attr, value, bctx->status),
+         bctx->status);
+      decrypted.len = MONGOCRYPT_KEY_LEN + 16;
+      _mongocrypt_cache_key_attr_destroy (attr);
+      _mongocrypt_key_destroy (key_doc);
+   }
+   _mongocrypt_buffer_cleanup (&decrypted);
+}
+
+
+/* Make keys ready for the first encryption by creating a mongocrypt_t that
+ * imports an export of as many keys as the size. One operation is one key,
+ * rounded up to whole imports. */
+static void
+_benchmark_key_cache_import (_benchmark_ctx_t *bctx, uint32_t iterations)
+{
+   mongocrypt_t *crypt;
+   uint32_t i;
+
+   _key_cache_export_init (bctx, bctx->plaintext.len);
+   for (i = 0; i < iterations; i += bctx->num_key_docs) {
+      crypt = mongocrypt_new ();
+      mongocrypt_setopt_kms_provider_local (
+         crypt,
+         _mongocrypt_buffer_as_binary (
+            &bctx->crypt->opts.kms_provider_local.key));
+      ASSERT_OR_PRINT (
+         mongocrypt_setopt_key_cache_import (
+            crypt,
+            _mongocrypt_buffer_as_binary (
+               &bctx->crypt->opts.kms_provider_local.key),
+            _mongocrypt_buffer_as_binary (&bctx->key_cache_export)),
+         crypt->status);
+      ASSERT_OR_PRINT (mongocrypt_init (crypt), crypt->status);
+      if (_mongocrypt_cache_num_entries (&crypt->cache_key) !=
+          bctx->num_key_docs) {
+         fprintf (stderr, "keys missing after import\n");
+         abort ();
+      }
+      mongocrypt_destroy (crypt);
+   }
+}
+
+
+static const _benchmark_t _benchmarks[] = {
+   {"encrypt_raw_key", _benchmark_encrypt_raw_key, "bytes"},
+   {"encrypt_key_state", _benchmark_encrypt_key_state, "bytes"},
+   {"decrypt_raw_key", _benchmark_decrypt_raw_key, "bytes"},
+   {"decrypt_key_state", _benchmark_decrypt_key_state, "bytes"},
+   {"random_iv_direct", _benchmark_random_iv_direct, "bytes"},
+   {"random_iv_pool", _benchmark_random_iv_pool, "bytes"},
+   {"memequal_bytewise", _benchmark_memequal_bytewise, "bytes"},
+   {"memequal", _benchmark_memequal, "bytes"},
+   {"memequal_timing", _benchmark_memequal_timing, "bytes", _timing_sizes},
+   {"cache_key_get", _benchmark_cache_key_get, "entries"},
+   {"cache_key_get_threads",
+    _benchmark_cache_key_get_threads,
+    "threads",
+    _thread_counts},
+   {"key_cache_cold", _benchmark_key_cache_cold, "keys", _key_counts},
+   {"key_cache_import", _benchmark_key_cache_import, "keys", _key_counts},
+};
+
+
+static void
+_run_benchmark (const _benchmark_t *benchmark)
+{
+   _benchmark_ctx_t bctx;
+   const uint32_t *sizes;
+   int64_t start_us, elapsed_us;
+   size_t i;
+
+   sizes = benchmark->sizes ? benchmark->sizes : _sizes;
+   for (i = 0; sizes[i]; i++) {
+      _benchmark_ctx_init (&bctx, sizes[i]);
+      /* Warm up. */
+      benchmark->fn (&bctx, BENCHMARK_ITERATIONS / 10);
+      start_us = bson_get_monotonic_time ();
+      benchmark->fn (&bctx, BENCHMARK_ITERATIONS);
+      elapsed_us = bson_get_monotonic_time () - start_us;
+      if (elapsed_us <= 0) {
+         elapsed_us = 1;
+      }
+      printf ("%-24s %8u %-7s %8d ops %12.0f ops/s\n",
+              benchmark->name,
+              sizes[i],
+              benchmark->unit,
+              BENCHMARK_ITERATIONS,
+              (double) BENCHMARK_ITERATIONS * 1000000.0 / (double) elapsed_us);
+      _benchmark_ctx_cleanup (&bctx);
+   }
+}
+
+
+int
+main (int argc, char **argv)
+{
+   size_t i;
+   int j;
+   bool found;
+
+   for (j = 1; j < argc; j++) {
+      found = false;
+      for (i = 0; i < sizeof (_benchmarks) / sizeof (_benchmarks[0]); i++) {
+         if (0 == strcmp (argv[j], _benchmarks[i].name)) {
+            found = true;
+         }
+      }
+      if (!found) {
+         fprintf (stderr, "unknown benchmark: %s\n", argv[j]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   for (i = 0; i < sizeof (_benchmarks) / sizeof (_benchmarks[0]); i++) {
+      if (argc > 1) {
+         found = false;
+         for (j = 1; j < argc; j++) {
+            if (0 == strcmp (argv[j], _benchmarks[i].name)) {
+               found = true;
+            }
+         }
+         if (!found) {
+            continue;
+         }
+      }
+      _run_benchmark (&_benchmarks[i]);
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -223,6 +223,11 @@ _run_state_machine (mongocrypt_ctx_t *ctx, bson_t *result)
          bson_destroy (&tmp);
          mongocrypt_binary_destroy (output);
          break;
+      case MONGOCRYPT_CTX_KEYS_PENDING:
+         /* Only with mongocrypt_setopt_coalesce_key_fetches. Progress another
+          * context, then check again. */
+         CHECK (mongocrypt_ctx_check_pending_keys (ctx));
+         break;
       case MONGOCRYPT_CTX_DONE:
          done = true;
          break;
@@ -17,14 +17,49 @@
 #include "test-mongocrypt.h"
 #include "mongocrypt-crypto-private.h"
 #include "mongocrypt-cache-collinfo-private.h"
+#include "mongocrypt-cache-deterministic-private.h"
+
+/* Returns a collinfo cache value with the schema { "a": @value }. */
+static _mongocrypt_cache_collinfo_value_t *
+_collinfo_new (const char *value)
+{
+   _mongocrypt_cache_collinfo_value_t *collinfo;
+   bson_t *doc;
+
+   doc = BCON_NEW ("options",
+                   "{",
+                   "validator",
+                   "{",
+                   "$jsonSchema",
+                   "{",
+                   "a",
+                   BCON_UTF8 (value),
+                   "}",
+                   "}",
+                   "}");
+   collinfo = _mongocrypt_cache_collinfo_value_new (doc, NULL);
+   BSON_ASSERT (collinfo);
+   bson_destroy (doc);
+   return collinfo;
+}
+
+
+static bool
+_collinfo_equal (_mongocrypt_cache_collinfo_value_t *a,
+                 _mongocrypt_cache_collinfo_value_t *b)
+{
+   return _mongocrypt_buffer_equal (&a->schema, &b->schema);
+}
+
 
 void
 _test_cache (_mongocrypt_tester_t *tester)
 {
    _mongocrypt_cache_t cache;
    mongocrypt_status_t *status;
-   bson_t *entry = BCON_NEW ("a", "b"), *entry2 = BCON_NEW ("c", "d");
-   bson_t *tmp = NULL;
+   _mongocrypt_cache_collinfo_value_t *entry = _collinfo_new ("b");
+   _mongocrypt_cache_collinfo_value_t *entry2 = _collinfo_new ("d");
+   _mongocrypt_cache_collinfo_value_t *tmp = NULL;
 
    status = mongocrypt_status_new ();
 
@@ -39,10 +74,9 @@ _test_cache (_mongocrypt_tester_t *tester)
    ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "1", entry, status),
                     status);
    BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
-   /* Assert we get a copy back. */
-   BSON_ASSERT (entry != tmp);
-   BSON_ASSERT (bson_equal (entry, tmp));
-   bson_destroy (tmp);
+   /* Assert we get the shared value back. */
+   BSON_ASSERT (entry == tmp);
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
 
    /* Test missing find. */
    BSON_ASSERT (_mongocrypt_cache_get (&cache, "2", (void **) &tmp));
@@ -54,26 +88,26 @@ _test_cache (_mongocrypt_tester_t *tester)
                     status);
    BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
    /* Overwrite is ignored. */
-   BSON_ASSERT (bson_equal (entry2, tmp));
-   bson_destroy (tmp);
+   BSON_ASSERT (_collinfo_equal (entry2, tmp));
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
 
    /* Test with two entries in the cache. */
    ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "2", entry2, status),
                     status);
    BSON_ASSERT (_mongocrypt_cache_get (&cache, "2", (void **) &tmp));
-   BSON_ASSERT (bson_equal (entry2, tmp));
-   bson_destroy (tmp);
+   BSON_ASSERT (_collinfo_equal (entry2, tmp));
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
 
    /* Test stealing an entry. */
    ASSERT_OR_PRINT (_mongocrypt_cache_add_stolen (&cache, "3", entry, status),
                     status);
    BSON_ASSERT (_mongocrypt_cache_get (&cache, "3", (void **) &tmp));
-   BSON_ASSERT (bson_equal (entry, tmp));
-   bson_destroy (tmp);
+   BSON_ASSERT (_collinfo_equal (entry, tmp));
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
 
    _mongocrypt_cache_cleanup (&cache);
    mongocrypt_status_destroy (status);
-   bson_destroy (entry2);
+   _mongocrypt_cache_collinfo_value_destroy (entry2);
 }
 
 static void
@@ -101,8 +135,8 @@ _test_cache_expiration (_mongocrypt_tester_t *tester)
 {
    _mongocrypt_cache_t cache;
    mongocrypt_status_t *status;
-   bson_t *entry = BCON_NEW ("a", "b");
-   bson_t *tmp = NULL;
+   _mongocrypt_cache_collinfo_value_t *entry = _collinfo_new ("b");
+   _mongocrypt_cache_collinfo_value_t *tmp = NULL;
 
    status = mongocrypt_status_new ();
 
@@ -112,10 +146,9 @@ _test_cache_expiration (_mongocrypt_tester_t *tester)
    ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "1", entry, status),
                     status);
    BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
-   /* Assert we get a copy back. */
-   BSON_ASSERT (entry != tmp);
-   BSON_ASSERT (bson_equal (entry, tmp));
-   bson_destroy (tmp);
+   /* Assert we get the shared value back. */
+   BSON_ASSERT (entry == tmp);
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
 
    /* Sleep for 100 milliseconds */
    _usleep (1000 * 100);
@@ -125,7 +158,178 @@ _test_cache_expiration (_mongocrypt_tester_t *tester)
 
    _mongocrypt_cache_cleanup (&cache);
    mongocrypt_status_destroy (status);
-   bson_destroy (entry);
+   _mongocrypt_cache_collinfo_value_destroy (entry);
+}
+
+
+/* Test that the first lookup within the refresh window misses, so that
+ * context refetches the entry, while other lookups keep using it. */
+static void
+_test_cache_refresh (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_cache_t cache;
+   mongocrypt_status_t *status;
+   _mongocrypt_cache_collinfo_value_t *entry = _collinfo_new ("b");
+   _mongocrypt_cache_collinfo_value_t *tmp = NULL;
+   int i;
+
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_cache_collinfo_init (&cache);
+   _mongocrypt_cache_set_expiration (&cache, 1000);
+   _mongocrypt_cache_set_refresh_window (&cache, 500);
+
+   for (i = 0; i < 2; i++) {
+      ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "1", entry, status),
+                       status);
+      BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
+      BSON_ASSERT (tmp);
+      _mongocrypt_cache_collinfo_value_destroy (tmp);
+
+      /* Age the entry into the refresh window. */
+      cache.pair->last_updated -= 600;
+      BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
+      BSON_ASSERT (!tmp);
+      BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
+      BSON_ASSERT (tmp);
+      BSON_ASSERT (_collinfo_equal (entry, tmp));
+      _mongocrypt_cache_collinfo_value_destroy (tmp);
+      /* Re-adding the entry resets the claim on the next iteration. */
+   }
+
+   _mongocrypt_cache_cleanup (&cache);
+   mongocrypt_status_destroy (status);
+   _mongocrypt_cache_collinfo_value_destroy (entry);
+}
+
+
+/* Test that a bounded cache evicts entries not used since eviction last
+ * passed over them, and counts lookups and evictions. */
+static void
+_test_cache_limits (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_cache_t cache;
+   _mongocrypt_cache_stats_t stats;
+   mongocrypt_status_t *status;
+   _mongocrypt_cache_collinfo_value_t *entry = _collinfo_new ("b");
+   _mongocrypt_cache_collinfo_value_t *tmp = NULL;
+   uint64_t entry_bytes;
+
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_cache_collinfo_init (&cache);
+   _mongocrypt_cache_set_limits (&cache, 3, 0);
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "1", entry, status),
+                    status);
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "2", entry, status),
+                    status);
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "3", entry, status),
+                    status);
+   /* Using "1" gives it a second chance, so "2" is evicted instead. */
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
+   BSON_ASSERT (tmp);
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "4", entry, status),
+                    status);
+   BSON_ASSERT (3 == _mongocrypt_cache_num_entries (&cache));
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "2", (void **) &tmp));
+   BSON_ASSERT (!tmp);
+
+   /* "1" was not used since eviction passed over it, and is evicted now. */
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "3", (void **) &tmp));
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "4", (void **) &tmp));
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "5", entry, status),
+                    status);
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "1", (void **) &tmp));
+   BSON_ASSERT (!tmp);
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "5", (void **) &tmp));
+   BSON_ASSERT (tmp);
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
+
+   _mongocrypt_cache_stats (&cache, &stats);
+   BSON_ASSERT (stats.hits == 4);
+   BSON_ASSERT (stats.misses == 2);
+   BSON_ASSERT (stats.evictions == 2);
+   BSON_ASSERT (stats.expirations == 0);
+   BSON_ASSERT (stats.entries == 3);
+   entry_bytes = stats.bytes / 3;
+   BSON_ASSERT (entry_bytes * 3 == stats.bytes);
+   BSON_ASSERT (entry_bytes > entry->schema.len);
+
+   /* Lowering the byte budget evicts immediately. */
+   _mongocrypt_cache_set_limits (&cache, 0, 2 * entry_bytes);
+   _mongocrypt_cache_stats (&cache, &stats);
+   BSON_ASSERT (stats.entries == 2);
+   BSON_ASSERT (stats.bytes == 2 * entry_bytes);
+   BSON_ASSERT (stats.evictions == 3);
+
+   /* An entry over the budget by itself is not kept. */
+   _mongocrypt_cache_set_limits (&cache, 0, entry_bytes - 1);
+   BSON_ASSERT (0 == _mongocrypt_cache_num_entries (&cache));
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, "6", entry, status),
+                    status);
+   BSON_ASSERT (0 == _mongocrypt_cache_num_entries (&cache));
+
+   _mongocrypt_cache_cleanup (&cache);
+   mongocrypt_status_destroy (status);
+   _mongocrypt_cache_collinfo_value_destroy (entry);
+}
+
+
+/* Test a cache large enough to grow its hash table several times, and that
+ * eviction removes exactly the expired entries. */
+static void
+_test_cache_many_entries (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_cache_t cache;
+   _mongocrypt_cache_pair_t *pair;
+   mongocrypt_status_t *status;
+   _mongocrypt_cache_collinfo_value_t *entry = _collinfo_new ("b");
+   _mongocrypt_cache_collinfo_value_t *tmp = NULL;
+   char ns[32];
+   int i;
+
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_cache_collinfo_init (&cache);
+   for (i = 0; i < 10000; i++) {
+      bson_snprintf (ns, sizeof (ns), "db.coll%d", i);
+      ASSERT_OR_PRINT (_mongocrypt_cache_add_copy (&cache, ns, entry, status),
+                       status);
+   }
+   BSON_ASSERT (_mongocrypt_cache_num_entries (&cache) == 10000);
+
+   for (i = 0; i < 10000; i++) {
+      bson_snprintf (ns, sizeof (ns), "db.coll%d", i);
+      BSON_ASSERT (_mongocrypt_cache_get (&cache, ns, (void **) &tmp));
+      BSON_ASSERT (tmp);
+      BSON_ASSERT (_collinfo_equal (entry, tmp));
+      _mongocrypt_cache_collinfo_value_destroy (tmp);
+   }
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "db.coll10000", (void **) &tmp));
+   BSON_ASSERT (!tmp);
+
+   /* Overwriting does not add entries. */
+   ASSERT_OR_PRINT (
+      _mongocrypt_cache_add_copy (&cache, "db.coll0", entry, status), status);
+   BSON_ASSERT (_mongocrypt_cache_num_entries (&cache) == 10000);
+
+   /* Age all but the entry just overwritten, which is the newest. */
+   for (pair = cache.pair->next; pair; pair = pair->next) {
+      pair->last_updated -= 2 * CACHE_EXPIRATION_MS;
+   }
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "db.coll1", (void **) &tmp));
+   BSON_ASSERT (!tmp);
+   BSON_ASSERT (_mongocrypt_cache_num_entries (&cache) == 1);
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, "db.coll0", (void **) &tmp));
+   BSON_ASSERT (tmp);
+   _mongocrypt_cache_collinfo_value_destroy (tmp);
+
+   _mongocrypt_cache_cleanup (&cache);
+   mongocrypt_status_destroy (status);
+   _mongocrypt_cache_collinfo_value_destroy (entry);
 }
 
 
@@ -256,10 +460,297 @@ _test_cache_duplicates (_mongocrypt_tester_t *tester)
    _mongocrypt_cache_cleanup (&cache);
 }
 
+/* Test that a key cache hit shares the entry, and that the entry outlives the
+ * cache while referenced. */
+static void
+_test_cache_key_refcount (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_cache_t cache;
+   mongocrypt_status_t *status;
+   _mongocrypt_key_doc_t *key_doc;
+   _mongocrypt_cache_key_value_t *value, *tmp1, *tmp2;
+   _mongocrypt_cache_key_attr_t *attr;
+   _mongocrypt_buffer_t id, key_material;
+
+   status = mongocrypt_status_new ();
+   _mongocrypt_buffer_copy_from_hex (&id, "61616161616161616161616161616161");
+   _mongocrypt_buffer_init (&key_material);
+   _mongocrypt_buffer_resize (&key_material, MONGOCRYPT_KEY_LEN);
+   memset (key_material.data, 'k', key_material.len);
+
+   key_doc = _mongocrypt_key_new ();
+   value = _mongocrypt_cache_key_value_new (key_doc, &key_material);
+   BSON_ASSERT (value->refcount == 1);
+   attr = _mongocrypt_cache_key_attr_new (&id, NULL);
+
+   _mongocrypt_cache_key_init (&cache);
+   ASSERT_OR_PRINT (_mongocrypt_cache_add_stolen (&cache, attr, value, status),
+                    status);
+
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, attr, (void **) &tmp1));
+   BSON_ASSERT (_mongocrypt_cache_get (&cache, attr, (void **) &tmp2));
+   BSON_ASSERT (tmp1 == value);
+   BSON_ASSERT (tmp2 == value);
+   BSON_ASSERT (value->refcount == 3);
+   _mongocrypt_cache_key_value_destroy (tmp2);
+   BSON_ASSERT (value->refcount == 2);
+
+   /* The entry survives the cache. */
+   _mongocrypt_cache_cleanup (&cache);
+   BSON_ASSERT (tmp1->refcount == 1);
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&tmp1->decrypted_key_material,
+                                             &key_material));
+   _mongocrypt_cache_key_value_destroy (tmp1);
+
+   _mongocrypt_cache_key_attr_destroy (attr);
+   _mongocrypt_key_destroy (key_doc);
+   _mongocrypt_buffer_cleanup (&key_material);
+   _mongocrypt_buffer_cleanup (&id);
+   mongocrypt_status_destroy (status);
+}
+
+
+static void
+_test_cache_deterministic (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_cache_deterministic_t cache;
+   _mongocrypt_buffer_t key_id, ciphertext, out;
+   uint8_t digest_a[MONGOCRYPT_DETERMINISTIC_DIGEST_LEN] = {0};
+   uint8_t digest_b[MONGOCRYPT_DETERMINISTIC_DIGEST_LEN] = {0};
+   uint8_t digest_c[MONGOCRYPT_DETERMINISTIC_DIGEST_LEN] = {0};
+   _mongocrypt_cache_stats_t stats;
+   uint32_t i;
+
+   digest_a[0] = 'a';
+   digest_b[0] = 'b';
+   /* Same bucket as a. */
+   digest_c[0] = 'a';
+   digest_c[MONGOCRYPT_DETERMINISTIC_DIGEST_LEN - 1] = 'c';
+
+   _mongocrypt_buffer_copy_from_hex (&key_id,
+                                     "61616161616161616161616161616161");
+   _mongocrypt_buffer_copy_from_hex (&ciphertext, "0102030405");
+   _mongocrypt_buffer_init (&out);
+
+   _mongocrypt_cache_deterministic_init (&cache);
+
+   /* Disabled by default. */
+   _mongocrypt_cache_deterministic_add (&cache, &key_id, digest_a, &ciphertext);
+   BSON_ASSERT (0 == _mongocrypt_cache_deterministic_num_entries (&cache));
+   BSON_ASSERT (
+      !_mongocrypt_cache_deterministic_get (&cache, &key_id, digest_a, &out));
+
+   _mongocrypt_cache_deterministic_set_max_entries (&cache, 2);
+   _mongocrypt_cache_deterministic_add (&cache, &key_id, digest_a, &ciphertext);
+   _mongocrypt_cache_deterministic_add (&cache, &key_id, digest_b, &ciphertext);
+   BSON_ASSERT (2 == _mongocrypt_cache_deterministic_num_entries (&cache));
+
+   /* Touch a, so b is the least recently used. */
+   BSON_ASSERT (
+      _mongocrypt_cache_deterministic_get (&cache, &key_id, digest_a, &out));
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&out, &ciphertext));
+   _mongocrypt_buffer_cleanup (&out);
+   _mongocrypt_buffer_init (&out);
+
+   _mongocrypt_cache_deterministic_add (&cache, &key_id, digest_c, &ciphertext);
+   BSON_ASSERT (2 == _mongocrypt_cache_deterministic_num_entries (&cache));
+   BSON_ASSERT (
+      !_mongocrypt_cache_deterministic_get (&cache, &key_id, digest_b, &out));
+   BSON_ASSERT (
+      _mongocrypt_cache_deterministic_get (&cache, &key_id, digest_a, &out));
+   _mongocrypt_buffer_cleanup (&out);
+   _mongocrypt_buffer_init (&out);
+   BSON_ASSERT (
+      _mongocrypt_cache_deterministic_get (&cache, &key_id, digest_c, &out));
+   _mongocrypt_buffer_cleanup (&out);
+   _mongocrypt_buffer_init (&out);
+
+   /* The key id is part of the cache key. */
+   key_id.data[0] = 'b';
+   BSON_ASSERT (
+      !_mongocrypt_cache_deterministic_get (&cache, &key_id, digest_a, &out));
+
+   _mongocrypt_cache_deterministic_stats (&cache, &stats);
+   BSON_ASSERT (stats.hits == 3);
+   BSON_ASSERT (stats.misses == 2);
+   BSON_ASSERT (stats.evictions == 1);
+   BSON_ASSERT (stats.entries == 2);
+   BSON_ASSERT (stats.bytes > 2 * ciphertext.len);
+
+   /* A large maximum does not allocate the bucket table up front. The table
+    * grows as entries are added, and entries survive the rehash. */
+   _mongocrypt_cache_deterministic_set_max_entries (&cache,
+                                                    (UINT32_MAX >> 1) + 1);
+   BSON_ASSERT (cache.num_buckets == MONGOCRYPT_DETERMINISTIC_MIN_BUCKETS);
+   for (i = 0; i < 100; i++) {
+      memcpy (digest_a, &i, sizeof (i));
+      _mongocrypt_cache_deterministic_add (
+         &cache, &key_id, digest_a, &ciphertext);
+   }
+   BSON_ASSERT (100 == _mongocrypt_cache_deterministic_num_entries (&cache));
+   BSON_ASSERT (cache.num_buckets == 128);
+   for (i = 0; i < 100; i++) {
+      memcpy (digest_a, &i, sizeof (i));
+      BSON_ASSERT (_mongocrypt_cache_deterministic_get (
+         &cache, &key_id, digest_a, &out));
+      _mongocrypt_buffer_cleanup (&out);
+      _mongocrypt_buffer_init (&out);
+   }
+
+   /* The table stops growing at the maximum number of entries. */
+   _mongocrypt_cache_deterministic_set_max_entries (&cache, 20);
+   for (i = 0; i < 100; i++) {
+      memcpy (digest_a, &i, sizeof (i));
+      _mongocrypt_cache_deterministic_add (
+         &cache, &key_id, digest_a, &ciphertext);
+   }
+   BSON_ASSERT (20 == _mongocrypt_cache_deterministic_num_entries (&cache));
+   BSON_ASSERT (cache.num_buckets == 32);
+
+   _mongocrypt_cache_deterministic_cleanup (&cache);
+   _mongocrypt_buffer_cleanup (&key_id);
+   _mongocrypt_buffer_cleanup (&ciphertext);
+}
+
+
+/* Test that OAuth tokens are cached per key, and that one lookup is told to
+ * renew a token once it is due. */
+static void
+_test_cache_oauth (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_cache_oauth_t *cache;
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+   char *azure_key;
+   char *gcp_key;
+   char *token;
+   int64_t claim;
+   int64_t other_claim;
+
+   status = mongocrypt_status_new ();
+
+   crypt = mongocrypt_new ();
+   ASSERT_FAILS (mongocrypt_setopt_oauth_renewal_percent (crypt, 100),
+                 crypt,
+                 "OAuth renewal percent must be less than 100");
+   ASSERT_OK (
+      mongocrypt_setopt_kms_providers (
+         crypt,
+         TEST_BSON ("{'azure': {'tenantId': 't', 'clientId': 'c', "
+                    "'clientSecret': 's'}, 'gcp': {'email': 'e', "
+                    "'privateKey': 'AAAA'}}")),
+      crypt);
+   ASSERT_OK (mongocrypt_setopt_oauth_renewal_percent (crypt, 50), crypt);
+   cache = crypt->cache_oauth;
+   BSON_ASSERT (cache->renewal_percent == 50);
+
+   /* The default endpoints share the key of the unset ones. */
+   azure_key = _mongocrypt_cache_oauth_key (
+      MONGOCRYPT_KMS_PROVIDER_AZURE, &crypt->opts, NULL);
+   gcp_key = _mongocrypt_cache_oauth_key (
+      MONGOCRYPT_KMS_PROVIDER_GCP, &crypt->opts, NULL);
+   BSON_ASSERT (0 != strcmp (azure_key, gcp_key));
+
+   BSON_ASSERT (!_mongocrypt_cache_oauth_get (cache, azure_key, &claim));
+   ASSERT_OR_PRINT (
+      _mongocrypt_cache_oauth_add (
+         cache,
+         azure_key,
+         TMP_BSON ("{'access_token': 'a', 'expires_in': 3600}"),
+         status),
+      status);
+   BSON_ASSERT (!_mongocrypt_cache_oauth_get (cache, gcp_key, &claim));
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &claim);
+   ASSERT_STREQUAL (token, "a");
+   BSON_ASSERT (!claim);
+   bson_free (token);
+
+   /* Age the token past half its lifetime. Only the first lookup renews. */
+   cache->entries->renewal_time_us = bson_get_monotonic_time ();
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &claim);
+   ASSERT_STREQUAL (token, "a");
+   BSON_ASSERT (claim);
+   bson_free (token);
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &other_claim);
+   ASSERT_STREQUAL (token, "a");
+   BSON_ASSERT (!other_claim);
+   bson_free (token);
+
+   /* A renewal given up is claimed by the next lookup. */
+   _mongocrypt_cache_oauth_release_renewal (cache, azure_key, claim);
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &claim);
+   ASSERT_STREQUAL (token, "a");
+   BSON_ASSERT (claim);
+   bson_free (token);
+
+   /* A renewal that never completes lapses before the token expires. */
+   cache->entries->renewal_claimed_us -= (cache->entries->expiration_time_us -
+                                          cache->entries->renewal_time_us) /
+                                         4;
+   claim = cache->entries->renewal_claimed_us;
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &other_claim);
+   ASSERT_STREQUAL (token, "a");
+   BSON_ASSERT (other_claim && other_claim != claim);
+   bson_free (token);
+
+   /* Releasing the lapsed claim leaves the claim that replaced it. */
+   _mongocrypt_cache_oauth_release_renewal (cache, azure_key, claim);
+   BSON_ASSERT (cache->entries->renewal_claimed_us == other_claim);
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &claim);
+   ASSERT_STREQUAL (token, "a");
+   BSON_ASSERT (!claim);
+   bson_free (token);
+   _mongocrypt_cache_oauth_release_renewal (cache, azure_key, other_claim);
+   BSON_ASSERT (cache->entries->renewal_claimed_us == 0);
+
+   /* The renewed token replaces it. */
+   ASSERT_OR_PRINT (
+      _mongocrypt_cache_oauth_add (
+         cache,
+         azure_key,
+         TMP_BSON ("{'access_token': 'b', 'expires_in': 3600}"),
+         status),
+      status);
+   token = _mongocrypt_cache_oauth_get (cache, azure_key, &claim);
+   ASSERT_STREQUAL (token, "b");
+   BSON_ASSERT (!claim);
+   bson_free (token);
+
+   /* An expired token is removed. */
+   cache->entries->expiration_time_us = 0;
+   BSON_ASSERT (!_mongocrypt_cache_oauth_get (cache, azure_key, &claim));
+   BSON_ASSERT (!cache->entries);
+
+   /* A short lived token is due for renewal before it is evicted, even at a
+    * high renewal percent. */
+   ASSERT_OK (mongocrypt_setopt_oauth_renewal_percent (crypt, 99), crypt);
+   ASSERT_OR_PRINT (
+      _mongocrypt_cache_oauth_add (
+         cache,
+         gcp_key,
+         TMP_BSON ("{'access_token': 'c', 'expires_in': 60}"),
+         status),
+      status);
+   BSON_ASSERT (cache->entries->renewal_time_us <
+                cache->entries->expiration_time_us);
+
+   bson_free (azure_key);
+   bson_free (gcp_key);
+   mongocrypt_destroy (crypt);
+   mongocrypt_status_destroy (status);
+}
+
+
 void
 _mongocrypt_tester_install_cache (_mongocrypt_tester_t *tester)
 {
    INSTALL_TEST (_test_cache);
    INSTALL_TEST (_test_cache_expiration);
+   INSTALL_TEST (_test_cache_refresh);
+   INSTALL_TEST (_test_cache_limits);
+   INSTALL_TEST (_test_cache_many_entries);
    INSTALL_TEST (_test_cache_duplicates);
+   INSTALL_TEST (_test_cache_key_refcount);
+   INSTALL_TEST (_test_cache_deterministic);
+   INSTALL_TEST (_test_cache_oauth);
 }
\ No newline at end of file
@@ -720,6 +720,279 @@ _test_crypto_hook_sign_rsaes_pkcs1_v1_5 (_mongocrypt_tester_t *tester)
    bson_string_free (call_history, true);
 }
 
+static bool
+_crypto_batch (void *ctx,
+               mongocrypt_crypto_op_t **ops,
+               uint32_t count,
+               mongocrypt_status_t *status)
+{
+   uint32_t i;
+
+   BSON_ASSERT (0 == strncmp ("error_on:", (char *) ctx, strlen ("error_on:")));
+   bson_string_append_printf (call_history, "call:%s\n", BSON_FUNC);
+   for (i = 0; i < count; i++) {
+      mongocrypt_binary_t *in = mongocrypt_crypto_op_in (ops[i]);
+      mongocrypt_binary_t *out = mongocrypt_crypto_op_out (ops[i]);
+      _mongocrypt_buffer_t tmp;
+
+      switch (mongocrypt_crypto_op_type (ops[i])) {
+      case MONGOCRYPT_CRYPTO_OP_AES_256_CBC_ENCRYPT:
+      case MONGOCRYPT_CRYPTO_OP_AES_256_CBC_DECRYPT:
+         bson_string_append_printf (call_history, "op:aes\n");
+         BSON_ASSERT (mongocrypt_crypto_op_iv (ops[i]));
+         /* copy it directly, don't encrypt or decrypt. */
+         memcpy (out->data, in->data, in->len);
+         mongocrypt_crypto_op_set_bytes_written (ops[i], in->len);
+         break;
+      case MONGOCRYPT_CRYPTO_OP_HMAC_SHA_512:
+         bson_string_append_printf (call_history, "op:hmac_sha512\n");
+         BSON_ASSERT (!mongocrypt_crypto_op_iv (ops[i]));
+         _mongocrypt_buffer_copy_from_hex (&tmp, HMAC_HEX);
+         memcpy (out->data, tmp.data, tmp.len);
+         _mongocrypt_buffer_cleanup (&tmp);
+         break;
+      default:
+         BSON_ASSERT (false);
+      }
+   }
+   bson_string_append_printf (call_history, "ret:%s\n", BSON_FUNC);
+   if (0 == strcmp ((char *) ctx, "error_on:crypto_batch")) {
+      mongocrypt_status_set (
+         status, MONGOCRYPT_STATUS_ERROR_CLIENT, 1, (char *) ctx, -1);
+      return false;
+   }
+   return true;
+}
+
+
+static mongocrypt_t *
+_create_mongocrypt_with_batch (_mongocrypt_tester_t *tester,
+                               const char *error_on)
+{
+   mongocrypt_t *crypt = mongocrypt_new ();
+
+   ASSERT_OK (
+      mongocrypt_setopt_kms_provider_aws (crypt, "example", -1, "example", -1),
+      crypt);
+   ASSERT_OK (mongocrypt_setopt_crypto_hooks (crypt,
+                                              _aes_256_cbc_encrypt,
+                                              _aes_256_cbc_decrypt,
+                                              _random,
+                                              _hmac_sha_512,
+                                              _hmac_sha_256,
+                                              _sha_256,
+                                              (void *) error_on),
+              crypt);
+   ASSERT_OK (mongocrypt_setopt_crypto_hook_batch (
+                 crypt, _crypto_batch, (void *) error_on),
+              crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   return crypt;
+}
+
+
+/* Test that every step of a batch is one call to the batch hook, and that the
+ * single operation hooks are not called. */
+static void
+_test_crypto_hook_batch (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+   _mongocrypt_key_state_t key_state;
+   _mongocrypt_buffer_t key, iv, associated_data;
+   _mongocrypt_buffer_t plaintexts[3], ciphertexts[3], decrypted[3];
+   _mongocrypt_encryption_t encryptions[3];
+   _mongocrypt_decryption_t decryptions[3];
+   const char *values[] = {"BBBB", "0102030405060708090A0B0C0D0E0F10", "CC"};
+   const char *expected_call_history = "call:_crypto_batch\n"
+                                       "op:aes\n"
+                                       "op:aes\n"
+                                       "op:aes\n"
+                                       "ret:_crypto_batch\n"
+                                       "call:_crypto_batch\n"
+                                       "op:hmac_sha512\n"
+                                       "op:hmac_sha512\n"
+                                       "op:hmac_sha512\n"
+                                       "ret:_crypto_batch\n";
+   uint32_t i;
+
+   /* The batch hook requires the single operation hooks. */
+   crypt = mongocrypt_new ();
+   ASSERT_FAILS (mongocrypt_setopt_crypto_hook_batch (
+                    crypt, _crypto_batch, (void *) "error_on:none"),
+                 crypt,
+                 "crypto_hooks must be set before the batch hook");
+   mongocrypt_destroy (crypt);
+
+   status = mongocrypt_status_new ();
+   crypt = _create_mongocrypt_with_batch (tester, "error_on:none");
+   call_history = bson_string_new (NULL);
+
+   _mongocrypt_buffer_copy_from_hex (&key, KEY_HEX);
+   _mongocrypt_buffer_copy_from_hex (&iv, IV_HEX);
+   _mongocrypt_buffer_copy_from_hex (&associated_data, "AAAA");
+   _mongocrypt_key_state_init (&key_state);
+   ASSERT_OR_PRINT (
+      _mongocrypt_key_state_set (crypt->crypto, &key_state, &key, status),
+      status);
+
+   for (i = 0; i < 3; i++) {
+      _mongocrypt_buffer_copy_from_hex (&plaintexts[i], values[i]);
+      _mongocrypt_buffer_init (&ciphertexts[i]);
+      _mongocrypt_buffer_resize (
+         &ciphertexts[i],
+         _mongocrypt_calculate_ciphertext_len (plaintexts[i].len));
+      encryptions[i].key_state = &key_state;
+      encryptions[i].iv = &iv;
+      encryptions[i].associated_data = &associated_data;
+      encryptions[i].plaintext = &plaintexts[i];
+      encryptions[i].ciphertext = &ciphertexts[i];
+      encryptions[i].bytes_written = 0;
+   }
+
+   ASSERT_OR_PRINT (_mongocrypt_do_encryption_batch (
+                       crypt->crypto, encryptions, 3, status),
+                    status);
+   ASSERT_STREQUAL (call_history->str, expected_call_history);
+   for (i = 0; i < 3; i++) {
+      BSON_ASSERT (encryptions[i].bytes_written == ciphertexts[i].len);
+   }
+
+   /* Decryption verifies all tags before decrypting. */
+   bson_string_free (call_history, true);
+   call_history = bson_string_new (NULL);
+   for (i = 0; i < 3; i++) {
+      _mongocrypt_buffer_init (&decrypted[i]);
+      _mongocrypt_buffer_resize (
+         &decrypted[i],
+         _mongocrypt_calculate_plaintext_len (ciphertexts[i].len));
+      decryptions[i].key_state = &key_state;
+      decryptions[i].associated_data = &associated_data;
+      decryptions[i].ciphertext = &ciphertexts[i];
+      decryptions[i].plaintext = &decrypted[i];
+      decryptions[i].bytes_written = 0;
+   }
+
+   ASSERT_OR_PRINT (_mongocrypt_do_decryption_batch (
+                       crypt->crypto, decryptions, 3, status),
+                    status);
+   BSON_ASSERT (strstr (call_history->str,
+                        "op:hmac_sha512\n"
+                        "ret:_crypto_batch\n"
+                        "call:_crypto_batch\n"
+                        "op:aes\n"));
+   BSON_ASSERT (!strstr (call_history->str, "call:_hmac_sha_512"));
+   BSON_ASSERT (!strstr (call_history->str, "call:_aes_256_cbc_decrypt"));
+   for (i = 0; i < 3; i++) {
+      decrypted[i].len = decryptions[i].bytes_written;
+      BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&decrypted[i], &plaintexts[i]));
+   }
+
+   for (i = 0; i < 3; i++) {
+      _mongocrypt_buffer_cleanup (&plaintexts[i]);
+      _mongocrypt_buffer_cleanup (&ciphertexts[i]);
+      _mongocrypt_buffer_cleanup (&decrypted[i]);
+   }
+   _mongocrypt_key_state_cleanup (&key_state);
+   _mongocrypt_buffer_cleanup (&key);
+   _mongocrypt_buffer_cleanup (&iv);
+   _mongocrypt_buffer_cleanup (&associated_data);
+   mongocrypt_destroy (crypt);
+   bson_string_free (call_history, true);
+
+   /* Errors from the batch hook are returned. */
+   crypt = _create_mongocrypt_with_batch (tester, "error_on:crypto_batch");
+   call_history = bson_string_new (NULL);
+   _mongocrypt_buffer_copy_from_hex (&key, KEY_HEX);
+   _mongocrypt_buffer_copy_from_hex (&plaintexts[0], values[0]);
+   _mongocrypt_buffer_init (&ciphertexts[0]);
+   _mongocrypt_buffer_resize (
+      &ciphertexts[0],
+      _mongocrypt_calculate_ciphertext_len (plaintexts[0].len));
+   _mongocrypt_buffer_copy_from_hex (&iv, IV_HEX);
+   _mongocrypt_key_state_init (&key_state);
+   ASSERT_OR_PRINT (
+      _mongocrypt_key_state_set (crypt->crypto, &key_state, &key, status),
+      status);
+   encryptions[0].key_state = &key_state;
+   encryptions[0].iv = &iv;
+   encryptions[0].associated_data = NULL;
+   encryptions[0].plaintext = &plaintexts[0];
+   encryptions[0].ciphertext = &ciphertexts[0];
+   BSON_ASSERT (!_mongocrypt_do_encryption_batch (
+      crypt->crypto, encryptions, 1, status));
+   ASSERT_STATUS_CONTAINS (status, "error_on:crypto_batch");
+
+   _mongocrypt_buffer_cleanup (&plaintexts[0]);
+   _mongocrypt_buffer_cleanup (&ciphertexts[0]);
+   _mongocrypt_key_state_cleanup (&key_state);
+   _mongocrypt_buffer_cleanup (&key);
+   _mongocrypt_buffer_cleanup (&iv);
+   mongocrypt_destroy (crypt);
+   bson_string_free (call_history, true);
+   mongocrypt_status_destroy (status);
+}
+
+
+/* Test that explicit encryption computes the deterministic IV, the
+ * ciphertext, and the tag with the batch hook. */
+static void
+_test_crypto_hook_batch_explicit (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_binary_t *bin, *key_id;
+   _mongocrypt_buffer_t encrypted;
+   char *deterministic = "AEAD_AES_256_CBC_HMAC_SHA_512-Deterministic";
+
+   crypt = _create_mongocrypt_with_batch (tester, "error_on:none");
+   call_history = bson_string_new (NULL);
+
+   ctx = mongocrypt_ctx_new (crypt);
+   key_id = mongocrypt_binary_new_from_data (
+      MONGOCRYPT_DATA_AND_LEN ("aaaaaaaaaaaaaaaa"));
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (ctx, deterministic, -1), ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_id (ctx, key_id), ctx);
+   ASSERT_OK (
+      mongocrypt_ctx_explicit_encrypt_init (ctx, TEST_BSON ("{'v': 123}")),
+      ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+
+   bson_string_free (call_history, true);
+   call_history = bson_string_new (NULL);
+   bin = mongocrypt_binary_new ();
+   ASSERT_OK (mongocrypt_ctx_finalize (ctx, bin), ctx);
+   ASSERT_STREQUAL (call_history->str,
+                    "call:_crypto_batch\n"
+                    "op:hmac_sha512\n"
+                    "ret:_crypto_batch\n"
+                    "call:_crypto_batch\n"
+                    "op:aes\n"
+                    "ret:_crypto_batch\n"
+                    "call:_crypto_batch\n"
+                    "op:hmac_sha512\n"
+                    "ret:_crypto_batch\n");
+   _mongocrypt_buffer_copy_from_binary (&encrypted, bin);
+   mongocrypt_binary_destroy (bin);
+   mongocrypt_ctx_destroy (ctx);
+
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_explicit_decrypt_init (
+                 ctx, _mongocrypt_buffer_as_binary (&encrypted)),
+              ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+   bin = mongocrypt_binary_new ();
+   ASSERT_OK (mongocrypt_ctx_finalize (ctx, bin), ctx);
+   _assert_bin_bson_equal (bin, TEST_BSON ("{'v': 123}"));
+
+   mongocrypt_binary_destroy (bin);
+   mongocrypt_binary_destroy (key_id);
+   mongocrypt_ctx_destroy (ctx);
+   _mongocrypt_buffer_cleanup (&encrypted);
+   mongocrypt_destroy (crypt);
+   bson_string_free (call_history, true);
+}
+
 void
 _mongocrypt_tester_install_crypto_hooks (_mongocrypt_tester_t *tester)
 {
@@ -734,4 +1007,6 @@ _mongocrypt_tester_install_crypto_hooks (_mongocrypt_tester_t *tester)
                         CRYPTO_OPTIONAL);
    INSTALL_TEST_CRYPTO (_test_crypto_hook_sign_rsaes_pkcs1_v1_5,
                         CRYPTO_OPTIONAL);
+   INSTALL_TEST_CRYPTO (_test_crypto_hook_batch, CRYPTO_OPTIONAL);
+   INSTALL_TEST_CRYPTO (_test_crypto_hook_batch_explicit, CRYPTO_OPTIONAL);
 }
@@ -16,6 +16,9 @@
 
 #include <mongocrypt.h>
 #include <mongocrypt-crypto-private.h>
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+#include <crypto/builtin-private.h>
+#endif
 
 #include "test-mongocrypt.h"
 
@@ -225,9 +228,741 @@ _test_mcgrew (_mongocrypt_tester_t *tester)
    mongocrypt_destroy (crypt);
 }
 
+/* Test that a precomputed key state produces the same results as the raw key,
+ * including when the state is reused. */
+static void
+_test_key_state (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+   _mongocrypt_key_state_t key_state;
+   _mongocrypt_buffer_t key, iv, associated_data, plaintext,
+      ciphertext_expected, ciphertext_actual, plaintext_actual, iv_expected,
+      iv_actual;
+   uint32_t bytes_written;
+   int i;
+
+   _mongocrypt_buffer_copy_from_hex (
+      &key,
+      "000102030405060708090a0b0c0d0e0f101112131415161718191a1"
+      "b1c1d1e1f202122232425262728292a2b2c2d2e2f30313233343536"
+      "3738393a3b3c3d3e3f"
+      "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f");
+   _mongocrypt_buffer_copy_from_hex (&iv, "1af38c2dc2b96ffdd86694092341bc04");
+   _mongocrypt_buffer_copy_from_hex (&plaintext, "41206369706865722073797374");
+   _mongocrypt_buffer_copy_from_hex (&associated_data, "546865207365636f6e64");
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_buffer_init (&ciphertext_expected);
+   _mongocrypt_buffer_resize (
+      &ciphertext_expected,
+      _mongocrypt_calculate_ciphertext_len (plaintext.len));
+   ASSERT_OR_PRINT (_mongocrypt_do_encryption (crypt->crypto,
+                                               &iv,
+                                               &associated_data,
+                                               &key,
+                                               &plaintext,
+                                               &ciphertext_expected,
+                                               &bytes_written,
+                                               status),
+                    status);
+   _mongocrypt_buffer_init (&iv_expected);
+   _mongocrypt_buffer_resize (&iv_expected, MONGOCRYPT_IV_LEN);
+   ASSERT_OR_PRINT (_mongocrypt_calculate_deterministic_iv (crypt->crypto,
+                                                            &key,
+                                                            &plaintext,
+                                                            &associated_data,
+                                                            &iv_expected,
+                                                            status),
+                    status);
+
+   _mongocrypt_key_state_init (&key_state);
+   ASSERT_OR_PRINT (
+      _mongocrypt_key_state_set (crypt->crypto, &key_state, &key, status),
+      status);
+
+   /* Reuse the state to check that no per-call state leaks between calls. */
+   for (i = 0; i < 2; i++) {
+      _mongocrypt_buffer_init (&ciphertext_actual);
+      _mongocrypt_buffer_resize (&ciphertext_actual, ciphertext_expected.len);
+      ASSERT_OR_PRINT (_mongocrypt_do_encryption_with_state (crypt->crypto,
+                                                             &iv,
+                                                             &associated_data,
+                                                             &key_state,
+                                                             &plaintext,
+                                                             &ciphertext_actual,
+                                                             &bytes_written,
+                                                             status),
+                       status);
+      BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&ciphertext_expected,
+                                                &ciphertext_actual));
+
+      _mongocrypt_buffer_init (&plaintext_actual);
+      _mongocrypt_buffer_resize (
+         &plaintext_actual,
+         _mongocrypt_calculate_plaintext_len (ciphertext_actual.len));
+      ASSERT_OR_PRINT (_mongocrypt_do_decryption_with_state (crypt->crypto,
+                                                             &associated_data,
+                                                             &key_state,
+                                                             &ciphertext_actual,
+                                                             &plaintext_actual,
+                                                             &bytes_written,
+                                                             status),
+                       status);
+      plaintext_actual.len = bytes_written;
+      BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&plaintext, &plaintext_actual));
+
+      _mongocrypt_buffer_init (&iv_actual);
+      _mongocrypt_buffer_resize (&iv_actual, MONGOCRYPT_IV_LEN);
+      ASSERT_OR_PRINT (
+         _mongocrypt_calculate_deterministic_iv_with_state (crypt->crypto,
+                                                            &key_state,
+                                                            &plaintext,
+                                                            &associated_data,
+                                                            &iv_actual,
+                                                            status),
+         status);
+      BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&iv_expected, &iv_actual));
+
+      _mongocrypt_buffer_cleanup (&ciphertext_actual);
+      _mongocrypt_buffer_cleanup (&plaintext_actual);
+      _mongocrypt_buffer_cleanup (&iv_actual);
+   }
+
+   /* A tampered ciphertext still fails the HMAC check. */
+   ciphertext_expected.data[ciphertext_expected.len - 1] ^= 1;
+   _mongocrypt_buffer_init (&plaintext_actual);
+   _mongocrypt_buffer_resize (
+      &plaintext_actual,
+      _mongocrypt_calculate_plaintext_len (ciphertext_expected.len));
+   ASSERT_FAILS_STATUS (
+      _mongocrypt_do_decryption_with_state (crypt->crypto,
+                                            &associated_data,
+                                            &key_state,
+                                            &ciphertext_expected,
+                                            &plaintext_actual,
+                                            &bytes_written,
+                                            status),
+      status,
+      "HMAC validation failure");
+
+   _mongocrypt_key_state_cleanup (&key_state);
+   _mongocrypt_buffer_cleanup (&plaintext_actual);
+   _mongocrypt_buffer_cleanup (&key);
+   _mongocrypt_buffer_cleanup (&iv);
+   _mongocrypt_buffer_cleanup (&plaintext);
+   _mongocrypt_buffer_cleanup (&associated_data);
+   _mongocrypt_buffer_cleanup (&ciphertext_expected);
+   _mongocrypt_buffer_cleanup (&iv_expected);
+   mongocrypt_status_destroy (status);
+   mongocrypt_destroy (crypt);
+}
+
+
+/* Track the largest allocation made through libbson. */
+static size_t _largest_alloc;
+
+static void *
+_tracking_malloc (size_t num_bytes)
+{
+   if (num_bytes > _largest_alloc) {
+      _largest_alloc = num_bytes;
+   }
+   return malloc (num_bytes);
+}
+
+static void *
+_tracking_calloc (size_t n_members, size_t num_bytes)
+{
+   if (n_members * num_bytes > _largest_alloc) {
+      _largest_alloc = n_members * num_bytes;
+   }
+   return calloc (n_members, num_bytes);
+}
+
+static void *
+_tracking_realloc (void *mem, size_t num_bytes)
+{
+   if (num_bytes > _largest_alloc) {
+      _largest_alloc = num_bytes;
+   }
+   return realloc (mem, num_bytes);
+}
+
+
+/* Test that encryption and decryption do not copy the plaintext or ciphertext
+ * into temporary buffers. */
+static void
+_test_no_intermediate_buffers (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+   _mongocrypt_key_state_t key_state;
+   _mongocrypt_buffer_t key, iv, associated_data, plaintext, ciphertext,
+      plaintext_actual;
+   bson_mem_vtable_t vtable = {_tracking_malloc,
+                               _tracking_calloc,
+                               _tracking_realloc,
+                               free};
+   uint32_t bytes_written;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_buffer_init (&key);
+   _mongocrypt_buffer_resize (&key, MONGOCRYPT_KEY_LEN);
+   memset (key.data, 1, key.len);
+   _mongocrypt_buffer_init (&iv);
+   _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
+   memset (iv.data, 2, iv.len);
+   _mongocrypt_buffer_init (&associated_data);
+   _mongocrypt_buffer_resize (&associated_data, 18);
+   memset (associated_data.data, 3, associated_data.len);
+   /* Not block aligned, so the final block is padded. */
+   _mongocrypt_buffer_init (&plaintext);
+   _mongocrypt_buffer_resize (&plaintext, 1024 * 1024 + 5);
+   memset (plaintext.data, 4, plaintext.len);
+   _mongocrypt_buffer_init (&ciphertext);
+   _mongocrypt_buffer_resize (
+      &ciphertext, _mongocrypt_calculate_ciphertext_len (plaintext.len));
+   _mongocrypt_buffer_init (&plaintext_actual);
+   _mongocrypt_buffer_resize (
+      &plaintext_actual, _mongocrypt_calculate_plaintext_len (ciphertext.len));
+
+   _mongocrypt_key_state_init (&key_state);
+   ASSERT_OR_PRINT (
+      _mongocrypt_key_state_set (crypt->crypto, &key_state, &key, status),
+      status);
+   if (!key_state.mac) {
+      /* Without precomputed contexts the HMAC input is concatenated. */
+      printf ("Skipping, native crypto has no precomputed contexts\n");
+      goto done;
+   }
+
+   _largest_alloc = 0;
+   bson_mem_set_vtable (&vtable);
+   ASSERT_OR_PRINT (_mongocrypt_do_encryption_with_state (crypt->crypto,
+                                                          &iv,
+                                                          &associated_data,
+                                                          &key_state,
+                                                          &plaintext,
+                                                          &ciphertext,
+                                                          &bytes_written,
+                                                          status),
+                    status);
+   ASSERT_OR_PRINT (_mongocrypt_do_decryption_with_state (crypt->crypto,
+                                                          &associated_data,
+                                                          &key_state,
+                                                          &ciphertext,
+                                                          &plaintext_actual,
+                                                          &bytes_written,
+                                                          status),
+                    status);
+   plaintext_actual.len = bytes_written;
+   /* The raw key path only allocates a temporary HMAC context. */
+   ASSERT_OR_PRINT (_mongocrypt_do_encryption (crypt->crypto,
+                                               &iv,
+                                               &associated_data,
+                                               &key,
+                                               &plaintext,
+                                               &ciphertext,
+                                               &bytes_written,
+                                               status),
+                    status);
+   bson_mem_restore_vtable ();
+   BSON_ASSERT (_largest_alloc < 1024);
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&plaintext, &plaintext_actual));
+
+done:
+   _mongocrypt_key_state_cleanup (&key_state);
+   _mongocrypt_buffer_cleanup (&key);
+   _mongocrypt_buffer_cleanup (&iv);
+   _mongocrypt_buffer_cleanup (&associated_data);
+   _mongocrypt_buffer_cleanup (&plaintext);
+   _mongocrypt_buffer_cleanup (&ciphertext);
+   _mongocrypt_buffer_cleanup (&plaintext_actual);
+   mongocrypt_status_destroy (status);
+   mongocrypt_destroy (crypt);
+}
+
+
+/* Test that encrypting a batch of fields matches encrypting each field. */
+static void
+_test_encryption_batch (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+#define BATCH_SIZE 5
+   _mongocrypt_key_state_t key_states[2];
+   _mongocrypt_buffer_t key, iv, associated_data;
+   _mongocrypt_buffer_t plaintexts[BATCH_SIZE];
+   _mongocrypt_buffer_t ciphertexts[BATCH_SIZE];
+   _mongocrypt_buffer_t ciphertext_expected;
+   _mongocrypt_encryption_t encryptions[BATCH_SIZE];
+   uint32_t bytes_written;
+   uint32_t i;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_buffer_init (&key);
+   _mongocrypt_buffer_resize (&key, MONGOCRYPT_KEY_LEN);
+   _mongocrypt_buffer_init (&iv);
+   _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
+   memset (iv.data, 1, iv.len);
+   _mongocrypt_buffer_copy_from_hex (&associated_data, "0102030405");
+
+   /* Alternate between two keys. */
+   for (i = 0; i < 2; i++) {
+      memset (key.data, (int) i, key.len);
+      _mongocrypt_key_state_init (&key_states[i]);
+      ASSERT_OR_PRINT (_mongocrypt_key_state_set (
+                          crypt->crypto, &key_states[i], &key, status),
+                       status);
+   }
+
+   for (i = 0; i < BATCH_SIZE; i++) {
+      _mongocrypt_buffer_init (&plaintexts[i]);
+      _mongocrypt_buffer_resize (&plaintexts[i], i * 13);
+      memset (plaintexts[i].data, (int) i, plaintexts[i].len);
+      _mongocrypt_buffer_init (&ciphertexts[i]);
+      _mongocrypt_buffer_resize (
+         &ciphertexts[i], _mongocrypt_calculate_ciphertext_len (i * 13));
+
+      encryptions[i].key_state = &key_states[i % 2];
+      encryptions[i].iv = &iv;
+      encryptions[i].associated_data = i == 0 ? NULL : &associated_data;
+      encryptions[i].plaintext = &plaintexts[i];
+      encryptions[i].ciphertext = &ciphertexts[i];
+   }
+
+   ASSERT_OR_PRINT (_mongocrypt_do_encryption_batch (
+                       crypt->crypto, encryptions, BATCH_SIZE, status),
+                    status);
+
+   for (i = 0; i < BATCH_SIZE; i++) {
+      BSON_ASSERT (encryptions[i].bytes_written == ciphertexts[i].len);
+      _mongocrypt_buffer_init (&ciphertext_expected);
+      _mongocrypt_buffer_resize (&ciphertext_expected, ciphertexts[i].len);
+      ASSERT_OR_PRINT (
+         _mongocrypt_do_encryption (crypt->crypto,
+                                    &iv,
+                                    encryptions[i].associated_data,
+                                    &encryptions[i].key_state->key,
+                                    &plaintexts[i],
+                                    &ciphertext_expected,
+                                    &bytes_written,
+                                    status),
+         status);
+      BSON_ASSERT (
+         0 == _mongocrypt_buffer_cmp (&ciphertext_expected, &ciphertexts[i]));
+      _mongocrypt_buffer_cleanup (&ciphertext_expected);
+      _mongocrypt_buffer_cleanup (&plaintexts[i]);
+      _mongocrypt_buffer_cleanup (&ciphertexts[i]);
+   }
+#undef BATCH_SIZE
+
+   _mongocrypt_key_state_cleanup (&key_states[0]);
+   _mongocrypt_key_state_cleanup (&key_states[1]);
+   _mongocrypt_buffer_cleanup (&key);
+   _mongocrypt_buffer_cleanup (&iv);
+   _mongocrypt_buffer_cleanup (&associated_data);
+   mongocrypt_status_destroy (status);
+   mongocrypt_destroy (crypt);
+}
+
+
+/* Test that decrypting a batch of fields matches decrypting each field, and
+ * that one bad tag fails the whole batch. */
+static void
+_test_decryption_batch (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+#define BATCH_SIZE 5
+   _mongocrypt_key_state_t key_states[2];
+   _mongocrypt_buffer_t key, iv, associated_data;
+   _mongocrypt_buffer_t plaintexts[BATCH_SIZE];
+   _mongocrypt_buffer_t ciphertexts[BATCH_SIZE];
+   _mongocrypt_buffer_t decrypted[BATCH_SIZE];
+   _mongocrypt_decryption_t decryptions[BATCH_SIZE];
+   uint32_t bytes_written;
+   uint32_t i;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   status = mongocrypt_status_new ();
+
+   _mongocrypt_buffer_init (&key);
+   _mongocrypt_buffer_resize (&key, MONGOCRYPT_KEY_LEN);
+   _mongocrypt_buffer_init (&iv);
+   _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
+   memset (iv.data, 1, iv.len);
+   _mongocrypt_buffer_copy_from_hex (&associated_data, "0102030405");
+
+   /* Alternate between two keys. */
+   for (i = 0; i < 2; i++) {
+      memset (key.data, (int) i, key.len);
+      _mongocrypt_key_state_init (&key_states[i]);
+      ASSERT_OR_PRINT (_mongocrypt_key_state_set (
+                          crypt->crypto, &key_states[i], &key, status),
+                       status);
+   }
+
+   for (i = 0; i < BATCH_SIZE; i++) {
+      _mongocrypt_buffer_init (&plaintexts[i]);
+      _mongocrypt_buffer_resize (&plaintexts[i], i * 13);
+      memset (plaintexts[i].data, (int) i, plaintexts[i].len);
+      _mongocrypt_buffer_init (&ciphertexts[i]);
+      _mongocrypt_buffer_resize (
+         &ciphertexts[i], _mongocrypt_calculate_ciphertext_len (i * 13));
+      ASSERT_OR_PRINT (
+         _mongocrypt_do_encryption_with_state (crypt->crypto,
+                                               &iv,
+                                               i == 0 ? NULL : &associated_data,
+                                               &key_states[i % 2],
+                                               &plaintexts[i],
+                                               &ciphertexts[i],
+                                               &bytes_written,
+                                               status),
+         status);
+      _mongocrypt_buffer_init (&decrypted[i]);
+      _mongocrypt_buffer_resize (
+         &decrypted[i],
+         _mongocrypt_calculate_plaintext_len (ciphertexts[i].len));
+
+      decryptions[i].key_state = &key_states[i % 2];
+      decryptions[i].associated_data = i == 0 ? NULL : &associated_data;
+      decryptions[i].ciphertext = &ciphertexts[i];
+      decryptions[i].plaintext = &decrypted[i];
+   }
+
+   ASSERT_OR_PRINT (_mongocrypt_do_decryption_batch (
+                       crypt->crypto, decryptions, BATCH_SIZE, status),
+                    status);
+   for (i = 0; i < BATCH_SIZE; i++) {
+      BSON_ASSERT (decryptions[i].bytes_written == plaintexts[i].len);
+      BSON_ASSERT (0 == memcmp (decrypted[i].data,
+                                plaintexts[i].data,
+                                plaintexts[i].len));
+   }
+
+   /* Tamper with the tag of the last field. */
+   ciphertexts[BATCH_SIZE - 1].data[ciphertexts[BATCH_SIZE - 1].len - 1] ^= 1;
+   BSON_ASSERT (!_mongocrypt_do_decryption_batch (
+      crypt->crypto, decryptions, BATCH_SIZE, status));
+   ASSERT_STATUS_CONTAINS (status, "HMAC validation failure");
+
+   for (i = 0; i < BATCH_SIZE; i++) {
+      _mongocrypt_buffer_cleanup (&plaintexts[i]);
+      _mongocrypt_buffer_cleanup (&ciphertexts[i]);
+      _mongocrypt_buffer_cleanup (&decrypted[i]);
+   }
+#undef BATCH_SIZE
+
+   _mongocrypt_key_state_cleanup (&key_states[0]);
+   _mongocrypt_key_state_cleanup (&key_states[1]);
+   _mongocrypt_buffer_cleanup (&key);
+   _mongocrypt_buffer_cleanup (&iv);
+   _mongocrypt_buffer_cleanup (&associated_data);
+   mongocrypt_status_destroy (status);
+   mongocrypt_destroy (crypt);
+}
+
+
+/* Test that IVs are handed out from the random pool, which is refilled when
+ * exhausted and after a fork. */
+static void
+_test_random_pool (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_status_t *status;
+   _mongocrypt_random_pool_t *pool;
+   _mongocrypt_buffer_t iv, prev;
+   const uint32_t ivs_per_fill = MONGOCRYPT_RANDOM_POOL_LEN / MONGOCRYPT_IV_LEN;
+   uint32_t i;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   status = mongocrypt_status_new ();
+   pool = crypt->crypto->random_pool;
+   BSON_ASSERT (pool == &crypt->random_pool);
+
+   _mongocrypt_buffer_init (&iv);
+   _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN);
+   _mongocrypt_buffer_init (&prev);
+   _mongocrypt_buffer_resize (&prev, MONGOCRYPT_IV_LEN);
+
+   /* The pool is filled on first use, and again once exhausted. */
+   for (i = 0; i < ivs_per_fill + 1; i++) {
+      ASSERT_OR_PRINT (_mongocrypt_random_iv (crypt->crypto, &iv, status),
+                       status);
+      BSON_ASSERT (0 != _mongocrypt_buffer_cmp (&iv, &prev));
+      memcpy (prev.data, iv.data, iv.len);
+   }
+   BSON_ASSERT (pool->requests == ivs_per_fill + 1);
+   BSON_ASSERT (pool->fills == 2);
+   BSON_ASSERT (_mongocrypt_random_pool_calls_saved (pool) == ivs_per_fill - 1);
+
+   /* A pool filled by another process is discarded. */
+   pool->pid = -1;
+   ASSERT_OR_PRINT (_mongocrypt_random_iv (crypt->crypto, &iv, status),
+                    status);
+   BSON_ASSERT (pool->fills == 3);
+   BSON_ASSERT (pool->pos == MONGOCRYPT_IV_LEN);
+
+   /* Only IV sized requests are served. */
+   _mongocrypt_buffer_resize (&iv, MONGOCRYPT_IV_LEN + 1);
+   BSON_ASSERT (!_mongocrypt_random_iv (crypt->crypto, &iv, status));
+   ASSERT_STATUS_CONTAINS (status, "out should have length");
+
+   _mongocrypt_buffer_cleanup (&iv);
+   _mongocrypt_buffer_cleanup (&prev);
+   mongocrypt_status_destroy (status);
+   mongocrypt_destroy (crypt);
+}
+
+
+/* Check the result for every length and position of the difference. The
+ * timing is checked by the memequal_timing benchmark, since a timing test is
+ * too noisy for the unit tests. */
+static void
+_test_memequal_constant_time (_mongocrypt_tester_t *tester)
+{
+   uint8_t a[101], b[101];
+   int i, j;
+
+   for (i = 0; i < (int) sizeof (a); i++) {
+      a[i] = (uint8_t) i;
+   }
+   memcpy (b, a, sizeof (a));
+
+   for (i = 0; i < 100; i++) {
+      BSON_ASSERT (0 == _mongocrypt_memequal (a + 1, b + 1, i));
+      for (j = 0; j < i; j++) {
+         b[1 + j] ^= 0x80;
+         BSON_ASSERT (1 == _mongocrypt_memequal (a + 1, b + 1, i));
+         b[1 + j] ^= 0x80;
+      }
+   }
+}
+
+
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+/* Known-answer tests for the builtin AES, run with every implementation the
+ * CPU supports. The existing McGrew vectors above cover the AEAD construction
+ * built from these. */
+static void
+_test_builtin_aes_kat (_mongocrypt_tester_t *tester)
+{
+   const _builtin_aes_impl_t impls[] = {BUILTIN_AES_IMPL_PORTABLE,
+                                        BUILTIN_AES_IMPL_AESNI};
+   _builtin_aes_256_t aes;
+   _mongocrypt_buffer_t key, iv, plaintext, ciphertext;
+   uint8_t chain[BUILTIN_AES_BLOCK_LEN];
+   uint8_t out[64];
+   size_t i;
+
+   /* Ensure CPU features are detected. */
+   mongocrypt_destroy (_mongocrypt_tester_mongocrypt ());
+
+   for (i = 0; i < sizeof (impls) / sizeof (impls[0]); i++) {
+      if (!_builtin_aes_impl_supported (impls[i])) {
+         continue;
+      }
+
+      /* FIPS-197 Appendix C.3 */
+      _mongocrypt_buffer_copy_from_hex (
+         &key,
+         "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+      _mongocrypt_buffer_copy_from_hex (&plaintext,
+                                        "00112233445566778899aabbccddeeff");
+      _mongocrypt_buffer_copy_from_hex (&ciphertext,
+                                        "8ea2b7ca516745bfeafc49904b496089");
+      _builtin_aes_256_init (&aes, key.data, impls[i]);
+      BSON_ASSERT (aes.impl == impls[i]);
+      _builtin_aes_256_ecb_encrypt (&aes, plaintext.data, out, plaintext.len);
+      BSON_ASSERT (0 == memcmp (out, ciphertext.data, ciphertext.len));
+      _builtin_aes_256_cleanup (&aes);
+      _mongocrypt_buffer_cleanup (&key);
+      _mongocrypt_buffer_cleanup (&plaintext);
+      _mongocrypt_buffer_cleanup (&ciphertext);
+
+      /* NIST SP 800-38A F.2.5 and F.2.6 */
+      _mongocrypt_buffer_copy_from_hex (
+         &key,
+         "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4");
+      _mongocrypt_buffer_copy_from_hex (&iv,
+                                        "000102030405060708090a0b0c0d0e0f");
+      _mongocrypt_buffer_copy_from_hex (
+         &plaintext,
+         "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+         "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+      _mongocrypt_buffer_copy_from_hex (
+         &ciphertext,
+         "f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d"
+         "39f23369a9d9bacfa530e26304231461b2eb05e2c39be9fcda6c19078c6a9d1b");
+      _builtin_aes_256_init (&aes, key.data, impls[i]);
+
+      memcpy (chain, iv.data, sizeof (chain));
+      _builtin_aes_256_cbc_encrypt (
+         &aes, chain, plaintext.data, out, plaintext.len);
+      BSON_ASSERT (0 == memcmp (out, ciphertext.data, ciphertext.len));
+
+      /* Decrypt in place, split across two calls to check IV chaining. */
+      memcpy (chain, iv.data, sizeof (chain));
+      _builtin_aes_256_cbc_decrypt (&aes, chain, out, out, 16);
+      _builtin_aes_256_cbc_decrypt (&aes, chain, out + 16, out + 16, 48);
+      BSON_ASSERT (0 == memcmp (out, plaintext.data, plaintext.len));
+
+      _builtin_aes_256_cleanup (&aes);
+      _mongocrypt_buffer_cleanup (&key);
+      _mongocrypt_buffer_cleanup (&iv);
+      _mongocrypt_buffer_cleanup (&plaintext);
+      _mongocrypt_buffer_cleanup (&ciphertext);
+   }
+}
+
+
+/* Checks SHA-256 and SHA-512 of @msg, hashed at once and a byte at a time. */
+static void
+_assert_sha2 (const char *msg,
+              const char *sha256_hex,
+              const char *sha512_hex)
+{
+   _builtin_sha256_t sha256;
+   _builtin_sha512_t sha512;
+   _mongocrypt_buffer_t expected;
+   uint8_t out[BUILTIN_SHA512_LEN];
+   size_t i;
+
+   _mongocrypt_buffer_copy_from_hex (&expected, sha256_hex);
+   _builtin_sha256_init (&sha256);
+   _builtin_sha256_update (&sha256, (const uint8_t *) msg, strlen (msg));
+   _builtin_sha256_final (&sha256, out);
+   BSON_ASSERT (0 == memcmp (out, expected.data, BUILTIN_SHA256_LEN));
+   _builtin_sha256_init (&sha256);
+   for (i = 0; i < strlen (msg); i++) {
+      _builtin_sha256_update (&sha256, (const uint8_t *) msg + i, 1);
+   }
+   _builtin_sha256_final (&sha256, out);
+   BSON_ASSERT (0 == memcmp (out, expected.data, BUILTIN_SHA256_LEN));
+   _mongocrypt_buffer_cleanup (&expected);
+
+   _mongocrypt_buffer_copy_from_hex (&expected, sha512_hex);
+   _builtin_sha512_init (&sha512);
+   _builtin_sha512_update (&sha512, (const uint8_t *) msg, strlen (msg));
+   _builtin_sha512_final (&sha512, out);
+   BSON_ASSERT (0 == memcmp (out, expected.data, BUILTIN_SHA512_LEN));
+   _builtin_sha512_init (&sha512);
+   for (i = 0; i < strlen (msg); i++) {
+      _builtin_sha512_update (&sha512, (const uint8_t *) msg + i, 1);
+   }
+   _builtin_sha512_final (&sha512, out);
+   BSON_ASSERT (0 == memcmp (out, expected.data, BUILTIN_SHA512_LEN));
+   _mongocrypt_buffer_cleanup (&expected);
+}
+
+
+/* Checks HMAC-SHA-256 and HMAC-SHA-512, including reuse of the keyed pads. */
+static void
+_assert_hmac_sha2 (const _mongocrypt_buffer_t *key,
+                   const char *msg,
+                   const char *hmac256_hex,
+                   const char *hmac512_hex)
+{
+   _builtin_hmac_sha256_t hmac256;
+   _builtin_hmac_sha512_t hmac512;
+   _mongocrypt_buffer_t expected;
+   uint8_t out[BUILTIN_SHA512_LEN];
+   int i;
+
+   _mongocrypt_buffer_copy_from_hex (&expected, hmac256_hex);
+   _builtin_hmac_sha256_init (&hmac256, key->data, key->len);
+   for (i = 0; i < 2; i++) {
+      _builtin_hmac_sha256_reset (&hmac256);
+      _builtin_hmac_sha256_update (
+         &hmac256, (const uint8_t *) msg, strlen (msg));
+      _builtin_hmac_sha256_final (&hmac256, out);
+      BSON_ASSERT (0 == memcmp (out, expected.data, BUILTIN_SHA256_LEN));
+   }
+   _mongocrypt_buffer_cleanup (&expected);
+
+   _mongocrypt_buffer_copy_from_hex (&expected, hmac512_hex);
+   _builtin_hmac_sha512_init (&hmac512, key->data, key->len);
+   for (i = 0; i < 2; i++) {
+      _builtin_hmac_sha512_reset (&hmac512);
+      _builtin_hmac_sha512_update (
+         &hmac512, (const uint8_t *) msg, strlen (msg));
+      _builtin_hmac_sha512_final (&hmac512, out);
+      BSON_ASSERT (0 == memcmp (out, expected.data, BUILTIN_SHA512_LEN));
+   }
+   _mongocrypt_buffer_cleanup (&expected);
+}
+
+
+/* Known-answer tests from FIPS 180-2 Appendix B/C and RFC 4231. */
+static void
+_test_builtin_sha2_kat (_mongocrypt_tester_t *tester)
+{
+   _mongocrypt_buffer_t key;
+
+   _assert_sha2 (
+      "abc",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+      "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+      "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f");
+   /* Padding spills into a second block for both hashes. */
+   _assert_sha2 (
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+      "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+      "96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445");
+   _assert_sha2 (
+      "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+      "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1",
+      "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+      "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909");
+
+   /* RFC 4231 Test Case 2 */
+   _mongocrypt_buffer_copy_from_hex (&key, "4a656665");
+   _assert_hmac_sha2 (
+      &key,
+      "what do ya want for nothing?",
+      "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+      "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+      "9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737");
+   _mongocrypt_buffer_cleanup (&key);
+
+   /* RFC 4231 Test Case 6: a key longer than the block size. */
+   _mongocrypt_buffer_init (&key);
+   _mongocrypt_buffer_resize (&key, 131);
+   memset (key.data, 0xaa, key.len);
+   _assert_hmac_sha2 (
+      &key,
+      "Test Using Larger Than Block-Size Key - Hash Key First",
+      "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+      "80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+      "6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598");
+   _mongocrypt_buffer_cleanup (&key);
+}
+#endif /* MONGOCRYPT_ENABLE_CRYPTO_BUILTIN */
+
+
 void
 _mongocrypt_tester_install_crypto (_mongocrypt_tester_t *tester)
 {
    INSTALL_TEST (_test_mcgrew);
    INSTALL_TEST (_test_roundtrip);
+   INSTALL_TEST (_test_key_state);
+   INSTALL_TEST (_test_no_intermediate_buffers);
+   INSTALL_TEST (_test_encryption_batch);
+   INSTALL_TEST (_test_decryption_batch);
+   INSTALL_TEST (_test_random_pool);
+   INSTALL_TEST (_test_memequal_constant_time);
+#ifdef MONGOCRYPT_ENABLE_CRYPTO_BUILTIN
+   INSTALL_TEST (_test_builtin_aes_kat);
+   INSTALL_TEST (_test_builtin_sha2_kat);
+#endif
 }
\ No newline at end of file
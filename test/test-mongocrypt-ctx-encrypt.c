@@ -873,7 +873,7 @@ _test_encrypt_caches_collinfo (_mongocrypt_tester_t *tester)
 {
    mongocrypt_t *crypt;
    mongocrypt_ctx_t *ctx;
-   bson_t *cached_collinfo;
+   _mongocrypt_cache_collinfo_value_t *cached_collinfo;
    mongocrypt_status_t *status;
 
    crypt = _mongocrypt_tester_mongocrypt ();
@@ -894,7 +894,9 @@ _test_encrypt_caches_collinfo (_mongocrypt_tester_t *tester)
    BSON_ASSERT (_mongocrypt_cache_get (
       &crypt->cache_collinfo, "test.test", (void **) &cached_collinfo));
    BSON_ASSERT (cached_collinfo != NULL);
-   bson_destroy (cached_collinfo);
+   BSON_ASSERT (!_mongocrypt_buffer_empty (&cached_collinfo->schema));
+   BSON_ASSERT (cached_collinfo->requires_encryption);
+   _mongocrypt_cache_collinfo_value_destroy (cached_collinfo);
    mongocrypt_ctx_destroy (ctx);
 
    /* The next context enters the NEED_MONGO_MARKINGS state immediately. */
@@ -911,6 +913,53 @@ _test_encrypt_caches_collinfo (_mongocrypt_tester_t *tester)
 }
 
 
+static void
+_test_encrypt_caches_no_encryption_needed (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_binary_t *cmd;
+   mongocrypt_binary_t *out;
+   _mongocrypt_cache_collinfo_value_t *cached_collinfo;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   cmd = TEST_FILE ("./test/example/cmd.json");
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_encrypt_init (ctx, "test", -1, cmd), ctx);
+   _mongocrypt_tester_run_ctx_to (
+      tester, ctx, MONGOCRYPT_CTX_NEED_MONGO_MARKINGS);
+   ASSERT_OK (
+      mongocrypt_ctx_mongo_feed (
+         ctx,
+         TEST_FILE ("./test/data/mongocryptd-reply-no-encryption-needed.json")),
+      ctx);
+   ASSERT_OK (mongocrypt_ctx_mongo_done (ctx), ctx);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_READY);
+   mongocrypt_ctx_destroy (ctx);
+
+   /* The cached collinfo records that no encryption is needed. */
+   BSON_ASSERT (_mongocrypt_cache_get (
+      &crypt->cache_collinfo, "test.test", (void **) &cached_collinfo));
+   BSON_ASSERT (cached_collinfo != NULL);
+   BSON_ASSERT (!cached_collinfo->requires_encryption);
+   BSON_ASSERT (!_mongocrypt_buffer_empty (&cached_collinfo->schema));
+   _mongocrypt_cache_collinfo_value_destroy (cached_collinfo);
+
+   /* The next context skips mongocryptd and returns the original command. */
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_encrypt_init (ctx, "test", -1, cmd), ctx);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_READY);
+   out = mongocrypt_binary_new ();
+   ASSERT_OK (mongocrypt_ctx_finalize (ctx, out), ctx);
+   _assert_bin_bson_equal (out, cmd);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_DONE);
+   mongocrypt_binary_destroy (out);
+   mongocrypt_ctx_destroy (ctx);
+
+   mongocrypt_destroy (crypt);
+}
+
+
 static void
 _test_encrypt_caches_keys (_mongocrypt_tester_t *tester)
 {
@@ -1363,6 +1412,333 @@ _test_explicit_encryption (_mongocrypt_tester_t *tester)
    mongocrypt_destroy (crypt);
 }
 
+static void
+_explicit_encrypt_deterministic (_mongocrypt_tester_t *tester,
+                                 mongocrypt_t *crypt,
+                                 _mongocrypt_buffer_t *out)
+{
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_binary_t *bin;
+
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Deterministic", -1),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_alt_name (
+                 ctx, TEST_BSON ("{'keyAltName': 'keyDocumentName'}")),
+              ctx);
+   ASSERT_OK (
+      mongocrypt_ctx_explicit_encrypt_init (ctx, TEST_BSON ("{'v': 123}")),
+      ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+   bin = mongocrypt_binary_new ();
+   ASSERT_OK (mongocrypt_ctx_finalize (ctx, bin), ctx);
+   _mongocrypt_buffer_copy_from_binary (out, bin);
+   mongocrypt_binary_destroy (bin);
+   mongocrypt_ctx_destroy (ctx);
+}
+
+
+static void
+_test_explicit_encryption_deterministic_cache (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   _mongocrypt_buffer_t uncached, miss, hit;
+   _mongocrypt_cache_stats_t stats;
+
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_deterministic_cache_size (crypt, 4), crypt);
+   mongocrypt_destroy (crypt);
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   ASSERT_FAILS (mongocrypt_setopt_deterministic_cache_size (crypt, 4),
+                 crypt,
+                 "options cannot be set after initialization");
+
+   /* The cache is disabled by default. */
+   _explicit_encrypt_deterministic (tester, crypt, &uncached);
+   BSON_ASSERT (
+      0 == _mongocrypt_cache_deterministic_num_entries (
+              &crypt->cache_deterministic));
+
+   _mongocrypt_cache_deterministic_set_max_entries (
+      &crypt->cache_deterministic, 4);
+   _explicit_encrypt_deterministic (tester, crypt, &miss);
+   _explicit_encrypt_deterministic (tester, crypt, &hit);
+   _mongocrypt_cache_deterministic_stats (&crypt->cache_deterministic, &stats);
+   BSON_ASSERT (stats.hits == 1);
+   BSON_ASSERT (stats.misses == 1);
+   BSON_ASSERT (
+      1 == _mongocrypt_cache_deterministic_num_entries (
+              &crypt->cache_deterministic));
+
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&uncached, &miss));
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&uncached, &hit));
+
+   _mongocrypt_buffer_cleanup (&uncached);
+   _mongocrypt_buffer_cleanup (&miss);
+   _mongocrypt_buffer_cleanup (&hit);
+   mongocrypt_destroy (crypt);
+}
+
+/* Streams @value, the bytes of a BSON value, through @ctx in pieces of at most
+ * @piece_len bytes, and appends the output to @out. */
+static bool
+_stream_pieces (mongocrypt_ctx_t *ctx,
+                const uint8_t *value,
+                uint32_t value_len,
+                uint32_t piece_len,
+                _mongocrypt_buffer_t *out)
+{
+   mongocrypt_binary_t *in, *bin;
+   uint32_t offset, n;
+   bool ret = true;
+
+   bin = mongocrypt_binary_new ();
+   for (offset = 0; ret && offset < value_len; offset += n) {
+      n = value_len - offset;
+      if (n > piece_len) {
+         n = piece_len;
+      }
+      in = mongocrypt_binary_new_from_data ((uint8_t *) value + offset, n);
+      ret = mongocrypt_ctx_stream_update (ctx, in, bin);
+      if (ret) {
+         memcpy (_mongocrypt_buffer_append_space (out, bin->len),
+                 bin->data,
+                 bin->len);
+      }
+      mongocrypt_binary_destroy (in);
+   }
+   if (ret) {
+      ret = mongocrypt_ctx_stream_finalize (ctx, bin);
+   }
+   if (ret) {
+      memcpy (_mongocrypt_buffer_append_space (out, bin->len),
+              bin->data,
+              bin->len);
+      BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_DONE);
+   }
+   mongocrypt_binary_destroy (bin);
+   return ret;
+}
+
+
+static mongocrypt_ctx_t *
+_explicit_encrypt_stream_ctx (_mongocrypt_tester_t *tester,
+                              mongocrypt_t *crypt,
+                              uint8_t bson_type)
+{
+   mongocrypt_ctx_t *ctx;
+
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Random", -1),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_alt_name (
+                 ctx, TEST_BSON ("{'keyAltName': 'keyDocumentName'}")),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_explicit_encrypt_stream_init (ctx, bson_type),
+              ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+   return ctx;
+}
+
+
+/* Decrypts @payload, the data of a BSON binary subtype 6, passing @first_len
+ * bytes to init. */
+static bool
+_explicit_decrypt_stream (_mongocrypt_tester_t *tester,
+                          mongocrypt_t *crypt,
+                          const _mongocrypt_buffer_t *payload,
+                          uint32_t first_len,
+                          uint32_t piece_len,
+                          _mongocrypt_buffer_t *out,
+                          mongocrypt_status_t *status)
+{
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_binary_t *first;
+   bool ret;
+
+   ctx = mongocrypt_ctx_new (crypt);
+   first = mongocrypt_binary_new_from_data (payload->data, first_len);
+   ASSERT_OK (mongocrypt_ctx_explicit_decrypt_stream_init (ctx, first), ctx);
+   mongocrypt_binary_destroy (first);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+   ret = _stream_pieces (ctx,
+                         payload->data + first_len,
+                         payload->len - first_len,
+                         piece_len,
+                         out);
+   mongocrypt_ctx_status (ctx, status);
+   mongocrypt_ctx_destroy (ctx);
+   return ret;
+}
+
+
+static void
+_test_explicit_encrypt_stream (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_status_t *status;
+   mongocrypt_binary_t *bin;
+   _mongocrypt_buffer_t value, payload, decrypted, wrapped;
+   bson_t doc, encrypted;
+   bson_iter_t iter;
+   char *str;
+   uint32_t piece_lens[] = {1, 7, 16, 100, 5000};
+   uint32_t i;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   status = mongocrypt_status_new ();
+
+   str = bson_malloc (1001);
+   memset (str, 'a', 1000);
+   str[1000] = '\0';
+   bson_init (&doc);
+   BSON_APPEND_UTF8 (&doc, "v", str);
+   BSON_ASSERT (bson_iter_init_find (&iter, &doc, "v"));
+   _mongocrypt_buffer_from_iter (&value, &iter);
+
+   for (i = 0; i < sizeof (piece_lens) / sizeof (piece_lens[0]); i++) {
+      _mongocrypt_buffer_init (&payload);
+      ctx = _explicit_encrypt_stream_ctx (tester, crypt, BSON_TYPE_UTF8);
+      ASSERT_OK (
+         _stream_pieces (ctx, value.data, value.len, piece_lens[i], &payload),
+         ctx);
+      mongocrypt_ctx_destroy (ctx);
+      BSON_ASSERT (payload.len ==
+                   18 + _mongocrypt_calculate_ciphertext_len (value.len));
+
+      /* The output is the same format as explicit encryption. */
+      bson_init (&encrypted);
+      bson_append_binary (&encrypted,
+                          "v",
+                          1,
+                          (bson_subtype_t) 6,
+                          payload.data,
+                          payload.len);
+      ctx = mongocrypt_ctx_new (crypt);
+      ASSERT_OK (mongocrypt_ctx_explicit_decrypt_init (
+                    ctx,
+                    mongocrypt_binary_new_from_data (
+                       (uint8_t *) bson_get_data (&encrypted), encrypted.len)),
+                 ctx);
+      _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+      bin = mongocrypt_binary_new ();
+      ASSERT_OK (mongocrypt_ctx_finalize (ctx, bin), ctx);
+      _assert_bin_bson_equal (
+         bin,
+         mongocrypt_binary_new_from_data ((uint8_t *) bson_get_data (&doc),
+                                          doc.len));
+      mongocrypt_binary_destroy (bin);
+      mongocrypt_ctx_destroy (ctx);
+      bson_destroy (&encrypted);
+
+      /* And decrypts in pieces. */
+      _mongocrypt_buffer_init (&decrypted);
+      ASSERT_OR_PRINT (_explicit_decrypt_stream (tester,
+                                                 crypt,
+                                                 &payload,
+                                                 19 + i,
+                                                 piece_lens[i],
+                                                 &decrypted,
+                                                 status),
+                       status);
+      BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&decrypted, &value));
+      _mongocrypt_buffer_cleanup (&decrypted);
+
+      /* Any change to the ciphertext fails to authenticate. */
+      payload.data[18 + 16 * i] ^= 1;
+      _mongocrypt_buffer_init (&decrypted);
+      BSON_ASSERT (!_explicit_decrypt_stream (
+         tester, crypt, &payload, 19, piece_lens[i], &decrypted, status));
+      ASSERT_STATUS_CONTAINS (status, "HMAC validation failure");
+      _mongocrypt_buffer_cleanup (&decrypted);
+      _mongocrypt_buffer_cleanup (&payload);
+   }
+
+   /* Ciphertexts from explicit encryption decrypt in pieces. */
+   _explicit_encrypt_deterministic (tester, crypt, &wrapped);
+   BSON_ASSERT (_mongocrypt_buffer_to_bson (&wrapped, &encrypted));
+   BSON_ASSERT (bson_iter_init_find (&iter, &encrypted, "v"));
+   BSON_ASSERT (_mongocrypt_buffer_from_binary_iter (&payload, &iter));
+   _mongocrypt_buffer_init (&decrypted);
+   ASSERT_OR_PRINT (_explicit_decrypt_stream (
+                       tester, crypt, &payload, 19, 5, &decrypted, status),
+                    status);
+   BSON_ASSERT (decrypted.len == 4);
+   BSON_ASSERT (0 == memcmp (decrypted.data, "\x7B\x00\x00\x00", 4));
+   _mongocrypt_buffer_cleanup (&decrypted);
+   _mongocrypt_buffer_cleanup (&wrapped);
+
+   /* The value must match its length prefix. */
+   ctx = _explicit_encrypt_stream_ctx (tester, crypt, BSON_TYPE_UTF8);
+   _mongocrypt_buffer_init (&payload);
+   BSON_ASSERT (
+      !_stream_pieces (ctx, value.data, value.len - 1, 100, &payload));
+   ASSERT_FAILS_STATUS (mongocrypt_ctx_status (ctx, status),
+                        status,
+                        "streamed value does not match its length prefix");
+   _mongocrypt_buffer_cleanup (&payload);
+   mongocrypt_ctx_destroy (ctx);
+
+   /* Only the random algorithm and string or binary values are supported. */
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Deterministic", -1),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_alt_name (
+                 ctx, TEST_BSON ("{'keyAltName': 'keyDocumentName'}")),
+              ctx);
+   ASSERT_FAILS (
+      mongocrypt_ctx_explicit_encrypt_stream_init (ctx, BSON_TYPE_UTF8),
+      ctx,
+      "streaming encryption requires the random algorithm");
+   mongocrypt_ctx_destroy (ctx);
+
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Random", -1),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_alt_name (
+                 ctx, TEST_BSON ("{'keyAltName': 'keyDocumentName'}")),
+              ctx);
+   ASSERT_FAILS (
+      mongocrypt_ctx_explicit_encrypt_stream_init (ctx, BSON_TYPE_INT32),
+      ctx,
+      "streaming encryption requires a string or binary value");
+   mongocrypt_ctx_destroy (ctx);
+
+   /* Streaming and non-streaming contexts do not mix. */
+   ctx = _explicit_encrypt_stream_ctx (tester, crypt, BSON_TYPE_UTF8);
+   bin = mongocrypt_binary_new ();
+   ASSERT_FAILS (
+      mongocrypt_ctx_finalize (ctx, bin), ctx, "not applicable to context");
+   mongocrypt_ctx_destroy (ctx);
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Random", -1),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_alt_name (
+                 ctx, TEST_BSON ("{'keyAltName': 'keyDocumentName'}")),
+              ctx);
+   ASSERT_OK (
+      mongocrypt_ctx_explicit_encrypt_init (ctx, TEST_BSON ("{'v': 'abc'}")),
+      ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_READY);
+   ASSERT_FAILS (mongocrypt_ctx_stream_finalize (ctx, bin),
+                 ctx,
+                 "not applicable to context");
+   mongocrypt_ctx_destroy (ctx);
+   mongocrypt_binary_destroy (bin);
+
+   bson_destroy (&doc);
+   bson_free (str);
+   mongocrypt_status_destroy (status);
+   mongocrypt_destroy (crypt);
+}
+
 /* Test with empty AWS credentials. */
 void
 _test_encrypt_empty_aws (_mongocrypt_tester_t *tester)
@@ -1460,6 +1836,165 @@ _test_encrypt_with_aws_session_token (_mongocrypt_tester_t *tester)
    mongocrypt_destroy (crypt);
 }
 
+/* Test fetching the keys of the schema while mongocryptd marks the command. */
+static void
+_test_encrypt_prefetch_keys (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *ctx, *prefetch;
+   mongocrypt_binary_t *out;
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_coalesce_key_fetches (crypt, true), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_encrypt_init (
+                 ctx, "test", -1, TEST_FILE ("./test/example/cmd.json")),
+              ctx);
+
+   /* Not until the schema is known. */
+   prefetch = mongocrypt_ctx_new (crypt);
+   ASSERT_FAILS (mongocrypt_ctx_prefetch_keys_init (prefetch, ctx),
+                 prefetch,
+                 "must be in MONGOCRYPT_CTX_NEED_MONGO_MARKINGS");
+   mongocrypt_ctx_destroy (prefetch);
+
+   _mongocrypt_tester_run_ctx_to (
+      tester, ctx, MONGOCRYPT_CTX_NEED_MONGO_MARKINGS);
+   prefetch = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_prefetch_keys_init (prefetch, ctx), prefetch);
+   BSON_ASSERT (mongocrypt_ctx_state (prefetch) ==
+                MONGOCRYPT_CTX_NEED_MONGO_KEYS);
+   _mongocrypt_tester_run_ctx_to (tester, prefetch, MONGOCRYPT_CTX_NEED_KMS);
+
+   /* The key requested by the markings is already being fetched. */
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_KEYS_PENDING);
+   _mongocrypt_tester_run_ctx_to (tester, prefetch, MONGOCRYPT_CTX_READY);
+   out = mongocrypt_binary_new ();
+   ASSERT_OK (mongocrypt_ctx_finalize (prefetch, out), prefetch);
+   BSON_ASSERT (mongocrypt_binary_len (out) == 5);
+   mongocrypt_binary_destroy (out);
+   BSON_ASSERT (mongocrypt_ctx_state (prefetch) == MONGOCRYPT_CTX_DONE);
+   mongocrypt_ctx_destroy (prefetch);
+
+   ASSERT_OK (mongocrypt_ctx_check_pending_keys (ctx), ctx);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_READY);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_DONE);
+   mongocrypt_ctx_destroy (ctx);
+
+   /* With all keys cached, the prefetch has nothing to do. */
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_encrypt_init (
+                 ctx, "test", -1, TEST_FILE ("./test/example/cmd.json")),
+              ctx);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) ==
+                MONGOCRYPT_CTX_NEED_MONGO_MARKINGS);
+   prefetch = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_prefetch_keys_init (prefetch, ctx), prefetch);
+   BSON_ASSERT (mongocrypt_ctx_state (prefetch) == MONGOCRYPT_CTX_READY);
+   mongocrypt_ctx_destroy (prefetch);
+   mongocrypt_ctx_destroy (ctx);
+
+   mongocrypt_destroy (crypt);
+}
+
+
+static mongocrypt_ctx_t *
+_explicit_encrypt_with_key_id (_mongocrypt_tester_t *tester,
+                               mongocrypt_t *crypt,
+                               uint8_t *key_id_data)
+{
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_binary_t *key_id;
+
+   key_id = mongocrypt_binary_new_from_data (key_id_data, 16);
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_id (ctx, key_id), ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Random", -1),
+              ctx);
+   ASSERT_OK (
+      mongocrypt_ctx_explicit_encrypt_init (ctx, TEST_BSON ("{'v': 123}")),
+      ctx);
+   mongocrypt_binary_destroy (key_id);
+   return ctx;
+}
+
+/* Test that contexts needing different keys wait for a batch, and the context
+ * that fills it fetches the keys of both. */
+static void
+_test_encrypt_key_fetch_batch (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *waiting, *fetching;
+   mongocrypt_kms_ctx_t *kms;
+   mongocrypt_binary_t *filter;
+   uint8_t key_id_a[16];
+   uint8_t key_id_b[16] = {0};
+   bson_t as_bson;
+   bson_iter_t iter;
+   bson_iter_t ids;
+   int num_ids;
+   int num_kms;
+
+   /* The ids of test/example/key-document.json and
+    * test/data/key-document-full.json. */
+   memset (key_id_a, 'a', sizeof (key_id_a));
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_key_fetch_batch (crypt, 60 * 60 * 1000, 2),
+              crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+
+   waiting = _explicit_encrypt_with_key_id (tester, crypt, key_id_a);
+   BSON_ASSERT (mongocrypt_ctx_state (waiting) == MONGOCRYPT_CTX_KEYS_PENDING);
+   ASSERT_OK (mongocrypt_ctx_check_pending_keys (waiting), waiting);
+   BSON_ASSERT (mongocrypt_ctx_state (waiting) == MONGOCRYPT_CTX_KEYS_PENDING);
+
+   /* The second key fills the batch. The filter matches both keys. */
+   fetching = _explicit_encrypt_with_key_id (tester, crypt, key_id_b);
+   BSON_ASSERT (mongocrypt_ctx_state (fetching) ==
+                MONGOCRYPT_CTX_NEED_MONGO_KEYS);
+   filter = mongocrypt_binary_new ();
+   ASSERT_OK (mongocrypt_ctx_mongo_op (fetching, filter), fetching);
+   BSON_ASSERT (_mongocrypt_binary_to_bson (filter, &as_bson));
+   BSON_ASSERT (bson_iter_init (&iter, &as_bson));
+   BSON_ASSERT (bson_iter_find_descendant (&iter, "$or.0._id.$in", &iter));
+   BSON_ASSERT (bson_iter_recurse (&iter, &ids));
+   for (num_ids = 0; bson_iter_next (&ids); num_ids++)
+      ;
+   BSON_ASSERT (num_ids == 2);
+   mongocrypt_binary_destroy (filter);
+
+   ASSERT_OK (mongocrypt_ctx_mongo_feed (
+                 fetching, TEST_FILE ("./test/example/key-document.json")),
+              fetching);
+   ASSERT_OK (mongocrypt_ctx_mongo_feed (
+                 fetching, TEST_FILE ("./test/data/key-document-full.json")),
+              fetching);
+   ASSERT_OK (mongocrypt_ctx_mongo_done (fetching), fetching);
+   BSON_ASSERT (mongocrypt_ctx_state (fetching) == MONGOCRYPT_CTX_NEED_KMS);
+   num_kms = 0;
+   while ((kms = mongocrypt_ctx_next_kms_ctx (fetching))) {
+      _mongocrypt_tester_satisfy_kms (tester, kms);
+      num_kms++;
+   }
+   BSON_ASSERT (num_kms == 2);
+   ASSERT_OK (mongocrypt_ctx_kms_done (fetching), fetching);
+   _mongocrypt_tester_run_ctx_to (tester, fetching, MONGOCRYPT_CTX_DONE);
+
+   /* The waiting context finds its key in the cache. */
+   ASSERT_OK (mongocrypt_ctx_check_pending_keys (waiting), waiting);
+   BSON_ASSERT (mongocrypt_ctx_state (waiting) == MONGOCRYPT_CTX_READY);
+   _mongocrypt_tester_run_ctx_to (tester, waiting, MONGOCRYPT_CTX_DONE);
+
+   mongocrypt_ctx_destroy (fetching);
+   mongocrypt_ctx_destroy (waiting);
+   mongocrypt_destroy (crypt);
+}
+
+
 void
 _mongocrypt_tester_install_ctx_encrypt (_mongocrypt_tester_t *tester)
 {
@@ -1473,6 +2008,7 @@ _mongocrypt_tester_install_ctx_encrypt (_mongocrypt_tester_t *tester)
    INSTALL_TEST (_test_view);
    INSTALL_TEST (_test_local_schema);
    INSTALL_TEST (_test_encrypt_caches_collinfo);
+   INSTALL_TEST (_test_encrypt_caches_no_encryption_needed);
    INSTALL_TEST (_test_encrypt_caches_keys);
    INSTALL_TEST (_test_encrypt_caches_keys_by_alt_name);
    INSTALL_TEST (_test_encrypt_random);
@@ -1482,7 +2018,11 @@ _mongocrypt_tester_install_ctx_encrypt (_mongocrypt_tester_t *tester)
    INSTALL_TEST (_test_encrypt_dupe_jsonschema);
    INSTALL_TEST (_test_encrypting_with_explicit_encryption);
    INSTALL_TEST (_test_explicit_encryption);
+   INSTALL_TEST (_test_explicit_encryption_deterministic_cache);
+   INSTALL_TEST (_test_explicit_encrypt_stream);
    INSTALL_TEST (_test_encrypt_empty_aws);
    INSTALL_TEST (_test_encrypt_custom_endpoint);
    INSTALL_TEST (_test_encrypt_with_aws_session_token);
+   INSTALL_TEST (_test_encrypt_prefetch_keys);
+   INSTALL_TEST (_test_encrypt_key_fetch_batch);
 }
@@ -17,6 +17,7 @@
 #include "mongocrypt.h"
 #include "mongocrypt-key-broker-private.h"
 #include "mongocrypt-key-private.h"
+#include "mongocrypt-marking-private.h"
 #include "test-mongocrypt.h"
 
 /* Given a string, populate a bson_value_t for that string */
@@ -618,6 +619,536 @@ _test_key_broker_multi_match (_mongocrypt_tester_t *tester)
    mongocrypt_status_destroy (status);
 }
 
+/* Requests, key documents, and lookups of many keys are indexed. */
+#define MANY_KEYS 200
+
+static void
+_test_key_broker_many_keys (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   _mongocrypt_key_broker_t key_broker;
+   _mongocrypt_buffer_t key_ids[MANY_KEYS];
+   _mongocrypt_buffer_t key_docs[MANY_KEYS];
+   _mongocrypt_buffer_t key_material;
+   _mongocrypt_buffer_t key_id_out;
+   mongocrypt_kms_ctx_t *kms;
+   bson_value_t key_name;
+   char altname[16];
+   uint32_t i;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   _mongocrypt_key_broker_init (&key_broker, crypt);
+   for (i = 0; i < MANY_KEYS; i++) {
+      bson_snprintf (altname, sizeof (altname), "key%u", i);
+      _gen_uuid_and_key_and_altname (
+         tester, altname, (uint8_t) i, &key_ids[i], &key_docs[i]);
+      /* Request each key twice, by id or by name. */
+      if (i % 2) {
+         ASSERT_OK (
+            _mongocrypt_key_broker_request_id (&key_broker, &key_ids[i]),
+            &key_broker);
+         ASSERT_OK (
+            _mongocrypt_key_broker_request_id (&key_broker, &key_ids[i]),
+            &key_broker);
+      } else {
+         _key_broker_add_name (&key_broker, altname);
+         _key_broker_add_name (&key_broker, altname);
+      }
+   }
+   BSON_ASSERT (0 == _key_broker_num_satisfied (&key_broker));
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&key_broker), &key_broker);
+
+   for (i = 0; i < MANY_KEYS; i++) {
+      ASSERT_OK (_mongocrypt_key_broker_add_doc (&key_broker, &key_docs[i]),
+                 &key_broker);
+      BSON_ASSERT (i + 1 == _key_broker_num_satisfied (&key_broker));
+   }
+   ASSERT_FAILS (_mongocrypt_key_broker_add_doc (&key_broker, &key_docs[0]),
+                 &key_broker,
+                 "keys returned have duplicate keyAltNames or _id");
+   _mongocrypt_key_broker_cleanup (&key_broker);
+
+   /* Run to completion and look every key up. */
+   _mongocrypt_key_broker_init (&key_broker, crypt);
+   for (i = 0; i < MANY_KEYS; i++) {
+      ASSERT_OK (_mongocrypt_key_broker_request_id (&key_broker, &key_ids[i]),
+                 &key_broker);
+   }
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&key_broker), &key_broker);
+   for (i = 0; i < MANY_KEYS; i++) {
+      ASSERT_OK (_mongocrypt_key_broker_add_doc (&key_broker, &key_docs[i]),
+                 &key_broker);
+   }
+   ASSERT_OK (_mongocrypt_key_broker_docs_done (&key_broker), &key_broker);
+   while ((kms = _mongocrypt_key_broker_next_kms (&key_broker))) {
+      _mongocrypt_tester_satisfy_kms (tester, kms);
+   }
+   ASSERT_OK (_mongocrypt_key_broker_kms_done (&key_broker), &key_broker);
+   for (i = 0; i < MANY_KEYS; i++) {
+      ASSERT_OK (_mongocrypt_key_broker_decrypted_key_by_id (
+                    &key_broker, &key_ids[i], &key_material),
+                 &key_broker);
+      BSON_ASSERT (key_material.len == MONGOCRYPT_KEY_LEN);
+      _mongocrypt_buffer_cleanup (&key_material);
+
+      bson_snprintf (altname, sizeof (altname), "key%u", i);
+      _bson_value_from_string (altname, &key_name);
+      ASSERT_OK (_mongocrypt_key_broker_decrypted_key_by_name (
+                    &key_broker, &key_name, &key_material, &key_id_out),
+                 &key_broker);
+      BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&key_id_out, &key_ids[i]));
+      _mongocrypt_buffer_cleanup (&key_material);
+      _mongocrypt_buffer_cleanup (&key_id_out);
+      bson_value_destroy (&key_name);
+   }
+   _mongocrypt_key_broker_cleanup (&key_broker);
+
+   for (i = 0; i < MANY_KEYS; i++) {
+      _mongocrypt_buffer_cleanup (&key_ids[i]);
+      _mongocrypt_buffer_cleanup (&key_docs[i]);
+   }
+   mongocrypt_destroy (crypt);
+}
+
+/* Run a key broker that claimed its keys to completion. */
+static void
+_key_broker_fetch (_mongocrypt_tester_t *tester,
+                   _mongocrypt_key_broker_t *kb,
+                   _mongocrypt_buffer_t *key_doc)
+{
+   mongocrypt_kms_ctx_t *kms;
+
+   BSON_ASSERT (kb->state == KB_ADDING_DOCS);
+   ASSERT_OK (_mongocrypt_key_broker_add_doc (kb, key_doc), kb);
+   ASSERT_OK (_mongocrypt_key_broker_docs_done (kb), kb);
+   kms = _mongocrypt_key_broker_next_kms (kb);
+   BSON_ASSERT (kms);
+   _mongocrypt_tester_satisfy_kms (tester, kms);
+   BSON_ASSERT (!_mongocrypt_key_broker_next_kms (kb));
+   ASSERT_OK (_mongocrypt_key_broker_kms_done (kb), kb);
+   BSON_ASSERT (kb->state == KB_DONE);
+}
+
+
+static void
+_test_key_broker_coalesce (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   _mongocrypt_buffer_t key_id1, key_id2, key_doc1, key_doc2;
+   _mongocrypt_key_broker_t fetching, waiting, other, retrying;
+
+   _gen_uuid_and_key (tester, 1, &key_id1, &key_doc1);
+   _gen_uuid_and_key (tester, 2, &key_id2, &key_doc2);
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_coalesce_key_fetches (crypt, true), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+
+   /* Only the first key broker to miss on a key fetches it. */
+   _mongocrypt_key_broker_init (&fetching, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&fetching, &key_id1),
+              &fetching);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&fetching), &fetching);
+   BSON_ASSERT (fetching.state == KB_ADDING_DOCS);
+
+   _mongocrypt_key_broker_init (&waiting, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&waiting, &key_id1),
+              &waiting);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&waiting), &waiting);
+   BSON_ASSERT (waiting.state == KB_KEYS_PENDING);
+   ASSERT_OK (_mongocrypt_key_broker_check_pending (&waiting), &waiting);
+   BSON_ASSERT (waiting.state == KB_KEYS_PENDING);
+
+   /* Different keys are fetched independently. */
+   _mongocrypt_key_broker_init (&other, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&other, &key_id2), &other);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&other), &other);
+   BSON_ASSERT (other.state == KB_ADDING_DOCS);
+
+   /* The waiting key broker picks the key up from the cache. */
+   _key_broker_fetch (tester, &fetching, &key_doc1);
+   ASSERT_OK (_mongocrypt_key_broker_check_pending (&waiting), &waiting);
+   BSON_ASSERT (waiting.state == KB_DONE);
+   BSON_ASSERT (waiting.keys_cached);
+   BSON_ASSERT (!waiting.keys_returned);
+   _mongocrypt_key_broker_cleanup (&fetching);
+   _mongocrypt_key_broker_cleanup (&waiting);
+   _mongocrypt_key_broker_cleanup (&other);
+
+   ASSERT_FAILS (mongocrypt_setopt_coalesce_key_fetches (crypt, false),
+                 crypt,
+                 "options cannot be set after initialization");
+   BSON_ASSERT (crypt->opts.coalesce_key_fetches);
+
+   /* A key broker waiting on two keys claims neither while one is being
+    * fetched. Once the fetching key broker gives up, it claims both. */
+   mongocrypt_destroy (crypt);
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_coalesce_key_fetches (crypt, true), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   _mongocrypt_key_broker_init (&retrying, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&retrying, &key_id1),
+              &retrying);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&retrying, &key_id2),
+              &retrying);
+   _mongocrypt_key_broker_init (&fetching, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&fetching, &key_id2),
+              &fetching);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&fetching), &fetching);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&retrying), &retrying);
+   BSON_ASSERT (retrying.state == KB_KEYS_PENDING);
+
+   _mongocrypt_key_broker_init (&waiting, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&waiting, &key_id1),
+              &waiting);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&waiting), &waiting);
+   BSON_ASSERT (waiting.state == KB_ADDING_DOCS);
+   _mongocrypt_key_broker_cleanup (&waiting);
+
+   _mongocrypt_key_broker_cleanup (&fetching);
+   ASSERT_OK (_mongocrypt_key_broker_check_pending (&retrying), &retrying);
+   BSON_ASSERT (retrying.state == KB_ADDING_DOCS);
+   _mongocrypt_key_broker_cleanup (&retrying);
+
+   _mongocrypt_buffer_cleanup (&key_id1);
+   _mongocrypt_buffer_cleanup (&key_doc1);
+   _mongocrypt_buffer_cleanup (&key_id2);
+   _mongocrypt_buffer_cleanup (&key_doc2);
+   mongocrypt_destroy (crypt);
+}
+
+
+static void
+_test_key_broker_batch (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   _mongocrypt_buffer_t key_id1, key_id2, key_id3, key_id4;
+   _mongocrypt_buffer_t key_doc1, key_doc2, key_doc3, key_doc4;
+   _mongocrypt_key_broker_t first, second, third;
+   mongocrypt_kms_ctx_t *kms;
+
+   _gen_uuid_and_key (tester, 1, &key_id1, &key_doc1);
+   _gen_uuid_and_key (tester, 2, &key_id2, &key_doc2);
+   _gen_uuid_and_key (tester, 3, &key_id3, &key_doc3);
+   _gen_uuid_and_key (tester, 4, &key_id4, &key_doc4);
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_FAILS (mongocrypt_setopt_key_fetch_batch (crypt, 0, 0),
+                 crypt,
+                 "max_keys must be positive");
+   ASSERT_OK (mongocrypt_setopt_key_fetch_batch (crypt, 60 * 60 * 1000, 2),
+              crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   ASSERT_FAILS (mongocrypt_setopt_key_fetch_batch (crypt, 0, 1),
+                 crypt,
+                 "options cannot be set after initialization");
+   /* Batched contexts wait on the batch like on coalesced fetches. */
+   BSON_ASSERT (crypt->opts.coalesce_key_fetches);
+   BSON_ASSERT (crypt->opts.key_fetch_batch_window_ms == 60 * 60 * 1000);
+   BSON_ASSERT (crypt->opts.key_fetch_batch_max_keys == 2);
+
+   /* The key broker filling the batch fetches the keys of both. */
+   _mongocrypt_key_broker_init (&first, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&first, &key_id1), &first);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&first), &first);
+   BSON_ASSERT (first.state == KB_KEYS_PENDING);
+   ASSERT_OK (_mongocrypt_key_broker_check_pending (&first), &first);
+   BSON_ASSERT (first.state == KB_KEYS_PENDING);
+
+   _mongocrypt_key_broker_init (&second, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&second, &key_id2), &second);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&second), &second);
+   BSON_ASSERT (second.state == KB_ADDING_DOCS);
+   ASSERT_OK (_mongocrypt_key_broker_add_doc (&second, &key_doc1), &second);
+   ASSERT_OK (_mongocrypt_key_broker_add_doc (&second, &key_doc2), &second);
+   ASSERT_OK (_mongocrypt_key_broker_docs_done (&second), &second);
+   while ((kms = _mongocrypt_key_broker_next_kms (&second))) {
+      _mongocrypt_tester_satisfy_kms (tester, kms);
+   }
+   ASSERT_OK (_mongocrypt_key_broker_kms_done (&second), &second);
+
+   ASSERT_OK (_mongocrypt_key_broker_check_pending (&first), &first);
+   BSON_ASSERT (first.state == KB_DONE);
+   BSON_ASSERT (first.keys_cached);
+   BSON_ASSERT (!first.keys_returned);
+   _mongocrypt_key_broker_cleanup (&first);
+   _mongocrypt_key_broker_cleanup (&second);
+
+   /* A key of the batch missing from the key vault is not an error for the
+    * key broker fetching the batch. The key broker needing it fetches it
+    * once the batch is done. */
+   _mongocrypt_key_broker_init (&first, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&first, &key_id3), &first);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&first), &first);
+   BSON_ASSERT (first.state == KB_KEYS_PENDING);
+
+   /* Cached keys do not join the batch. */
+   _mongocrypt_key_broker_init (&third, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&third, &key_id1), &third);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&third), &third);
+   BSON_ASSERT (third.state == KB_DONE);
+   _mongocrypt_key_broker_cleanup (&third);
+
+   _mongocrypt_key_broker_init (&second, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&second, &key_id4), &second);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&second), &second);
+   BSON_ASSERT (second.state == KB_ADDING_DOCS);
+   _key_broker_fetch (tester, &second, &key_doc4);
+
+   ASSERT_OK (_mongocrypt_key_broker_check_pending (&first), &first);
+   BSON_ASSERT (first.state == KB_ADDING_DOCS);
+   ASSERT_FAILS (_mongocrypt_key_broker_docs_done (&first),
+                 &first,
+                 "not all keys requested were satisfied");
+   _mongocrypt_key_broker_cleanup (&first);
+   _mongocrypt_key_broker_cleanup (&second);
+
+   _mongocrypt_buffer_cleanup (&key_id1);
+   _mongocrypt_buffer_cleanup (&key_doc1);
+   _mongocrypt_buffer_cleanup (&key_id2);
+   _mongocrypt_buffer_cleanup (&key_doc2);
+   _mongocrypt_buffer_cleanup (&key_id3);
+   _mongocrypt_buffer_cleanup (&key_doc3);
+   _mongocrypt_buffer_cleanup (&key_id4);
+   _mongocrypt_buffer_cleanup (&key_doc4);
+   mongocrypt_destroy (crypt);
+}
+
+/* Request @key_id with a new key broker, and return its state once the
+ * requests are done. */
+static key_broker_state_t
+_key_broker_request_one (_mongocrypt_key_broker_t *kb,
+                         mongocrypt_t *crypt,
+                         _mongocrypt_buffer_t *key_id)
+{
+   _mongocrypt_key_broker_init (kb, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (kb, key_id), kb);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (kb), kb);
+   return kb->state;
+}
+
+
+static void
+_test_key_broker_refresh (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   _mongocrypt_buffer_t key_id, key_doc;
+   _mongocrypt_key_broker_t refreshing, cached, lapsed;
+   _mongocrypt_cache_pair_t *pair;
+   int64_t last_updated;
+
+   _gen_uuid_and_key (tester, 1, &key_id, &key_doc);
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_key_cache_ttl_ms (crypt, 60 * 1000), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_refresh_window_ms (crypt, 20 * 1000),
+              crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+
+   BSON_ASSERT (KB_ADDING_DOCS ==
+                _key_broker_request_one (&refreshing, crypt, &key_id));
+   _key_broker_fetch (tester, &refreshing, &key_doc);
+   _mongocrypt_key_broker_cleanup (&refreshing);
+
+   /* Age the key into the refresh window. The first key broker to see it
+    * refetches it, and others keep using the cached key. */
+   crypt->cache_key.pair->last_updated -= 50 * 1000;
+   BSON_ASSERT (KB_ADDING_DOCS ==
+                _key_broker_request_one (&refreshing, crypt, &key_id));
+   BSON_ASSERT (KB_DONE == _key_broker_request_one (&cached, crypt, &key_id));
+   _mongocrypt_key_broker_cleanup (&cached);
+
+   /* A key broker destroyed before re-caching the key gives up its claim. */
+   _mongocrypt_key_broker_cleanup (&refreshing);
+   BSON_ASSERT (KB_ADDING_DOCS ==
+                _key_broker_request_one (&refreshing, crypt, &key_id));
+   BSON_ASSERT (KB_DONE == _key_broker_request_one (&cached, crypt, &key_id));
+   _mongocrypt_key_broker_cleanup (&cached);
+
+   /* Re-caching the key takes it out of the refresh window. */
+   last_updated = crypt->cache_key.pair->last_updated;
+   _key_broker_fetch (tester, &refreshing, &key_doc);
+   _mongocrypt_key_broker_cleanup (&refreshing);
+   pair = crypt->cache_key.pair;
+   BSON_ASSERT (pair->last_updated > last_updated);
+   BSON_ASSERT (pair->refresh_claimed_at == 0);
+   BSON_ASSERT (KB_DONE == _key_broker_request_one (&cached, crypt, &key_id));
+   _mongocrypt_key_broker_cleanup (&cached);
+
+   /* A claim held too long lapses, so a context that never finishes does not
+    * stop the key from being refreshed before it expires. */
+   pair->last_updated -= 50 * 1000;
+   BSON_ASSERT (KB_ADDING_DOCS ==
+                _key_broker_request_one (&refreshing, crypt, &key_id));
+   pair->refresh_claimed_at -= 5 * 1000;
+   BSON_ASSERT (KB_ADDING_DOCS ==
+                _key_broker_request_one (&lapsed, crypt, &key_id));
+
+   /* The lapsed claim is not released over the new one. */
+   _mongocrypt_key_broker_cleanup (&refreshing);
+   BSON_ASSERT (KB_DONE == _key_broker_request_one (&cached, crypt, &key_id));
+   _mongocrypt_key_broker_cleanup (&cached);
+   _key_broker_fetch (tester, &lapsed, &key_doc);
+   _mongocrypt_key_broker_cleanup (&lapsed);
+
+   _mongocrypt_buffer_cleanup (&key_id);
+   _mongocrypt_buffer_cleanup (&key_doc);
+   mongocrypt_destroy (crypt);
+}
+
+/* Count allocations made through libbson. */
+static uint32_t _num_allocs;
+
+static void *
+_counting_malloc (size_t num_bytes)
+{
+   _num_allocs++;
+   return malloc (num_bytes);
+}
+
+static void *
+_counting_calloc (size_t n_members, size_t num_bytes)
+{
+   _num_allocs++;
+   return calloc (n_members, num_bytes);
+}
+
+static void *
+_counting_realloc (void *mem, size_t num_bytes)
+{
+   _num_allocs++;
+   return realloc (mem, num_bytes);
+}
+
+
+/* Encrypts the first @count values of @doc with the key @key_id, and returns
+ * the number of allocations, less the output ciphertexts. */
+static uint32_t
+_count_field_encryption_allocs (_mongocrypt_key_broker_t *key_broker,
+                                _mongocrypt_buffer_t *key_id,
+                                bson_t *doc,
+                                uint32_t count)
+{
+   _mongocrypt_marking_t markings[2];
+   _mongocrypt_ciphertext_t ciphertexts[2];
+   mongocrypt_status_t *status;
+   bson_iter_t iter;
+   bson_mem_vtable_t vtable = {_counting_malloc,
+                               _counting_calloc,
+                               _counting_realloc,
+                               free};
+   uint32_t num_allocs;
+   uint32_t i;
+   bool ok;
+
+   BSON_ASSERT (count <= 2);
+   status = mongocrypt_status_new ();
+   BSON_ASSERT (bson_iter_init (&iter, doc));
+   for (i = 0; i < count; i++) {
+      _mongocrypt_marking_init (&markings[i]);
+      markings[i].algorithm = MONGOCRYPT_ENCRYPTION_ALGORITHM_RANDOM;
+      _mongocrypt_buffer_set_to (key_id, &markings[i].key_id);
+      BSON_ASSERT (bson_iter_next (&iter));
+      memcpy (&markings[i].v_iter, &iter, sizeof (bson_iter_t));
+   }
+
+   _num_allocs = 0;
+   bson_mem_set_vtable (&vtable);
+   ok = _mongocrypt_markings_to_ciphertexts (
+      key_broker, markings, ciphertexts, count, status);
+   bson_mem_restore_vtable ();
+   ASSERT_OR_PRINT (ok, status);
+   num_allocs = _num_allocs - count;
+
+   for (i = 0; i < count; i++) {
+      BSON_ASSERT (
+         0 == _mongocrypt_buffer_cmp (&ciphertexts[i].key_id, key_id));
+      BSON_ASSERT (!ciphertexts[i].key_id.owned);
+      _mongocrypt_ciphertext_cleanup (&ciphertexts[i]);
+      _mongocrypt_marking_cleanup (&markings[i]);
+   }
+   mongocrypt_status_destroy (status);
+   return num_allocs;
+}
+
+
+/* Test that key handles are stable, and that looking up a key for each field
+ * does not allocate. */
+static void
+_test_key_broker_key_handles (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   _mongocrypt_buffer_t key_id, key_doc;
+   _mongocrypt_key_broker_t key_broker;
+   _mongocrypt_key_handle_t by_id, by_name, handle;
+   bson_value_t key_name;
+   bson_t *fields;
+   bson_mem_vtable_t vtable = {_counting_malloc,
+                               _counting_calloc,
+                               _counting_realloc,
+                               free};
+   uint32_t i;
+
+   crypt = _mongocrypt_tester_mongocrypt ();
+   _gen_uuid_and_key_and_altname (tester, "Sharlene", 1, &key_id, &key_doc);
+   _bson_value_from_string ("Sharlene", &key_name);
+
+   _mongocrypt_key_broker_init (&key_broker, crypt);
+   ASSERT_OK (_mongocrypt_key_broker_request_id (&key_broker, &key_id),
+              &key_broker);
+   ASSERT_OK (_mongocrypt_key_broker_request_name (&key_broker, &key_name),
+              &key_broker);
+   ASSERT_OK (_mongocrypt_key_broker_requests_done (&key_broker), &key_broker);
+   _key_broker_fetch (tester, &key_broker, &key_doc);
+
+   /* The first lookup computes the key state. */
+   ASSERT_OK (_mongocrypt_key_broker_key_by_id (&key_broker, &key_id, &by_id),
+              &key_broker);
+   BSON_ASSERT (by_id.key_material->len == MONGOCRYPT_KEY_LEN);
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (by_id.key_id, &key_id));
+   ASSERT_OK (
+      _mongocrypt_key_broker_key_by_name (&key_broker, &key_name, &by_name),
+      &key_broker);
+   BSON_ASSERT (by_name.key_id == by_id.key_id);
+   BSON_ASSERT (by_name.key_material == by_id.key_material);
+   BSON_ASSERT (by_name.key_state == by_id.key_state);
+
+   _num_allocs = 0;
+   bson_mem_set_vtable (&vtable);
+   for (i = 0; i < 1000; i++) {
+      if (!_mongocrypt_key_broker_key_by_id (&key_broker, &key_id, &handle) ||
+          handle.key_state != by_id.key_state) {
+         break;
+      }
+      if (!_mongocrypt_key_broker_key_by_name (
+             &key_broker, &key_name, &handle) ||
+          handle.key_state != by_id.key_state) {
+         break;
+      }
+   }
+   bson_mem_restore_vtable ();
+   BSON_ASSERT (i == 1000);
+   BSON_ASSERT (_num_allocs == 0);
+
+   /* Encrypting a field only allocates a copy of its plaintext, besides its
+    * ciphertext. The key id and key material are borrowed from the key
+    * broker, and the IV and associated data are kept in the storage of the
+    * batch. The difference between two fields and one leaves out the
+    * allocations shared by the batch. */
+   fields = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_INT32 (2));
+   BSON_ASSERT (
+      _count_field_encryption_allocs (&key_broker, &key_id, fields, 2) -
+         _count_field_encryption_allocs (&key_broker, &key_id, fields, 1) ==
+      1);
+   bson_destroy (fields);
+
+   _mongocrypt_key_broker_cleanup (&key_broker);
+   bson_value_destroy (&key_name);
+   _mongocrypt_buffer_cleanup (&key_id);
+   _mongocrypt_buffer_cleanup (&key_doc);
+   mongocrypt_destroy (crypt);
+}
+
 void
 _mongocrypt_tester_install_key_broker (_mongocrypt_tester_t *tester)
 {
@@ -626,4 +1157,9 @@ _mongocrypt_tester_install_key_broker (_mongocrypt_tester_t *tester)
    INSTALL_TEST (_test_key_broker_add_decrypted_key);
    INSTALL_TEST (_test_key_broker_wrong_subtype);
    INSTALL_TEST (_test_key_broker_multi_match);
+   INSTALL_TEST (_test_key_broker_coalesce);
+   INSTALL_TEST (_test_key_broker_batch);
+   INSTALL_TEST (_test_key_broker_refresh);
+   INSTALL_TEST (_test_key_broker_many_keys);
+   INSTALL_TEST (_test_key_broker_key_handles);
 }
@@ -466,8 +466,218 @@ _test_key_cache (_mongocrypt_tester_t *tester)
    bson_destroy (&test_file);
 }
 
+static void
+_test_key_cache_setopts (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_binary_t *local_key;
+   char local_key_data[MONGOCRYPT_KEY_LEN] = {0};
+   uint64_t stat;
+
+   local_key = mongocrypt_binary_new_from_data ((uint8_t *) local_key_data,
+                                                sizeof (local_key_data));
+
+   crypt = mongocrypt_new ();
+   ASSERT_FAILS (mongocrypt_setopt_key_cache_ttl_ms (crypt, 0),
+                 crypt,
+                 "key cache TTL must be positive");
+   mongocrypt_destroy (crypt);
+
+   /* The refresh window must fit within the TTL. */
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_ttl_ms (crypt, 1000), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_refresh_window_ms (crypt, 1000),
+              crypt);
+   ASSERT_FAILS (mongocrypt_init (crypt),
+                 crypt,
+                 "key cache refresh window must be less than the key cache "
+                 "TTL");
+   mongocrypt_destroy (crypt);
+
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_ttl_ms (crypt, 1000), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_refresh_window_ms (crypt, 500),
+              crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   BSON_ASSERT (crypt->cache_key.expiration == 1000);
+   BSON_ASSERT (crypt->cache_key.refresh_window == 500);
+   ASSERT_FAILS (mongocrypt_setopt_key_cache_ttl_ms (crypt, 2000),
+                 crypt,
+                 "options cannot be set after initialization");
+   ASSERT_FAILS (mongocrypt_setopt_key_cache_refresh_window_ms (crypt, 100),
+                 crypt,
+                 "options cannot be set after initialization");
+   mongocrypt_destroy (crypt);
+
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_cache_limits (
+                 crypt, MONGOCRYPT_CACHE_TYPE_KEY, 100, 1024 * 1024),
+              crypt);
+   ASSERT_FAILS (mongocrypt_setopt_cache_limits (
+                    crypt, MONGOCRYPT_CACHE_TYPE_DETERMINISTIC, 100, 0),
+                 crypt,
+                 "use mongocrypt_setopt_deterministic_cache_size");
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   BSON_ASSERT (crypt->cache_key.max_entries == 100);
+   BSON_ASSERT (crypt->cache_key.max_bytes == 1024 * 1024);
+   BSON_ASSERT (crypt->cache_collinfo.max_entries == 0);
+   ASSERT_OK (mongocrypt_cache_stat (crypt,
+                                     MONGOCRYPT_CACHE_TYPE_COLLINFO,
+                                     MONGOCRYPT_CACHE_STAT_ENTRIES,
+                                     &stat),
+              crypt);
+   BSON_ASSERT (stat == 0);
+   ASSERT_FAILS (mongocrypt_cache_stat (crypt,
+                                        MONGOCRYPT_CACHE_TYPE_KEY,
+                                        (mongocrypt_cache_stat_t) 100,
+                                        &stat),
+                 crypt,
+                 "unrecognized cache statistic");
+   mongocrypt_destroy (crypt);
+
+   mongocrypt_binary_destroy (local_key);
+}
+
+/* Exported keys are restored with the time they had left. */
+static void
+_test_key_cache_export_import (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_binary_t *local_key;
+   mongocrypt_binary_t *wrong_key;
+   mongocrypt_binary_t *exported;
+   mongocrypt_binary_t *in;
+   bson_t filter;
+   mongocrypt_status_t *status;
+   _mongocrypt_cache_key_attr_t *attr;
+   _mongocrypt_cache_key_value_t *value;
+   _mongocrypt_key_doc_t *key_doc;
+   _mongocrypt_buffer_t key_material;
+   char local_key_data[MONGOCRYPT_KEY_LEN] = {0};
+   char wrong_key_data[MONGOCRYPT_KEY_LEN] = {1};
+   int64_t age;
+
+   status = mongocrypt_status_new ();
+   local_key = mongocrypt_binary_new_from_data ((uint8_t *) local_key_data,
+                                                sizeof (local_key_data));
+   wrong_key = mongocrypt_binary_new_from_data ((uint8_t *) wrong_key_data,
+                                                sizeof (wrong_key_data));
+
+   key_doc = _mongocrypt_key_new ();
+   gen_key (tester,
+            TMP_BSON ("{'_id': 0, 'keyAltNames': ['a'], 'local': true}"),
+            NULL,
+            key_doc);
+   _mongocrypt_buffer_init (&key_material);
+   _mongocrypt_buffer_resize (&key_material, MONGOCRYPT_KEY_LEN);
+   memset (key_material.data, 7, MONGOCRYPT_KEY_LEN);
+
+   /* Cache a key that has 1s left. */
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_ttl_ms (crypt, 1000), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   attr = _mongocrypt_cache_key_attr_new (&key_doc->id, NULL);
+   value = _mongocrypt_cache_key_value_new (key_doc, &key_material);
+   ASSERT_OK_STATUS (
+      _mongocrypt_cache_add_stolen (&crypt->cache_key, attr, value, status),
+      status);
+
+   /* Each export is a copy that outlives the mongocrypt_t. */
+   exported = mongocrypt_key_cache_export (crypt, local_key);
+   ASSERT_OK (exported, crypt);
+   in = mongocrypt_key_cache_export (crypt, local_key);
+   ASSERT_OK (in, crypt);
+   BSON_ASSERT (mongocrypt_binary_data (in) !=
+                mongocrypt_binary_data (exported));
+   BSON_ASSERT (mongocrypt_binary_len (in) == mongocrypt_binary_len (exported));
+
+   /* An export can be reused as the output of other functions. Destroying it
+    * frees the export, and not the data it views. */
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_setopt_algorithm (
+                 ctx, "AEAD_AES_256_CBC_HMAC_SHA_512-Deterministic", -1),
+              ctx);
+   ASSERT_OK (mongocrypt_ctx_setopt_key_alt_name (
+                 ctx, TEST_BSON ("{'keyAltName': 'b'}")),
+              ctx);
+   ASSERT_OK (
+      mongocrypt_ctx_explicit_encrypt_init (ctx, TEST_BSON ("{'v': 1}")), ctx);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_NEED_MONGO_KEYS);
+   ASSERT_OK (mongocrypt_ctx_mongo_op (ctx, exported), ctx);
+   BSON_ASSERT (_mongocrypt_binary_to_bson (exported, &filter));
+   BSON_ASSERT (bson_has_field (&filter, "$or"));
+   mongocrypt_binary_destroy (exported);
+   mongocrypt_ctx_destroy (ctx);
+   mongocrypt_destroy (crypt);
+
+   /* The import does not outlive the export, even with a longer TTL. */
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_import (crypt, local_key, in), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   /* The key and the export are freed once imported. */
+   BSON_ASSERT (_mongocrypt_buffer_empty (&crypt->opts.key_cache_kek));
+   BSON_ASSERT (_mongocrypt_buffer_empty (&crypt->opts.key_cache_import));
+   BSON_ASSERT (1 == _mongocrypt_cache_num_entries (&crypt->cache_key));
+   BSON_ASSERT (
+      _mongocrypt_cache_get (&crypt->cache_key, attr, (void **) &value));
+   BSON_ASSERT (value);
+   BSON_ASSERT (0 == _mongocrypt_buffer_cmp (&value->decrypted_key_material,
+                                             &key_material));
+   BSON_ASSERT (
+      0 == _mongocrypt_buffer_cmp (&value->key_doc->id, &key_doc->id));
+   _mongocrypt_cache_key_value_destroy (value);
+   age = bson_get_monotonic_time () / 1000 -
+         crypt->cache_key.pair->last_updated;
+   BSON_ASSERT (age >= (int64_t) crypt->cache_key.expiration - 1000);
+   mongocrypt_destroy (crypt);
+
+   /* Keys are found by key alt name too. */
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_import (crypt, local_key, in), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   _mongocrypt_cache_key_attr_destroy (attr);
+   attr = _mongocrypt_cache_key_attr_new (NULL, key_doc->key_alt_names);
+   BSON_ASSERT (
+      _mongocrypt_cache_get (&crypt->cache_key, attr, (void **) &value));
+   BSON_ASSERT (value);
+   _mongocrypt_cache_key_value_destroy (value);
+   mongocrypt_destroy (crypt);
+
+   crypt = mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_provider_local (crypt, local_key), crypt);
+   ASSERT_OK (mongocrypt_setopt_key_cache_import (crypt, wrong_key, in), crypt);
+   ASSERT_FAILS (mongocrypt_init (crypt), crypt, "HMAC validation failure");
+   BSON_ASSERT (_mongocrypt_buffer_empty (&crypt->opts.key_cache_kek));
+   BSON_ASSERT (_mongocrypt_buffer_empty (&crypt->opts.key_cache_import));
+   mongocrypt_destroy (crypt);
+
+   crypt = mongocrypt_new ();
+   ASSERT_FAILS (mongocrypt_key_cache_export (crypt, local_key),
+                 crypt,
+                 "must be initialized");
+   mongocrypt_destroy (crypt);
+
+   _mongocrypt_cache_key_attr_destroy (attr);
+   _mongocrypt_key_destroy (key_doc);
+   _mongocrypt_buffer_cleanup (&key_material);
+   mongocrypt_binary_destroy (in);
+   mongocrypt_binary_destroy (wrong_key);
+   mongocrypt_binary_destroy (local_key);
+   mongocrypt_status_destroy (status);
+}
+
+
 void
 _mongocrypt_tester_install_key_cache (_mongocrypt_tester_t *tester)
 {
    INSTALL_TEST (_test_key_cache);
+   INSTALL_TEST (_test_key_cache_setopts);
+   INSTALL_TEST (_test_key_cache_export_import);
 }
\ No newline at end of file
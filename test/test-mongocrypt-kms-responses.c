@@ -153,8 +153,116 @@ _test_kms_responses (_mongocrypt_tester_t *tester)
    bson_destroy (&test_file);
 }
 
+/* Feeds an HTTP response with an empty body. */
+static bool
+_feed_http_status (mongocrypt_kms_ctx_t *kms, const char *status_line)
+{
+   char *reply;
+   mongocrypt_binary_t *bin;
+   bool ret;
+
+   reply = bson_strdup_printf ("%s\r\nContent-Length: 0\r\n\r\n", status_line);
+   bin = mongocrypt_binary_new_from_data ((uint8_t *) reply,
+                                          (uint32_t) strlen (reply));
+   ret = mongocrypt_kms_ctx_feed (kms, bin);
+   mongocrypt_binary_destroy (bin);
+   bson_free (reply);
+   return ret;
+}
+
+
+static void
+_test_kms_retry (_mongocrypt_tester_t *tester)
+{
+   mongocrypt_t *crypt;
+   mongocrypt_ctx_t *ctx;
+   mongocrypt_kms_ctx_t *kms;
+   mongocrypt_binary_t *bin, *msg;
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_FAILS (mongocrypt_setopt_kms_retry (crypt, 1, UINT64_MAX),
+                 crypt,
+                 "timeout_ms is too large");
+   ASSERT_OK (mongocrypt_setopt_kms_retry (crypt, 1, 60 * 1000), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   ASSERT_FAILS (mongocrypt_setopt_kms_retry (crypt, 0, 0),
+                 crypt,
+                 "options cannot be set after initialization");
+   mongocrypt_destroy (crypt);
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_retry (crypt, 1, 60 * 1000), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   bin = _mongocrypt_tester_encrypted_doc (tester);
+   tester->key_file_path = "./test/example/key-document.json";
+   msg = mongocrypt_binary_new ();
+
+   /* A server error is retried with the same message. */
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_decrypt_init (ctx, bin), ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_NEED_KMS);
+   kms = mongocrypt_ctx_next_kms_ctx (ctx);
+   BSON_ASSERT (kms);
+   BSON_ASSERT (mongocrypt_kms_ctx_attempts (kms) == 1);
+   BSON_ASSERT (mongocrypt_kms_ctx_remaining_ms (kms) == 60 * 1000);
+   BSON_ASSERT (mongocrypt_kms_ctx_message (kms, msg));
+   BSON_ASSERT (mongocrypt_kms_ctx_remaining_ms (kms) <= 60 * 1000);
+   BSON_ASSERT (!_feed_http_status (kms, "HTTP/1.1 503 Service Unavailable"));
+   BSON_ASSERT (mongocrypt_kms_ctx_latency_us (kms) >= 0);
+   BSON_ASSERT (mongocrypt_kms_ctx_fail (kms));
+   BSON_ASSERT (mongocrypt_kms_ctx_attempts (kms) == 2);
+   BSON_ASSERT (mongocrypt_kms_ctx_latency_us (kms) == -1);
+   BSON_ASSERT (mongocrypt_kms_ctx_bytes_needed (kms) > 0);
+   BSON_ASSERT (mongocrypt_kms_ctx_message (kms, msg));
+   _mongocrypt_tester_satisfy_kms (tester, kms);
+   BSON_ASSERT (mongocrypt_kms_ctx_latency_us (kms) >= 0);
+   BSON_ASSERT (!mongocrypt_ctx_next_kms_ctx (ctx));
+   ASSERT_OK (mongocrypt_ctx_kms_done (ctx), ctx);
+   BSON_ASSERT (mongocrypt_ctx_state (ctx) == MONGOCRYPT_CTX_READY);
+   mongocrypt_ctx_destroy (ctx);
+   mongocrypt_destroy (crypt); /* recreate crypt because of caching. */
+
+   /* A network error uses up the retries. */
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_retry (crypt, 1, 0), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_decrypt_init (ctx, bin), ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_NEED_KMS);
+   kms = mongocrypt_ctx_next_kms_ctx (ctx);
+   BSON_ASSERT (mongocrypt_kms_ctx_remaining_ms (kms) == -1);
+   BSON_ASSERT (mongocrypt_kms_ctx_fail (kms));
+   BSON_ASSERT (!mongocrypt_kms_ctx_fail (kms));
+   ASSERT_FAILS (mongocrypt_kms_ctx_status (kms, ctx->status),
+                 ctx,
+                 "KMS request failed after 2 attempts");
+   mongocrypt_ctx_destroy (ctx);
+   mongocrypt_destroy (crypt);
+
+   /* A client error is not retried. */
+   crypt = _mongocrypt_tester_mongocrypt_new ();
+   ASSERT_OK (mongocrypt_setopt_kms_retry (crypt, 1, 0), crypt);
+   ASSERT_OK (mongocrypt_init (crypt), crypt);
+   ctx = mongocrypt_ctx_new (crypt);
+   ASSERT_OK (mongocrypt_ctx_decrypt_init (ctx, bin), ctx);
+   _mongocrypt_tester_run_ctx_to (tester, ctx, MONGOCRYPT_CTX_NEED_KMS);
+   kms = mongocrypt_ctx_next_kms_ctx (ctx);
+   BSON_ASSERT (!_feed_http_status (kms, "HTTP/1.1 400 Bad Request"));
+   BSON_ASSERT (!mongocrypt_kms_ctx_fail (kms));
+   ASSERT_FAILS (mongocrypt_kms_ctx_status (kms, ctx->status),
+                 ctx,
+                 "HTTP status=400");
+   mongocrypt_ctx_destroy (ctx);
+   mongocrypt_destroy (crypt);
+
+   mongocrypt_binary_destroy (msg);
+   mongocrypt_binary_destroy (bin);
+}
+
+
 void
 _mongocrypt_tester_install_kms_responses (_mongocrypt_tester_t *tester)
 {
    INSTALL_TEST (_test_kms_responses);
+   INSTALL_TEST (_test_kms_retry);
 }
@@ -359,6 +359,9 @@ _mongocrypt_tester_run_ctx_to (_mongocrypt_tester_t *tester,
          BSON_ASSERT (state == stop_state);
          mongocrypt_status_destroy (status);
          return;
+      case MONGOCRYPT_CTX_KEYS_PENDING:
+         /* Another context must fetch the keys before this one can
+          * continue. */
       case MONGOCRYPT_CTX_DONE:
          BSON_ASSERT (state == stop_state);
          mongocrypt_status_destroy (status);
@@ -474,7 +477,7 @@ _mongocrypt_tester_fill_buffer (_mongocrypt_buffer_t *buf, int n)
    "I4VnrEMGrQ8e+qYSwYk9Gh6dKGoRMAPYVXQAO0fIsHF/T0a"
 
 mongocrypt_t *
-_mongocrypt_tester_mongocrypt (void)
+_mongocrypt_tester_mongocrypt_new (void)
 {
    mongocrypt_t *crypt;
    char localkey_data[MONGOCRYPT_KEY_LEN] = {0};
@@ -510,6 +513,16 @@ _mongocrypt_tester_mongocrypt (void)
    ASSERT_OK (mongocrypt_setopt_kms_providers (crypt, bin), crypt);
    bson_destroy (kms_providers);
    mongocrypt_binary_destroy (bin);
+   return crypt;
+}
+
+
+mongocrypt_t *
+_mongocrypt_tester_mongocrypt (void)
+{
+   mongocrypt_t *crypt;
+
+   crypt = _mongocrypt_tester_mongocrypt_new ();
    ASSERT_OK (mongocrypt_init (crypt), crypt);
    return crypt;
 }
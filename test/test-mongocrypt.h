@@ -86,6 +86,12 @@ void
 _mongocrypt_tester_fill_buffer (_mongocrypt_buffer_t *buf, int n);
 
 
+/* Return a new mongocrypt_t for testing, with the test KMS providers set but
+ * not yet initialized, so a test can set other options first. */
+mongocrypt_t *
+_mongocrypt_tester_mongocrypt_new (void);
+
+
 /* Return a new initialized mongocrypt_t for testing. */
 mongocrypt_t *
 _mongocrypt_tester_mongocrypt (void);
@@ -797,6 +797,8 @@ _state_string (mongocrypt_ctx_state_t state)
       return "MONGOCRYPT_CTX_READY";
    case MONGOCRYPT_CTX_DONE:
       return "MONGOCRYPT_CTX_DONE";
+   case MONGOCRYPT_CTX_KEYS_PENDING:
+      return "MONGOCRYPT_CTX_KEYS_PENDING";
    default:
       return "UNKNOWN";
    }